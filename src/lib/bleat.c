@@ -8,6 +8,10 @@
 	Mods:		10 May 2016 - fix comment
 				01 Jun 2016 - Add auto cleanup of log files.
 							Corrected memory leak.
+				18 Oct 2026 - Add in memory flight recorder which captures messages
+							that are below the current level so they can be dumped
+							after the fact.
+				18 Oct 2026 - Add a signal safe flight recorder dump for crashes.
 
 	Valgrind:	These are notes about valgrind complaints that cannot be
 				resolved, and are not considered harmful:
@@ -53,6 +57,42 @@ static time_t	purge_threshold = 0;	// number of seconds afterwhich log files are
 static	char*	purge_directory = NULL;	// directory where we should purge on a regular basis
 static	char*	purge_prefix = NULL;	// prefix of files in the log directory that are purged
 
+// --------------------- flight recorder --------------------
+#define FR_MSG_LEN	200					// max bytes of a captured message (includes end of string)
+
+/*
+	A single captured message. The text is rendered at capture time; the
+	variable argument list cannot be kept past the call as %s args usually
+	point at the caller's stack.
+*/
+typedef struct fr_ent {
+	struct timespec	ts;					// time the message was captured
+	int			level;					// level the message was bleated at
+	int			tnum;					// thread number of the ring owner
+	const char*	fmt;					// caller's format string (static in all of our code); nil when slot is unused
+	char		msg[FR_MSG_LEN];		// rendered message (truncated)
+} fr_ent_t;
+
+/*
+	Each thread gets its own ring so that capture needs no locking. Rings are
+	pushed onto a single list so the dump can find all of them; they are never
+	freed as a thread's messages are most interesting after it has gone away.
+*/
+typedef struct fr_ring {
+	struct fr_ring*	next;
+	int			tnum;					// thread number (order of first capture)
+	unsigned int nents;					// number of entries in the ring
+	unsigned int nxt;					// next slot to fill (mod nents)
+	fr_ent_t*	ents;
+} fr_ring_t;
+
+static int			fr_nents = 0;		// entries per thread ring; 0 disables capture
+static int			fr_tcount = 0;		// thread number assignment
+static fr_ring_t*	fr_rings = NULL;	// all rings allocated
+static __thread fr_ring_t*	fr_mine = NULL;	// the ring for the calling thread
+static char			fr_crash_fname[1024];	// crash dump file; set in advance as nothing can be built in a signal handler
+static char			fr_crash_buf[FR_MSG_LEN + 128];	// crash dump line buffer
+
 // -- private -------------------------------------------------------------------------
 /*
 	Compute the next time we need to flip the log. The base is the roll time
@@ -142,6 +182,103 @@ static void purge_old_files( ) {
 	}
 }
 
+/*
+	Allocate a ring for the calling thread and add it to the list. Returns nil if
+	memory is short; capture is silently skipped in that case.
+*/
+static fr_ring_t* fr_new_ring( void ) {
+	fr_ring_t*	r;
+
+	if( (r = (fr_ring_t *) malloc( sizeof( *r ) )) == NULL ) {
+		return NULL;
+	}
+
+	memset( r, 0, sizeof( *r ) );
+	r->nents = fr_nents;
+	if( (r->ents = (fr_ent_t *) malloc( sizeof( fr_ent_t ) * r->nents )) == NULL ) {
+		free( r );
+		return NULL;
+	}
+	memset( r->ents, 0, sizeof( fr_ent_t ) * r->nents );
+	r->tnum = __sync_fetch_and_add( &fr_tcount, 1 );
+
+	do {												// lock free push so that threads don't race
+		r->next = fr_rings;
+	} while( ! __sync_bool_compare_and_swap( &fr_rings, r->next, r ) );
+
+	return r;
+}
+
+/*
+	Capture a message that was not written to the log.
+*/
+static void fr_capture( int vlevel, const char* fmt, va_list argp ) {
+	fr_ent_t*	e;
+
+	if( fr_mine == NULL ) {
+		if( (fr_mine = fr_new_ring( )) == NULL ) {
+			return;
+		}
+	}
+
+	e = &fr_mine->ents[fr_mine->nxt % fr_mine->nents];
+	fr_mine->nxt++;
+
+	clock_gettime( CLOCK_REALTIME, &e->ts );
+	e->level = vlevel;
+	e->tnum = fr_mine->tnum;
+	e->fmt = fmt;
+	vsnprintf( e->msg, sizeof( e->msg ), fmt, argp );
+}
+
+/*
+	Add a string, or an unsigned value zero padded to width, to the crash buffer at
+	pos. Returns the new position. Used in a signal handler so no library formatting.
+*/
+static int fr_put_str( int pos, const char* s ) {
+	while( *s && pos < (int) sizeof( fr_crash_buf ) - 1 ) {
+		fr_crash_buf[pos++] = *s++;
+	}
+
+	return pos;
+}
+
+static int fr_put_num( int pos, unsigned long long v, int width ) {
+	char	digits[24];
+	int		n = 0;
+
+	do {
+		digits[n++] = '0' + (v % 10);
+		v /= 10;
+	} while( v > 0 && n < (int) sizeof( digits ) );
+
+	while( n < width && n < (int) sizeof( digits ) ) {
+		digits[n++] = '0';
+	}
+
+	while( n > 0 && pos < (int) sizeof( fr_crash_buf ) - 1 ) {
+		fr_crash_buf[pos++] = digits[--n];
+	}
+
+	return pos;
+}
+
+/*
+	Compare two entry pointers for qsort; oldest first.
+*/
+static int fr_cmp( const void* a, const void* b ) {
+	const fr_ent_t*	ea = *(const fr_ent_t **) a;
+	const fr_ent_t*	eb = *(const fr_ent_t **) b;
+
+	if( ea->ts.tv_sec != eb->ts.tv_sec ) {
+		return ea->ts.tv_sec < eb->ts.tv_sec ? -1 : 1;
+	}
+	if( ea->ts.tv_nsec != eb->ts.tv_nsec ) {
+		return ea->ts.tv_nsec < eb->ts.tv_nsec ? -1 : 1;
+	}
+	return 0;
+}
+
 /*
 	set the level; does not affect the value saved with a push.
 */
@@ -326,8 +463,14 @@ void bleat_printf( int vlevel, const char *fmt, ... )
 		}
 	}
 
-	if( vlevel > cur_level  )		// mod -- ningaui caps at 0x0f
+	if( vlevel > cur_level  ) {		// mod -- ningaui caps at 0x0f
+		if( fr_nents > 0 ) {			// recorder on, keep it in memory in case someone asks later
+			va_start( argp, fmt );
+			fr_capture( vlevel, fmt, argp );
+			va_end( argp );
+		}
 		return;
+	}
 
  	gmt = time(  NULL );				// current time
 	ptime = pretty_time( gmt );
@@ -348,3 +491,151 @@ void bleat_printf( int vlevel, const char *fmt, ... )
 }
 
 
+
+// ---------------- flight recorder ---------------------------------------------------
+
+/*
+	Enable the flight recorder. Nents is the number of messages kept for each
+	thread; a value of 0 stops capture (what has been captured is kept and can
+	still be dumped). The size of an existing thread's ring does not change, so
+	this should be called before any threads are started. Returns the previous
+	setting.
+*/
+extern int bleat_fr_enable( int nents ) {
+	int r;
+
+	r = fr_nents;
+	fr_nents = nents > 0 ? nents : 0;
+
+	return r;
+}
+
+/*
+	Write the messages captured during the last seconds seconds (all of them if
+	seconds is <= 0), from all threads, to the named file in time order. The
+	file is truncated if it exists. Returns the number of messages written, or
+	-1 on error. Entries being captured by other threads while the dump runs
+	may appear garbled; this is a post mortem tool and no locking is done.
+*/
+extern int bleat_fr_dump( const char* fname, int seconds ) {
+	FILE*		f;
+	fr_ring_t*	r;
+	fr_ent_t**	list;
+	struct timespec now;
+	unsigned int i;
+	int		total = 0;
+	int		n = 0;
+	char*	ptime;
+
+	if( fname == NULL ) {
+		return -1;
+	}
+
+	for( r = fr_rings; r != NULL; r = r->next ) {
+		total += r->nents;
+	}
+
+	if( (list = (fr_ent_t **) malloc( sizeof( fr_ent_t * ) * (total + 1) )) == NULL ) {
+		return -1;
+	}
+
+	clock_gettime( CLOCK_REALTIME, &now );
+	for( r = fr_rings; r != NULL; r = r->next ) {
+		for( i = 0; i < r->nents && i < r->nxt; i++ ) {
+			if( r->ents[i].fmt != NULL && (seconds <= 0 || r->ents[i].ts.tv_sec >= now.tv_sec - seconds) ) {
+				list[n++] = &r->ents[i];
+			}
+		}
+	}
+
+	if( (f = fopen( fname, "w" )) == NULL ) {
+		free( list );
+		return -1;
+	}
+
+	qsort( list, n, sizeof( fr_ent_t * ), fr_cmp );
+	fprintf( f, "flight recorder: %d messages captured in the last %d seconds\n", n, seconds );
+	for( i = 0; i < (unsigned int) n; i++ ) {
+		ptime = pretty_time( list[i]->ts.tv_sec );
+		fprintf( f, "%lld.%06ld %s [%d] t%d %s\n", (long long) list[i]->ts.tv_sec, list[i]->ts.tv_nsec/1000, ptime, list[i]->level, list[i]->tnum, list[i]->msg );
+		free( ptime );
+	}
+
+	fclose( f );
+	free( list );
+	return n;
+}
+
+/*
+	Set the file that bleat_fr_crash_dump() writes to. The name is copied; it must
+	be set before it is needed as it cannot be built in a signal handler.
+*/
+extern void bleat_fr_crash_file( const char* fname ) {
+	fr_crash_buf[0] = 0;
+	fr_crash_fname[0] = 0;
+	if( fname != NULL ) {
+		strncpy( fr_crash_fname, fname, sizeof( fr_crash_fname ) - 1 );
+		fr_crash_fname[sizeof( fr_crash_fname ) - 1] = 0;
+	}
+}
+
+/*
+	Write everything the flight recorder holds to the crash file using only calls
+	which are safe in a signal handler (open, write, close). Messages are not
+	merged by time as bleat_fr_dump() does; each thread's ring is written oldest
+	first, and each line carries the time so the file can be sorted after the fact.
+	Returns the number of messages written, or -1 if no file was set or it could
+	not be opened.
+*/
+extern int bleat_fr_crash_dump( void ) {
+	fr_ring_t*	r;
+	fr_ent_t*	e;
+	unsigned int i;
+	unsigned int first;
+	int		fd;
+	int		pos;
+	int		n = 0;
+
+	if( fr_crash_fname[0] == 0 ) {
+		return -1;
+	}
+
+	if( (fd = open( fr_crash_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644 )) < 0 ) {
+		return -1;
+	}
+
+	pos = fr_put_str( 0, "flight recorder: crash dump, threads written one after another, oldest first\n" );
+	if( write( fd, fr_crash_buf, pos ) < 0 ) {
+		close( fd );
+		return -1;
+	}
+
+	for( r = fr_rings; r != NULL; r = r->next ) {
+		first = r->nxt > r->nents ? r->nxt % r->nents : 0;			// oldest entry once the ring has wrapped
+		for( i = 0; i < r->nents && i < r->nxt; i++ ) {
+			e = &r->ents[(first + i) % r->nents];
+			if( e->fmt == NULL ) {
+				continue;
+			}
+
+			pos = fr_put_num( 0, (unsigned long long) e->ts.tv_sec, 0 );
+			pos = fr_put_str( pos, "." );
+			pos = fr_put_num( pos, (unsigned long long) e->ts.tv_nsec / 1000, 6 );
+			pos = fr_put_str( pos, " [" );
+			pos = fr_put_num( pos, (unsigned long long) (e->level < 0 ? 0 : e->level), 0 );
+			pos = fr_put_str( pos, "] t" );
+			pos = fr_put_num( pos, (unsigned long long) e->tnum, 0 );
+			pos = fr_put_str( pos, " " );
+			e->msg[FR_MSG_LEN - 1] = 0;									// entry may have been mid capture
+			pos = fr_put_str( pos, e->msg );
+			fr_crash_buf[pos++] = '\n';
+			if( write( fd, fr_crash_buf, pos ) < 0 ) {
+				break;
+			}
+			n++;
+		}
+	}
+
+	close( fd );
+	return n;
+}
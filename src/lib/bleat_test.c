@@ -30,6 +30,8 @@ int main( int argc, char** argv ) {
 	int	id = 0;
 	int	psec = 0;
 	int rsec = 0;			// seconds to wait when testing log roll
+	int	rc = 0;
+	int	n;
 
 	
 	id = getppid();
@@ -75,6 +77,27 @@ int main( int argc, char** argv ) {
 	bleat_printf( 2, "this message should NOT be seen it is level 2" );
 	bleat_printf( 0, "this is a level 0 should be SEEN data: %d",  id );
 
+	// flight recorder: messages below the level are kept in memory and can be dumped
+	bleat_fr_enable( 4 );
+	for( n = 0; n < 6; n++ ) {
+		bleat_printf( 3, "flight recorder message %d should NOT be seen in the log, but in foo.flight only if > 1", n );
+	}
+	bleat_printf( 1, "flight recorder test message written to the log should be SEEN here and not in foo.flight" );
+	if( (n = bleat_fr_dump( "foo.flight", 60 )) != 4 ) {
+		fprintf( stderr, "[FAIL] flight recorder dump expected 4 messages, got %d\n", n );
+		rc = 1;
+	} else {
+		fprintf( stderr, "[OK] flight recorder dumped %d messages to foo.flight\n", n );
+	}
+	bleat_fr_crash_file( "foo.flight.crash" );
+	if( (n = bleat_fr_crash_dump( )) != 4 ) {
+		fprintf( stderr, "[FAIL] flight recorder crash dump expected 4 messages, got %d\n", n );
+		rc = 1;
+	} else {
+		fprintf( stderr, "[OK] flight recorder crash dump wrote %d messages to foo.flight.crash\n", n );
+	}
+	bleat_fr_enable( 0 );
+
 	if( rsec > 0 ) {
 		// these should to to foo.log.<date> in the current directory, hms should be added and the 
 		// log should 'roll' on rsec boundaries
@@ -88,4 +111,6 @@ int main( int argc, char** argv ) {
 		sleep( rsec );
 		bleat_printf( 0, "this bleat should be SEEN in the rolled log file" );
 	}
+
+	return rc;
 }
@@ -19,6 +19,20 @@
 				10 Jul 2017 : We now support "mac": "addr" rather than an array.
 				07 Feb 2018 : Add memory support back.
 				14 Feb 2018 : Add default for vf config name.
+				18 Oct 2026 : Add flight_recorder size to parm file.
+				18 Oct 2026 : Add vdev/sim_vfs to pciid objects and no_pci to support virtual devices.
+				18 Oct 2026 : Add bandwidth rebalancer parms, and rate_ceiling/min_rate_floor to vf config.
+				18 Oct 2026 : Add noisy neighbour throttle parms.
+				18 Oct 2026 : Add vf counter state file parms.
+				18 Oct 2026 : Add xstats_filter.
+				18 Oct 2026 : Add nl_stats_itvl.
+				18 Oct 2026 : Add pf capture parms.
+				18 Oct 2026 : Add callback concurrency and timeout parms.
+				18 Oct 2026 : Add prep_devices, and pf_driver/vf_driver/vfs_count to pciid objects.
+				18 Oct 2026 : Add state_file.
+				18 Oct 2026 : Add reconcile_itvl.
+				18 Oct 2026 : Default sim_vfs for pciids given as a string.
+				18 Oct 2026 : xstats_filter defaults to no filter (all stats).
 
 	TODO:		convert things to the new jw_xapi functions to make for easier to read code.
 */
@@ -159,6 +173,7 @@ extern parms_t* read_parms( char* fname ) {
 	char*		buf;			// buffer read from file (nil terminated)
 	char*		stuff;
 	char		sm_wrk[128];	// small work buffer
+	char*		tok;			// pointer into the work buffer
 	int			i, j, k;
 	int			def_mtu;		// default mtu (pulled and used to set pciid struct, but not kept in parms
 	tc_class_t* tc_class_ptr;	// ponter to heap location
@@ -188,6 +203,20 @@ extern parms_t* read_parms( char* fname ) {
 		parms->init_log_level = !jw_is_value( jblob, "init_log_level" ) ? 1 : (int) jw_value( jblob, "init_log_level" );
 		parms->log_keep = !jw_is_value( jblob, "log_keep" ) ? 30 : (int) jw_value( jblob, "log_keep" );
 		parms->delete_keep = !jw_is_bool( jblob, "delete_keep" ) ? 0 : (int) jw_value( jblob, "delete_keep" );
+		parms->fr_entries = !jw_is_value( jblob, "flight_recorder" ) ? 1024 : (int) jw_value( jblob, "flight_recorder" );
+		parms->rebal_itvl = !jw_is_value( jblob, "rebalance_itvl" ) ? 0 : (int) jw_value( jblob, "rebalance_itvl" );
+		parms->recon_itvl = !jw_is_value( jblob, "reconcile_itvl" ) ? 0 : (int) jw_value( jblob, "reconcile_itvl" );
+		parms->rebal_hyst = !jw_is_value( jblob, "rebalance_hyst" ) ? 2 : (int) jw_value( jblob, "rebalance_hyst" );
+		parms->thr_itvl = !jw_is_value( jblob, "throttle_itvl" ) ? 0 : (int) jw_value( jblob, "throttle_itvl" );
+		parms->thr_window = !jw_is_value( jblob, "throttle_window" ) ? 3 : (int) jw_value( jblob, "throttle_window" );
+		parms->thr_calm = !jw_is_value( jblob, "throttle_calm" ) ? 6 : (int) jw_value( jblob, "throttle_calm" );
+		parms->thr_rate = !jw_is_value( jblob, "throttle_rate" ) ? 10 : (int) jw_value( jblob, "throttle_rate" );
+		parms->thr_pps = !jw_is_value( jblob, "throttle_pps" ) ? 0 : (uint64_t) jw_value( jblob, "throttle_pps" );
+		parms->thr_mbps = !jw_is_value( jblob, "throttle_mbps" ) ? 0 : (uint64_t) jw_value( jblob, "throttle_mbps" );
+		parms->thr_drops = !jw_is_value( jblob, "throttle_drops" ) ? 0 : (uint64_t) jw_value( jblob, "throttle_drops" );
+		parms->thr_window = IBOUND( parms->thr_window, 1, 60 );
+		parms->thr_calm = IBOUND( parms->thr_calm, 1, 600 );
+		parms->thr_rate = IBOUND( parms->thr_rate, 1, 100 );
 		
 		if( jw_is_bool( jblob, "enable_qos" ) ) {
 			if( jw_value( jblob, "enable_qos" ) ) {
@@ -201,6 +230,18 @@ extern parms_t* read_parms( char* fname ) {
 			}
 		}
 
+		if( jw_is_bool( jblob, "no_pci" ) ) {					// run without the pci bus; all pfs must be given as vdevs
+			if( jw_value( jblob, "no_pci" ) ) {
+				parms->rflags |= RF_NO_PCI;
+			}
+		}
+
+		if( jw_is_bool( jblob, "prep_devices" ) ) {				// bind drivers and create vfs before dpdk init (replaces vfd_pre_start)
+			if( jw_value( jblob, "prep_devices" ) ) {
+				parms->rflags |= RF_PREP_DEVS;
+			}
+		}
+
 		if( jw_is_bool( jblob, "enable_flowcontrol" ) ) {
 			if( jw_value( jblob, "enable_flowcontrol" ) ) {
 				parms->rflags |= RF_ENABLE_FC;
@@ -237,6 +278,51 @@ extern parms_t* read_parms( char* fname ) {
 			parms->fifo_path = strdup( "/var/lib/vfd/request" );
 		}
 
+		if(  (stuff = jw_string( jblob, "vf_counter_file" )) ) {
+			parms->ctr_file = ltrim( stuff );
+		} else {
+			parms->ctr_file = strdup( "/var/lib/vfd/vf_counters" );
+		}
+		parms->ctr_save_itvl = !jw_is_value( jblob, "vf_counter_save_itvl" ) ? 60 : (int) jw_value( jblob, "vf_counter_save_itvl" );
+
+		if(  (stuff = jw_string( jblob, "state_file" )) ) {
+			parms->state_file = ltrim( stuff );
+		} else {
+			parms->state_file = strdup( "/var/lib/vfd/vfd_state" );
+		}
+
+		parms->nl_stats_itvl = !jw_is_value( jblob, "nl_stats_itvl" ) ? 2 : (int) jw_value( jblob, "nl_stats_itvl" );
+
+		if(  (stuff = jw_string( jblob, "xstats_filter" )) ) {
+			parms->xstats_filter = ltrim( stuff );
+		} else {
+			parms->xstats_filter = strdup( "" );								// no filter: all stats
+		}
+
+		if(  (stuff = jw_string( jblob, "pf_capture_dir" )) ) {
+			parms->pfcap_dir = ltrim( stuff );
+		} else {
+			parms->pfcap_dir = strdup( "" );
+		}
+		if(  (stuff = jw_string( jblob, "pf_capture_filter" )) ) {
+			parms->pfcap_filter = ltrim( stuff );
+		} else {
+			parms->pfcap_filter = strdup( "" );
+		}
+		parms->pfcap_snaplen = !jw_is_value( jblob, "pf_capture_snaplen" ) ? 256 : (int) jw_value( jblob, "pf_capture_snaplen" );
+		parms->pfcap_sample = !jw_is_value( jblob, "pf_capture_sample" ) ? 1 : (int) jw_value( jblob, "pf_capture_sample" );
+		parms->pfcap_file_mb = !jw_is_value( jblob, "pf_capture_file_mb" ) ? 64 : (int) jw_value( jblob, "pf_capture_file_mb" );
+		parms->pfcap_nfiles = !jw_is_value( jblob, "pf_capture_nfiles" ) ? 8 : (int) jw_value( jblob, "pf_capture_nfiles" );
+		parms->pfcap_snaplen = IBOUND( parms->pfcap_snaplen, 64, 2048 );
+		parms->pfcap_sample = IBOUND( parms->pfcap_sample, 1, 1000000 );
+		parms->pfcap_file_mb = IBOUND( parms->pfcap_file_mb, 1, 4096 );
+		parms->pfcap_nfiles = IBOUND( parms->pfcap_nfiles, 1, 64 );
+
+		parms->cb_max_running = !jw_is_value( jblob, "cb_max_running" ) ? 16 : (int) jw_value( jblob, "cb_max_running" );
+		parms->cb_timeout = !jw_is_value( jblob, "cb_timeout" ) ? 30 : (int) jw_value( jblob, "cb_timeout" );
+		parms->cb_max_running = IBOUND( parms->cb_max_running, 1, 256 );
+		parms->cb_timeout = IBOUND( parms->cb_timeout, 1, 3600 );
+
 		if(  (stuff = jw_string( jblob, "log_dir" )) ) {
 			parms->log_dir = ltrim( stuff );
 		} else {
@@ -264,19 +350,34 @@ extern parms_t* read_parms( char* fname ) {
 					if( stuff != NULL ) {										// string, use default mtu
 						parms->pciids[i].id = ltrim( stuff );
 						parms->pciids[i].mtu = def_mtu;
+						parms->pciids[i].vfs_count = -1;
+						parms->pciids[i].sim_vfs = 32;							// same default as the object form; used if the port has no pci device
 						parms->pciids[i].flags &= ~PFF_LOOP_BACK;
 						parms->pciids[i].flags |= PFF_PROMISC;					// this defaults to on to be consistent with original version
 					} else {
 						if( (pobj = jw_obj_ele( jblob, "pciids", i )) != NULL ) {		// full pciid object -- take values from it
 							int jntcs;				// number of tc objects in the json
 
+							parms->pciids[i].vdev = ltrim( (char *) jw_string( pobj, "vdev" ) );	// virtual device (e.g. net_null0) rather than a pci device
+							parms->pciids[i].sim_vfs = !jw_is_value( pobj, "sim_vfs" ) ? 32 : IBOUND( (int) jw_value( pobj, "sim_vfs" ), 1, 254 );	// 254 == MAX_VFS in sriov.h
+
 							if( (stuff = jw_string( pobj, "id" )) == NULL ) {
-								snprintf( sm_wrk, sizeof( sm_wrk ),  "missing-id" );
+								if( parms->pciids[i].vdev != NULL ) {				// id defaults to the device name portion of the vdev
+									snprintf( sm_wrk, sizeof( sm_wrk ),  "%s", parms->pciids[i].vdev );
+									if( (tok = strchr( sm_wrk, ',' )) != NULL ) {
+										*tok = 0;
+									}
+								} else {
+									snprintf( sm_wrk, sizeof( sm_wrk ),  "missing-id" );
+								}
 								stuff = sm_wrk;
 							}
 							parms->pciids[i].id = ltrim( stuff );
 
 							parms->pciids[i].mtu = !jw_is_value( pobj, "mtu" ) ? def_mtu : (int) jw_value( pobj, "mtu" );
+							parms->pciids[i].pf_driver = ltrim( (char *) jw_string( pobj, "pf_driver" ) );		// device prep; nil when not given
+							parms->pciids[i].vf_driver = ltrim( (char *) jw_string( pobj, "vf_driver" ) );
+							parms->pciids[i].vfs_count = !jw_is_value( pobj, "vfs_count" ) ? -1 : IBOUND( (int) jw_value( pobj, "vfs_count" ), 0, 254 );
 							parms->pciids[i].hw_strip_crc = jwx_get_bool( pobj, "hw_strip_crc", 1 );		// strip on by default
 							if( jwx_get_bool( pobj, "promiscuous", 0 ) ) {									// set promisc; default is off
 								parms->pciids[i].flags |= PFF_PROMISC;
@@ -397,6 +498,9 @@ extern void free_parms( parms_t* parms ) {
 
 	for( i = 0; i < parms->npciids; i++ ) {
 		SFREE( parms->pciids[i].tcs[0] );			// all of the blocks are allocated in one hunk
+		SFREE( parms->pciids[i].vdev );
+		SFREE( parms->pciids[i].pf_driver );
+		SFREE( parms->pciids[i].vf_driver );
 	}
 
 	SFREE( parms->log_dir );
@@ -405,6 +509,11 @@ extern void free_parms( parms_t* parms ) {
 	SFREE( parms->pciids );
 	SFREE( parms->pid_fname );
 	SFREE( parms->stats_path );
+	SFREE( parms->ctr_file );
+	SFREE( parms->state_file );
+	SFREE( parms->xstats_filter );
+	SFREE( parms->pfcap_dir );
+	SFREE( parms->pfcap_filter );
 	SFREE( parms->numa_mem );
 
 	free( parms );
@@ -464,6 +573,8 @@ extern vf_config_t*	read_config( char* fname ) {
 
 		vfc->rate = jw_missing( jblob, "rate" ) ? 0 : (float) jw_value( jblob, "rate" );
 		vfc->min_rate = jw_missing( jblob, "min_rate" ) ? 0 : (float) jw_value( jblob, "min_rate" );
+		vfc->rate_ceiling = jw_missing( jblob, "rate_ceiling" ) ? 0 : (float) jw_value( jblob, "rate_ceiling" );
+		vfc->min_rate_floor = jw_missing( jblob, "min_rate_floor" ) ? 0 : (float) jw_value( jblob, "min_rate_floor" );
 
 		if(  (stuff = jw_string( jblob, "name" )) ) {
 			vfc->name = strdup( stuff );
@@ -11,7 +11,8 @@
 	Author:		E. Scott Daniels
 	Date:		26 May 2016
 
-	Mods:
+	Mods:		18 Oct 2026 - Add the callback executor (cbx_*) which runs commands with posix_spawn,
+							bounded concurrency and timeouts, capturing their output to the log.
 */
 
 #include <fcntl.h>
@@ -19,15 +20,59 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
 
 #include "vfdlib.h"
 
 // -------------------------------------------------------------------------------------
 #define SFREE(p) if((p)){free(p);}			// safe free (free shouldn't balk on nil, but don't chance it)
 
+#define CBX_LINE		256				// longest line of command output logged; longer lines are split
+#define CBX_GRACE_MS	5000			// after SIGTERM on timeout, time given before SIGKILL
+#define CBX_MAX_ARGS	64				// max tokens when a command is split without a shell
+#define CBX_SHELL_META	"|&;<>()$`\\\"'*?[]#~=%{}\n"		// any of these and the command is given to sh -c
+
+extern char** environ;
+
+/*
+	One command managed by the executor.
+*/
+typedef struct cbx_cmd {
+	struct cbx_cmd* next;
+	char*	cmd;
+	char*	tag;				// caller's label used on log messages (e.g. start_cb pf=0 vf=3)
+	uid_t	uid;
+	pid_t	pid;
+	int		fd;					// read end of the pipe on the command's stdout/stderr
+	int		eof;
+	int		reaped;
+	int		have_status;		// waitpid gave us the status (not so if sigchld is ignored)
+	int		status;
+	int		killed;				// 1 == sent term, 2 == sent kill
+	int64_t	started;			// ms (monotonic)
+	int		llen;
+	char	lbuf[CBX_LINE];		// partial line of output
+} cbx_cmd_t;
+
+typedef struct cbx {
+	int		max_running;
+	int64_t	timeout_ms;
+	int		nrunning;
+	int		nqueued;
+	cbx_cmd_t*	qhead;			// waiting to start (fifo)
+	cbx_cmd_t*	qtail;
+	cbx_cmd_t*	running;
+	uint64_t	nok;			// completion counts
+	uint64_t	nfail;
+	uint64_t	ntimeout;
+} cbx_t;
+
 
 
 /*
@@ -54,3 +99,433 @@ int user_cmd( uid_t uid, char* cmd ) {
 	free( cmd_buf );
 	return rc;
 }
+
+// ----------------- callback executor ------------------------------------------------------------------
+/*
+	The executor runs user commands (start/stop callbacks) without blocking the caller.
+	Commands are queued with cbx_add() and started, at most max_running at a time, by
+	cbx_poll() which must be called regularly. Each command is started directly with
+	posix_spawn(); sudo is added only when the owner isn't the user we are running as,
+	and a shell is used only when the command contains shell syntax. Output (stdout and
+	stderr) is written to the bleat log a line at a time, and a command which runs past
+	the timeout is sent SIGTERM, then SIGKILL, as a process group.
+
+	If SIGCHLD is ignored the system reaps the children and the exit status is lost;
+	completion is then noticed when the command closes its output.
+*/
+
+static int64_t cbx_now( void ) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ((int64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void cbx_free_cmd( cbx_cmd_t* c ) {
+	if( c != NULL ) {
+		if( c->fd >= 0 ) {
+			close( c->fd );
+		}
+		SFREE( c->cmd );
+		SFREE( c->tag );
+		free( c );
+	}
+}
+
+/*
+	Build the argument vector for the command. The command string is modified
+	when it is split, so the caller passes a copy (buf).
+*/
+static int cbx_mk_argv( cbx_cmd_t* c, char* buf, char** argv, char* ubuf, int ulen ) {
+	char*	tok;
+	char*	tok_ctx = NULL;
+	int		argc = 0;
+
+	if( c->uid != geteuid() ) {								// only need sudo to run as someone else
+		snprintf( ubuf, ulen, "#%d", (int) c->uid );
+		argv[argc++] = "sudo";
+		argv[argc++] = "-n";								// never prompt; we have no terminal
+		argv[argc++] = "-u";
+		argv[argc++] = ubuf;
+		argv[argc++] = "--";
+	}
+
+	if( strpbrk( buf, CBX_SHELL_META ) != NULL ) {
+		argv[argc++] = "/bin/sh";
+		argv[argc++] = "-c";
+		argv[argc++] = buf;
+	} else {
+		for( tok = strtok_r( buf, " \t", &tok_ctx ); tok != NULL && argc < CBX_MAX_ARGS - 1; tok = strtok_r( NULL, " \t", &tok_ctx ) ) {
+			argv[argc++] = tok;
+		}
+	}
+
+	argv[argc] = NULL;
+	return argc;
+}
+
+/*
+	Start the command. Returns 0 on success; on failure the command is finished
+	and the caller should count it as failed.
+*/
+static int cbx_spawn( cbx_cmd_t* c ) {
+	posix_spawn_file_actions_t	fa;
+	posix_spawnattr_t	attr;
+	sigset_t	sigs;
+	char*	argv[CBX_MAX_ARGS];
+	char*	buf;
+	char	ubuf[32];
+	int		fds[2];
+	int		rc;
+
+	if( (buf = strdup( c->cmd )) == NULL ) {
+		return ENOMEM;
+	}
+
+	if( cbx_mk_argv( c, buf, argv, ubuf, sizeof( ubuf ) ) == 0 || argv[0] == NULL ) {
+		free( buf );
+		return EINVAL;
+	}
+
+	if( pipe( fds ) < 0 ) {
+		rc = errno;
+		free( buf );
+		return rc;
+	}
+	fcntl( fds[0], F_SETFD, FD_CLOEXEC );						// neither end leaks into other children; the dup2 in the
+	fcntl( fds[1], F_SETFD, FD_CLOEXEC );						// file actions clears cloexec on the child's 1 and 2
+	fcntl( fds[0], F_SETFL, fcntl( fds[0], F_GETFL ) | O_NONBLOCK );
+
+	posix_spawn_file_actions_init( &fa );
+	posix_spawn_file_actions_adddup2( &fa, fds[1], 1 );
+	posix_spawn_file_actions_adddup2( &fa, fds[1], 2 );
+	posix_spawn_file_actions_addopen( &fa, 0, "/dev/null", O_RDONLY, 0 );		// after the dups in case the pipe landed on 0
+
+	posix_spawnattr_init( &attr );
+	posix_spawnattr_setpgroup( &attr, 0 );						// own group so a timeout kills anything it started
+	sigemptyset( &sigs );
+	posix_spawnattr_setsigmask( &attr, &sigs );					// caller's thread may have signals blocked
+	sigaddset( &sigs, SIGCHLD );								// undo anything we ignore or catch
+	sigaddset( &sigs, SIGPIPE );
+	sigaddset( &sigs, SIGQUIT );
+	sigaddset( &sigs, SIGHUP );
+	sigaddset( &sigs, SIGINT );
+	sigaddset( &sigs, SIGTERM );
+	sigaddset( &sigs, SIGUSR1 );
+	sigaddset( &sigs, SIGUSR2 );
+	posix_spawnattr_setsigdefault( &attr, &sigs );
+	posix_spawnattr_setflags( &attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF );
+
+	rc = posix_spawnp( &c->pid, argv[0], &fa, &attr, argv, environ );
+
+	posix_spawnattr_destroy( &attr );
+	posix_spawn_file_actions_destroy( &fa );
+	close( fds[1] );
+	free( buf );
+
+	if( rc != 0 ) {
+		close( fds[0] );
+		return rc;
+	}
+
+	c->fd = fds[0];
+	c->started = cbx_now();
+	return 0;
+}
+
+/*
+	Write the buffered partial line to the log.
+*/
+static void cbx_flush_line( cbx_cmd_t* c ) {
+	if( c->llen > 0 ) {
+		c->lbuf[c->llen] = 0;
+		bleat_printf( 1, "%s [%d]: %s", c->tag, (int) c->pid, c->lbuf );
+		c->llen = 0;
+	}
+}
+
+/*
+	Read whatever output is waiting and log complete lines.
+*/
+static void cbx_read( cbx_cmd_t* c ) {
+	char	rbuf[1024];
+	int		n;
+	int		i;
+
+	if( c->fd < 0 || c->eof ) {
+		return;
+	}
+
+	while( (n = read( c->fd, rbuf, sizeof( rbuf ) )) > 0 ) {
+		for( i = 0; i < n; i++ ) {
+			if( rbuf[i] == '\n' ) {
+				cbx_flush_line( c );
+			} else {
+				if( rbuf[i] != '\r' ) {
+					c->lbuf[c->llen++] = rbuf[i];
+				}
+				if( c->llen >= CBX_LINE - 1 ) {
+					cbx_flush_line( c );
+				}
+			}
+		}
+	}
+
+	if( n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) ) {
+		c->eof = 1;
+	}
+}
+
+/*
+	Report the end of a command and bump the counters.
+*/
+static void cbx_report( cbx_t* cbx, cbx_cmd_t* c ) {
+	int64_t	elapsed;
+
+	elapsed = cbx_now() - c->started;
+	cbx_flush_line( c );
+
+	if( c->killed ) {
+		cbx->ntimeout++;
+		bleat_printf( 0, "WRN: %s [%d]: killed after timeout of %ds (%lldms): %s", c->tag, (int) c->pid,
+			(int) (cbx->timeout_ms / 1000), (long long) elapsed, c->cmd );
+		return;
+	}
+
+	if( ! c->have_status ) {
+		cbx->nok++;
+		bleat_printf( 1, "%s [%d]: completed in %lldms, exit status unavailable: %s", c->tag, (int) c->pid, (long long) elapsed, c->cmd );
+		return;
+	}
+
+	if( WIFEXITED( c->status ) && WEXITSTATUS( c->status ) == 0 ) {
+		cbx->nok++;
+		bleat_printf( 1, "%s [%d]: completed in %lldms: %s", c->tag, (int) c->pid, (long long) elapsed, c->cmd );
+		return;
+	}
+
+	cbx->nfail++;
+	if( WIFSIGNALED( c->status ) ) {
+		bleat_printf( 0, "WRN: %s [%d]: ended by signal %d after %lldms: %s", c->tag, (int) c->pid, WTERMSIG( c->status ), (long long) elapsed, c->cmd );
+	} else {
+		bleat_printf( 0, "WRN: %s [%d]: exited with %d after %lldms: %s", c->tag, (int) c->pid, WEXITSTATUS( c->status ), (long long) elapsed, c->cmd );
+	}
+}
+
+/*
+	Check a running command: gather output, reap it, enforce the timeout.
+	Returns true when the command is finished.
+*/
+static int cbx_check( cbx_t* cbx, cbx_cmd_t* c, int64_t now ) {
+	pid_t	rc;
+
+	cbx_read( c );
+
+	if( ! c->reaped ) {
+		rc = waitpid( c->pid, &c->status, WNOHANG );
+		if( rc == c->pid ) {
+			c->reaped = 1;
+			c->have_status = 1;
+			cbx_read( c );							// anything written just before exit
+		} else {
+			if( rc < 0 && errno == ECHILD ) {			// sigchld ignored; already reaped by the system
+				c->reaped = c->eof;
+			}
+		}
+	}
+
+	if( c->reaped ) {
+		return 1;								// a child left holding the pipe doesn't keep us waiting
+	}
+
+	if( now - c->started >= cbx->timeout_ms ) {
+		if( c->killed == 0 ) {
+			bleat_printf( 1, "%s [%d]: timeout; sending SIGTERM", c->tag, (int) c->pid );
+			kill( -c->pid, SIGTERM );
+			c->killed = 1;
+		} else {
+			if( c->killed == 1 && now - c->started >= cbx->timeout_ms + CBX_GRACE_MS ) {
+				bleat_printf( 1, "%s [%d]: did not stop; sending SIGKILL", c->tag, (int) c->pid );
+				kill( -c->pid, SIGKILL );
+				c->killed = 2;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+	Create an executor which runs at most max_running commands at once and allows
+	each timeout_sec seconds before it is killed.
+*/
+extern void* cbx_mk( int max_running, int timeout_sec ) {
+	cbx_t*	cbx;
+
+	if( (cbx = (cbx_t *) malloc( sizeof( *cbx ) )) == NULL ) {
+		return NULL;
+	}
+
+	memset( cbx, 0, sizeof( *cbx ) );
+	cbx->max_running = max_running > 0 ? max_running : 1;
+	cbx->timeout_ms = (int64_t) (timeout_sec > 0 ? timeout_sec : 1) * 1000;
+	return (void *) cbx;
+}
+
+/*
+	Queue a command to be run as uid. Tag is used to identify the command on log
+	messages. Nothing is started until cbx_poll() is called. Returns 0 on success.
+*/
+extern int cbx_add( void* vcbx, uid_t uid, const char* cmd, const char* tag ) {
+	cbx_t*	cbx;
+	cbx_cmd_t*	c;
+
+	if( (cbx = (cbx_t *) vcbx) == NULL || cmd == NULL || *cmd == 0 ) {
+		return -1;
+	}
+
+	if( (c = (cbx_cmd_t *) malloc( sizeof( *c ) )) == NULL ) {
+		return -1;
+	}
+	memset( c, 0, sizeof( *c ) );
+	c->fd = -1;
+	c->uid = uid;
+	c->cmd = strdup( cmd );
+	c->tag = strdup( tag != NULL ? tag : "cmd" );
+	if( c->cmd == NULL || c->tag == NULL ) {
+		cbx_free_cmd( c );
+		return -1;
+	}
+
+	if( cbx->qtail != NULL ) {
+		cbx->qtail->next = c;
+	} else {
+		cbx->qhead = c;
+	}
+	cbx->qtail = c;
+	cbx->nqueued++;
+
+	return 0;
+}
+
+/*
+	Drive the executor: finish and report commands which are done, enforce timeouts,
+	and start queued commands while there is room. Never blocks. Returns the number
+	of commands queued or running.
+*/
+extern int cbx_poll( void* vcbx ) {
+	cbx_t*	cbx;
+	cbx_cmd_t*	c;
+	cbx_cmd_t*	next;
+	cbx_cmd_t*	prev = NULL;
+	int64_t	now;
+	int		rc;
+
+	if( (cbx = (cbx_t *) vcbx) == NULL ) {
+		return 0;
+	}
+
+	now = cbx_now();
+	for( c = cbx->running; c != NULL; c = next ) {
+		next = c->next;
+		if( cbx_check( cbx, c, now ) ) {
+			if( prev != NULL ) {
+				prev->next = next;
+			} else {
+				cbx->running = next;
+			}
+			cbx->nrunning--;
+			cbx_report( cbx, c );
+			cbx_free_cmd( c );
+		} else {
+			prev = c;
+		}
+	}
+
+	while( cbx->nrunning < cbx->max_running && (c = cbx->qhead) != NULL ) {
+		if( (cbx->qhead = c->next) == NULL ) {
+			cbx->qtail = NULL;
+		}
+		cbx->nqueued--;
+
+		if( (rc = cbx_spawn( c )) != 0 ) {
+			cbx->nfail++;
+			bleat_printf( 0, "WRN: %s: unable to start: %s: %s", c->tag, strerror( rc ), c->cmd );
+			cbx_free_cmd( c );
+			continue;
+		}
+
+		bleat_printf( 2, "%s [%d]: started: %s", c->tag, (int) c->pid, c->cmd );
+		c->next = cbx->running;
+		cbx->running = c;
+		cbx->nrunning++;
+	}
+
+	return cbx->nrunning + cbx->nqueued;
+}
+
+/*
+	Poll until everything queued has finished, or max_sec seconds pass. Used at shutdown
+	where we must wait, but never forever. Returns the number of commands still pending.
+*/
+extern int cbx_wait( void* vcbx, int max_sec ) {
+	int64_t	deadline;
+	int		pending;
+
+	deadline = cbx_now() + ((int64_t) max_sec * 1000);
+	while( (pending = cbx_poll( vcbx )) > 0 && cbx_now() < deadline ) {
+		usleep( 20000 );
+	}
+
+	return pending;
+}
+
+/*
+	Return the number of commands which completed ok, failed and were killed on timeout.
+*/
+extern void cbx_counts( void* vcbx, uint64_t* nok, uint64_t* nfail, uint64_t* ntimeout ) {
+	cbx_t*	cbx;
+
+	if( (cbx = (cbx_t *) vcbx) == NULL ) {
+		return;
+	}
+
+	if( nok != NULL ) {
+		*nok = cbx->nok;
+	}
+	if( nfail != NULL ) {
+		*nfail = cbx->nfail;
+	}
+	if( ntimeout != NULL ) {
+		*ntimeout = cbx->ntimeout;
+	}
+}
+
+/*
+	Drop anything queued, kill anything running and free the executor.
+*/
+extern void cbx_free( void* vcbx ) {
+	cbx_t*	cbx;
+	cbx_cmd_t*	c;
+	cbx_cmd_t*	next;
+
+	if( (cbx = (cbx_t *) vcbx) == NULL ) {
+		return;
+	}
+
+	for( c = cbx->qhead; c != NULL; c = next ) {
+		next = c->next;
+		bleat_printf( 1, "%s: not run: %s", c->tag, c->cmd );
+		cbx_free_cmd( c );
+	}
+
+	for( c = cbx->running; c != NULL; c = next ) {
+		next = c->next;
+		bleat_printf( 0, "WRN: %s [%d]: still running; killed: %s", c->tag, (int) c->pid, c->cmd );
+		kill( -c->pid, SIGKILL );
+		waitpid( c->pid, NULL, WNOHANG );
+		cbx_free_cmd( c );
+	}
+
+	free( cbx );
+}
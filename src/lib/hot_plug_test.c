@@ -1,9 +1,19 @@
-
 /*
 	Mneminic:	hot_plug_test.c
 	Abstract: 	Unit test for the hot-plug functions.
+
+				hot_plug_test [user-id command-string]
+
+				With a user and command, the command is run with user_cmd().
+				Without, the callback executor (cbx_*) is tested: output
+				capture to the log, exit status, a command which cannot be
+				started, the kill on timeout and the cap on concurrent commands.
+				Output goes to hot_plug_test.log in the current directory.
+
 	Date:		26 May 2016
 	Author:		E. Scott Daniels
+
+	Mods:		18 Oct 2026 - Add executor tests.
 */
 
 #include <unistd.h>
@@ -12,19 +22,120 @@
 #include <strings.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include "vfdlib.h"
 
+#define LOG_FILE	"hot_plug_test.log"
+
+static int64_t now_ms( void ) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ((int64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*
+	Run the command(s) on a new executor and wait for them. Returns the elapsed ms
+	and fills in the counts.
+*/
+static int64_t run( int max_running, int timeout, const char** cmds, int ncmds, uint64_t* nok, uint64_t* nfail, uint64_t* ntimeout ) {
+	void*	cbx;
+	int64_t	start;
+	int		i;
+
+	*nok = *nfail = *ntimeout = 0;
+	if( (cbx = cbx_mk( max_running, timeout )) == NULL ) {
+		return -1;
+	}
+
+	start = now_ms();
+	for( i = 0; i < ncmds; i++ ) {
+		cbx_add( cbx, geteuid(), cmds[i], "test" );
+	}
+	cbx_wait( cbx, 30 );
+	cbx_counts( cbx, nok, nfail, ntimeout );
+	cbx_free( cbx );
+
+	return now_ms() - start;
+}
+
+/*
+	Return true if the string is in the log file.
+*/
+static int in_log( const char* str ) {
+	FILE*	f;
+	char	buf[1024];
+	int		found = 0;
+
+	if( (f = fopen( LOG_FILE, "r" )) == NULL ) {
+		return 0;
+	}
+	while( ! found && fgets( buf, sizeof( buf ), f ) != NULL ) {
+		found = strstr( buf, str ) != NULL;
+	}
+	fclose( f );
+
+	return found;
+}
+
+static int check( int ok, const char* what ) {
+	fprintf( stderr, "[%s] %s\n", ok ? "OK" : "FAIL", what );
+	return ok ? 0 : 1;
+}
+
 int main( int argc, char** argv ) {
-	int	rc;
+	const char*	cmds[4];
+	uint64_t	nok;
+	uint64_t	nfail;
+	uint64_t	ntimeout;
+	int64_t		elapsed;
+	int	rc = 0;
 
-	if( argc < 3 ) {
-		fprintf( stderr, "usage: %s user-id command string\n", argv[0] );
-		exit( 1 );
+	if( argc > 1 ) {
+		if( argc < 3 ) {
+			fprintf( stderr, "usage: %s [user-id command string]\n", argv[0] );
+			exit( 1 );
+		}
+
+		rc = user_cmd( atoi( argv[1] ), argv[2] );
+		fprintf( stderr, "rc from detach: %d\n", rc );
+		exit( rc );
 	}
 
-	rc = user_cmd( atoi( argv[1] ), argv[2] );
-	fprintf( stderr, "rc from detach: %d\n", rc );
+	unlink( LOG_FILE );
+	bleat_set_lvl( 1 );
+	bleat_set_log( LOG_FILE, 0 );
+
+	cmds[0] = "echo cbx-stdout-line";
+	cmds[1] = "/bin/sh -c 'echo cbx-stderr-line >&2'";
+	run( 1, 5, cmds, 2, &nok, &nfail, &ntimeout );
+	rc += check( nok == 2 && nfail == 0, "commands writing output completed ok" );
+	rc += check( in_log( "cbx-stdout-line" ), "stdout captured to the log" );
+	rc += check( in_log( "cbx-stderr-line" ), "stderr captured to the log" );
+
+	cmds[0] = "false";
+	cmds[1] = "/bin/sh -c 'exit 3'";
+	cmds[2] = "true";
+	run( 4, 5, cmds, 3, &nok, &nfail, &ntimeout );
+	rc += check( nok == 1 && nfail == 2, "non-zero exits counted as failures" );
+	rc += check( in_log( "exited with 3" ), "exit status logged" );
+
+	cmds[0] = "/nonexistent/hot_plug_test/command";
+	run( 1, 5, cmds, 1, &nok, &nfail, &ntimeout );
+	rc += check( nok == 0 && nfail == 1, "command which cannot be started counted as a failure" );
+	rc += check( in_log( "unable to start" ), "failed start logged" );
+
+	cmds[0] = "sleep 30";
+	elapsed = run( 1, 1, cmds, 1, &nok, &nfail, &ntimeout );
+	rc += check( ntimeout == 1 && nok == 0 && nfail == 0, "command past the timeout is killed" );
+	rc += check( elapsed < 3000, "killed with SIGTERM; SIGKILL grace not needed" );
+
+	cmds[0] = cmds[1] = cmds[2] = cmds[3] = "sleep 1";
+	elapsed = run( 2, 10, cmds, 4, &nok, &nfail, &ntimeout );
+	rc += check( nok == 4 && elapsed >= 1900, "at most 2 of 4 commands run at once" );
+	elapsed = run( 4, 10, cmds, 4, &nok, &nfail, &ntimeout );
+	rc += check( nok == 4 && elapsed < 1900, "4 of 4 commands run at once" );
 
-	exit( rc );		// bad exit if we failed a test
+	exit( rc != 0 );		// bad exit if we failed a test
 }
@@ -36,6 +36,8 @@
 #define RF_INITIALISED	0x02		// init has finished
 #define RF_ENABLE_FC	0x04		// enable flow control for all PFs
 #define RF_NO_HUGE		0x08		// disable huget pages
+#define RF_NO_PCI		0x10		// don't scan the pci bus (virtual devices only)
+#define RF_PREP_DEVS	0x20		// bind drivers and create vfs for the pciids before dpdk init
 
 #define MAX_TCS			8			// max number of traffic classes supported (0 - 7)
 #define NUM_BWGS		8			// number of bandwidth groups
@@ -68,6 +70,11 @@ typedef struct {
 	int		mtu;
 	int		hw_strip_crc;			// set hardware to strip crc when true
 	unsigned int flags;				// PFF_ flag constants
+	char*	vdev;					// dpdk virtual device (--vdev) string; nil for a real pci device
+	int		sim_vfs;				// number of simulated VFs presented when vdev is set
+	char*	pf_driver;				// driver the pf is bound to by device prep (nil == not prepared)
+	char*	vf_driver;				// driver vfs are bound to by device prep (nil == leave them alone)
+	int		vfs_count;				// vfs device prep creates on the pf (-1 == not given)
 									// QoS members
     int32_t ntcs;					// number of TCs (4 or 8)
     tc_class_t* tcs[MAX_TCS];		// defined TCs (0-3 or 0-7) position in the array is the priority (from pri in the json)
@@ -91,6 +98,30 @@ typedef struct {
 	char*	pid_fname;				// if we daemonise we should write our pid here.
 	char*	cpu_mask;				// should be something like 0x04, but could be decimal.  string so it can have lead 0x
 	char*	numa_mem;				// something like 64 or 64,64 or 64,128.  For our little app, the default 64,64 should be fine
+	int		fr_entries;				// number of suppressed bleat messages each thread keeps in the flight recorder (0 disables)
+	int		rebal_itvl;				// seconds between bandwidth rebalancer passes (0 disables)
+	int		recon_itvl;				// seconds between nic/config reconcile passes (0 disables)
+	int		rebal_hyst;				// change (percent of link speed) needed before the rebalancer reprograms a vf
+	int		thr_itvl;				// seconds between noisy neighbour samples (0 disables throttling)
+	int		thr_window;				// consecutive samples over a threshold before a vf is throttled
+	int		thr_calm;				// consecutive calm samples before the throttle is lifted
+	int		thr_rate;				// temporary rate limit (percent of link speed) applied to a noisy vf
+	uint64_t thr_pps;				// tx packets/sec threshold (0 == not checked)
+	uint64_t thr_mbps;				// tx Mbit/sec threshold (0 == not checked)
+	uint64_t thr_drops;				// dropped/errored packets/sec threshold (0 == not checked)
+	char*	ctr_file;				// file where monotonic vf counters are saved across restarts (empty string disables)
+	int		ctr_save_itvl;			// seconds between writes of the counter file
+	char*	xstats_filter;			// comma separated list of xstats name prefixes to report (* reports all)
+	int		nl_stats_itvl;			// seconds between pushes of vf stats to the vfd-net module (0 disables)
+	char*	pfcap_dir;				// directory for pcap files of traffic drained from pf queues (empty string disables capture)
+	int		pfcap_snaplen;			// bytes of each packet captured
+	int		pfcap_sample;			// capture 1 in n packets which pass the filter
+	char*	pfcap_filter;			// comma separated ethertype/vlan terms (empty captures all)
+	int		pfcap_file_mb;			// size at which a capture file is rotated
+	int		pfcap_nfiles;			// capture files kept per pf
+	int		cb_max_running;			// start/stop callback commands run concurrently
+	int		cb_timeout;				// seconds a callback command may run before it is killed
+	char*	state_file;				// snapshot of the running config used on restart (empty string disables)
 
 									// these things have no defaults
 	int		npciids;				// number of pciids specified for us to configure
@@ -132,6 +163,8 @@ typedef struct {
 	int		mirror_target;			// vf number of the target for mirroring
 	int		mirror_dir;				// direction (in/out/both/off)
 	float	min_rate;				// percentage of the total link speed that is guaranteed (BW guarantee)
+	float	rate_ceiling;			// rebalancer may raise the rate limit up to this (0 == never above rate)
+	float	min_rate_floor;			// rebalancer may lend guarantee down to this when the vf is idle
 	uint8_t	qshare[MAX_TCS];		// share (percentage) of each traffic class
 	// ignoring mirrors right now
 	/*
@@ -189,9 +222,19 @@ extern void bleat_pop_lvl( void );
 extern int bleat_will_it( int l );
 extern int bleat_set_log( char* fname, int add_date );
 extern void bleat_printf( int level, const char* fmt, ... );
+extern int bleat_fr_enable( int nents );
+extern int bleat_fr_dump( const char* fname, int seconds );
+extern void bleat_fr_crash_file( const char* fname );
+extern int bleat_fr_crash_dump( void );
 
 //---------------- hot_plug -------------------------------------------------------------------------------
 extern int user_cmd( uid_t uid, char* cmd );
+extern void* cbx_mk( int max_running, int timeout_sec );
+extern int cbx_add( void* vcbx, uid_t uid, const char* cmd, const char* tag );
+extern int cbx_poll( void* vcbx );
+extern int cbx_wait( void* vcbx, int max_sec );
+extern void cbx_counts( void* vcbx, uint64_t* nok, uint64_t* nfail, uint64_t* ntimeout );
+extern void cbx_free( void* vcbx );
 
 //---------------- jwrapper -------------------------------------------------------------------------------
 extern void jw_nuke( void* st );
@@ -113,17 +113,8 @@ static void sig_int(int sig)
   terminated = 1;
   restart = 0;
 
-  int portid;
-  if (sig == SIGINT) 
-  {
-		for (portid = 0; portid < nb_ports; portid++) 
-    {
-			rte_eth_dev_close(portid);
-		}
-	}
-  
-  
-  
+  // ports are closed by main once the lcores have stopped polling them
+
   static int called = 0;
   
   if(sig == 1) called = sig;
@@ -200,7 +191,7 @@ double timeDelta(struct timeval * now, struct timeval * before)
 static inline int port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 {
 	struct rte_eth_conf port_conf = port_conf_default;
-	const uint16_t rx_rings = 1, tx_rings = 1;
+	const uint16_t rx_rings = nb_queues, tx_rings = nb_queues;
 	int retval;
 	uint16_t q;
   struct rte_eth_dev_info dev_info;
@@ -218,6 +209,20 @@ static inline int port_init(uint8_t port, struct rte_mempool *mbuf_pool)
   
   if(strip)
     port_conf.rxmode.hw_vlan_strip = 1;
+
+  if (rx_rings > dev_info.max_rx_queues || tx_rings > dev_info.max_tx_queues)
+  {
+    traceLog(TRACE_ERROR, "port %u supports at most %u rx and %u tx queues, %u requested\n", port, dev_info.max_rx_queues, dev_info.max_tx_queues, rx_rings);
+    exit(EXIT_FAILURE);
+  }
+
+  // spread flows over the queues; each queue is polled by its own lcore
+  if (rx_rings > 1)
+  {
+    port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+    port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+    port_conf.rx_adv_conf.rss_conf.rss_hf = (ETH_RSS_IP | ETH_RSS_UDP | ETH_RSS_TCP) & dev_info.flow_type_rss_offloads;
+  }
   
 	// Configure the Ethernet device.
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
@@ -230,7 +235,7 @@ static inline int port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 
   rte_eth_dev_callback_register(port, RTE_ETH_EVENT_INTR_LSC, lsi_event_callback, NULL);
 
-	// Allocate and set up 1 RX queue per Ethernet port. 
+	// Allocate and set up the RX queues. 
 	for (q = 0; q < rx_rings; q++) 
   {
 		retval = rte_eth_rx_queue_setup(port, q, RX_RING_SIZE, rte_eth_dev_socket_id(port), NULL, mbuf_pool);
@@ -241,7 +246,7 @@ static inline int port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 		}
 	}
 
-	// Allocate and set up 1 TX queue per Ethernet port.
+	// Allocate and set up the TX queues.
 	for (q = 0; q < tx_rings; q++) 
   {
 		retval = rte_eth_tx_queue_setup(port, q, TX_RING_SIZE, rte_eth_dev_socket_id(port), NULL);
@@ -327,13 +332,12 @@ static void lsi_event_callback(uint8_t port_id, enum rte_eth_event_type type, vo
 }
 
 
+/*
+  Print the packet details. Debugging only (-P); the counting, mac rewrite
+  and vlan insert flag are done for the whole burst by fwd_burst().
+*/
 inline void gotpacket(struct rte_mbuf  *mb, int __attribute__((__unused__)) port)
 {
-
-  st.bcount += mb->pkt_len;
-  st.pcount++;
-  
-  
   char msg[256];
   char ip_buf[16];
   
@@ -365,26 +369,6 @@ inline void gotpacket(struct rte_mbuf  *mb, int __attribute__((__unused__)) port
 
   
   
-  // put address of right port as source and change dest
-  
-  if(!keep_mac)
-  {
-    eth_hdr->d_addr = eth_hdr->s_addr;
-    eth_hdr->s_addr = addr;
-  }
-  
-  
-  /* Enable VLAN tag insertion through TXD */
-  
-  if(insert_vlan) {
-    printf("Inserting PKT_TX_VLAN_PKT\n");
-    mb->ol_flags = mb->ol_flags | PKT_TX_VLAN_PKT;
-  }
-
-  
-  
-  if (!print_ips) return;
-  
   struct rte_eth_dev_info dev_info;
 	rte_eth_dev_info_get(port, &dev_info);
 
@@ -403,7 +387,7 @@ inline void gotpacket(struct rte_mbuf  *mb, int __attribute__((__unused__)) port
 			addr_t.addr_bytes[4], addr_t.addr_bytes[5]);
 
 
-  printf("Driver Name: %s, Index %d, Pkts rx: %lu, ", dev_info.driver_name, dev_info.if_index, st.pcount);
+  printf("Driver Name: %s, Index %d, ", dev_info.driver_name, dev_info.if_index);
   
   printf("PCI: %04X:%02X:%02X.%01X, Max VF's: %d, Numa: %d\n\n", dev_info.pci_dev->addr.domain, dev_info.pci_dev->addr.bus , dev_info.pci_dev->addr.devid , dev_info.pci_dev->addr.function, dev_info.max_vfs, dev_info.pci_dev->numa_node);
 
@@ -535,17 +519,830 @@ inline uint128_t ntoh128_u(uint128_t * src)
 }
 
 
-uint64_t ticks_before, ticks_now, t_usefull, t_begin, t_end;
+/*
+  MAC rewrite: the destination becomes the old source and the source becomes
+  our port address. With SSSE3 the 16 bytes at the start of the frame are
+  rewritten with one shuffle and or; the masks are built by mac_init().
+*/
+#if defined(RTE_MACHINE_CPUFLAG_SSSE3)
+#include <tmmintrin.h>
+
+static __m128i mac_shuf;    // moves the source mac over the destination, zeros the source, keeps the ether type
+static __m128i mac_src;     // our address in the source mac bytes
+
+static void mac_init(struct ether_addr *a)
+{
+  mac_shuf = _mm_setr_epi8(6, 7, 8, 9, 10, 11, -128, -128, -128, -128, -128, -128, 12, 13, 14, 15);
+  mac_src = _mm_setr_epi8(0, 0, 0, 0, 0, 0, a->addr_bytes[0], a->addr_bytes[1], a->addr_bytes[2],
+    a->addr_bytes[3], a->addr_bytes[4], a->addr_bytes[5], 0, 0, 0, 0);
+}
+
+static inline void mac_rewrite(struct ether_hdr *eh)
+{
+  __m128i h = _mm_loadu_si128((__m128i *) eh);
+
+  _mm_storeu_si128((__m128i *) eh, _mm_or_si128(_mm_shuffle_epi8(h, mac_shuf), mac_src));
+}
+
+#else
+
+static void mac_init(struct ether_addr __attribute__((__unused__)) *a)
+{
+}
+
+static inline void mac_rewrite(struct ether_hdr *eh)
+{
+  eh->d_addr = eh->s_addr;
+  eh->s_addr = addr;
+}
+#endif
+
+
+/*
+  Per burst work for received packets: prefetch the headers PREFETCH_OFFSET
+  packets ahead, rewrite the macs and set the vlan insert flag. Returns the
+  number of bytes in the burst.
+*/
+static inline uint64_t fwd_burst(struct rte_mbuf **bufs, uint16_t n)
+{
+  uint64_t bytes = 0;
+  uint16_t x;
+
+  for (x = 0; x < n && x < PREFETCH_OFFSET; x++)
+    rte_prefetch0(rte_pktmbuf_mtod(bufs[x], void *));
+
+  for (x = 0; x < n; x++)
+  {
+    if (likely(x + PREFETCH_OFFSET < n))
+      rte_prefetch0(rte_pktmbuf_mtod(bufs[x + PREFETCH_OFFSET], void *));
+
+    bytes += bufs[x]->pkt_len;
+
+    if (!keep_mac)
+      mac_rewrite(rte_pktmbuf_mtod(bufs[x], struct ether_hdr *));
+
+    if (insert_vlan)
+      bufs[x]->ol_flags |= PKT_TX_VLAN_PKT;
+  }
+
+  return bytes;
+}
+
+
+/*
+  Polls one queue (arg is the queue number) on each port until terminated.
+  Counters go to the queue's own cache line in qstats.
+*/
+static int lcore_main(void *arg)
+{
+  uint16_t q = (uint16_t) (uintptr_t) arg;
+  struct q_stats *qs = &qstats[q];
+  struct rte_mbuf *bufs[burst];
+  uint16_t nb_rx, nb_tx;
+  uint8_t port;
+  int x;
+
+  traceLog(TRACE_NORMAL, "lcore %u polling queue %u\n", rte_lcore_id(), q);
+
+  if (lat_pps > 0)
+    return lat_main(q);
+
+  if (gen_nrates > 0)
+    return gen_main(q);
+
+  while (!terminated)
+  {
+    for (port = 0; port < nb_ports; port++)
+    {
+      nb_rx = rte_eth_rx_burst(port, q, bufs, burst);
+      if (unlikely(nb_rx == 0))
+      {
+        qs->idle_loops++;
+        continue;
+      }
 
+      qs->busy_loops++;
+      qs->pkts_rx += nb_rx;
+      qs->bytes_rx += fwd_burst(bufs, nb_rx);
+
+      if (unlikely(print_ips))
+        for (x = 0; x < nb_rx; x++)
+          gotpacket(bufs[x], port);
+
+      nb_tx = 0;
+      if (transmit == 1)
+      {
+        nb_tx = rte_eth_tx_burst(port, q, bufs, nb_rx);
+        qs->pkts_tx += nb_tx;
+        qs->missed_tx += nb_rx - nb_tx;
+      }
+
+      if (unlikely(nb_tx < nb_rx))
+      {
+        do
+        {
+          rte_pktmbuf_free(bufs[nb_tx]);
+        } while (++nb_tx < nb_rx);
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+/*
+  Fill in an ether/ipv4/udp frame of len bytes (no crc) addressed to the gw
+  mac, with a vlan tag of tci unless tci is negative. The udp ports are set
+  from the queue so that the flows of the queues hash apart at the far end;
+  the udp checksum is left 0 (none).
+*/
+static void build_udp_frame(uint8_t *pkt, uint16_t len, uint16_t q, int tci)
+{
+  struct ether_hdr *eh = (struct ether_hdr *) pkt;
+  struct vlan_hdr *vh;
+  struct ipv4_hdr *ip;
+  struct udp_hdr *udp;
+  uint16_t l2_len = sizeof(*eh);
+
+  eh->d_addr = ifrate_stats->port_stats[0].gw_addr;
+  eh->s_addr = addr;
+
+  if (tci >= 0)
+  {
+    eh->ether_type = htons(ETHER_TYPE_VLAN);
+    vh = (struct vlan_hdr *) (eh + 1);
+    vh->vlan_tci = htons((uint16_t) tci);
+    vh->eth_proto = htons(ETHERTYPE_IP);
+    l2_len += sizeof(*vh);
+  }
+  else
+    eh->ether_type = htons(ETHERTYPE_IP);
+
+  ip = (struct ipv4_hdr *) (pkt + l2_len);
+  memset(ip, 0, sizeof(*ip));
+  ip->version_ihl = 0x45;
+  ip->total_length = htons(len - l2_len);
+  ip->time_to_live = 64;
+  ip->next_proto_id = IPPROTO_UDP;
+  ip->src_addr = htonl(0x0a000001);
+  ip->dst_addr = htonl(0x0a000002);
+  ip->hdr_checksum = rte_ipv4_cksum(ip);
+
+  udp = (struct udp_hdr *) (ip + 1);
+  udp->src_port = htons(LAT_UDP_PORT + q);
+  udp->dst_port = htons(LAT_UDP_PORT + q);
+  udp->dgram_len = htons(len - l2_len - sizeof(*ip));
+  udp->dgram_cksum = 0;
+}
+
+
+/*
+  Allocate and build one probe from queue q; stamped as late as possible.
+*/
+static inline struct rte_mbuf *lat_probe_alloc(uint16_t q, u_int64_t seq)
+{
+  struct rte_mbuf *m;
+  uint8_t *pkt;
+  struct lat_probe *lp;
+
+  if ((m = rte_pktmbuf_alloc(pkt_pool)) == NULL)
+    return NULL;
+
+  pkt = (uint8_t *) rte_pktmbuf_append(m, LAT_PKT_LEN);
+  build_udp_frame(pkt, LAT_PKT_LEN, q, -1);
+
+  lp = (struct lat_probe *) (pkt + LAT_HDR_LEN);
+  lp->magic = LAT_MAGIC;
+  lp->queue = q;
+  lp->pad = 0;
+  lp->seq = seq;
+  lp->tsc = rte_rdtsc();
+
+  return m;
+}
+
+
+/*
+  Return the probe in the packet, or NULL if it isn't one of ours. A single
+  vlan tag (pcp marking) is allowed.
+*/
+static inline struct lat_probe *lat_probe_find(struct rte_mbuf *m)
+{
+  uint8_t *pkt = rte_pktmbuf_mtod(m, uint8_t *);
+  u_int32_t off = 12;                   // ether type
+  struct ipv4_hdr *ip;
+  struct lat_probe *lp;
+
+  if (*(u_int16_t *) (pkt + off) == htons(ETHER_TYPE_VLAN))
+    off += 4;
+
+  if (*(u_int16_t *) (pkt + off) != htons(ETHERTYPE_IP) || rte_pktmbuf_data_len(m) < off + 2 + sizeof(*ip) + sizeof(struct udp_hdr) + sizeof(*lp))
+    return NULL;
+
+  ip = (struct ipv4_hdr *) (pkt + off + 2);
+  if (ip->next_proto_id != IPPROTO_UDP)
+    return NULL;
+
+  lp = (struct lat_probe *) ((uint8_t *) (ip + 1) + sizeof(struct udp_hdr));
+  if (lp->magic != LAT_MAGIC || lp->queue >= nb_queues)
+    return NULL;
+
+  return lp;
+}
+
+
+/*
+  Record one returned probe in the stats of the receiving queue.
+*/
+static inline void lat_record(struct lat_stats *ls, struct lat_probe *lp, u_int64_t now, double ns_per_tsc)
+{
+  u_int64_t ns;
+  u_int64_t d;
+  u_int64_t b;
+
+  ns = (u_int64_t) ((now - lp->tsc) * ns_per_tsc);
+
+  ls->count++;
+  ls->sum_ns += ns;
+  if (ns < ls->min_ns)
+    ls->min_ns = ns;
+  if (ns > ls->max_ns)
+    ls->max_ns = ns;
+
+  if (ls->count > 1)
+  {
+    d = ns > ls->last_ns ? ns - ls->last_ns : ls->last_ns - ns;
+    ls->jitter_ns += ((double) d - ls->jitter_ns) / 16;
+  }
+  ls->last_ns = ns;
+
+  b = ns / LAT_BUCKET_NS;
+  ls->hist[b < LAT_NBUCKETS ? b : LAT_NBUCKETS - 1]++;
+
+  ls->rcvd_from[lp->queue]++;
+  if (lp->seq < ls->max_seq[lp->queue])
+    ls->reordered++;
+  else
+    ls->max_seq[lp->queue] = lp->seq + 1;
+}
+
+
+/*
+  Latency generator for one queue: send probes paced by the TSC at lat_pps
+  and record the ones which come back. Anything else received is counted and
+  dropped.
+*/
+static int lat_main(uint16_t q)
+{
+  struct q_stats *qs = &qstats[q];
+  struct lat_stats *ls = &lstats[q];
+  struct rte_mbuf *bufs[burst];
+  struct rte_mbuf *tx[burst];
+  struct lat_probe *lp;
+  double ns_per_tsc = 1000000000.0 / rte_get_tsc_hz();
+  u_int64_t gap = rte_get_tsc_hz() / lat_pps;
+  u_int64_t next = rte_rdtsc();
+  u_int64_t seq = 0;
+  u_int64_t now;
+  uint16_t nb_rx, nb_tx, n;
+  int x;
+
+  if (gap == 0)
+    gap = 1;
+
+  while (!terminated)
+  {
+    nb_rx = rte_eth_rx_burst(0, q, bufs, burst);
+    if (nb_rx > 0)
+    {
+      now = rte_rdtsc();
+      qs->pkts_rx += nb_rx;
+      for (x = 0; x < nb_rx; x++)
+      {
+        qs->bytes_rx += bufs[x]->pkt_len;
+        if ((lp = lat_probe_find(bufs[x])) != NULL)
+          lat_record(ls, lp, now, ns_per_tsc);
+        rte_pktmbuf_free(bufs[x]);
+      }
+    }
+
+    if (lat_stop_tx)
+      continue;
+
+    now = rte_rdtsc();
+    for (n = 0; n < burst && next <= now; n++, next += gap)
+      if ((tx[n] = lat_probe_alloc(q, seq++)) == NULL)
+        break;
+
+    if (n > 0)
+    {
+      nb_tx = rte_eth_tx_burst(0, q, tx, n);
+      qs->pkts_tx += nb_tx;
+      qs->missed_tx += n - nb_tx;
+      while (nb_tx < n)
+        rte_pktmbuf_free(tx[nb_tx++]);
+    }
+
+    if (now > next + rte_get_tsc_hz())      // fell a second behind (stall); don't burst to catch up
+      next = now;
+  }
+
+  return 0;
+}
+
+
+/*
+  Latency (ns) below which pct percent of the count fall, from the histogram.
+  The last bucket is open ended so max is used for it.
+*/
+static u_int64_t lat_pct(u_int64_t *hist, u_int64_t count, double pct, u_int64_t max_ns)
+{
+  u_int64_t target;
+  u_int64_t cum = 0;
+  int b;
+
+  if (count == 0)
+    return 0;
+
+  target = (u_int64_t) ((count * pct) / 100.0 + 0.5);
+  if (target == 0)
+    target = 1;
+
+  for (b = 0; b < LAT_NBUCKETS - 1; b++)
+  {
+    cum += hist[b];
+    if (cum >= target)
+      return (u_int64_t) (b + 1) * LAT_BUCKET_NS;
+  }
+
+  return max_ns;
+}
+
+
+/*
+  Report the latency run: per queue sent/lost (by sending queue) and latency
+  (by receiving queue), then the totals. Written to the log and, if -j was
+  given, as json for regression tracking.
+*/
+static void lat_report(void)
+{
+  static u_int64_t thist[LAT_NBUCKETS];
+  struct lat_stats *ls;
+  u_int64_t rcvd[MAX_QUEUES];
+  u_int64_t tsent = 0, trcvd = 0, tcount = 0, tsum = 0, tmin = UINT64_MAX, tmax = 0, treorder = 0;
+  double tjitter = 0;
+  FILE *jf = NULL;
+  int q, r, b;
+
+  memset(rcvd, 0, sizeof(rcvd));
+  memset(thist, 0, sizeof(thist));
+  for (r = 0; r < nb_queues; r++)
+  {
+    ls = &lstats[r];
+    for (q = 0; q < nb_queues; q++)
+      rcvd[q] += ls->rcvd_from[q];
+    for (b = 0; b < LAT_NBUCKETS; b++)
+      thist[b] += ls->hist[b];
+
+    tcount += ls->count;
+    tsum += ls->sum_ns;
+    treorder += ls->reordered;
+    tjitter += ls->jitter_ns * ls->count;
+    if (ls->count > 0 && ls->min_ns < tmin)
+      tmin = ls->min_ns;
+    if (ls->max_ns > tmax)
+      tmax = ls->max_ns;
+  }
+  if (tcount == 0)
+    tmin = 0;
+
+  if (json_file != NULL)
+  {
+    if (strcmp(json_file, "-") == 0)
+      jf = stdout;
+    else if ((jf = fopen(json_file, "w")) == NULL)
+      traceLog(TRACE_ERROR, "unable to open json file %s: %s\n", json_file, strerror(errno));
+  }
+
+  if (jf)
+    fprintf(jf, "{\n  \"mode\": \"latency\",\n  \"pps_per_queue\": %lu,\n  \"frame_len\": %lu,\n  \"bucket_ns\": %d,\n  \"queues\": [\n",
+      lat_pps, (unsigned long) LAT_PKT_LEN + 4, LAT_BUCKET_NS);
+
+  for (q = 0; q < nb_queues; q++)
+  {
+    u_int64_t sent = qstats[q].pkts_tx;
+    u_int64_t lost = sent > rcvd[q] ? sent - rcvd[q] : 0;
+
+    ls = &lstats[q];
+    tsent += sent;
+    trcvd += rcvd[q];
+
+    traceLog(TRACE_NORMAL, "queue %2d: sent %lu lost %lu (%.4f%%) | rx %lu min %lu avg %lu p50 %lu p99 %lu p99.9 %lu max %lu jitter %.0f ns, reordered %lu\n",
+      q, sent, lost, sent ? (lost * 100.0) / sent : 0.0, ls->count, ls->count ? ls->min_ns : 0, ls->count ? ls->sum_ns / ls->count : 0,
+      lat_pct(ls->hist, ls->count, 50, ls->max_ns), lat_pct(ls->hist, ls->count, 99, ls->max_ns), lat_pct(ls->hist, ls->count, 99.9, ls->max_ns),
+      ls->max_ns, ls->jitter_ns, ls->reordered);
+
+    if (jf)
+      fprintf(jf, "    { \"queue\": %d, \"sent\": %lu, \"received\": %lu, \"lost\": %lu, \"loss_pct\": %.6f, "
+        "\"rx_probes\": %lu, \"min_ns\": %lu, \"avg_ns\": %lu, \"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu, "
+        "\"jitter_ns\": %.1f, \"reordered\": %lu }%s\n",
+        q, sent, rcvd[q], lost, sent ? (lost * 100.0) / sent : 0.0,
+        ls->count, ls->count ? ls->min_ns : 0, ls->count ? ls->sum_ns / ls->count : 0,
+        lat_pct(ls->hist, ls->count, 50, ls->max_ns), lat_pct(ls->hist, ls->count, 99, ls->max_ns), lat_pct(ls->hist, ls->count, 99.9, ls->max_ns),
+        ls->max_ns, ls->jitter_ns, ls->reordered, q < nb_queues - 1 ? "," : "");
+  }
+
+  tjitter = tcount ? tjitter / tcount : 0;
+  traceLog(TRACE_NORMAL, "total:    sent %lu lost %lu | rx %lu min %lu avg %lu p50 %lu p99 %lu p99.9 %lu max %lu jitter %.0f ns, reordered %lu\n",
+    tsent, tsent > trcvd ? tsent - trcvd : 0, tcount, tmin, tcount ? tsum / tcount : 0,
+    lat_pct(thist, tcount, 50, tmax), lat_pct(thist, tcount, 99, tmax), lat_pct(thist, tcount, 99.9, tmax), tmax, tjitter, treorder);
+
+  if (jf)
+  {
+    fprintf(jf, "  ],\n  \"total\": { \"sent\": %lu, \"received\": %lu, \"lost\": %lu, \"loss_pct\": %.6f, "
+      "\"min_ns\": %lu, \"avg_ns\": %lu, \"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu, \"jitter_ns\": %.1f, \"reordered\": %lu }\n}\n",
+      tsent, trcvd, tsent > trcvd ? tsent - trcvd : 0, tsent ? ((tsent > trcvd ? tsent - trcvd : 0) * 100.0) / tsent : 0.0,
+      tmin, tcount ? tsum / tcount : 0, lat_pct(thist, tcount, 50, tmax), lat_pct(thist, tcount, 99, tmax), lat_pct(thist, tcount, 99.9, tmax),
+      tmax, tjitter, treorder);
+
+    if (jf != stdout)
+      fclose(jf);
+  }
+}
+
+
+/*
+  Parse the generator rates: <mbps>[@<tc>][,...], one per queue. Returns the
+  number parsed or -1 on error.
+*/
+static int gen_parse_rates(char *spec)
+{
+  char *tok, *save = NULL, *at;
+  int n = 0;
+
+  for (tok = strtok_r(spec, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+  {
+    if (n >= MAX_QUEUES)
+      return -1;
+
+    gen_q[n].mbps = strtod(tok, NULL);
+    gen_q[n].tc = -1;
+    if ((at = strchr(tok, '@')) != NULL)
+      gen_q[n].tc = atoi(at + 1);
+
+    if (gen_q[n].mbps <= 0 || gen_q[n].tc > 7)
+      return -1;
+    n++;
+  }
+
+  return n;
+}
+
+
+/*
+  Parse the size mix: <len>[:<weight>][,...]. Returns the number of sizes or
+  -1 on error.
+*/
+static int gen_parse_sizes(char *spec)
+{
+  char *tok, *save = NULL, *colon;
+  int n = 0;
+  int total = 0;
+
+  for (tok = strtok_r(spec, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+  {
+    if (n >= GEN_MAX_SIZES)
+      return -1;
+
+    gen_sizes[n] = atoi(tok);
+    gen_weights[n] = 1;
+    if ((colon = strchr(tok, ':')) != NULL)
+      gen_weights[n] = atoi(colon + 1);
+
+    if (gen_sizes[n] < GEN_MIN_LEN || gen_sizes[n] > GEN_MAX_LEN || gen_weights[n] < 1)
+      return -1;
+    total += gen_weights[n];
+    n++;
+  }
+
+  return (n > 0 && total <= GEN_MIX_SLOTS) ? n : -1;
+}
+
+
+/*
+  Build the size mix (smooth weighted round robin so the sizes are interleaved
+  rather than sent in runs) and the frame templates for each queue and size.
+*/
+static void gen_init(void)
+{
+  int cur[GEN_MAX_SIZES];
+  int total = 0;
+  int best;
+  int q, i;
+  struct gen_q *g;
+
+  memset(cur, 0, sizeof(cur));
+  for (i = 0; i < gen_nsizes; i++)
+    total += gen_weights[i];
+
+  for (gen_nmix = 0; gen_nmix < total; gen_nmix++)
+  {
+    best = 0;
+    for (i = 0; i < gen_nsizes; i++)
+    {
+      cur[i] += gen_weights[i];
+      if (cur[i] > cur[best])
+        best = i;
+    }
+    cur[best] -= total;
+    gen_mix[gen_nmix] = best;
+  }
+
+  for (q = 0; q < nb_queues; q++)
+  {
+    g = &gen_q[q < gen_nrates ? q : gen_nrates - 1];
+    for (i = 0; i < gen_nsizes; i++)
+    {
+      if ((gen_tmpl[q][i] = rte_zmalloc("gen_tmpl", gen_sizes[i], RTE_CACHE_LINE_SIZE)) == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate generator templates\n");
+      build_udp_frame(gen_tmpl[q][i], gen_sizes[i], q, g->tc >= 0 ? (g->tc << 13) | (gen_vid & 0xfff) : -1);
+    }
+  }
+}
+
+
+/*
+  Generator for one queue: frames from the size mix are copied from the
+  templates and paced by the TSC so that the wire rate is the one requested.
+  Frames the NIC won't take (ring full because of a rate limit or the link)
+  are counted as missed and dropped, so the accepted rate is what the VF was
+  allowed to send. Anything received is counted and dropped.
+*/
+static int gen_main(uint16_t q)
+{
+  struct q_stats *qs = &qstats[q];
+  struct gen_q *g = &gen_q[q < gen_nrates ? q : gen_nrates - 1];
+  struct rte_mbuf *bufs[burst];
+  struct rte_mbuf *tx[burst];
+  uint8_t sidx[burst];
+  double tsc_per_byte = (rte_get_tsc_hz() * 8.0) / (g->mbps * 1000000.0);
+  double next = rte_rdtsc();
+  u_int64_t now;
+  u_int64_t wire;
+  uint16_t nb_rx, nb_tx, n, len;
+  int mi = (q * 7) % gen_nmix;          // queues start at different points in the mix
+  int x;
+
+  while (!terminated)
+  {
+    nb_rx = rte_eth_rx_burst(0, q, bufs, burst);
+    if (nb_rx > 0)
+    {
+      qs->pkts_rx += nb_rx;
+      for (x = 0; x < nb_rx; x++)
+      {
+        qs->bytes_rx += bufs[x]->pkt_len;
+        rte_pktmbuf_free(bufs[x]);
+      }
+    }
+
+    now = rte_rdtsc();
+    for (n = 0; n < burst && next <= now; n++)
+    {
+      sidx[n] = gen_mix[mi];
+      next += (gen_sizes[sidx[n]] + GEN_WIRE_OVERHEAD) * tsc_per_byte;
+      if (++mi >= gen_nmix)
+        mi = 0;
+    }
+
+    if (n == 0)
+      continue;
+
+    if (rte_pktmbuf_alloc_bulk(pkt_pool, tx, n) != 0)
+    {
+      qs->missed_tx += n;
+      continue;
+    }
+
+    for (x = 0; x < n; x++)
+    {
+      len = gen_sizes[sidx[x]];
+      rte_memcpy(rte_pktmbuf_mtod(tx[x], void *), gen_tmpl[q][sidx[x]], len);
+      tx[x]->data_len = len;
+      tx[x]->pkt_len = len;
+    }
+
+    nb_tx = rte_eth_tx_burst(0, q, tx, n);
+    wire = 0;
+    for (x = 0; x < nb_tx; x++)
+      wire += gen_sizes[sidx[x]] + GEN_WIRE_OVERHEAD;
+
+    qs->pkts_tx += nb_tx;
+    qs->bytes_tx += wire;
+    qs->missed_tx += n - nb_tx;
+    while (nb_tx < n)
+      rte_pktmbuf_free(tx[nb_tx++]);
+
+    if (now > next + rte_get_tsc_hz())    // fell a second behind (stall); don't burst to catch up
+      next = now;
+  }
+
+  return 0;
+}
+
+
+/*
+  Report requested versus achieved (accepted by the NIC) wire rate for each
+  queue and each traffic class over the whole run. Written to the log and,
+  if -j was given, as json.
+*/
+static void gen_report(void)
+{
+  double req[9], got[9];            // by tc; index 8 is untagged
+  u_int64_t pkts[9], missed[9];
+  struct timeval now;
+  struct gen_q *g;
+  double secs;
+  double mbps;
+  FILE *jf = NULL;
+  int q, t, first;
+
+  gettimeofday(&now, NULL);
+  if ((secs = timeDelta(&now, &st.startTime) / 1000) <= 0)
+    secs = 1;
+
+  memset(req, 0, sizeof(req));
+  memset(got, 0, sizeof(got));
+  memset(pkts, 0, sizeof(pkts));
+  memset(missed, 0, sizeof(missed));
+
+  if (json_file != NULL)
+  {
+    if (strcmp(json_file, "-") == 0)
+      jf = stdout;
+    else if ((jf = fopen(json_file, "w")) == NULL)
+      traceLog(TRACE_ERROR, "unable to open json file %s: %s\n", json_file, strerror(errno));
+  }
+
+  if (jf)
+    fprintf(jf, "{\n  \"mode\": \"generator\",\n  \"seconds\": %.3f,\n  \"queues\": [\n", secs);
+
+  for (q = 0; q < nb_queues; q++)
+  {
+    g = &gen_q[q < gen_nrates ? q : gen_nrates - 1];
+    t = g->tc >= 0 ? g->tc : 8;
+    mbps = (qstats[q].bytes_tx * 8) / (secs * 1000000);
+
+    req[t] += g->mbps;
+    got[t] += mbps;
+    pkts[t] += qstats[q].pkts_tx;
+    missed[t] += qstats[q].missed_tx;
+
+    traceLog(TRACE_NORMAL, "queue %2d tc %2d: requested %9.1f Mbps achieved %9.1f Mbps (%6.2f%%) pkts %lu missed %lu\n",
+      q, g->tc, g->mbps, mbps, (mbps * 100) / g->mbps, qstats[q].pkts_tx, qstats[q].missed_tx);
+
+    if (jf)
+      fprintf(jf, "    { \"queue\": %d, \"tc\": %d, \"requested_mbps\": %.3f, \"achieved_mbps\": %.3f, \"achieved_pct\": %.3f, \"pkts\": %lu, \"missed\": %lu }%s\n",
+        q, g->tc, g->mbps, mbps, (mbps * 100) / g->mbps, qstats[q].pkts_tx, qstats[q].missed_tx, q < nb_queues - 1 ? "," : "");
+  }
+
+  if (jf)
+    fprintf(jf, "  ],\n  \"tcs\": [\n");
+
+  for (t = 0, first = 1; t < 9; t++)
+  {
+    if (req[t] <= 0)
+      continue;
+
+    traceLog(TRACE_NORMAL, "tc %s%d: requested %9.1f Mbps achieved %9.1f Mbps (%6.2f%%) pkts %lu missed %lu\n",
+      t == 8 ? "untagged " : "", t == 8 ? -1 : t, req[t], got[t], (got[t] * 100) / req[t], pkts[t], missed[t]);
+
+    if (jf)
+    {
+      fprintf(jf, "%s    { \"tc\": %d, \"requested_mbps\": %.3f, \"achieved_mbps\": %.3f, \"achieved_pct\": %.3f, \"pkts\": %lu, \"missed\": %lu }",
+        first ? "" : ",\n", t == 8 ? -1 : t, req[t], got[t], (got[t] * 100) / req[t], pkts[t], missed[t]);
+      first = 0;
+    }
+  }
+
+  if (jf)
+  {
+    fprintf(jf, "\n  ]\n}\n");
+    if (jf != stdout)
+      fclose(jf);
+  }
+}
+
+
+/*
+  Runs on the master lcore while the queue lcores poll: once a second the
+  per queue counters are summed, rates printed, and the totals copied to the
+  shared memzone for anything watching from outside.
+*/
+static void stats_loop(void)
+{
+  struct q_stats last[MAX_QUEUES];
+  struct timeval now, before;
+  u_int64_t prx, pbytes, ptx, pmissed, idle, busy;
+  double secs;
+  int q;
+
+  struct timeval start;
+  u_int64_t tx_bytes[MAX_QUEUES];
+
+  memset(tx_bytes, 0, sizeof(tx_bytes));
+  memset(last, 0, sizeof(last));
+  gettimeofday(&before, NULL);
+  start = before;
+
+  while (!terminated)
+  {
+    sleep(1);
+    gettimeofday(&now, NULL);
+
+    if (duration > 0 && timeDelta(&now, &start) >= duration * 1000.0)
+    {
+      lat_stop_tx = 1;                  // let the probes in flight come back before stopping
+      usleep(LAT_DRAIN_US);
+      terminated = 1;
+      break;
+    }
+
+    secs = timeDelta(&now, &before) / 1000;
+    before = now;
+    if (secs <= 0)
+      continue;
+
+    prx = pbytes = ptx = pmissed = idle = busy = 0;
+    for (q = 0; q < nb_queues; q++)
+    {
+      struct q_stats cur = qstats[q];
+
+      if (nb_queues > 1)
+        traceLog(TRACE_INFO, "queue %2d: rx %10.0f pps %9.1f Mbps, tx %10.0f pps, missed %lu\n", q,
+          (cur.pkts_rx - last[q].pkts_rx) / secs, ((cur.bytes_rx - last[q].bytes_rx) * 8) / (secs * 1000000),
+          (cur.pkts_tx - last[q].pkts_tx) / secs, cur.missed_tx - last[q].missed_tx);
+
+      prx += cur.pkts_rx - last[q].pkts_rx;
+      pbytes += cur.bytes_rx - last[q].bytes_rx;
+      ptx += cur.pkts_tx - last[q].pkts_tx;
+      pmissed += cur.missed_tx - last[q].missed_tx;
+      idle += cur.idle_loops;
+      busy += cur.busy_loops;
+      last[q] = cur;
+    }
+
+    st.pcount += prx;
+    st.bcount += pbytes;
+    ifrate_stats->port_stats[0].pkt_stats.pkts_rx = st.pcount;
+    ifrate_stats->port_stats[0].pkt_stats.bytes_rx = st.bcount;
+    ifrate_stats->port_stats[0].pkt_stats.pkts_tx += ptx;
+    ifrate_stats->port_stats[0].pkt_stats.missed_tx += pmissed;
+    ifrate_stats->idle_loops = idle;
+    ifrate_stats->busy_loops = busy;
+
+    if (gen_nrates > 0)
+    {
+      double tc_mbps[9];
+      int t;
+
+      memset(tc_mbps, 0, sizeof(tc_mbps));
+      for (q = 0; q < nb_queues; q++)
+      {
+        t = gen_q[q < gen_nrates ? q : gen_nrates - 1].tc;
+        tc_mbps[t >= 0 ? t : 8] += ((qstats[q].bytes_tx - tx_bytes[q]) * 8) / (secs * 1000000);
+        tx_bytes[q] = qstats[q].bytes_tx;
+      }
+      for (t = 0; t < 9; t++)
+        if (tc_mbps[t] > 0)
+          traceLog(TRACE_INFO, "tc %d: tx %9.1f Mbps\n", t == 8 ? -1 : t, tc_mbps[t]);
+    }
+
+    traceLog(TRACE_NORMAL, "total: rx %10.0f pps %9.1f Mbps, tx %10.0f pps, missed %lu\n",
+      prx / secs, (pbytes * 8) / (secs * 1000000), ptx / secs, pmissed);
+  }
+}
+
+
+/*
+  Start one lcore per queue and run the stats loop on the master. With a
+  single queue and a single lcore the queue is polled on the master (no
+  periodic stats) as it always was.
+*/
 void runIfrate(uint8_t port, unsigned nb_ports, int _mtu, unsigned long cmask)
 { 
+  unsigned lcore;
+  int q;
+
   terminated = 0;
  
   st.bcount = 0;
   st.pcount = 0;
   st.pcount_before = 0;
+  memset(qstats, 0, sizeof(qstats));
 
-  traceLog(TRACE_NORMAL, "mtu %d, cmask %u\n", _mtu, cmask);
+  traceLog(TRACE_NORMAL, "mtu %d, cmask %u, queues %d\n", _mtu, cmask, nb_queues);
 
   for (port = 0; port < nb_ports; port++)
   {
@@ -558,79 +1355,66 @@ void runIfrate(uint8_t port, unsigned nb_ports, int _mtu, unsigned long cmask)
     ifrate_stats->port_stats[port].core_id = rte_lcore_id();
   }     
 
-	printf("\nCore %u forwarding packets. [Ctrl+C to quit]\n", rte_lcore_id());
-
-
   memset(itvl, 0, sizeof(struct itvl_stats) * 2);
 	gettimeofday(&itvl[0].tv, NULL);
 	gettimeofday(&itvl[1].tv, NULL);
   itvl_idx = TOGGLE(0);
 
   restart = 0;
-
-  
-  //rte_eal_alarm_set(1000 * 1000, print_periodic_stats, (void *)1);
- 
-  //record start time here
   gettimeofday(&st.startTime, NULL);
-  
-  
-  while(!terminated)
-	{
-		for (port = 0; port < nb_ports; port++) 
+
+  if (lat_pps > 0)
+  {
+    if ((lstats = rte_zmalloc("lat_stats", sizeof(*lstats) * nb_queues, RTE_CACHE_LINE_SIZE)) == NULL)
+      rte_exit(EXIT_FAILURE, "Cannot allocate latency stats\n");
+    for (q = 0; q < nb_queues; q++)
+      lstats[q].min_ns = UINT64_MAX;
+  }
+
+  if (gen_nrates > 0)
+    gen_init();
+
+  if (rte_lcore_count() == 1 && nb_queues == 1 && lat_pps == 0 && gen_nrates == 0)
+  {
+    printf("\nCore %u forwarding packets. [Ctrl+C to quit]\n", rte_lcore_id());
+    lcore_main((void *) 0);
+  }
+  else
+  {
+    if ((int) rte_lcore_count() < nb_queues + 1)
+      rte_exit(EXIT_FAILURE, "%d queues need %d lcores (one per queue and one for stats); the core mask gives %u\n",
+        nb_queues, nb_queues + 1, rte_lcore_count());
+
+    q = 0;
+    RTE_LCORE_FOREACH_SLAVE(lcore)
     {
-			// Get burst of RX packets, from first port of pair.
-			struct rte_mbuf *bufs[burst];
-      uint16_t nb_rx = rte_eth_rx_burst(port, 0, bufs, burst);
-			if (unlikely(nb_rx == 0))
-      {
-        ++ifrate_stats->idle_loops;
-				continue;
-      }
-      
-      ++ifrate_stats->busy_loops;
+      if (q >= nb_queues)
+        break;
+      rte_eal_remote_launch(lcore_main, (void *) (uintptr_t) q, lcore);
+      q++;
+    }
 
-      t_begin = rte_get_tsc_cycles();
-      
-      // loop here for a while
-     //AZ if(ifrate_stats->waist_cycles > 0)
-     //AZ   waist_time(ifrate_stats->waist_cycles);
-      
-     // waist_cycles = rte_get_tsc_cycles() - t_begin;
-      
-      ifrate_stats->port_stats[port].pkt_stats.pkts_rx += nb_rx;
-      
-      int x;
-      for (x = 0; x < nb_rx; x++)
-      {
-        gotpacket(bufs[x], port);
+    printf("\n%d lcores forwarding packets, stats on core %u. [Ctrl+C to quit]\n", nb_queues, rte_lcore_id());
+    stats_loop();
+    rte_eal_mp_wait_lcore();
+  }
 
-        //ifrate_stats->port_stats[port].pkt_stats.bytes_rx += bufs[x]->pkt_len + 8;
-        //ifrate_stats->port_stats[port ^ 1].pkt_stats.bytes_tx += bufs[x]->pkt_len + 8;
-      }
-      
-      uint16_t nb_tx = 0;
-      
-      if (transmit == 1)
-        nb_tx = rte_eth_tx_burst(port, 0, bufs, nb_rx);
-      
-      
-      //printf("N = %d\n", nb_tx);
+  st.pcount = st.bcount = 0;
+  for (q = 0; q < nb_queues; q++)
+  {
+    st.pcount += qstats[q].pkts_rx;
+    st.bcount += qstats[q].bytes_rx;
+  }
 
-      if (unlikely(nb_tx < nb_rx))
-      {
-        do 
-        {
-          rte_pktmbuf_free(bufs[nb_tx]);
-        } while (++nb_tx < nb_rx);
-      }
-  
+  if (gen_nrates > 0)
+    gen_report();
 
-      t_end = rte_get_tsc_cycles();
-      ifrate_stats->t_usefull += (t_end - t_begin);
-		}
-    //uint64_t t1 = RDTSC();   
-	}
+  if (lat_pps > 0)
+  {
+    lat_report();
+    rte_free(lstats);
+    lstats = NULL;
+  }
 }
 
 
@@ -663,13 +1447,63 @@ int main(int argc, char **argv)
 
 
   // Parse command line options
-  while ( (opt = getopt(argc, argv, "htkSCiv:c:m:l:s:k:y:b:")) != -1)
+  while ( (opt = getopt(argc, argv, "htkSCiPRv:c:m:l:s:k:y:b:q:L:d:j:g:z:V:")) != -1)
   {
     switch (opt)
     {
 
     case 'c':
-      cpu_mask = atoi(optarg);
+      cpu_mask = strtoul(optarg, NULL, 0);
+      break;
+
+    case 'q':
+      nb_queues = atoi(optarg);
+      if (nb_queues < 1 || nb_queues > MAX_QUEUES)
+      {
+        printf("queues must be 1 - %d\n", MAX_QUEUES);
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 'P':
+      print_ips = 1;
+      break;
+
+    case 'L':
+      lat_pps = strtoull(optarg, NULL, 0);
+      break;
+
+    case 'R':
+      transmit = 1;           // reflector: everything goes back with the macs rewritten; payload untouched
+      keep_mac = 0;
+      break;
+
+    case 'd':
+      duration = atoi(optarg);
+      break;
+
+    case 'j':
+      json_file = strdup(optarg);
+      break;
+
+    case 'g':
+      if ((gen_nrates = gen_parse_rates(optarg)) <= 0)
+      {
+        printf("bad generator rates (max %d): %s\n", MAX_QUEUES, optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 'z':
+      if ((gen_nsizes = gen_parse_sizes(optarg)) <= 0)
+      {
+        printf("bad size mix (lengths %d - %d, total weight <= %d): %s\n", GEN_MIN_LEN, GEN_MAX_LEN, GEN_MIX_SLOTS, optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 'V':
+      gen_vid = atoi(optarg);
       break;
       
     case 'b':
@@ -733,6 +1567,15 @@ int main(int argc, char **argv)
 
 
 
+  if (gen_nrates > 0 && lat_pps > 0)
+  {
+    printf("-g and -L can't be used together\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (gen_nrates > nb_queues)
+    nb_queues = gen_nrates;           // one queue for each rate unless more were asked for
+
   argc -= optind;
   argv += optind;
   optind = 0;
@@ -836,7 +1679,7 @@ int main(int argc, char **argv)
   ifrate_stats->transmit = transmit;
 
 	// Creates a new mempool in memory to hold the mbufs.
-	mbuf_pool = rte_pktmbuf_pool_create(pciid_l, NUM_MBUFS * nb_ports,
+	mbuf_pool = rte_pktmbuf_pool_create(pciid_l, NUM_MBUFS * nb_ports * nb_queues,
                       MBUF_CACHE_SIZE,
                       0, 
                       RTE_MBUF_DEFAULT_BUF_SIZE,
@@ -844,6 +1687,7 @@ int main(int argc, char **argv)
 
 	if (mbuf_pool == NULL)
 		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+  pkt_pool = mbuf_pool;
 
 	/* Initialize all ports. */
   u_int16_t portid;
@@ -869,8 +1713,10 @@ int main(int argc, char **argv)
 			addr.addr_bytes[2], addr.addr_bytes[3],
 			addr.addr_bytes[4], addr.addr_bytes[5]);
 
+  mac_init(&addr);
+
 
-  printf("Driver Name: %s, Index %d, Pkts rx: %lu, ", dev_info.driver_name, dev_info.if_index, st.pcount);
+  printf("Driver Name: %s, Index %d, ", dev_info.driver_name, dev_info.if_index);
   
   printf("PCI: %04X:%02X:%02X.%01X, Max VF's: %d, Numa: %d\n\n", dev_info.pci_dev->addr.domain, dev_info.pci_dev->addr.bus , dev_info.pci_dev->addr.devid , dev_info.pci_dev->addr.function, dev_info.max_vfs, dev_info.pci_dev->numa_node);
 
@@ -903,8 +1749,15 @@ int main(int argc, char **argv)
   runIfrate(2, nb_ports, mtu, cpu_mask);
  
   gettimeofday(&st.endTime, NULL);
-  traceLog(TRACE_NORMAL, "Duration %.f sec\n", timeDelta(&st.endTime, &st.startTime));
-  traceLog(TRACE_NORMAL, "Total packets: %d, Total Bytes: %d\n", st.pcount, st.bcount);
+
+  for (portid = 0; portid < nb_ports; portid++)
+  {
+    rte_eth_dev_stop(portid);
+    rte_eth_dev_close(portid);
+  }
+
+  traceLog(TRACE_NORMAL, "Duration %.f sec\n", timeDelta(&st.endTime, &st.startTime) / 1000);
+  traceLog(TRACE_NORMAL, "Total packets: %lu, Total Bytes: %lu\n", st.pcount, st.bcount);
 
   traceLog(TRACE_NORMAL, "ifrate exit\n");
 
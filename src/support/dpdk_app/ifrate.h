@@ -90,6 +90,8 @@
 #include <rte_mempool.h>
 #include <rte_mbuf.h>
 #include <rte_malloc.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
 
 
 
@@ -113,10 +115,13 @@
 
 #define US_PER_MS 1000
 
-#define RX_RING_SIZE 128
-#define TX_RING_SIZE 128
+#define RX_RING_SIZE 1024
+#define TX_RING_SIZE 1024
 
-#define NUM_MBUFS 8191
+#define NUM_MBUFS 8191          // per queue
+
+#define MAX_QUEUES 16           // rx/tx queue pairs; one lcore polls each
+#define PREFETCH_OFFSET 3       // packets ahead of the one being worked on whose header is prefetched
 
 #define MBUF_SIZE (1600 + sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM)
 #define MBUF_CACHE_SIZE 250
@@ -143,7 +148,7 @@ unsigned int itvl_idx = 0;
 WINDOW * mainwin;   // ncurses window
 
 
-int print_ips = 1;
+int print_ips = 0;        // print every packet (debugging only, -P)
 
 
 struct pkt_stats
@@ -156,6 +161,100 @@ struct pkt_stats
 } __rte_cache_aligned;
 
 
+/*
+  Counters for one queue. Each is written only by the lcore which polls the
+  queue, and read by the stats loop on the master lcore; cache aligned so the
+  lcores don't share lines.
+*/
+struct q_stats
+{
+  volatile u_int64_t pkts_rx;
+  volatile u_int64_t bytes_rx;
+  volatile u_int64_t pkts_tx;
+  volatile u_int64_t bytes_tx;        // generator only; wire bytes (frame + GEN_WIRE_OVERHEAD)
+  volatile u_int64_t missed_tx;
+  volatile u_int64_t idle_loops;
+  volatile u_int64_t busy_loops;
+} __rte_cache_aligned;
+
+struct q_stats qstats[MAX_QUEUES];
+
+
+/*
+  Latency mode. The generator (-L) stamps udp probes with the TSC and a per
+  queue sequence number; the reflector (-R) sends them back with the macs
+  rewritten. Latency is kept in LAT_BUCKET_NS buckets up to LAT_NBUCKETS,
+  anything longer goes in the last bucket (max is kept exactly).
+*/
+#define LAT_MAGIC       0x69667274    // "ifrt"
+#define LAT_BUCKET_NS   100
+#define LAT_NBUCKETS    10000         // 1ms of 100ns buckets
+#define LAT_DRAIN_US    200000        // wait for in flight probes after the last is sent
+#define LAT_UDP_PORT    0x4000        // udp ports are this plus the sending queue
+
+struct lat_probe
+{
+  u_int32_t magic;
+  u_int16_t queue;                    // sending queue
+  u_int16_t pad;
+  u_int64_t seq;
+  u_int64_t tsc;
+} __attribute__((packed));
+
+#define LAT_HDR_LEN (sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr))
+#define LAT_PKT_LEN (LAT_HDR_LEN + sizeof(struct lat_probe))
+
+/*
+  Latency stats for one receive queue; written only by the lcore polling the
+  queue. Probes are counted by the queue which sent them (rcvd_from, max_seq)
+  so loss and reordering are per sender regardless of where RSS put them.
+*/
+struct lat_stats
+{
+  u_int64_t count;
+  u_int64_t sum_ns;
+  u_int64_t min_ns;
+  u_int64_t max_ns;
+  u_int64_t last_ns;
+  double    jitter_ns;                // rfc 3550 interarrival jitter estimate
+  u_int64_t reordered;
+  u_int64_t rcvd_from[MAX_QUEUES];
+  u_int64_t max_seq[MAX_QUEUES];      // one more than the highest seq seen from each sender
+  u_int64_t hist[LAT_NBUCKETS];
+} __rte_cache_aligned;
+
+struct lat_stats * lstats;            // one per queue (rte_zmalloc) when in latency mode
+
+
+/*
+  Generator mode (-g). Each queue sends at its own rate (Mbit/s on the wire,
+  so preamble, ifg and crc are counted the way a link or the NIC rate limiter
+  sees them), optionally vlan tagged with the pcp of a traffic class. Frame
+  lengths are taken from the size mix (-z), interleaved by weight.
+*/
+#define GEN_MAX_SIZES     16
+#define GEN_MIX_SLOTS     256
+#define GEN_WIRE_OVERHEAD 24                // crc 4, preamble/sfd 8, ifg 12
+#define GEN_MIN_LEN       60                // frame lengths are without crc
+#define GEN_MAX_LEN       RTE_MBUF_DEFAULT_DATAROOM
+
+struct gen_q
+{
+  double    mbps;                           // requested rate
+  int       tc;                             // traffic class for pcp marking; -1 == untagged
+};
+
+struct gen_q  gen_q[MAX_QUEUES];
+int           gen_nrates = 0;               // number of -g entries; 0 == not generator mode
+u_int16_t     gen_sizes[GEN_MAX_SIZES] = { GEN_MIN_LEN };
+int           gen_weights[GEN_MAX_SIZES] = { 1 };
+int           gen_nsizes = 1;
+u_int8_t      gen_mix[GEN_MIX_SLOTS];       // index into gen_sizes for each slot of the mix
+int           gen_nmix = 0;
+int           gen_vid = 0;                  // vlan id used with the pcp; 0 == priority tagged only
+u_int8_t *    gen_tmpl[MAX_QUEUES][GEN_MAX_SIZES];   // prebuilt frame for each queue and size
+
+
 struct port_s
 {
   char name[5];
@@ -252,13 +351,22 @@ static const struct rte_eth_conf port_conf_default = {
 static const char * main_help =
 	"ifrate\n"
 	"Usage:\n"
-  "  ifrate [options] -d <if-name>\n"
+  "  ifrate [options] -l <pciid of interface>\n"
 	"  Options:\n"
   "\t -c <mask> Processor affinity mask\n"
   "\t -m <mtu>  MTU size\n"
   "\t -y <MAC> \n"
   "\t -l <pciid of interface> \n"
   "\t -t transmit\n"
+  "\t -q <num> number of rx/tx queue pairs, spread by RSS; one lcore each plus one for stats (max 16)\n"
+  "\t -P print every packet (slow; debugging only)\n"
+  "\t -L <pps> latency generator: send <pps> timestamped probes per queue to the -y mac and measure their return\n"
+  "\t -R latency reflector: send everything back (same as -t)\n"
+  "\t -d <sec> stop after sec seconds and report\n"
+  "\t -j <file> write the latency or generator report as json to file (- for stdout)\n"
+  "\t -g <mbps>[@<tc>][,...] generator: one rate per queue (wire Mbit/s) sent to the -y mac, tagged with the tc as pcp when given\n"
+  "\t -z <len>[:<weight>][,...] generator frame length mix, without crc (default 60)\n"
+  "\t -V <vid> vlan id used for pcp marking (default 0, priority tag)\n"
   "\t -k keep original dst mac\n"
   "\t -v <num>  Verbose (if num > 3 foreground) num - verbose level\n"
   "\t -s <num>  syslog facility 0-11 (log_kern - log_ftp) 16-23 (local0-local7) see /usr/include/sys/syslog.h\n"
@@ -268,13 +376,19 @@ static const char * main_help =
 	"\t -h|?  Display this help screen\n";
 
 
-int  				terminated = 0;
+volatile int terminated = 0;
 int  				restart = 0;           
 static int	transmit = 0;
 int         burst = BURST_SIZE;
 int         strip = 0;
 int         change_vlan = 0;
 int         insert_vlan = 0;
+int         nb_queues = 1;
+u_int64_t   lat_pps = 0;            // latency generator probe rate per queue; 0 == not latency mode
+int         duration = 0;           // seconds to run in latency mode; 0 == until interrupted
+char *      json_file = NULL;
+volatile int lat_stop_tx = 0;       // stop sending probes; set ahead of terminated to let probes in flight return
+struct rte_mempool * pkt_pool;
 
 
 static int keep_mac = 0;
@@ -324,6 +438,12 @@ inline void ether_aton_r (const char *asc, struct ether_addr * addr);
 inline uint128_t ntoh128_u(uint128_t * src);
 static double timeDelta (struct timeval * now, struct timeval * before);
 static void runIfrate(uint8_t port, unsigned nb_ports, int _mtu, unsigned long cpu_mask);
+static int lcore_main(void *arg);
+static void stats_loop(void);
+static int lat_main(uint16_t q);
+static void lat_report(void);
+static int gen_main(uint16_t q);
+static void gen_report(void);
 inline void gotpacket(struct rte_mbuf  *mb, int port);
 static void lsi_event_callback(uint8_t port_id, enum rte_eth_event_type type, void *param);
 void print_port_stats(struct rte_eth_stats et_stats);
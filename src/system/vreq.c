@@ -12,6 +12,10 @@
 				invoke this for the generic user commands).
 	Author:		E. Scott Daniels
 	Date:		03 April 2017
+
+	Mods:		18 Oct 2026 - Use the request channel code shared with vreq_load (vreq_chan.c);
+					the response is read until its json is closed rather than to the
+					first empty line.
 */
 
 #include <fcntl.h>
@@ -23,7 +27,7 @@
 #include <errno.h>
 #include <string.h>
 
-#include <vfdlib.h>
+#include "vreq.h"
 
 #define VERSION "v1.0"			// pull from mk file eventually
 
@@ -117,21 +121,6 @@ extern cl_parms_t* crack_args( int argc, char** argv ) {
 }
 
 
-/*
-	Open the VFd request channel.
-*/
-int open_rchannel( char* v_chan ) {
-	int vfifo;
-
-	if( (vfifo = open( v_chan, O_RDWR, 0 )) < 0 ) {
-		fprintf( stderr, "unable to open VFd request channel: %s: %s\n", v_chan, strerror( errno ) );
-		return -1;
-	}
-
-	return vfifo;
-}
-
-
 /*
 	Send a show request to VFd and return good (1) if the caller should wait 
 	for the response on our request channel. V_channel is the file name that
@@ -141,28 +130,26 @@ int do_show( int argc, char** argv, char* v_channel, char* r_channel ) {
 	int	vfifo = -1;						// file des for VFd's fifo where we write
 	int	rc = 0;								// 0 is bad
 	int	log_level = 0;
-	char	buf[2048];
-	char	fmt[1024];
+	char*	what = NULL;
 
 
-	if( (vfifo = open_rchannel( v_channel )) >= 0 ) {
-		snprintf( fmt, sizeof( fmt ), "{ \"action\": \"show\", \"params\": { \"resource\": \"%%s\", \"loglevel\": %d, \"r_fifo\": \"%s\"} }\n", 
-			log_level, r_channel );
+	if( argc < 1 ) {
+		fprintf( stderr, "missing show option\n" );
+		return 0;
+	}
 
+	if( (vfifo = vreq_open_chan( v_channel )) >= 0 ) {
 		switch( *(argv[0]) ) {
 			case 'a':					// all
-				snprintf( buf, sizeof( buf ), fmt, "all" );
-				rc = 1;
+				what = "all";
 				break;
 
 			case 'e':					// extended stats
-				snprintf( buf, sizeof( buf ), fmt, "extended" );
-				rc = 1;
+				what = "extended";
 				break;
 
 			case 'p':					// just pfs
-				snprintf( buf, sizeof( buf ), fmt, "pfs" );
-				rc = 1;
+				what = "pfs";
 				break;
 	
 			default:
@@ -171,8 +158,8 @@ int do_show( int argc, char** argv, char* v_channel, char* r_channel ) {
 		}
 	}
 
-	if( rc ) {									// all is well above -- send it on
-		write( vfifo, buf, strlen( buf ) );
+	if( what != NULL ) {						// all is well above -- send it on
+		rc = vreq_send( vfifo, "show", what, log_level, NULL, r_channel ) == 0;
 	}
 
 	if( vfifo >= 0 ) {
@@ -189,13 +176,10 @@ int do_show( int argc, char** argv, char* v_channel, char* r_channel ) {
 int do_dump( char* v_channel, char* r_channel ) {
 	int	vfifo = -1;						// file des for VFd's fifo where we write
 	int	rc = 0;							// 0 is bad
-	char	buf[2048];
 
 
-	if( (vfifo = open_rchannel( v_channel )) >= 0 ) {
-		snprintf( buf, sizeof( buf ), "{ \"action\": \"dump\", \"params\": { \"resource\": null, \"loglevel\": 0, \"r_fifo\": \"%s\"} }\n", r_channel );
-		write( vfifo, buf, strlen( buf ) );
-		rc = 1;
+	if( (vfifo = vreq_open_chan( v_channel )) >= 0 ) {
+		rc = vreq_send( vfifo, "dump", NULL, 0, NULL, r_channel ) == 0;
 	}
 
 	if( vfifo >= 0 ) {
@@ -211,13 +195,10 @@ int do_dump( char* v_channel, char* r_channel ) {
 int do_ping( char* v_channel, char* r_channel ) {
 	int	vfifo = -1;						// file des for VFd's fifo where we write
 	int	rc = 0;								// 0 is bad
-	char	buf[2048];
 
 
-	if( (vfifo = open_rchannel( v_channel )) >= 0 ) {
-		snprintf( buf, sizeof( buf ), "{ \"action\": \"ping\", \"params\": { \"resource\": null, \"loglevel\": 0, \"r_fifo\": \"%s\"} }\n", r_channel );
-		write( vfifo, buf, strlen( buf ) );
-		rc = 1;
+	if( (vfifo = vreq_open_chan( v_channel )) >= 0 ) {
+		rc = vreq_send( vfifo, "ping", NULL, 0, NULL, r_channel ) == 0;
 	}
 
 	if( vfifo >= 0 ) {
@@ -230,17 +211,16 @@ int do_ping( char* v_channel, char* r_channel ) {
 
 int main( int argc, char** argv ) {
 	cl_parms_t*	parms;
-	void*	resp_fifo;					// fifo where vfd will write it's response
+	int		rfd;						// fifo where vfd will write it's response
+	int		wfd;						// our writer on it so vfd's close isn't seen as end of file
 	char	resp_fname[128];
 	int		ok2read = 0;
 
 	snprintf( resp_fname, sizeof( resp_fname ), "/tmp/PID%d.resp", getpid() );
 
-	if( (resp_fifo = rfifo_create( resp_fname, 0666 )) == NULL ) {
-		fprintf( stderr, "unable to create response channel: %s: %s\n", resp_fname, strerror( errno ) );
+	if( (rfd = vreq_mk_resp( resp_fname, &wfd )) < 0 ) {
 		exit( 1 );
 	}
-	rfifo_detect_close( resp_fifo );		// detect when other side closes the fifo; will give us an empty buffer on the next read
 
 	parms = crack_args( argc, argv );
 
@@ -271,19 +251,19 @@ int main( int argc, char** argv ) {
 	}
 
 	if( ok2read ) {
-		char* rbuf;
-		int		timeout = 100;			// wait 10 seconds for initial response
+		char*	rbuf = NULL;
+		int		rsize = 0;
 
-		while( ((rbuf = rfifo_to_readln( resp_fifo, timeout )) != NULL) && *rbuf ) {		// blocking read until we see an empty line or nil (error)
-			fprintf( stdout, "%s", rbuf );													// buffers should be newline terminated
-			free( rbuf );
-			timeout = 0;																	// full blocking after initial read
+		if( vreq_read_resp( rfd, &rbuf, &rsize, 10 ) > 0 ) {			// wait up to 10 seconds for the complete response
+			fprintf( stdout, "%s", rbuf );
 		}
+		free( rbuf );
 	} else {
 		fprintf( stderr, "internal mishap: not waiting for response; above error messages may help determine the cause of the problem\n" );
 	}
 
-	rfifo_close( resp_fifo );
+	close( wfd );
+	close( rfd );
 	unlink( resp_fname );
 
 	return 0;
@@ -0,0 +1,18 @@
+// :vi noet tw=4 ts=4:
+/*
+	Mnemonic:	vreq.h
+	Abstract:	Request channel functions shared by vreq and vreq_load (vreq_chan.c).
+	Date:		18 October 2026
+*/
+
+#ifndef _VREQ_H
+#define _VREQ_H
+
+#define VREQ_RESP_END	"\" }\n\n"		// VFd closes every response json with this
+
+extern int vreq_open_chan( const char* v_chan );
+extern int vreq_mk_resp( const char* r_fname, int* wfd );
+extern int vreq_send( int vfifo, const char* action, const char* resource, int log_level, const char* req_id, const char* r_fname );
+extern int vreq_read_resp( int rfd, char** rbuf, int* rsize, int timeout );
+
+#endif
@@ -0,0 +1,148 @@
+// :vi noet tw=4 ts=4:
+/*
+	Mnemonic:	vreq_chan.c
+	Abstract:	The request channel code shared by vreq and vreq_load: open VFd's
+				request fifo, create our response fifo, build and send a request,
+				and read a complete response.
+
+				A response is complete when the closing of the json (VREQ_RESP_END)
+				has been read. Show output can contain blank lines, so an empty line
+				is not taken as the end; reading until the json is closed ensures
+				that nothing from one response is left to be read with the next.
+
+				The response fifo is read with poll() rather than the library's
+				polled reads (100ms granularity) so that vreq_load's latencies are
+				real.
+
+	Date:		18 October 2026
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+
+#include "vreq.h"
+
+/*
+	Open the VFd request channel.
+*/
+extern int vreq_open_chan( const char* v_chan ) {
+	int vfifo;
+
+	if( (vfifo = open( v_chan, O_RDWR, 0 )) < 0 ) {
+		fprintf( stderr, "unable to open VFd request channel: %s: %s\n", v_chan, strerror( errno ) );
+		return -1;
+	}
+
+	return vfifo;
+}
+
+/*
+	Create the response fifo and open it for reading. A writer is also opened, and its
+	fd placed in wfd, so that VFd closing its end after each response does not leave
+	us reading end of file. Returns the read fd, or -1 on error.
+*/
+extern int vreq_mk_resp( const char* r_fname, int* wfd ) {
+	int rfd;
+
+	unlink( r_fname );
+	if( mkfifo( r_fname, 0666 ) < 0 || (rfd = open( r_fname, O_RDONLY | O_NONBLOCK, 0 )) < 0 ) {
+		fprintf( stderr, "unable to create response channel: %s: %s\n", r_fname, strerror( errno ) );
+		return -1;
+	}
+
+	*wfd = open( r_fname, O_WRONLY | O_NONBLOCK, 0 );
+	fcntl( rfd, F_SETPIPE_SZ, 1024 * 60 );				// same size VFd uses for its fifo
+
+	return rfd;
+}
+
+/*
+	Build a request and write it on the VFd channel. Resource and req_id may be nil;
+	resource is sent as null, and VFd generates an id when none is given.
+	Returns 0 on success, -1 on error.
+*/
+extern int vreq_send( int vfifo, const char* action, const char* resource, int log_level, const char* req_id, const char* r_fname ) {
+	char	buf[2048];
+	char	rsrc[1024];
+	char	rid[256];
+	int		len;
+
+	if( resource != NULL ) {
+		snprintf( rsrc, sizeof( rsrc ), "\"%s\"", resource );
+	} else {
+		snprintf( rsrc, sizeof( rsrc ), "null" );
+	}
+
+	*rid = 0;
+	if( req_id != NULL ) {
+		snprintf( rid, sizeof( rid ), "\"req_id\": \"%s\", ", req_id );
+	}
+
+	len = snprintf( buf, sizeof( buf ), "{ \"action\": \"%s\", \"params\": { \"resource\": %s, \"loglevel\": %d, %s\"r_fifo\": \"%s\"} }\n",
+		action, rsrc, log_level, rid, r_fname );
+	if( len >= (int) sizeof( buf ) ) {
+		fprintf( stderr, "request is too long: %s %s\n", action, resource != NULL ? resource : "" );
+		return -1;
+	}
+
+	if( write( vfifo, buf, len ) != len ) {
+		fprintf( stderr, "write to VFd request channel failed: %s\n", strerror( errno ) );
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+	Read a complete response. Rbuf points to a buffer of rsize bytes which is
+	grown as needed (both are updated); it may be nil with rsize of 0. Timeout is
+	the number of seconds to wait for data before giving up. Returns the length of
+	the response (the buffer is nil terminated), or -1 on timeout or error.
+*/
+extern int vreq_read_resp( int rfd, char** rbuf, int* rsize, int timeout ) {
+	struct pollfd pfd;
+	int		elen;				// length of the end marker
+	int		len = 0;
+	int		rlen;
+
+	pfd.fd = rfd;
+	pfd.events = POLLIN;
+	elen = strlen( VREQ_RESP_END );
+
+	while( 1 ) {
+		if( *rsize - len < 4096 ) {
+			*rsize = *rsize > 0 ? *rsize * 2 : 64 * 1024;
+			if( (*rbuf = (char *) realloc( *rbuf, sizeof( char ) * *rsize )) == NULL ) {
+				fprintf( stderr, "unable to allocate response buffer\n" );
+				return -1;
+			}
+		}
+
+		if( poll( &pfd, 1, timeout * 1000 ) <= 0 ) {
+			fprintf( stderr, "timeout waiting for response\n" );
+			return -1;
+		}
+
+		if( (rlen = read( rfd, *rbuf + len, *rsize - len - 1 )) < 0 ) {
+			if( errno == EAGAIN || errno == EINTR ) {
+				continue;
+			}
+			fprintf( stderr, "error reading response: %s\n", strerror( errno ) );
+			return -1;
+		}
+		len += rlen;
+		(*rbuf)[len] = 0;
+
+		if( len >= elen && strcmp( *rbuf + len - elen, VREQ_RESP_END ) == 0 ) {
+			return len;
+		}
+	}
+}
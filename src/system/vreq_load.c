@@ -0,0 +1,398 @@
+// :vi noet tw=4 ts=4:
+/*
+	Mnemonic:	vreq_load.c
+	Abstract:	Scripted load generator for VFd. Built on the request channel code
+				it shares with vreq (vreq_chan.c), this reads a script of requests (one per line) and
+				sends them to VFd n times over, waiting for each response before
+				sending the next. The time from write to the end of the response
+				is captured for every request and count, error count, mean and tail
+				latency are written to stdout for each action when finished.
+
+				Script lines have the form:
+					<action> [resource]
+				where action is any action VFd accepts (add, delete, show, ping, dump,
+				etc.) and resource is passed as the resource (the vf config file name
+				for add/delete). Blank lines and lines starting with # are ignored.
+
+				When VFd is started against virtual devices (vdev entries and no_pci
+				in the parm file) this allows end-to-end control plane measurements
+				without any sr-iov hardware.
+
+				Unlike vreq this is NOT intended to be installed suid; privileged
+				requests are allowed and the channel must be writable by the user.
+
+	Date:		18 October 2026
+
+	Mods:		18 Oct 2026 - Share the request channel code with vreq; read each response
+					until its json is closed so that blank lines in show output do not
+					leave bytes to be counted against the next request.
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "vreq.h"
+
+#define VERSION "v1.0"
+
+#define MAX_ACTIONS		32			// max number of different actions tracked
+#define MAX_LINES		1024		// max script lines
+
+typedef struct {
+	int		argc;				// number of unparsed command line positional parms
+	char	**argv;				// first positional parm
+	char*	vfd_channel;		// channel to vfd (fifo file name most likely)
+	int		iterations;			// number of times the script is run
+	int		timeout;			// seconds to wait for any single response
+	int		verbose;			// write responses to stderr
+} cl_parms_t;
+
+/*
+	One line from the script.
+*/
+typedef struct {
+	int		aidx;				// index into the action stats
+	char*	resource;			// resource (may be nil)
+} req_t;
+
+/*
+	Latencies (nsec) captured for one action.
+*/
+typedef struct {
+	char*		action;
+	int			nalloc;
+	int			count;
+	int			errors;
+	uint64_t*	lat;
+	uint64_t	total;
+} act_stats_t;
+
+static act_stats_t	acts[MAX_ACTIONS];
+static int			nacts = 0;
+
+/*
+	Present a usage message.
+*/
+static void usage( void ) {
+	const char *version = VERSION "    build: " __DATE__ " " __TIME__;
+
+	fprintf( stdout, "vreq_load %s\n", version );
+	fprintf( stdout, "vreq_load [-c channel-path] [-n iterations] [-t timeout-sec] [-v] script-file\n" );
+}
+
+/*
+	Get the parm pointed to by pidx unless it's out of range. If oor
+	then we abort and error. pidx is a pointer to the index of
+	the next parameter in argv to use. It must be >=1 and < argc.
+*/
+static char* get_nxt( int argc, char** argv, int* pidx ) {
+	if( *pidx >= argc || *pidx <= 0 || argv[*pidx] == NULL ) {
+		fprintf( stderr, "abort: missing command line data; unable to parse command line\n" );
+		usage( );
+		exit( 1 );
+	}
+
+	(*pidx)++;
+	return argv[(*pidx-1)];
+}
+
+/*
+	Crack the command line args leaving the parms argc/argv info at the positional
+	parms.
+*/
+static cl_parms_t* crack_args( int argc, char** argv ) {
+	cl_parms_t*	parms;
+	int		parg = 1;		// arg being parsed
+	char*	opt;			// next option string to parse
+
+	if( (parms = (cl_parms_t *) malloc( sizeof( cl_parms_t ) )) == NULL ) {
+		fprintf( stderr, "abort: cannot allocate space for parms\n" );
+		exit( 1 );
+	}
+	memset( parms, 0, sizeof( *parms ) );
+	parms->vfd_channel = "/var/lib/vfd/request";		// the standard place
+	parms->iterations = 1;
+	parms->timeout = 10;
+
+	while( parg < argc ) {
+		opt = argv[parg++];						// parg at the next parameter
+		if( *opt != '-' ) {
+			parg--;
+			break;
+		} else {
+			if( strcmp( opt, "--" ) == 0 ) {
+				break;
+			}
+		}
+
+		for( opt++; *opt; opt++ ) {
+			switch( *opt ) {
+				case 'c':							// alternate fifo (channel) that VFd is reading from
+					parms->vfd_channel = get_nxt( argc, argv, &parg );
+					break;
+
+				case 'n':
+					parms->iterations = atoi( get_nxt( argc, argv, &parg ) );
+					break;
+
+				case 't':
+					parms->timeout = atoi( get_nxt( argc, argv, &parg ) );
+					break;
+
+				case 'v':
+					parms->verbose = 1;
+					break;
+
+				case '?':
+					usage();
+					exit( 0 );
+					break;
+
+				default:
+					fprintf( stderr, "unrecognised commandline flag: %c\n", *opt );
+					usage();
+					exit( 1 );
+			}
+		}
+	}
+
+	parms->argc = argc - parg;	// set up positional parameter info
+	if( parg < argc ) {
+		parms->argv = &argv[parg];
+	} else {
+		parms->argv = NULL;
+	}
+
+	return parms;
+}
+
+// ------------------------------------------------------------------------------------------------------
+
+static inline uint64_t now_ns( void ) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/*
+	Map the action name to its stats block, adding one if it's new.
+	Returns -1 if the table is full.
+*/
+static int get_action( char* action ) {
+	int i;
+
+	for( i = 0; i < nacts; i++ ) {
+		if( strcmp( acts[i].action, action ) == 0 ) {
+			return i;
+		}
+	}
+
+	if( nacts >= MAX_ACTIONS ) {
+		return -1;
+	}
+
+	memset( &acts[nacts], 0, sizeof( acts[nacts] ) );
+	acts[nacts].action = strdup( action );
+	return nacts++;
+}
+
+/*
+	Capture the latency for a request.
+*/
+static void add_lat( act_stats_t* as, uint64_t elapsed, int error ) {
+	if( as->count >= as->nalloc ) {
+		as->nalloc = as->nalloc > 0 ? as->nalloc * 2 : 1024;
+		if( (as->lat = (uint64_t *) realloc( as->lat, sizeof( *as->lat ) * as->nalloc )) == NULL ) {
+			fprintf( stderr, "abort: unable to allocate memory for latency capture\n" );
+			exit( 1 );
+		}
+	}
+
+	as->lat[as->count++] = elapsed;
+	as->total += elapsed;
+	if( error ) {
+		as->errors++;
+	}
+}
+
+static int cmp_u64( const void* a, const void* b ) {
+	uint64_t va = *(const uint64_t *) a;
+	uint64_t vb = *(const uint64_t *) b;
+
+	return va < vb ? -1 : (va > vb);
+}
+
+/*
+	Return the pct (e.g. 99.9) percentile from a sorted list.
+*/
+static uint64_t pctl( act_stats_t* as, double pct ) {
+	int i;
+
+	if( as->count <= 0 ) {
+		return 0;
+	}
+
+	i = (int) ((pct / 100.0) * as->count);
+	if( i >= as->count ) {
+		i = as->count - 1;
+	}
+
+	return as->lat[i];
+}
+
+/*
+	Read the script into the request list. Returns the number of requests.
+*/
+static int read_script( char* fname, req_t* reqs, int max ) {
+	FILE*	f;
+	char	buf[1024];
+	char*	action;
+	char*	resource;
+	char*	tok;
+	int		n = 0;
+
+	if( (f = fopen( fname, "r" )) == NULL ) {
+		fprintf( stderr, "unable to open script: %s: %s\n", fname, strerror( errno ) );
+		return 0;
+	}
+
+	while( n < max && fgets( buf, sizeof( buf ), f ) != NULL ) {
+		if( (action = strtok_r( buf, " \t\n", &tok )) == NULL || *action == '#' ) {
+			continue;
+		}
+
+		resource = strtok_r( NULL, " \t\n", &tok );
+		if( (reqs[n].aidx = get_action( action )) < 0 ) {
+			fprintf( stderr, "too many different actions in script; %s ignored\n", action );
+			continue;
+		}
+		reqs[n].resource = resource != NULL ? strdup( resource ) : NULL;
+		n++;
+	}
+
+	fclose( f );
+	return n;
+}
+
+/*
+	Send the request and wait for the response. Latency is captured in the
+	action's stats block. Returns -1 on a hard failure.
+*/
+static int send_req( int vfifo, int rfd, char* r_fname, req_t* req, int seq, cl_parms_t* parms, char** rbuf, int* rsize ) {
+	char		rid[64];
+	uint64_t	start;
+
+	snprintf( rid, sizeof( rid ), "load-%d", seq );
+
+	start = now_ns();
+	if( vreq_send( vfifo, acts[req->aidx].action, req->resource, 0, rid, r_fname ) < 0 ) {
+		return -1;
+	}
+
+	if( vreq_read_resp( rfd, rbuf, rsize, parms->timeout ) < 0 ) {
+		return -1;
+	}
+	add_lat( &acts[req->aidx], now_ns() - start, strstr( *rbuf, "\"ERROR\"" ) != NULL );
+
+	if( parms->verbose ) {
+		fprintf( stderr, "%s", *rbuf );
+	}
+
+	return 0;
+}
+
+/*
+	Write the results to stdout.
+*/
+static void report( uint64_t elapsed ) {
+	act_stats_t* as;
+	int		i;
+	int		total = 0;
+
+	printf( "\n%-10s %8s %6s %10s %10s %10s %10s %10s %10s\n", "action", "count", "errs", "mean(us)", "p50(us)", "p90(us)", "p99(us)", "p99.9(us)", "max(us)" );
+	for( i = 0; i < nacts; i++ ) {
+		as = &acts[i];
+		if( as->count <= 0 ) {
+			continue;
+		}
+
+		total += as->count;
+		qsort( as->lat, as->count, sizeof( *as->lat ), cmp_u64 );
+		printf( "%-10s %8d %6d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			as->action, as->count, as->errors,
+			(double) as->total / as->count / 1000.0,
+			pctl( as, 50.0 ) / 1000.0,
+			pctl( as, 90.0 ) / 1000.0,
+			pctl( as, 99.0 ) / 1000.0,
+			pctl( as, 99.9 ) / 1000.0,
+			as->lat[as->count-1] / 1000.0 );
+	}
+
+	printf( "\n%d requests in %.3fs (%.1f req/sec)\n", total, elapsed / 1000000000.0, elapsed > 0 ? total / (elapsed / 1000000000.0) : 0.0 );
+}
+
+int main( int argc, char** argv ) {
+	cl_parms_t*	parms;
+	req_t		reqs[MAX_LINES];
+	char		resp_fname[128];
+	char*		rbuf = NULL;			// response buffer; grown as needed
+	int			rsize = 0;
+	int			nreqs;
+	int			vfifo;
+	int			rfd;
+	int			wfd;					// dummy writer so that vfd's close doesn't give us eof
+	int			i;
+	int			j;
+	int			seq = 0;
+	int			rc = 0;
+	uint64_t	start;
+
+	parms = crack_args( argc, argv );
+	if( parms == NULL || parms->argc < 1 || parms->iterations <= 0 ) {
+		usage();
+		exit( 1 );
+	}
+
+	if( (nreqs = read_script( parms->argv[0], reqs, MAX_LINES )) <= 0 ) {
+		fprintf( stderr, "no requests found in script: %s\n", parms->argv[0] );
+		exit( 1 );
+	}
+
+	snprintf( resp_fname, sizeof( resp_fname ), "/tmp/PID%d.resp", getpid() );
+	if( (rfd = vreq_mk_resp( resp_fname, &wfd )) < 0 ) {
+		exit( 1 );
+	}
+
+	if( (vfifo = vreq_open_chan( parms->vfd_channel )) < 0 ) {
+		unlink( resp_fname );
+		exit( 1 );
+	}
+
+	fprintf( stderr, "sending %d requests (%d iterations of %d)\n", nreqs * parms->iterations, parms->iterations, nreqs );
+	start = now_ns();
+	for( i = 0; i < parms->iterations && rc == 0; i++ ) {
+		for( j = 0; j < nreqs && rc == 0; j++ ) {
+			rc = send_req( vfifo, rfd, resp_fname, &reqs[j], seq++, parms, &rbuf, &rsize );
+		}
+	}
+
+	report( now_ns() - start );
+
+	close( vfifo );
+	close( wfd );
+	close( rfd );
+	unlink( resp_fname );
+	free( rbuf );
+
+	return rc == 0 ? 0 : 1;
+}
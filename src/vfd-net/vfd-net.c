@@ -50,11 +50,12 @@ void vfd_init(struct net_device *dev);
 static int add_vfd_net(int pf, int vf, char * bdf, int len);
 static int delete_vfd_net(int pf, int vf);
 static void update_vfd_net(void);
+static void send_nl_ack(__u32 seq, struct vfd_nl_stats_hdr *ack);
 
 
 
 struct vfd_priv {
-	struct net_device_stats stats;
+	struct rtnl_link_stats64 stats64;	/* last stats pushed by vfd; served by ndo_get_stats64 */
 	struct pci_dev *pci_dev;
 	int status;
 	struct sk_buff *skb;
@@ -89,18 +90,147 @@ static void delete_all_vfd_devs(void)
 }
 
 
+/*
+ * Set the carrier and flags of a netdev to match the link state vfd sent.
+ */
+static void vfd_set_link(struct net_device *netdev, int up)
+{
+	if (up) {
+		if (netif_carrier_ok(netdev))
+			return;
+
+		netdev->state = __LINK_STATE_PRESENT;
+		netdev->flags |= IFF_UP | IFF_LOWER_UP | IFF_RUNNING; 
+		netif_carrier_on(netdev);
+		netif_tx_wake_all_queues(netdev);
+	} else {
+		netdev->flags &= ~IFF_UP & ~IFF_RUNNING & ~IFF_LOWER_UP;
+		netif_carrier_off(netdev);
+		netif_stop_queue(netdev);
+	}
+}
+
+
+/*
+ * Handle stats pushed by vfd: a header and nrecs records for the PF and VFs
+ * of one port. The records are copied into the cache of each netdev which
+ * ndo_get_stats64 serves from; no request goes back to vfd.
+ */
+static void vfd_stats_push(struct vfd_nl_stats_hdr *hdr, int len)
+{
+	struct vfd_nl_vf_stats *rec;
+	struct net_device *netdev;
+	struct vfd_priv *priv;
+	struct rtnl_link_stats64 *s;
+	__u32 i;
+
+	if (hdr->nrecs > (len - sizeof(*hdr)) / sizeof(*rec)) {
+		pr_warning("vfd-net: short stats message: PF = %u, nrecs = %u, len = %d\n", hdr->port, hdr->nrecs, len);
+		return;
+	}
+
+	rec = (struct vfd_nl_vf_stats *) (hdr + 1);
+	for (i = 0; i < hdr->nrecs; i++, rec++) {
+		if (!is_port_vf_valid(hdr->port, rec->vf) || (netdev = vfd_netdevs[hdr->port][rec->vf]) == NULL)
+			continue;
+
+		priv = netdev_priv(netdev);
+		s = &priv->stats64;
+
+		spin_lock_bh(&priv->lock);
+		s->rx_packets	= rec->stats.rx_packets;
+		s->tx_packets	= rec->stats.tx_packets;
+		s->rx_bytes		= rec->stats.rx_bytes;
+		s->tx_bytes		= rec->stats.tx_bytes;
+		s->rx_errors	= rec->stats.rx_errors;
+		s->tx_errors	= rec->stats.tx_errors;
+		s->rx_dropped	= rec->stats.rx_dropped;
+		s->tx_dropped	= rec->stats.tx_dropped;
+		s->multicast	= rec->stats.multicast;
+		s->rx_missed_errors = rec->stats.rx_missed_errors;
+		spin_unlock_bh(&priv->lock);
+
+		netdev->flags &= ~IFF_BROADCAST & ~IFF_MULTICAST;
+		memcpy(netdev->dev_addr, rec->mac, ETH_ALEN);
+		vfd_set_link(netdev, rec->link_state);
+	}
+}
+
+
+/*
+ * Handle a batch of coalesced add/delete records from vfd, then ack the
+ * batch so that vfd can tell it was applied without having waited on it.
+ */
+static void vfd_dev_batch(struct vfd_nl_stats_hdr *hdr, int len, __u32 seq)
+{
+	struct vfd_nl_dev_rec *rec;
+	struct vfd_nl_stats_hdr ack;
+	__u32 i;
+	int rc;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.req = NL_PF_DEV_ACK;
+	ack.resp = NL_PF_RESP_OK;
+
+	if (hdr->nrecs > (len - sizeof(*hdr)) / sizeof(*rec)) {
+		pr_warning("vfd-net: short device batch: nrecs = %u, len = %d\n", hdr->nrecs, len);
+		ack.resp = NL_PF_RESP_ERR;
+		send_nl_ack(seq, &ack);
+		return;
+	}
+
+	rec = (struct vfd_nl_dev_rec *) (hdr + 1);
+	for (i = 0; i < hdr->nrecs; i++, rec++) {
+		rc = -EINVAL;
+		if (is_port_vf_valid(rec->port, rec->vf)) {
+			switch (rec->req) {
+			case NL_PF_ADD_DEV_RQ:
+				pr_debug("Add device: Port: %d, VF: %d\n", rec->port, rec->vf);
+				rc = add_vfd_net(rec->port, rec->vf, rec->pciaddr, strnlen(rec->pciaddr, sizeof(rec->pciaddr) - 1));
+				break;
+
+			case NL_PF_DEL_DEV_RQ:
+				pr_debug("Delete device: Port: %d, VF: %d\n", rec->port, rec->vf);
+				rc = delete_vfd_net(rec->port, rec->vf);
+				break;
+			}
+		}
+
+		if (rc == 0) {
+			ack.nrecs++;
+		} else {
+			ack.port++;			/* count of failures */
+			pr_warning("vfd-net: device request failed: RQ = %u, PF = %u, VF = %u, rc = %d\n", rec->req, rec->port, rec->vf, rc);
+		}
+	}
+
+	if (ack.port)
+		ack.resp = NL_PF_RESP_ERR;
+	send_nl_ack(seq, &ack);
+}
+
+
 static void vfd_stats_callback(struct cn_msg *msg, struct netlink_skb_parms *nsp)
 {
 	struct vfd_nl_message *vfd_msg;	
-	struct vfd_priv *priv = NULL;
-	spinlock_t *lock;
 	
 	pr_debug("%s: %lu: idx=%x, val=%x, seq=%u, ack=%u, len=%d\n",
 	        __func__, jiffies, msg->id.idx, msg->id.val,
 	        msg->seq, msg->ack, msg->len);			
 	
 	vfd_msg = (struct vfd_nl_message *) msg->data;
-		
+
+	if (msg->len >= sizeof(struct vfd_nl_stats_hdr)) {
+		switch (vfd_msg->req) {
+		case NL_VF_STATS_PUSH:
+			vfd_stats_push((struct vfd_nl_stats_hdr *) msg->data, msg->len);
+			return;
+
+		case NL_PF_DEV_BATCH:
+			vfd_dev_batch((struct vfd_nl_stats_hdr *) msg->data, msg->len, msg->seq);
+			return;
+		}
+	}
 	
 	if(vfd_msg->resp != NL_PF_RESP_OK) {
 		pr_warning("ERROR: PF = %u, VF = %u, RQ = %u, RESP = %u\n", vfd_msg->port, vfd_msg->vf, vfd_msg->req, vfd_msg->resp);
@@ -112,61 +242,6 @@ static void vfd_stats_callback(struct cn_msg *msg, struct netlink_skb_parms *nsp
 	if (is_port_vf_valid(vfd_msg->port, vfd_msg->vf))
 	{
 		switch (vfd_msg->req) {
-		case NL_VF_STATS_RQ:
-		
-			priv = netdev_priv(vfd_netdevs[vfd_msg->port][vfd_msg->vf]);	
-			
-			lock = &priv->lock;
-			spin_lock(lock);
-			
-			if (priv) {
-				pr_debug("PF = %u, VF = %u, STATE %x\n", vfd_msg->port, vfd_msg->vf, vfd_msg->info->link_state);
-
-				priv->stats.rx_packets	= vfd_msg->info->stats->rx_packets;
-				priv->stats.tx_packets	= vfd_msg->info->stats->tx_packets;
-				priv->stats.rx_bytes	= vfd_msg->info->stats->rx_bytes;
-				priv->stats.tx_bytes	= vfd_msg->info->stats->tx_bytes;
-				priv->stats.rx_errors	= vfd_msg->info->stats->rx_errors;
-				priv->stats.tx_errors	= vfd_msg->info->stats->tx_errors;
-				priv->stats.rx_dropped	= vfd_msg->info->stats->rx_dropped;
-				
-				priv->netdev->flags &= ~IFF_BROADCAST & ~IFF_MULTICAST;
-				
-				memcpy(priv->netdev->dev_addr, vfd_msg->info->mac, ETH_ALEN);	
-
-	
-				if (vfd_msg->info->link_state) {
-					priv->netdev->state = __LINK_STATE_PRESENT;
-					priv->netdev->flags |= IFF_UP | IFF_LOWER_UP | IFF_RUNNING; 
-					
-					netif_carrier_on(priv->netdev);
-					netif_tx_wake_all_queues(priv->netdev);
-					
-				} else {
-					priv->netdev->flags &= ~IFF_UP & ~IFF_RUNNING & ~IFF_LOWER_UP;
-					netif_carrier_off(priv->netdev);
-					netif_stop_queue(priv->netdev);
-				}
-				
-				pr_debug("FLAGS = %x, STATE = %x\n", priv->netdev->flags, (uint32_t) priv->netdev->state);
-			}
-			else
-				pr_debug("*priv == NULL PF = %u, VF = %u\n", vfd_msg->port, vfd_msg->vf);
-			
-			spin_unlock(lock);
-			
-			break;
-						
-		case NL_PF_ADD_DEV_RQ:
-			pr_debug("Add device: Port: %d, VF: %d\n", vfd_msg->port, vfd_msg->vf);; 		
-			add_vfd_net(vfd_msg->port, vfd_msg->vf, vfd_msg->pciaddr, PCIADDR_LEN); 			
-			break;
-
-		case NL_PF_DEL_DEV_RQ:
-			pr_debug("Delete device: Port: %d, VF: %d\n", vfd_msg->port, vfd_msg->vf);
-			delete_vfd_net(vfd_msg->port, vfd_msg->vf);	
-			break;	
-			
 		case NL_PF_UPD_DEV_RQ:
 			pr_debug("Update device list: Port: %d, VF: %d\n", vfd_msg->port, vfd_msg->vf);
 			update_vfd_net(); 			
@@ -254,11 +329,28 @@ static void send_nl_request(int port, int vf, uint32_t req)
 }
 
 
-static void send_stats_request(int port, int vf)
+/*
+ * Send an ack (header only) for the message with the given seq.
+ */
+static void send_nl_ack(__u32 seq, struct vfd_nl_stats_hdr *ack)
 {
-	send_nl_request(port, vf, NL_VF_STATS_RQ);
-}
+	struct cn_msg *m;
 
+	m = kzalloc(sizeof(*m) + sizeof(*ack), GFP_ATOMIC);
+	if (m) {
+		memcpy(&m->id, &vfd_cn_id, sizeof(m->id));
+		m->seq = vfd_nl_rq_counter++;
+		m->ack = seq;
+		m->len = sizeof(*ack);
+		memcpy(m + 1, ack, sizeof(*ack));
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,17,0)
+		cn_netlink_send(m, 0, GFP_ATOMIC);
+#else
+		cn_netlink_send(m, 0, 0, GFP_ATOMIC);
+#endif
+		kfree(m);
+	}
+}
 
 static void send_get_dev_list_request(void)
 {
@@ -513,29 +605,25 @@ int vfd_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 }
 
 
-struct net_device_stats *vfd_stats(struct net_device *dev)
+/*
+ * Stats are pushed by vfd on an interval (vfd_stats_push), so this only
+ * returns the cached copy; there is no round trip to vfd.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+struct rtnl_link_stats64 *vfd_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *stats)
+#else
+void vfd_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *stats)
+#endif
 {
 	struct vfd_priv *priv = netdev_priv(dev);
-	int port, vf, fields;
-	struct pci_dev *pdev;
-	
-	//sscanf(dev->name, "vfd%dp%df%d", &bus, &port, &vf);
-	fields = sscanf(dev->name, "vfd_p%df%d", &port, &vf);
-	
-	if(fields == 1)
-		vf = MAX_VF - 1;	// PF
-	
-	pdev = priv->pci_dev;
-	
-	
-	if (pdev)
-		pr_debug("Getting Stats: %s, %d, %d, %s\n", dev->name, port, vf, dev_name(&pdev->dev));
-	else
-		pr_debug("Getting stats: %s, %d, %d, %d\n", dev->name, port, vf, netif_carrier_ok(dev));
-	
-	send_stats_request(port, vf);
 
-	return &priv->stats;
+	spin_lock_bh(&priv->lock);
+	memcpy(stats, &priv->stats64, sizeof(*stats));
+	spin_unlock_bh(&priv->lock);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+	return stats;
+#endif
 }
 
 
@@ -614,7 +702,7 @@ static const struct net_device_ops vfd_netdev_ops = {
 	.ndo_start_xmit      = vfd_tx,
 	.ndo_do_ioctl        = vfd_ioctl,
 	.ndo_set_config      = vfd_config,
-	.ndo_get_stats       = vfd_stats,
+	.ndo_get_stats64     = vfd_get_stats64,
 	.ndo_change_mtu      = vfd_change_mtu,
 	.ndo_tx_timeout      = vfd_tx_timeout
 };
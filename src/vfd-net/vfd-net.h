@@ -24,44 +24,53 @@
 #define NL_PF_ADD_DEV_RQ	0x400
 #define NL_PF_DEL_DEV_RQ	0x800
 #define NL_PF_UPD_DEV_RQ	0x1000
+#define NL_VF_STATS_PUSH	0x2000		/* vfd pushes stats for a PF and its VFs (struct vfd_nl_stats_hdr) */
+#define NL_PF_DEV_BATCH		0x4000		/* vfd sends coalesced add/delete records (struct vfd_nl_dev_rec) */
+#define NL_PF_DEV_ACK		0x8000		/* module acks a device batch; cn_msg ack is the batch seq */
 
 #define MAX_PF	16
 #define MAX_VF	254
 
 #define PCIADDR_LEN	12	
 
+#define VFD_NL_MAX_PAYLOAD	8192	/* max connector payload vfd sends; well under CONNECTOR_MAX_MSG_SIZE */
+
 	
+/*
+	Counters are 64 bit; vfd keeps monotonic 64 bit values for each VF
+	and they must not be truncated on the way to the netdev.
+*/
 struct dev_stats
 {
-	__u32	rx_packets;		/* total packets received	*/
-	__u32	tx_packets;		/* total packets transmitted	*/
-	__u32	rx_bytes;		/* total bytes received 	*/
-	__u32	tx_bytes;		/* total bytes transmitted	*/
-	__u32	rx_errors;		/* bad packets received		*/
-	__u32	tx_errors;		/* packet transmit problems	*/
-	__u32	rx_dropped;		/* no space in linux buffers	*/
-	__u32	tx_dropped;		/* no space available in linux	*/
-	__u32	multicast;		/* multicast packets received	*/
-	__u32	collisions;
+	__u64	rx_packets;		/* total packets received	*/
+	__u64	tx_packets;		/* total packets transmitted	*/
+	__u64	rx_bytes;		/* total bytes received 	*/
+	__u64	tx_bytes;		/* total bytes transmitted	*/
+	__u64	rx_errors;		/* bad packets received		*/
+	__u64	tx_errors;		/* packet transmit problems	*/
+	__u64	rx_dropped;		/* no space in linux buffers	*/
+	__u64	tx_dropped;		/* no space available in linux	*/
+	__u64	multicast;		/* multicast packets received	*/
+	__u64	collisions;
 
 	/* detailed rx_errors: */
-	__u32	rx_length_errors;
-	__u32	rx_over_errors;		/* receiver ring buff overflow	*/
-	__u32	rx_crc_errors;		/* recved pkt with crc error	*/
-	__u32	rx_frame_errors;	/* recv'd frame alignment error */
-	__u32	rx_fifo_errors;		/* recv'r fifo overrun		*/
-	__u32	rx_missed_errors;	/* receiver missed packet	*/
+	__u64	rx_length_errors;
+	__u64	rx_over_errors;		/* receiver ring buff overflow	*/
+	__u64	rx_crc_errors;		/* recved pkt with crc error	*/
+	__u64	rx_frame_errors;	/* recv'd frame alignment error */
+	__u64	rx_fifo_errors;		/* recv'r fifo overrun		*/
+	__u64	rx_missed_errors;	/* receiver missed packet	*/
 
 	/* detailed tx_errors */
-	__u32	tx_aborted_errors;
-	__u32	tx_carrier_errors;
-	__u32	tx_fifo_errors;
-	__u32	tx_heartbeat_errors;
-	__u32	tx_window_errors;
+	__u64	tx_aborted_errors;
+	__u64	tx_carrier_errors;
+	__u64	tx_fifo_errors;
+	__u64	tx_heartbeat_errors;
+	__u64	tx_window_errors;
 
 	/* for cslip etc */
-	__u32	rx_compressed;
-	__u32	tx_compressed;
+	__u64	rx_compressed;
+	__u64	tx_compressed;
 };
 
 
@@ -85,8 +94,41 @@ struct vfd_nl_message {
 	struct dev_info *info;
 };
 
+/*
+	Pushed stats. vfd sends, on a fixed interval, one or more messages for
+	each PF: a header followed by nrecs records. The header's first fields
+	line up with struct vfd_nl_message (req, resp, port) so the receiver can
+	dispatch on req before knowing which it has. Everything is inline (no
+	pointers) so the message can be used as is on the kernel side.
+*/
+struct vfd_nl_vf_stats {
+	__u32	vf;				/* MAX_VF - 1 is the PF */
+	__u32	link_state;
+	__u8	mac[6];
+	__u8	pad[2];
+	struct dev_stats stats;
+};
 
+struct vfd_nl_stats_hdr {
+	__u32	req;			/* NL_VF_STATS_PUSH */
+	__u32	resp;
+	__u32	port;
+	__u32	nrecs;			/* number of struct vfd_nl_vf_stats which follow */
+};
 
+#define VFD_NL_STATS_PER_MSG	((VFD_NL_MAX_PAYLOAD - sizeof(struct vfd_nl_stats_hdr)) / sizeof(struct vfd_nl_vf_stats))
+
+/*
+	Device add/delete notifications are coalesced by vfd and sent as a batch:
+	a struct vfd_nl_stats_hdr (req == NL_PF_DEV_BATCH, port unused) followed by
+	nrecs of these. The module answers with a header (req == NL_PF_DEV_ACK)
+	where nrecs is the number applied and port the number which failed.
+*/
+struct vfd_nl_dev_rec {
+	__u32	req;			/* NL_PF_ADD_DEV_RQ or NL_PF_DEL_DEV_RQ */
+	__u32	port;
+	__u32	vf;				/* MAX_VF - 1 is the PF */
+	char	pciaddr[PCIADDR_LEN + 4];	/* nil terminated; used as the netdev alias */
+};
 
-
-
+#define VFD_NL_DEVS_PER_MSG	((VFD_NL_MAX_PAYLOAD - sizeof(struct vfd_nl_stats_hdr)) / sizeof(struct vfd_nl_dev_rec))
@@ -78,6 +78,36 @@
 				10 Jan 2018 - mlx5: Add VF mirroring support.
 				10 Jan 2018 - mlx5: Add VF queue sharing per TC.
 				19 Feb 2018 - Add support to ensure config directories exist. (#263)
+				18 Oct 2026 - Enable the bleat flight recorder and dump it on fatal signals.
+				18 Oct 2026 - Charge update lock wait in update_nic to the request being traced.
+				18 Oct 2026 - Add -b option to run the control plane benchmark against simulated nics.
+				18 Oct 2026 - Support virtual devices (vdev) and no_pci; VF operations on them go to the simulator.
+				18 Oct 2026 - Remove deleted VF's qshares from the port's running sums.
+				18 Oct 2026 - Drive the bandwidth rebalancer from the main loop.
+				18 Oct 2026 - Link state changes restore all VFs in one update_nic pass; queue shares
+							are recomputed once per port per pass; rates are not set while the link is down.
+				18 Oct 2026 - Drive noisy neighbour throttling from the main loop; keep throttles across vf resets.
+				18 Oct 2026 - Keep monotonic vf counters; restore them at start and save at shutdown.
+				18 Oct 2026 - Build the cached xstats id map for each port after it is initialised.
+				18 Oct 2026 - Push vf stats to the vfd-net module from the main loop.
+				18 Oct 2026 - Queue netdev add/delete notifications; flush them from the main loop.
+				18 Oct 2026 - PF rx draining moved from the main loop to the drain thread (vfd_drain.c).
+				18 Oct 2026 - Start/stop the optional pf traffic capture.
+				18 Oct 2026 - Software mirrors: refreshed on vf update, cleared on delete and shutdown.
+				18 Oct 2026 - Start/stop callbacks run concurrently, with timeouts, by the callback executor.
+				18 Oct 2026 - Prepare pf/vf devices (vfd_prep.c) before eal init when prep_devices is set.
+				18 Oct 2026 - SIGUSR2 is a warm stop: vfs are left configured and a state snapshot is written.
+							A start which finds a warm snapshot restores from it, and reprograms only the vfs
+							whose nic settings differ (vfd_state.c).
+				18 Oct 2026 - Restore from the state snapshot, when current, rather than parsing config_live.
+				18 Oct 2026 - Periodic nic/config reconcile (vfd_recon.c); a warm start fixes drifted
+							settings in place rather than reprogramming the whole vf.
+				18 Oct 2026 - Crash signals dump the flight recorder with a signal safe writer; fatal
+							initialisation errors dump it on the way out.
+				18 Oct 2026 - PF promiscuous/allmulticast settings are not pushed to simulated ports
+							(no ethdev exists for them when the benchmark runs without the eal).
+				18 Oct 2026 - A snapshot whose vfs no longer fit the ports is dropped and the config_live
+							files are read instead.
 */
 
 
@@ -97,6 +127,17 @@
 #include "vfd_rif.h"	// request interface stuff
 #include "vfd_dcb.h"	// dcb related stuff
 #include "vfd_mlx5.h"
+#include "vfd_timing.h"
+#include "vfd_rebal.h"
+#include "vfd_recon.h"
+#include "vfd_throttle.h"
+#include "vfd_ctrs.h"
+#include "vfd_xstats.h"
+#include "vfd_drain.h"
+#include "vfd_pcap.h"
+#include "vfd_smirror.h"
+#include "vfd_prep.h"
+#include "vfd_state.h"
 
 #if VFD_KERNEL
 #include "vfd_nl.h"		// netlink 
@@ -107,6 +148,8 @@
 
 // ---------------------globals: bad form, but unavoidable -------------------------------------------------------
 static parms_t *g_parms = NULL;											// dpdk callback does not allow data pointer so we must have a global. all other functions should accept a pointer!
+static int warm_stop = 0;												// set by SIGUSR2; shutdown leaves the vfs configured
+static int clean_exit = 0;												// set just before main returns; any other exit is a failure
 
 
 // -- global initialisation ----
@@ -184,51 +227,90 @@ extern int stricmp(const char *s1, const char *s2)
 	VFd is cycled.  This might be necessary as some drivers do not seem
 	to reset completely when VFd reinitialises on start up.
 
-	State of the command is _not_ captured; it seems that the dpdk lib
-	fiddles with underlying system() calls and the status returns -1 regardless
-	of what the command returns.
-
-	Output from these user defined commands goes to standard output or
-	standard error and won't be capture in our log files.
+	Commands are handed to the callback executor (lib/hot_plug.c) which runs
+	up to cb_max_running of them at once and kills any which run longer than
+	cb_timeout seconds. Their output is written to our log and their exit
+	status is reported as each finishes. Start commands are queued and then
+	driven from the main loop so that requests are not held up; at shutdown
+	we wait for the stop commands, but only as long as the timeouts allow.
 */
-static void run_start_cbs( sriov_conf_t* conf ) {
+static void* cb_exec = NULL;			// the callback executor
+
+static int queue_cbs( sriov_conf_t* conf, int start ) {
 	int i;
 	int j;
+	int	count = 0;
+	char	tag[64];
+	char*	cmd;
 	struct sriov_port_s* port;
 	struct vf_s *vf;
 
+	if( cb_exec == NULL ) {
+		if( (cb_exec = cbx_mk( g_parms->cb_max_running, g_parms->cb_timeout )) == NULL ) {
+			bleat_printf( 0, "ERR: unable to allocate callback executor; %s callbacks not run", start ? "start" : "stop" );
+			return 0;
+		}
+	}
+
 	for (i = 0; i < conf->num_ports; ++i){							// run each port we know about
 		port = &conf->ports[i];
 
-	    for( j = 0; j < port->num_vfs; ++j ) { 			// traverse each VF and if we have a command, then drive it
+	    for( j = 0; j < port->num_vfs; ++j ) { 			// traverse each VF and if we have a command, then queue it
 			vf = &port->vfs[j];				   			// convenience
 
-			if( vf->num >= 0  &&  vf->start_cb != NULL ) {
-				user_cmd( vf->owner, vf->start_cb );		
-				bleat_printf( 1, "start_cb for pf=%d vf=%d executed: %s", i, j, vf->start_cb  );
+			cmd = start ? vf->start_cb : vf->stop_cb;
+			if( vf->num >= 0  &&  cmd != NULL ) {
+				snprintf( tag, sizeof( tag ), "%s pf=%d vf=%d", start ? "start_cb" : "stop_cb", port->rte_port_number, vf->num );
+				if( cbx_add( cb_exec, vf->owner, cmd, tag ) == 0 ) {
+					count++;
+				} else {
+					bleat_printf( 0, "WRN: %s: unable to queue: %s", tag, cmd );
+				}
 			}
 		}
 	}
+
+	return count;
 }
 
-static void run_stop_cbs( sriov_conf_t* conf ) {
-	int i;
-	int j;
-	struct sriov_port_s* port;
-	struct vf_s *vf;
+static void run_start_cbs( sriov_conf_t* conf ) {
+	int count;
 
-	for (i = 0; i < conf->num_ports; ++i){							// run each port we know about
-		port = &conf->ports[i];
+	if( (count = queue_cbs( conf, 1 )) > 0 ) {
+		bleat_printf( 1, "%d start callback(s) queued; running up to %d at once with a %ds timeout", count, g_parms->cb_max_running, g_parms->cb_timeout );
+		cbx_poll( cb_exec );
+	}
+}
 
-	    for( j = 0; j < port->num_vfs; ++j ) { 			// traverse each VF and if we have a command, then drive it
-			vf = &port->vfs[j];				   			// convenience
+static void run_stop_cbs( sriov_conf_t* conf, int warm ) {
+	int count = 0;
+	int	max_wait;
+	int	pending;
+	uint64_t	nok = 0;
+	uint64_t	nfail = 0;
+	uint64_t	ntimeout = 0;
 
-			if( vf->num >= 0  &&  vf->stop_cb != NULL ) {
-				user_cmd( vf->owner, vf->stop_cb );		
-				bleat_printf( 1, "stop_cb for pf=%d vf=%d executed: %s", i, j, vf->stop_cb  );
-			}
-		}
+	if( warm ) {
+		bleat_printf( 1, "warm stop: stop callbacks are not run" );			// vfs stay up; only wait for start commands still going
+	} else {
+		count = queue_cbs( conf, 0 );
+	}
+	if( cb_exec == NULL ) {
+		return;
 	}
+
+	pending = cbx_poll( cb_exec );												// includes any start commands still going
+	max_wait = ((pending / g_parms->cb_max_running) + 1) * (g_parms->cb_timeout + 10);		// each batch can take a timeout plus kill grace
+	bleat_printf( 1, "%d stop callback(s) queued; waiting up to %ds for %d command(s)", count, max_wait, pending );
+	if( (pending = cbx_wait( cb_exec, max_wait )) > 0 ) {
+		bleat_printf( 0, "WRN: %d callback command(s) did not finish", pending );
+	}
+
+	cbx_counts( cb_exec, &nok, &nfail, &ntimeout );
+	bleat_printf( 1, "callbacks: %llu ok, %llu failed, %llu timed out",
+		(unsigned long long) nok, (unsigned long long) nfail, (unsigned long long) ntimeout );
+	cbx_free( cb_exec );
+	cb_exec = NULL;
 }
 
 // --- callback/mailbox support - depend on global parms ---------------------------------------------------------
@@ -503,28 +585,53 @@ extern int add_mac( int port, int vfid, char* mac ) {
 	terminate any active mirror as it steems in some cases that a 'hanging mirror' will cause the machine
 	to crash on restart of VFd.  Called by signal handlerers before caling abort() to core dump, and at 
 	end of normal processing.
+
+	On a warm stop the PFs are not stopped or closed as that resets the NIC and takes the VFs
+	down with it. Only the PF's own queues are stopped so that nothing is DMAed into our
+	memory once we exit; filters, VF queues and the link are left for the next start to
+	reattach to. Mirrors are still terminated and are set again by that start.
 */
-static void close_ports( void ) {
+static void close_ports( int warm ) {
 	int 	i;
 	int		j;
+	int		q;
 	struct sriov_port_s* port;
+	struct rte_eth_dev_info dev_info;
 	//char	dev_name[1024];
 
+	vfd_drain_stop();									// drain thread must be off the rx queues before they stop
+	vfd_pcap_stop();									// flush and close capture files (nothing is offered once drain stops)
+
 	bleat_printf( 2, "terminating active mirrors begins" );
 	for( i = 0; i < running_config->num_ports; i++ ) {
 		port = &running_config->ports[i];
 		bleat_printf( 2, "port %d has %d mirrors", port->rte_port_number, port->num_mirrors );
 		for( j = 0; j < MAX_VFS; j++ ) {					// run regardless of what we think the count is!
-			if( port->mirrors[j].dir != MIRROR_OFF ) {
+			if( port->mirrors[j].dir != MIRROR_OFF && ! port->mirrors[j].soft ) {			// soft mirrors share port rules; dropped below
 				bleat_printf( 0, "terminating active mirror on shutdown: pf=%d vf=%d", port->rte_port_number,  port->vfs[i].num );
 				set_mirror_wrp( port->rte_port_number, port->vfs[j].num,  port->mirrors[j].id, port->mirrors[j].target, MIRROR_OFF );
 			}
 		}
 	}
+	vfd_smirror_shutdown( running_config );
 	bleat_printf( 2, "terminating active mirrors is complete" );
 
 	bleat_printf( 0, "closing ports" );
 	for( i = 0; i < n_ports; i++) {
+		if( warm ) {
+			if( port2config_map[i] >= 0 ) {
+				bleat_printf( 0, "warm stop: stopping pf queues, port left running: %d", i );
+				rte_eth_dev_info_get( i, &dev_info );
+				for( q = 0; q < dev_info.nb_rx_queues; q++ ) {
+					rte_eth_dev_rx_queue_stop( i, q );
+				}
+				for( q = 0; q < dev_info.nb_tx_queues; q++ ) {
+					rte_eth_dev_tx_queue_stop( i, q );
+				}
+			}
+			continue;
+		}
+
 		bleat_printf( 0, "closing port: %d", running_config->ports[i].rte_port_number );
 		rte_eth_dev_stop( i );
 		rte_eth_dev_close( i );
@@ -664,8 +771,20 @@ static int vfd_eal_init( parms_t* parms ) {
 	}
 
 
-	for( i = 0; i < parms->npciids; i++ ) {												// add in the -w pciid values to the list
-		insert_pair( argv, &argc, MAX_ARGV_LEN, "-w", parms->pciids[i].id );
+	if( parms->rflags & RF_NO_PCI ) {
+		insert_pair( argv, &argc, MAX_ARGV_LEN, "--no-pci", NULL );
+	}
+
+	for( i = 0; i < parms->npciids; i++ ) {												// add in the -w pciid (or --vdev) values to the list
+		if( parms->pciids[i].vdev != NULL ) {
+			insert_pair( argv, &argc, MAX_ARGV_LEN, "--vdev", parms->pciids[i].vdev );
+		} else {
+			if( parms->rflags & RF_NO_PCI ) {
+				bleat_printf( 0, "WRN: pciid %s ignored: no_pci is set and it is not a virtual device", parms->pciids[i].id );
+			} else {
+				insert_pair( argv, &argc, MAX_ARGV_LEN, "-w", parms->pciids[i].id );
+			}
+		}
 	}
 
 	dummy_rte_eal_init( argc, argv );													// print out parms, vet, etc.
@@ -697,6 +816,7 @@ char*  gen_stats( sriov_conf_t* conf, int pf_only, int pf ) {
 	int		l;
 	int		i;
 	struct rte_eth_dev_info dev_info;
+	struct rte_pci_addr pci_addr;
 
 	rblen = BUF_SIZE;
 	rbuf = (char *) malloc( sizeof( char ) * rblen );
@@ -724,20 +844,23 @@ char*  gen_stats( sriov_conf_t* conf, int pf_only, int pf ) {
 			continue;
 		}
 
-		memset( &dev_info, 0, sizeof( dev_info ) );										// no status from rte function, but if it fails to populate we need to know, so 0s required
-		rte_eth_dev_info_get( conf->ports[i].rte_port_number, &dev_info );				// must use port number that we mapped during initialisation
+		if( vfd_sim_pci_addr( conf->ports[i].rte_port_number, &pci_addr ) != 0 ) {		// simulated ports have no pci device; sim supplies an address
+			memset( &dev_info, 0, sizeof( dev_info ) );										// no status from rte function, but if it fails to populate we need to know, so 0s required
+			rte_eth_dev_info_get( conf->ports[i].rte_port_number, &dev_info );				// must use port number that we mapped during initialisation
 
-		if( dev_info.pci_dev == NULL ) {
-			continue;
+			if( dev_info.pci_dev == NULL ) {
+				continue;
+			}
+			pci_addr = dev_info.pci_dev->addr;
 		}
 
 		l = snprintf( buf, sizeof( buf ), "%s   %4d    %04X:%02X:%02X.%01X",
 					"pf",
 					conf->ports[i].rte_port_number,
-					dev_info.pci_dev->addr.domain,
-					dev_info.pci_dev->addr.bus,
-					dev_info.pci_dev->addr.devid,
-					dev_info.pci_dev->addr.function);
+					pci_addr.domain,
+					pci_addr.bus,
+					pci_addr.devid,
+					pci_addr.function);
 							
 		if( l + rbidx > rblen ) {
 			rblen += BUF_SIZE;
@@ -764,7 +887,7 @@ char*  gen_stats( sriov_conf_t* conf, int pf_only, int pf ) {
 		
 		if( ! pf_only ) {
 			// pack PCI ARI into 32bit to be used to get VF's ARI later
-			uint32_t pf_ari = dev_info.pci_dev->addr.bus << 8 | dev_info.pci_dev->addr.devid << 3 | dev_info.pci_dev->addr.function;
+			uint32_t pf_ari = pci_addr.bus << 8 | pci_addr.devid << 3 | pci_addr.function;
 			
 			//iterate over active (configured) VF's only
 			int * vf_arr = malloc(sizeof(int) * conf->ports[i].num_vfs);
@@ -883,6 +1006,30 @@ extern void log_port_state( struct sriov_port_s* port, const_str msg ) {
 	}
 }
 
+/*
+	Set the PF promiscuous and allmulticast modes. Simulated ports have no ethdev
+	behind them (the benchmark runs without the eal), so nothing is done for them.
+*/
+static void set_port_rxmode( struct sriov_port_s* port ) {
+	if( get_nic_type( port->rte_port_number ) == VFD_SIM ) {
+		return;
+	}
+
+	if( port->flags & PF_PROMISC ) {
+		bleat_printf( 1, "enabling promiscuous mode for port %d", port->rte_port_number );
+		rte_eth_promiscuous_enable(port->rte_port_number);
+	}
+	else {
+		bleat_printf( 1, "disabling promiscuous mode for port %d", port->rte_port_number );
+		rte_eth_promiscuous_disable(port->rte_port_number);
+	}
+
+	if (get_nic_type(port->rte_port_number) == VFD_BNXT)
+		rte_eth_allmulticast_disable(port->rte_port_number);
+	else
+		rte_eth_allmulticast_enable(port->rte_port_number);
+}
+
 /*
 	Runs through the configuration and makes adjustments.  This is
 	a tweak of the original code (update_ports_config) inasmuch as the dynamic
@@ -921,16 +1068,21 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 		return 0;
 	}
 
-	rte_spinlock_lock( &running_config->update_lock );
+	vfd_trace_lock( &running_config->update_lock );			// lock, charging wait time to any request being traced
 	
 	for (i = 0; i < conf->num_ports; ++i){												// run each port we know about to apply port only changes
 		int ret;
+		int requos;					// one or more vfs changed; queue shares must be recomputed and pushed
 		struct sriov_port_s* port;
 		struct rte_eth_link link;
 
 		port = &conf->ports[i];
 
-		rte_eth_link_get_nowait(port->rte_port_number, &link);
+		vfd_link_get( port->rte_port_number, &link );
+		if( link.link_status && link.link_speed > 0 ) {
+			port->link_speed = link.link_speed;						// speed that rates are computed from in this pass
+		}
+		requos = 0;
 
 		//  WHY is this and disable pool done every time?  why is it not just done at the time of add?
 		tx_set_loopback( port->rte_port_number, !!(port->flags & PF_LOOPBACK) );		// enable loopback if set (disabled: all vm-vm traffic must go to TOR and back
@@ -945,19 +1097,7 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 
 			bleat_printf( 1, "port updated: %s/%s",  port->name, port->pciid );
 
-			if( port->flags & PF_PROMISC ) {
-				bleat_printf( 1, "enabling promiscuous mode for port %d", port->rte_port_number );
-				rte_eth_promiscuous_enable(port->rte_port_number);
-			}
-			else {
-				bleat_printf( 1, "disabling promiscuous mode for port %d", port->rte_port_number );
-				rte_eth_promiscuous_disable(port->rte_port_number);
-			}
-			
-			if (get_nic_type(port->rte_port_number) == VFD_BNXT)
-				rte_eth_allmulticast_disable(port->rte_port_number);
-			else
-				rte_eth_allmulticast_enable(port->rte_port_number);
+			set_port_rxmode( port );
 		
 			if (get_nic_type(port->rte_port_number) == VFD_NIANTIC) {
 				ret = rte_eth_dev_uc_all_hash_table_set(port->rte_port_number, on);
@@ -988,13 +1128,13 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 					case ADDED:		
 						reason = "add"; 
 #if VFD_KERNEL
-						device_message(port->rte_port_number, vf->num, NL_PF_ADD_DEV_RQ, NL_PF_RESP_OK);
+						vfd_nl_queue_dev( port, vf->num, NL_PF_ADD_DEV_RQ );			// sent coalesced by vfd_nl_flush() from the main loop
 #endif
 						break;						
 					case DELETED:	
 						reason = "delete"; 
 #if VFD_KERNEL
-						device_message(port->rte_port_number, vf->num, NL_PF_DEL_DEV_RQ, NL_PF_RESP_OK);
+						vfd_nl_queue_dev( port, vf->num, NL_PF_DEL_DEV_RQ );
 #endif						
 						break;					
 					case RESET:		reason = "reset"; break;
@@ -1014,10 +1154,15 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 					}
 
 					if( port->mirrors[y].dir != MIRROR_OFF ) {													// stop the mirror on delete
-						set_mirror_wrp( port->rte_port_number, vf->num, port->mirrors[y].id, port->mirrors[y].target, MIRROR_OFF );		// turn off
+						if( port->mirrors[y].soft ) {
+							vfd_smirror_clear( conf, port, vf->num );											// shared port rule is adjusted; no id of its own
+							port->mirrors[y].soft = port->mirrors[y].pcap = 0;
+						} else {
+							set_mirror_wrp( port->rte_port_number, vf->num, port->mirrors[y].id, port->mirrors[y].target, MIRROR_OFF );		// turn off
+							idm_return( conf->mir_id_mgr, port->mirrors[y].id );								// mark the id as unused in allocator
+						}
 						port->mirrors[y].dir = MIRROR_OFF;
 						port->mirrors[y].target = MAX_VFS + 1;													// target is unsigned -- set out of range high
-						idm_return( conf->mir_id_mgr, port->mirrors[y].id );									// mark the id as unused in allocator
 						if( port->num_mirrors > 0 ) {
 							port->num_mirrors--; 
 						}
@@ -1038,7 +1183,15 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 					int v;
 
 					if( port->mirrors[y].dir != MIRROR_OFF ) {						// setup the mirror
-						set_mirror_wrp( port->rte_port_number, vf->num, port->mirrors[y].id, port->mirrors[y].target, port->mirrors[y].dir );		// set target and type (in/out/both)
+						if( port->mirrors[y].soft ) {
+							const char* reason;
+
+							if( vfd_smirror_set( conf, port, vf, &port->mirrors[y], &reason ) < 0 ) {		// picks up any mac change
+								bleat_printf( 0, "WRN: soft mirror not refreshed: pf/vf=%d/%d: %s", port->rte_port_number, vf->num, reason );
+							}
+						} else {
+							set_mirror_wrp( port->rte_port_number, vf->num, port->mirrors[y].id, port->mirrors[y].target, port->mirrors[y].dir );		// set target and type (in/out/both)
+						}
 						port->num_mirrors++;
 					}
 
@@ -1096,18 +1249,27 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 */
 				}
 
-				if( vf->rate || vf->min_rate ) {
+				if( (vf->rate || vf->min_rate) && vf->last_updated != DELETED && port->link_speed == 0 ) {
+					bleat_printf( 1, "port %d link has not been up; vf %d rates will be set when the link comes up", port->rte_port_number, vf->num );
+				}
+
+				if( (vf->rate || vf->min_rate) && port->link_speed > 0 ) {
+					vfd_rebal_reset( port->rte_port_number, vf->num );		// rebalancer must start again from the configured values
 					if( vf->rate ) {
-						bleat_printf( 1, "setting rate: %d", (int)  ( (float)link.link_speed * vf->rate ) );
-						set_vf_rate_limit( port->rte_port_number, vf->num, (uint16_t)( (float)link.link_speed * vf->rate ), 0x01 );
+						bleat_printf( 1, "setting rate: %d", (int)  ( (float)port->link_speed * vf->rate ) );
+						set_vf_rate_limit( port->rte_port_number, vf->num, (uint16_t)( (float)port->link_speed * vf->rate ), 0x01 );
 					}
 
 					if( vf->min_rate ) {
-						bleat_printf( 1, "setting min_rate: %d", (int)  ( (float)link.link_speed * vf->min_rate ) );
-						set_vf_min_rate( port->rte_port_number, vf->num, (uint16_t)( (float)link.link_speed * vf->min_rate ), 0x01 );
+						bleat_printf( 1, "setting min_rate: %d", (int)  ( (float)port->link_speed * vf->min_rate ) );
+						set_vf_min_rate( port->rte_port_number, vf->num, (uint16_t)( (float)port->link_speed * vf->min_rate ), 0x01 );
 					}
 				}
 
+				if( vf->last_updated != DELETED ) {
+					vfd_throttle_reapply( port->rte_port_number, vf->num, port->link_speed );	// a reset must not lift a throttle
+				}
+
 				if( vf->last_updated == DELETED ) {				// do this last!
 					if( vf->rate > 0 ) { //disable rate limit
 						bleat_printf( 1, "disabling rate limit");
@@ -1118,6 +1280,9 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 						bleat_printf( 1, "disabling min rate guarantee");
 						set_vf_min_rate( port->rte_port_number, vf->num, 0, 0x01 );
 					}
+					vfd_rebal_reset( port->rte_port_number, vf->num );
+					vfd_throttle_reset( port->rte_port_number, vf->num );
+					vfd_ctrs_clear( port->rte_port_number, vf->num );		// next vf in this slot counts from zero
 
 					/* retoring VF cfg to default */
 					vfd_set_ins_strip( port, vf );
@@ -1131,6 +1296,7 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 					bleat_printf( 2, "port: %d vf: %d set allow mcast to %d", port->rte_port_number, vf->num, SET_OFF );
 					set_vf_allow_mcast(port->rte_port_number, vf->num, SET_OFF);
 				
+					qs_del_vf( port, vf );						// drop its shares from the running sums before the number is lost
 					vf->num = -1;								// must reset this so an add request with the now deleted number will succeed
 					// TODO -- is there anything else that we need to clean up in the struct?
 				}
@@ -1167,35 +1333,14 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 				vf->last_updated = UNCHANGED;				// mark processed
 			}
 
-			if( change2port && (g_parms->rflags & RF_ENABLE_QOS) ) {		// changes, we must recompute queue shares and push to nic
-				gen_port_qshares( port );									// compute and save in the port struct
-				if (get_nic_type(port->rte_port_number) == VFD_MLX5) {
-					mlx5_set_vf_tcqos( port, link.link_speed );
-				} else {
-					//uint8_t* pp;
-					qos_set_credits( port->rte_port_number, port->mtu, port->vftc_qshares, TC_4PERQ_MODE );	// push out to nic
-					//qos_set_credits( port->rte_port_number, port->mtu, pp, TC_4PERQ_MODE );	// push out to nic
-				}
-			}
+			requos |= change2port;
 
 			if( change2port && vf->num >= 0 ) {
 				bleat_printf( 3, "set promiscuous: port: %d, vf: %d ", port->rte_port_number, vf->num);
 		
 				// az says: figure out if we have to update it every time we change VLANS/MACS
 				// 			or once when update ports config
-				if( port->flags & PF_PROMISC ) {
-					bleat_printf( 1, "enabling promiscuous mode for port %d", port->rte_port_number );
-					rte_eth_promiscuous_enable(port->rte_port_number);
-				}
-				else {
-					bleat_printf( 1, "disabling promiscuous mode for port %d", port->rte_port_number );
-					rte_eth_promiscuous_disable(port->rte_port_number);
-				}
-				
-				if (get_nic_type(port->rte_port_number) == VFD_BNXT)
-					rte_eth_allmulticast_disable(port->rte_port_number);
-				else
-					rte_eth_allmulticast_enable(port->rte_port_number);
+				set_port_rxmode( port );
 				
 				if (get_nic_type(port->rte_port_number) == VFD_NIANTIC) {
 					ret = rte_eth_dev_uc_all_hash_table_set(port->rte_port_number, on);
@@ -1211,6 +1356,17 @@ extern int vfd_update_nic( parms_t* parms, sriov_conf_t* conf ) {
 			}
 		}				// end for each vf on this port
 
+		if( requos && (g_parms->rflags & RF_ENABLE_QOS) ) {				// changes, we must recompute queue shares and push to nic; once for all vfs changed
+			gen_port_qshares( port );									// compute and save in the port struct
+			if (get_nic_type(port->rte_port_number) == VFD_MLX5) {
+				if( port->link_speed > 0 ) {
+					mlx5_set_vf_tcqos( port, port->link_speed );
+				}
+			} else {
+				qos_set_credits( port->rte_port_number, port->mtu, port->vftc_qshares, TC_4PERQ_MODE );	// push out to nic
+			}
+		}
+
 		if( need_ready_msg ) {									// only on the first port init; all other updates are quiet
 			log_port_state( port, "ready" );
 			need_ready_msg = 0;
@@ -1254,13 +1410,19 @@ static void sig_int( int sig ) {
 		case SIGSEGV:
 				terminated = 1;				// prevent loop
 				bleat_printf( 0, "signal caught (aborting): %d", sig );
-				close_ports();				// must attempt to do this else we potentially crash the machine
+				bleat_fr_crash_dump( );		// capture what was suppressed before we lose it (open/write only)
+				close_ports( 0 );			// must attempt to do this else we potentially crash the machine
 				abort( );					// to get core; not safe to just set term flag and end normally
 				break;
 
+		case SIGUSR2:						// warm stop: shut down leaving the vfs configured for the next start
+				warm_stop = 1;
+				terminated = 1;
+				bleat_printf( 0, "signal caught (warm stop): %d", sig );
+				break;
+
 		case SIGPIPE:
 		case SIGUSR1:						// for these we just ignore and go on
-		case SIGUSR2:
 		case SIGALRM:
 				bleat_printf( 0, "signal caught (ignored): %d", sig );
 				break;
@@ -1274,6 +1436,17 @@ static void sig_int( int sig ) {
 	return;
 }
 
+/*
+	Registered with atexit(). Exit() and rte_exit() are only called once initialisation
+	is under way when something fatal happened, so dump the flight recorder; nothing is
+	done when main returns normally.
+*/
+static void fr_at_exit( void ) {
+	if( ! clean_exit ) {
+		vfd_fr_dump( g_parms, 0, NULL, 0 );
+	}
+}
+
 /*
 	Signals we choose to ignore drive this.
 */
@@ -1381,18 +1554,62 @@ restore_vf_setings(portid_t port_id, int vf_id) {
 
 					matched++;															// for bleat message at end
 					vf->last_updated = RESET;											// flag for update_nic()
-					if( vfd_update_nic( g_parms, running_config ) != 0 ) {				// now that dpdk is initialised run the list and 'activate' everything
-						bleat_printf( 0, "WRN: reset of port %d vf %d failed", port_id, vf_id );
-					}
+					vfd_ctrs_reset_event( port_id, vf->num );							// nic counters may drop back to 0
 				}
 			}
 		}
 	}
+
+	if( matched > 0 ) {														// one pass for all of them rather than a pass per vf
+		if( vfd_update_nic( g_parms, running_config ) != 0 ) {
+			bleat_printf( 0, "WRN: reset of port %d vf %d failed", port_id, vf_id );
+		}
+	}
 	
 	bleat_printf( 1, "restore for  port=%d vf=%d matched %d vfs in the config", port_id, vf_id, matched );
 }
 
 
+/*
+	Driven by the link state change callback. When the link comes up all VFs on the
+	port are restored in a single update_nic pass; rate, min_rate and the mlx5 per TC
+	rates are computed from the link speed at that point, so a renegotiation (e.g.
+	25G down to 10G) leaves every VF limited to the same fraction of the link as
+	before. The speed change is logged with the number of VFs affected and the time
+	the pass took.
+*/
+extern void vfd_link_change( portid_t port_id, struct rte_eth_link* link ) {
+	struct sriov_port_s* port;
+	uint32_t	old_speed;
+	uint64_t	start;
+	int			nvfs = 0;
+	int			i;
+
+	if( (port = suss_port( port_id )) == NULL ) {
+		return;
+	}
+
+	if( ! link->link_status ) {
+		bleat_printf( 1, "port %d link down (rates stay computed from %u Mbps)", port_id, port->link_speed );
+		return;
+	}
+
+	old_speed = port->link_speed;
+	for( i = 0; i < port->num_vfs; i++ ) {
+		if( port->vfs[i].num >= 0 && (port->vfs[i].rate || port->vfs[i].min_rate) ) {
+			nvfs++;
+		}
+	}
+
+	start = vfd_timing_start();
+	restore_vf_setings( port_id, -1 );				// reset _all_ VFs on the port; update_nic picks up the new speed
+
+	if( old_speed != port->link_speed ) {			// update_nic saw a new speed
+		bleat_printf( 0, "port %d link speed changed: %u -> %u Mbps; rates recomputed for %d vfs in %lld us",
+			port_id, old_speed, port->link_speed, nvfs, (long long) ((rte_rdtsc() - start) * 1000000 / rte_get_tsc_hz()) );
+	}
+}
+
 /*
 	Runs the current in memory configuration and dumps stuff to the log.
 	Only mods were to replace tracelog calls with bleat calls to allow
@@ -1475,8 +1692,12 @@ main(int argc, char **argv)
 	__attribute__((__unused__))	int ignored;	// ignored return code to keep compiler from whining
 	char*	parm_file = NULL;					// default in /etc, -p overrieds
 	char*	log_file;							// buffer to build full log file in
+	char	fr_crash[BUF_1K];					// flight recorder crash dump file name
 	char	run_asynch = 1;				// -f sets off to keep attached to tty
 	int		forreal = 1;				// -n sets to 0 to keep us from actually fiddling the nic
+	void*	snap = NULL;				// running config snapshot; used rather than the config_live files when current
+	int		warm_start = 0;				// snapshot was left by a warm stop
+	int		restored = 0;				// vfs came from the snapshot rather than the config_live files
 	int		opt;
 	int		fd = -1;
 	int		enable_qos = 0;				// off by default enable_qos in config should be used to set on
@@ -1485,14 +1706,18 @@ main(int argc, char **argv)
 	int		no_huge = 0;				// -H will turn on and we will flip the appropriate bit in parms
 
 	int		enable_fc = 0;				// enable flow control (-F sets)
-	u_int16_t portid;
+	int		bench_iters = 0;			// -b sets to run the control plane benchmark rather than the daemon
+	int		bench_latency = 0;			// simulated nic latency (usec) for the benchmark
+	char*	tok;
 
 
   const char * main_help =
 		"\n"
 		"Usage: vfd [-f] [-F] [-H] [-n] [-p parm-file] [-v level] [-q]\n"
+		"Usage: vfd -b iterations[,usec]\n"
 		"Usage: vfd -?\n"
 		"  Options:\n"
+		"\t -b n[,us] run the control plane benchmark against simulated nics and exit\n"
 		"\t -f        keep in 'foreground'\n"
 		"\t -F        enable flow control (might be ignored in qos mode)\n"
 		"\t -H        disable use of huge pages\n"
@@ -1513,10 +1738,17 @@ main(int argc, char **argv)
 	log_file = (char *) malloc( sizeof( char ) * BUF_1K );
 
   // Parse command line options
-  while ( (opt = getopt(argc, argv, "?qfFHhnqv:p:s:")) != -1)
+  while ( (opt = getopt(argc, argv, "?b:qfFHhnqv:p:s:")) != -1)
   {
     switch (opt)
     {
+		case 'b':
+			bench_iters = atoi( optarg );
+			if( (tok = strchr( optarg, ',' )) != NULL ) {
+				bench_latency = atoi( tok + 1 );
+			}
+			break;
+
 		case 'F':
 			enable_fc = 1;					// enable flow control (qos might ignore this)
 			break;
@@ -1564,6 +1796,16 @@ main(int argc, char **argv)
   }
 
 
+	if( bench_iters > 0 ) {									// benchmark needs no parm file, fifo or dpdk; just run it and go
+		if( (g_parms = (parms_t *) malloc( sizeof( *g_parms ) )) == NULL ) {
+			fprintf( stderr, "CRI: unable to allocate memory for parms\n" );
+			exit( 1 );
+		}
+		memset( g_parms, 0, sizeof( *g_parms ) );
+		bleat_set_lvl( 0 );
+		exit( vfd_bench( g_parms, bench_iters, bench_latency ) );
+	}
+
 	if( (g_parms = read_parms( parm_file )) == NULL ) {						// get overall configuration (includes list of pciids we manage)
 		fprintf( stderr, "CRI: unable to read configuration from %s: %s\n", parm_file, strerror( errno ) );
 		exit( 1 );
@@ -1608,6 +1850,12 @@ main(int argc, char **argv)
 		bleat_printf( 2, "-f supplied, staying attached to tty" );
 	}
 	free( log_file );
+	bleat_fr_enable( g_parms->fr_entries );												// before any threads are started
+	if( g_parms->fr_entries > 0 && g_parms->log_dir != NULL ) {
+		snprintf( fr_crash, sizeof( fr_crash ), "%s/vfd.flight.crash.%d", g_parms->log_dir, (int) getpid() );
+		bleat_fr_crash_file( fr_crash );														// name must be built now; a signal handler cannot
+		atexit( fr_at_exit );
+	}
 	bleat_set_lvl( g_parms->init_log_level );											// set default level
 	bleat_printf( 0, "VFD %s %s initialising", vnum, version );
 	bleat_printf( 0, "config dir set to: %s", g_parms->config_dir );
@@ -1617,6 +1865,13 @@ main(int argc, char **argv)
 		exit( 1 );
 	}
 
+	if( g_parms->forreal && (g_parms->rflags & RF_PREP_DEVS) ) {						// bind drivers and create vfs before dpdk looks for the devices
+		if( vfd_prep_devices( g_parms ) != 0 ) {
+			bleat_printf( 0, "CRI: abort: unable to prepare pf/vf devices" );
+			exit( 1 );
+		}
+	}
+
 	if( vfd_eal_init( g_parms ) < 0 ) {												// dpdk function returns -1 on error
 		bleat_printf( 0, "CRI: abort: unable to initialise dpdk eal environment" );
 		exit( 1 );
@@ -1632,6 +1887,14 @@ main(int argc, char **argv)
 		uint32_t pci_control_r;
 
 		bleat_printf( 1, "starting rte initialisation" );
+
+		snap = vfd_state_read( g_parms, running_config, &warm_start );			// must know if warm before the ports are initialised
+		if( warm_start ) {
+			for( j = 0; j < running_config->num_ports; j++ ) {
+				running_config->ports[j].flags |= PF_WARM;
+			}
+			bleat_printf( 0, "warm start: snapshot found; ports are reattached and vf settings verified" );
+		}
 		
 		rte_openlog_stream(stderr);						// log level for initialisation will be set with eal_init call
 
@@ -1680,15 +1943,22 @@ main(int argc, char **argv)
 		bleat_printf( 1, "initialising all (%d) ports", n_ports );
 		for (portid = 0; portid < n_ports; portid++) { 								// initialize ports, but ONLY the ports listed in our config
 			int i;
-			char pciid[25];
+			char pciid[RTE_ETH_NAME_MAX_LEN];										// pci address, or device name for a virtual device
 			struct rte_eth_dev_info dev_info;
+			struct rte_eth_link link;
 			int	pfidx;																// port index in our array if we find it; -1 otherwise.
 			struct rte_eth_dev_info pf_dev;
 			struct sriov_port_s* port;
 
 			pfidx = -1;																// default to PF not in our config list
 			rte_eth_dev_info_get(portid, &dev_info);
-			snprintf(pciid, sizeof( pciid ), "%04x:%02x:%02x.%01x", dev_info.pci_dev->addr.domain, dev_info.pci_dev->addr.bus, dev_info.pci_dev->addr.devid, dev_info.pci_dev->addr.function);
+			if( dev_info.pci_dev != NULL ) {
+				snprintf(pciid, sizeof( pciid ), "%04x:%02x:%02x.%01x", dev_info.pci_dev->addr.domain, dev_info.pci_dev->addr.bus, dev_info.pci_dev->addr.devid, dev_info.pci_dev->addr.function);
+			} else {																// virtual device (net_null, net_ring, net_tap...); match on the device name
+				if( rte_eth_dev_get_name_by_port( portid, pciid ) != 0 ) {
+					snprintf( pciid, sizeof( pciid ), "port%d", (int) portid );
+				}
+			}
 			for(i = 0; i < running_config->num_ports; ++i) {						// must record the 'real' PF number as that likely won't match array order
 				if (strcmp(pciid, running_config->ports[i].pciid) == 0) {
 					bleat_printf( 2, "physical port %i maps to config %d (%s)", portid, i, pciid );
@@ -1698,6 +1968,16 @@ main(int argc, char **argv)
 					running_config->ports[i].nvfs_config = dev_info.max_vfs;		// number of configured VFs (could be less than max)
 					if (strcmp(dev_info.driver_name, "net_mlx5") == 0)
 						running_config->ports[i].nvfs_config = vfd_mlx5_get_num_vfs(portid);
+
+					if( dev_info.pci_dev == NULL || g_parms->pciids[i].vdev != NULL ) {		// no sr-iov behind a vdev; vf operations go to the simulator
+						rte_eth_link_get_nowait( portid, &link );
+						if( vfd_sim_attach( portid, g_parms->pciids[i].sim_vfs, link.link_speed > 0 ? link.link_speed : 10000 ) != 0 ) {
+							bleat_printf( 0, "CRI: abort: unable to attach virtual device to the simulator: %s", pciid );
+							rte_exit( EXIT_FAILURE, "initialisation failure, see log(s) in: %s\n", g_parms->log_dir );
+						}
+						running_config->ports[i].nvfs_config = g_parms->pciids[i].sim_vfs;
+						bleat_printf( 1, "virtual device %s (%s) attached to simulator with %d vfs", pciid, dev_info.driver_name, g_parms->pciids[i].sim_vfs );
+					}
 					break;
 				}
 			}
@@ -1707,10 +1987,13 @@ main(int argc, char **argv)
 				port  = &running_config->ports[pfidx];
 
 				for( j = 0; j < 64; j++ ) {						//???  hardcoded 64 seems very dodgy!
+					if( (port->flags & PF_WARM) && get_nic_type( portid ) == VFD_NIANTIC && (get_split_ctlreg( portid, j ) & IXGBE_SRRCTL_DROP_EN) ) {
+						continue;												// already set; a warm start leaves the queue alone
+					}
 					set_split_erop( portid, j, SET_ON );							// set the split receive drop enable for all VFs
 				}
 
-				if( g_parms->rflags & RF_ENABLE_QOS ) {
+				if( (g_parms->rflags & RF_ENABLE_QOS) && get_nic_type( portid ) != VFD_SIM ) {		// vdevs have no dcb support; qshares still go to the simulator
 					state = dcb_port_init( &running_config->ports[pfidx], mbuf_pool );
 				} else {
 					state = port_init(portid, mbuf_pool, g_parms->pciids[pfidx].hw_strip_crc, &running_config->ports[pfidx] );  // g_parms order is same as running_config
@@ -1724,6 +2007,8 @@ main(int argc, char **argv)
 					bleat_printf( 2, "port initialisation successful for port %d [%d]", portid, pfidx );
 				}
 
+				vfd_xstats_init( g_parms, portid );			// names are fixed once the port is started; map the ones we report
+
 				set_pfrx_drop( portid, 1 );			// enable the drop bit for the PF queues on this port
 			
 				rte_eth_macaddr_get(portid, &addr);
@@ -1734,8 +2019,12 @@ main(int argc, char **argv)
 						addr.addr_bytes[4], addr.addr_bytes[5]);
 	
 				bleat_printf( 1, "driver: %s, index %d, pkts rx: %lu", dev_info.driver_name, dev_info.if_index, st.pcount);
-				bleat_printf( 1, "pci: %04X:%02X:%02X.%01X, max VF's: %d", dev_info.pci_dev->addr.domain, dev_info.pci_dev->addr.bus,
-					dev_info.pci_dev->addr.devid , dev_info.pci_dev->addr.function, dev_info.max_vfs );
+				if( dev_info.pci_dev != NULL ) {
+					bleat_printf( 1, "pci: %04X:%02X:%02X.%01X, max VF's: %d", dev_info.pci_dev->addr.domain, dev_info.pci_dev->addr.bus,
+						dev_info.pci_dev->addr.devid , dev_info.pci_dev->addr.function, dev_info.max_vfs );
+				} else {
+					bleat_printf( 1, "vdev: %s, simulated VF's: %d", pciid, port->nvfs_config );
+				}
 				
 				rte_eth_dev_info_get(portid, &pf_dev);
 				switch( get_nic_type( portid ) ) {		// read pci config to get a generic offset and stride of VFs
@@ -1774,6 +2063,10 @@ main(int argc, char **argv)
 					case VFD_MLX5:
 						pci_control_r = vfd_mlx5_pf_vf_offset(port->pciid) | (1 << 16);
 						break;
+
+					case VFD_SIM:
+						pci_control_r = (1 << 16) | 1;				// no config space; offset 1, stride 1
+						break;
 				}
 
 				port->vf_offset = pci_control_r & 0x0ffff;
@@ -1786,6 +2079,12 @@ main(int argc, char **argv)
 		
 		bleat_printf( 2, "port initialisation complete" );
 
+		vfd_pcap_start( g_parms );										// optional capture of drained pf traffic; not fatal if it can't start
+		if( vfd_drain_start( running_config ) != 0 ) {					// pf rx queues which need draining are handled off the main loop
+			bleat_printf( 0, "CRI: abort: unable to start the pf drain thread" );
+			rte_exit( EXIT_FAILURE, "Cannot create pf drain thread\n" );
+		}
+
 		set_signals();												// register signal handlers
 
 		gettimeofday(&st.startTime, NULL);
@@ -1800,7 +2099,34 @@ main(int argc, char **argv)
 	}
 
 
-	vfd_add_all_vfs( g_parms, running_config );							// read all existing config files and add the VFs to the config
+	if( g_parms->forreal ) {
+		vfd_ctrs_load( g_parms, running_config );						// pick up vf counters saved by the last run; before any stats are read
+	}
+
+	if( snap != NULL ) {
+		if( (restored = vfd_state_restore( snap, running_config, warm_start )) == VST_STALE ) {	// pf vf counts changed since it was written
+			restored = 0;
+			warm_start = 0;												// vfs from the files are programmed in full
+		} else {
+			if( restored < 0 ) {										// read validated it; failure now leaves a partial config
+				bleat_printf( 0, "CRI: abort: unable to restore vfs from the state snapshot" );
+				rte_exit( EXIT_FAILURE, "initialisation failure, see log(s) in: %s\n", g_parms->log_dir );
+			}
+			restored = 1;
+		}
+		vfd_state_free( snap );
+		snap = NULL;
+	}
+
+	if( restored ) {
+		if( warm_start ) {
+			vfd_state_verify( g_parms, running_config );				// fix vfs whose nic settings drifted
+			vfd_state_save( g_parms, running_config, 0 );				// a second restart from this snapshot would not be warm
+		}
+	} else {
+		vfd_add_all_vfs( g_parms, running_config );						// read all existing config files and add the VFs to the config
+		vfd_state_changed();											// snapshot what was read for the next start
+	}
 
 	if( vfd_update_nic( g_parms, running_config ) != 0 ) {				// now that dpdk is initialised run the list and 'activate' everything
 		bleat_printf( 0, "CRI: abort: unable to initialise nic with base config:" );
@@ -1810,8 +2136,16 @@ main(int argc, char **argv)
 			exit( 1 );
 		}
 	}
+	for( j = 0; j < running_config->num_ports; j++ ) {
+		running_config->ports[j].flags &= ~PF_WARM;						// from here on changes are made as usual
+	}
 	
-	run_start_cbs( running_config );				// run any user startup callback commands defined in VF configs
+	signal( SIGCHLD, SIG_DFL );						// daemonize ignores it; callback commands are reaped by the executor so status can be had
+	if( warm_start ) {
+		bleat_printf( 1, "warm start: start callbacks are not run" );	// the vfs never went down
+	} else {
+		run_start_cbs( running_config );			// queue any user startup callback commands defined in VF configs
+	}
 
 	bleat_printf( 0, "version: %s", version );
 	bleat_printf( 0, "initialisation complete, setting bleat level to %d; starting to loop", g_parms->log_level );
@@ -1835,10 +2169,18 @@ main(int argc, char **argv)
 		usleep(50000);			// .5s
 
 		while( vfd_req_if( g_parms, running_config, 0 ) ); 				// process _all_ pending requests before going on
-		// Discard any RX traffic...
-		for (portid = 0; portid < n_ports; portid++)
-			discard_pf_traffic(portid);
-
+		vfd_state_tick( g_parms, running_config );						// snapshot the config if the requests changed it
+#if VFD_KERNEL
+		vfd_nl_flush();													// send netdev add/delete notifications queued by the requests
+#endif
+		vfd_ctrs_tick( g_parms, running_config );						// keep narrow nic counters from wrapping unseen; save counters
+		vfd_throttle_tick( g_parms, running_config );					// throttle noisy vfs (before rebalance so it skips them)
+		vfd_rebal_tick( g_parms, running_config );						// rebalance vf bandwidth if enabled and it's time
+		vfd_recon_tick( g_parms, running_config );						// reconcile vf settings on the nic with the config if enabled and it's time
+		cbx_poll( cb_exec );											// start queued callback commands, log output and completions
+#if VFD_KERNEL
+		vfd_nl_stats_tick( g_parms, running_config );					// push vf stats to the vfd-net module
+#endif
 	}		// end !terminated while
 
 #if VFD_KERNEL
@@ -1846,18 +2188,29 @@ main(int argc, char **argv)
 	device_message(0, 0, NL_PF_RES_DEV_RQ, NL_PF_RESP_OK);
 #endif	
 
-	bleat_printf( 0, "terminating" );
+	if( warm_stop && g_parms->forreal ) {
+		if( ! vfd_state_save( g_parms, running_config, 1 ) ) {		// without the snapshot the next start is cold; stop as usual
+			bleat_printf( 0, "WRN: warm stop: snapshot not written; stopping cold" );
+			warm_stop = 0;
+		}
+	}
+
+	bleat_printf( 0, "terminating%s", warm_stop ? " (warm, vfs left configured)" : "" );
 	log_port_state( NULL, "not ready" );								// mark all ports down in log
-	run_stop_cbs( running_config );										// run any user stop callback commands that were given in VF conf files
+	run_stop_cbs( running_config, warm_stop );							// run any user stop callback commands that were given in VF conf files
+	if( g_parms->forreal ) {
+		vfd_ctrs_save( g_parms, running_config );						// counters carry on from here on restart
+	}
 
 	if( fd >= 0 ) {
 		close(fd);
 	}
 
-	close_ports();				// clean up the PFs, terminate mirrors
+	close_ports( warm_stop );	// clean up the PFs, terminate mirrors
 
 	gettimeofday(&st.endTime, NULL);
 	bleat_printf( 1, "duration %.f sec\n", timeDelta(&st.endTime, &st.startTime));
 
+	clean_exit = 1;
 	return EXIT_SUCCESS;
 }
@@ -38,14 +38,23 @@
 
 	Author:		E. Scott Daniels
 	Date:		06 June 2016
+
+	Mods:		18 Oct 2026 - Time credit and mlx5 tc qos writes.
+				18 Oct 2026 - Route credit settings for simulated ports to vfd_sim.
+				18 Oct 2026 - Write only the queue credits which changed and count register writes.
+				18 Oct 2026 - Add qos_apply_tcs() to push TC bandwidth settings to a running port.
 */
 
 #include "sriov.h"
 #include "vfd_qos.h"
+#include "vfd_timing.h"
 #include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
 
 static int option1 = 1;
 
+static uint32_t	last_credits[MAX_PORTS][MAX_QUEUES];	// credit values last written for each queue
+static int		credits_valid[MAX_PORTS];				// true once all queues on the port have been written
+
 /*
 	Set security buffer minimum ifg.
 */
@@ -194,8 +203,10 @@ static double compute_credit_factor( uint8_t *pctgs, int npctgs, int mtu ) {
 	constant max value based on an assumed burst max of 5x.
 */
 #define BURST_FACTOR	5
-extern void qos_set_tdplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntcs, int mtu ) {
+#define QOS_SP_BITS		0xc0000000		// lsp (31) and gsp (30) bits in the T2 config registers
+extern int qos_set_tdplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntcs, int mtu ) {
 	int i;
+	int bad = 0;				// registers which did not read back as written
 	uint32_t cval;				// current value
 	uint32_t offset;
 	uint32_t mask = 0x3f000000;	// mask which preserves reserved bits in current value
@@ -214,9 +225,14 @@ extern void qos_set_tdplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntc
 		port_pci_reg_write( pf, offset, (cval & mask) | max | credits | group );		
 		bleat_printf( 1, "qos: set tdplane:  tc=%d cur=0x%08x max=%d creds=%d grp=%d write: [%04x] -> 0x%02x",
 			i, (int) cval, (int) credits * BURST_FACTOR, (int) credits, (int) bwgs[i], (int) offset, (int) (cval & mask) | max | credits | group );
+		if( (port_pci_reg_read( pf, offset ) & ~mask & ~QOS_SP_BITS) != ((max | credits | group) & ~mask & ~QOS_SP_BITS) ) {
+			bad++;
+		}
 
 		offset += 4;
 	}
+
+	return bad;
 }
 
 /*
@@ -230,8 +246,9 @@ extern void qos_set_tdplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntc
 
 	This should be covered by the current DPDK DCB mode setup. (alas it does not)
 */
-extern void qos_set_txpplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntcs, int mtu ) {
+extern int qos_set_txpplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntcs, int mtu ) {
 	int i;
+	int bad = 0;				// registers which did not read back as written
 	uint32_t cval;				// current value
 	uint32_t offset;
 	uint32_t mask = 0x3f000000;
@@ -251,9 +268,14 @@ extern void qos_set_txpplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int nt
 		port_pci_reg_write( pf, offset, (cval & mask) | max | credits | group );		
 		bleat_printf( 1, "qos: set txpplane:  tc=%d cur=0x%08x max=%d creds=%d grp=%d write: [%04x] -> 0x%02x",
 			i, (int) cval, (int) credits * BURST_FACTOR, (int) credits, (int) bwgs[i], (int) offset, (int) (cval & mask) | max | credits | group );
+		if( (port_pci_reg_read( pf, offset ) & ~mask & ~QOS_SP_BITS) != ((max | credits | group) & ~mask & ~QOS_SP_BITS) ) {
+			bad++;
+		}
 
 		offset += 4;
 	}
+
+	return bad;
 }
 
 /*
@@ -288,12 +310,15 @@ extern void mlx5_set_vf_tcqos( sriov_port_t *port, uint32_t link_speed ) {
 	uint32_t rate;
 	int vfid;
 	int i, j;
+	uint64_t vt_start;
 
 	if (port->ntcs != 8) {
 		bleat_printf( 1, "mlx5 set vf tc qos: Cannot set configuration if less then 8 tcs");
 		return;
 	}
 
+	vt_start = vfd_timing_start();
+
 	for(i = 0; i < port->num_vfs; i++) {
 		vfid = port->vfs[i].num;
 		if( vfid >= 0 ) {
@@ -305,6 +330,7 @@ extern void mlx5_set_vf_tcqos( sriov_port_t *port, uint32_t link_speed ) {
 			}
 		}
 	}
+	vfd_timing_add( port->rte_port_number, VT_TCQOS, vt_start );
 }
 /*
 	Accepts an array of percentages (rates), where each element defines a percentage of the related
@@ -329,6 +355,12 @@ extern void mlx5_set_vf_tcqos( sriov_port_t *port, uint32_t link_speed ) {
 			q3 receives (57/10) * 141 = 804 credits
 
 	MTU cannot be less than 1536 bytes (1.5 * 1024) and thus the minmum number of credits is 24.
+
+	The credit value last written for each queue is kept and only queues whose value
+	changes are written; the first call for a port writes them all. Because credits
+	are relative to the smallest share in the TC, renormalisation after an add or
+	delete usually leaves most of them unchanged. Register writes are counted (see
+	show timings).
 */
 extern void qos_set_credits( portid_t pf, int mtu, int* rates, int tc8_mode ) {
 	uint32_t	sel_offset = 0x04904;				// offset of the selector register
@@ -341,9 +373,15 @@ extern void qos_set_credits( portid_t pf, int mtu, int* rates, int tc8_mode ) {
 	int			tc;
 	int			i;
 	int			j;
+	int			sim;								// simulated port; nothing to write to
+	int			cache;								// last written values can be used
+	int			nwrites = 0;
+	uint64_t	vt_start;
 
 	int 	num_tcs = 4;
 
+	vt_start = vfd_timing_start();
+
 	if( tc8_mode ) {
 		num_tcs = 8;
 	}
@@ -366,11 +404,25 @@ extern void qos_set_credits( portid_t pf, int mtu, int* rates, int tc8_mode ) {
 		bleat_printf( 3, "qos_set_credits: pf=%d tc=%d factor=%.2f", (int) pf, i, cred_factor[i] );
 	}
 	
+	sim = vfd_sim_is_port( pf );
+	cache = pf < MAX_PORTS && credits_valid[pf];
 	mask = 0xffffc000;								// we set bits 0:13; we'll mask those off the current value first to preserve what might be set
 	for( q = 0; q < MAX_QUEUES; q++ ) {				// set the credits for each of the possible queues
 		tc = q % num_tcs;
 		amt = ceil( (double)rates[q] * cred_factor[tc] );					// figure the amount for this pool
 
+		if( cache && last_credits[pf][q] == amt ) {
+			continue;														// unchanged; no need to touch the nic
+		}
+		if( pf < MAX_PORTS ) {
+			last_credits[pf][q] = amt;
+		}
+		nwrites += 2;
+
+		if( sim ) {
+			continue;														// counted, but no registers to poke
+		}
+
 		// --- this seems dodgy if another process/thread can select before we make our second write ----
 		port_pci_reg_write( pf, sel_offset, q );						// select the queue to work on
 		cval = port_pci_reg_read( pf, reg_offset );						// read to preserve reserved bits
@@ -379,6 +431,121 @@ extern void qos_set_credits( portid_t pf, int mtu, int* rates, int tc8_mode ) {
 			bleat_printf( 2, "qos set rate: q=%d mtu=%d rate=%d%% credits=%d cval&mask|amt=%08x", q, mtu, rates[q], amt, (cval & mask) | amt );
 		}
 	}
+
+	if( pf < MAX_PORTS ) {
+		credits_valid[pf] = 1;
+	}
+	if( sim ) {
+		vfd_sim_set_qshares( pf, rates );			// let the simulator capture the shares
+	}
+
+	bleat_printf( 2, "qos_set_credits: pf=%d register writes=%d", (int) pf, nwrites );
+	vfd_timing_regw( pf, nwrites );
+	vfd_timing_add( pf, VT_QOS_CREDITS, vt_start );
+}
+
+/*
+	Force the next qos_set_credits() call for the port to write every queue. Should
+	be called if the nic is reset or initialised after credits were set.
+*/
+extern void qos_reset_credits( portid_t pf ) {
+	if( pf < MAX_PORTS ) {
+		credits_valid[pf] = 0;
+	}
+}
+
+
+/*
+	Set or clear the link strict priority (bit 31) and group strict priority (bit 30)
+	bits for each TC in both the descriptor and packet plane T2 config registers.
+	Flags are the TCF_ flags for each TC. Must be called after the planes are set
+	as setting them clears these bits.
+*/
+static void qos_set_strict( portid_t pf, uint8_t* flags, int ntcs ) {
+	uint32_t	offsets[2] = { 0x04910, 0x0cd20 };		// RTTDT2C and RTTPT2C
+	uint32_t	cval;
+	uint32_t	val;
+	int			i;
+	int			j;
+
+	for( j = 0; j < 2; j++ ) {
+		for( i = 0; i < ntcs; i++ ) {
+			val = 0;
+			if( flags[i] & TCF_LNK_STRICTP ) {
+				val |= 0x80000000;
+			}
+			if( flags[i] & TCF_BW_STRICTP ) {
+				val |= 0x40000000;
+			}
+
+			cval = port_pci_reg_read( pf, offsets[j] + (i * 4) );
+			if( (cval & QOS_SP_BITS) != val ) {
+				port_pci_reg_write( pf, offsets[j] + (i * 4), (cval & ~QOS_SP_BITS) | val );
+				bleat_printf( 2, "qos: set strict: tc=%d [%04x] 0x%08x -> 0x%08x", i, (int) offsets[j] + (i * 4), cval, (cval & ~QOS_SP_BITS) | val );
+			}
+		}
+	}
+}
+
+/*
+	Push the TC bandwidth configuration currently in the port (min bandwidth
+	percentages and strict priority flags from tc_config, and the tc2bwg map) to
+	the nic. The descriptor and packet planes are rewritten and, because the arbiter
+	has been reprogrammed, every queue's credits are pushed again. This can be
+	invoked on a running port; the port is not reinitialised.
+
+	Returns 0 on success; non-zero if the nic did not accept the settings (the
+	caller is expected to restore the previous settings and call again).
+*/
+extern int qos_apply_tcs( sriov_port_t* port ) {
+	uint8_t		pctgs[MAX_TCS];
+	uint8_t		flags[MAX_TCS];
+	portid_t	pf;
+	int			i;
+	int			rc = 0;
+	uint64_t	vt_start;
+
+	pf = port->rte_port_number;
+	memset( pctgs, 0, sizeof( pctgs ) );
+	memset( flags, 0, sizeof( flags ) );
+	for( i = 0; i < port->ntcs; i++ ) {
+		if( port->tc_config[i] == NULL ) {
+			bleat_printf( 0, "qos apply tcs: port %d has no configuration for tc %d", (int) pf, i );
+			return 1;
+		}
+
+		pctgs[i] = port->tc_config[i]->min_bw;
+		flags[i] = port->tc_config[i]->flags;
+	}
+
+	vt_start = vfd_timing_start();
+	switch( get_nic_type( pf ) ) {
+		case VFD_MLX5:
+			rc = vfd_mlx5_set_qos_pf( pf, port->tc_config, port->ntcs );
+			break;
+
+		case VFD_SIM:
+			break;								// nothing to program
+
+		default:
+			rc = qos_set_tdplane( pf, pctgs, port->tc2bwg, port->ntcs, port->mtu );
+			rc += qos_set_txpplane( pf, pctgs, port->tc2bwg, port->ntcs, port->mtu );
+			qos_set_strict( pf, flags, port->ntcs );
+			break;
+	}
+	vfd_timing_add( pf, VT_TCQOS, vt_start );
+
+	if( rc != 0 ) {
+		bleat_printf( 0, "ERR: qos apply tcs: port %d: nic did not accept tc bandwidth settings: %d", (int) pf, rc );
+		return rc;
+	}
+
+	if( port->vftc_qshares != NULL && get_nic_type( pf ) != VFD_MLX5 ) {
+		qos_reset_credits( pf );
+		qos_set_credits( pf, port->mtu, port->vftc_qshares, TC_4PERQ_MODE );
+	}
+
+	return 0;
 }
 
 
@@ -680,6 +847,7 @@ extern int enable_dcb_qos( sriov_port_t *port, int* pctgs, int tc8_mode, int opt
 	qos_set_fcc( pf ); 							// from the list -- step 2
 
 												// from the list step 3
+	qos_reset_credits( pf );
 	qos_set_credits( pf, port->mtu, pctgs, tc8_mode );		// set quantums based on percentages
 	//qos_set_tdplane( pf );				// tc plane
 	//qos_set_txpplane( pf );				// tx and rx packet plane
@@ -32,6 +32,19 @@
 				06 Apr 2017 - Add set flowcontrol function, add mtu/jumbo confirmation msg to log.
 				22 May 2017 - Add ability to remove a whitelist RX mac.
 				10 Oct 2017 - Add range check on mirror target.
+				18 Oct 2026 - Add per operation latency timing to the dispatch functions.
+				18 Oct 2026 - Add simulated nic (vfd_sim) to the dispatch functions.
+				18 Oct 2026 - Port init supports virtual devices attached to the simulator.
+				18 Oct 2026 - Pull vf stats fetch into get_vf_stats() so the rebalancer can use it.
+				18 Oct 2026 - Link state change handled by vfd_link_change().
+				18 Oct 2026 - VF stats returned by get_vf_stats() are monotonic (vfd_ctrs.c).
+				18 Oct 2026 - Extended stats moved to vfd_xstats.c (cached name/id maps).
+				18 Oct 2026 - discard_pf_traffic() returns counts; bnxt ports ask for rx queue interrupts.
+				18 Oct 2026 - Offer discarded pf traffic to the pf capture.
+				18 Oct 2026 - Add set_mirror_mask(); pf queue 0 is drained while a software mirror is active.
+				18 Oct 2026 - Add get_vf_hw_state(). On a warm restart port_init() leaves the vf untagged
+					setting where it is already off and does not clear the port stats.
+				18 Oct 2026 - port_init() drops the cached queue credits for the port.
 
 	useful doc:
 				 http://www.intel.com/content/dam/doc/design-guide/82599-sr-iov-driver-companion-guide.pdf
@@ -41,6 +54,10 @@
 #include "sriov.h"
 #include "vfd_dcb.h"
 #include "vfd_mlx5.h"
+#include "vfd_timing.h"
+#include "vfd_ctrs.h"
+#include "vfd_pcap.h"
+#include "vfd_smirror.h"
 
 
 #define RTE_PMD_PARAM_UNSET -1
@@ -107,11 +124,33 @@ int
 get_num_vfs( uint32_t port_id ) {
 	struct rte_eth_dev_info dev_info;
 
+	if( vfd_sim_is_port( port_id ) ) {
+		return vfd_sim_get_num_vfs( port_id );
+	}
+
 	rte_eth_dev_info_get( port_id, &dev_info );
 
 	return dev_info.max_vfs;
 }
 
+/*
+	Fill in the link information for the port without waiting. Simulated
+	ports are answered by the simulator; all others by dpdk. The struct is
+	cleared first so that a port which dpdk doesn't know about reports down
+	with a speed of 0 rather than garbage.
+*/
+int
+vfd_link_get( portid_t port_id, struct rte_eth_link* link ) {
+	memset( link, 0, sizeof( *link ) );
+
+	if( vfd_sim_is_port( port_id ) ) {
+		return vfd_sim_link_get( port_id, link );
+	}
+
+	rte_eth_link_get_nowait( port_id, link );
+	return 0;
+}
+
 /*
 	Accept a null termianted, human readable MAC and convert it into
 	an ether_addr struct.
@@ -152,6 +191,10 @@ get_nic_type(portid_t port_id)
 	static int warned = 0;
 	struct rte_eth_dev_info dev_info;
 
+	if( vfd_sim_is_port( port_id ) ) {						// simulated ports have no dpdk device behind them
+		return VFD_SIM;
+	}
+
 	memset( &dev_info, 0, sizeof( dev_info ) );			// keep valgrind from complaining
 	rte_eth_dev_info_get(port_id, &dev_info);
 
@@ -187,14 +230,20 @@ set_vf_link_status(portid_t port_id, uint16_t vf, int status)
 	if ((status > VF_LINK_ON) || (status < VF_LINK_OFF))
 			bleat_printf( 0, "set_vf_link_status: invalid link status: %d, port: %u", status, port_id);
 
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_MLX5:
 			diag = vfd_mlx5_set_vf_link_status(port_id, vf, status);
 			break;
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_link_status(port_id, vf, status);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_link_status: unknown device type: %u, port: %u", port_id, dev_type);
 	}
+	vfd_timing_add( port_id, VT_LINK_STATUS, vt_start );
 
 	if (diag != 0) {
 		bleat_printf( 0, "set_vf_link_status: unable to set link state %d: (%d) %s", status, diag, strerror( -diag ) );
@@ -211,6 +260,7 @@ set_vf_min_rate(portid_t port_id, uint16_t vf, uint16_t rate, uint64_t q_msk)
 	if (q_msk == 0)
 		return 0;
 
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -226,10 +276,15 @@ set_vf_min_rate(portid_t port_id, uint16_t vf, uint16_t rate, uint64_t q_msk)
 			diag = vfd_mlx5_set_vf_min_rate(port_id, vf, rate);
 			break;
 
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_min_rate(port_id, vf, rate);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_min_rate: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_MIN_RATE, vt_start );
 
 	if (diag != 0) {
 		bleat_printf( 0, "set_vf_min_rate: unable to set value %u: (%d) %s", rate, diag, strerror( -diag ) );
@@ -248,12 +303,13 @@ set_vf_rate_limit(portid_t port_id, uint16_t vf, uint16_t rate, uint64_t q_msk)
 		return 0;
 
 
-	rte_eth_link_get_nowait(port_id, &link);
+	vfd_link_get(port_id, &link);
 	if (rate > link.link_speed) {
 		bleat_printf( 0, "set_vf_rate: invalid rate value: %u bigger than link speed: %u", rate, link.link_speed);
 		return 1;
 	}
 	
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -270,10 +326,15 @@ set_vf_rate_limit(portid_t port_id, uint16_t vf, uint16_t rate, uint64_t q_msk)
 			diag = vfd_mlx5_set_vf_rate_limit(port_id, vf, rate);
 			break;
 
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_rate_limit(port_id, vf, rate);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_rate: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_RATE_LIMIT, vt_start );
 
 	if (diag != 0) {
 		bleat_printf( 0, "set_vf_rate: unable to set value %u: (%d) %s", rate, diag, strerror( -diag ) );
@@ -293,6 +354,7 @@ tx_vlan_insert_set_on_vf(portid_t port_id, uint16_t vf_id, int vlan_id)
 {
 	int diag = 0;
 			
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -311,10 +373,15 @@ tx_vlan_insert_set_on_vf(portid_t port_id, uint16_t vf_id, int vlan_id)
 			diag = vfd_mlx5_set_vf_vlan_insert( port_id, vf_id, vlan_id );
 			break;
 			
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_vlan_insert( port_id, vf_id, vlan_id );
+			break;
+
 		default:
 			bleat_printf( 0, "tx_vlan_insert_set_on_vf: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_VLAN_INSERT, vt_start );
 	
 	if (diag < 0) {
 		bleat_printf( 0, "set tx vlan insert on vf failed: port_pi=%d, vf_id=%d, vlan_id=%d) failed rc=%d", port_id, vf_id, vlan_id, diag );
@@ -328,6 +395,7 @@ tx_cvlan_insert_set_on_vf(portid_t port_id, uint16_t vf_id, int vlan_id)
 {
 	int diag = 0;
 			
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -343,10 +411,15 @@ tx_cvlan_insert_set_on_vf(portid_t port_id, uint16_t vf_id, int vlan_id)
 			diag = vfd_mlx5_set_vf_cvlan_insert( port_id, vf_id, vlan_id );
 			break;
 			
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_cvlan_insert( port_id, vf_id, vlan_id );
+			break;
+
 		default:
 			bleat_printf( 0, "tx_cvlan_insert_set_on_vf: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_CVLAN_INSERT, vt_start );
 	
 	if (diag < 0) {
 		bleat_printf( 0, "set tx cvlan insert on vf failed: port_pi=%d, vf_id=%d, vlan_id=%d) failed rc=%d", port_id, vf_id, vlan_id, diag );
@@ -360,6 +433,7 @@ rx_vlan_strip_set_on_vf(portid_t port_id, uint16_t vf_id, int on)
 {
 	int diag = 0;
 			
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -378,10 +452,15 @@ rx_vlan_strip_set_on_vf(portid_t port_id, uint16_t vf_id, int on)
 			diag = vfd_mlx5_set_vf_vlan_stripq(port_id, vf_id, on);
 			break;
 
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_vlan_stripq(port_id, vf_id, on);
+			break;
+
 		default:
 			bleat_printf( 0, "rx_vlan_strip_set_on_vf: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_VLAN_STRIP, vt_start );
 
 	if (diag < 0) {
 		bleat_printf( 0, "set rx vlan strip on vf failed: port_pi=%d, vf_id=%d, on=%d) failed rc=%d", port_id, vf_id, on, diag );
@@ -395,6 +474,7 @@ rx_cvlan_strip_set_on_vf(portid_t port_id, uint16_t vf_id, int on)
 {
 	int diag = 0;
 			
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -409,10 +489,15 @@ rx_cvlan_strip_set_on_vf(portid_t port_id, uint16_t vf_id, int on)
 		case VFD_MLX5:
 			break;
 
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_cvlan_stripq(port_id, vf_id, on);
+			break;
+
 		default:
 			bleat_printf( 0, "rx_cvlan_strip_set_on_vf: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_CVLAN_STRIP, vt_start );
 
 	if (diag < 0) {
 		bleat_printf( 0, "set rx cvlan strip on vf failed: port_pi=%d, vf_id=%d, on=%d) failed rc=%d", port_id, vf_id, on, diag );
@@ -426,6 +511,7 @@ set_vf_allow_bcast(portid_t port_id, uint16_t vf_id, int on)
 {
   int ret = 0;
 
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -443,10 +529,15 @@ set_vf_allow_bcast(portid_t port_id, uint16_t vf_id, int on)
 		case VFD_MLX5:
 			break;
 
+		case VFD_SIM:
+			ret = vfd_sim_set_vf_broadcast(port_id, vf_id, on);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_allow_bcast: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_ALLOW_BCAST, vt_start );
 	
 	if (ret < 0) {
 		bleat_printf( 0, "set allow bcast failed: port/vf %d/%d on/off=%d rc=%d", port_id, vf_id, on, ret );
@@ -461,6 +552,7 @@ set_vf_allow_mcast(portid_t port_id, uint16_t vf_id, int on)
 {
 	int ret = 0;
 
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -478,10 +570,15 @@ set_vf_allow_mcast(portid_t port_id, uint16_t vf_id, int on)
 		case VFD_MLX5:
 			ret = vfd_mlx5_set_vf_promisc(port_id, vf_id, on);
 			break;
+		case VFD_SIM:
+			ret = vfd_sim_set_vf_multicast_promisc(port_id, vf_id, on);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_allow_mcast: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_ALLOW_MCAST, vt_start );
 	
 	if (ret < 0) {
 		bleat_printf( 0, "set allow mcast failed: port/vf %d/%d on/off=%d rc=%d", port_id, vf_id, on, ret );
@@ -496,6 +593,7 @@ set_vf_allow_un_ucast(portid_t port_id, uint16_t vf_id, int on)
 {
 	int ret = 0;
 
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -514,10 +612,15 @@ set_vf_allow_un_ucast(portid_t port_id, uint16_t vf_id, int on)
 			ret = vfd_mlx5_set_vf_promisc(port_id, vf_id, on);
 			break;
 
+		case VFD_SIM:
+			ret = vfd_sim_set_vf_unicast_promisc(port_id, vf_id, on);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_allow_un_ucast: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_ALLOW_UN_UCAST, vt_start );
 	
 	if (ret < 0) {
 		bleat_printf( 0, "set allow ucast failed: port/vf %d/%d on/off=%d rc=%d", port_id, vf_id, on, ret );
@@ -532,6 +635,7 @@ set_vf_allow_untagged(portid_t port_id, uint16_t vf_id, int on)
 {
 	int ret = 0;
 
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -549,10 +653,15 @@ set_vf_allow_untagged(portid_t port_id, uint16_t vf_id, int on)
 			ret = vfd_mlx5_set_vf_vlan_filter(port_id, 0, VFN2MASK(vf_id), on);
 			break;
 			
+		case VFD_SIM:
+			ret = vfd_sim_allow_untagged(port_id, vf_id, on);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_allow_untagged: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_ALLOW_UNTAGGED, vt_start );
 	
 	if (ret < 0) {
 		bleat_printf( 3, "set allow untagged failed: port/vf %d/%d on/off=%d rc=%d", port_id, vf_id, on, ret );
@@ -573,6 +682,7 @@ set_vf_rx_mac(portid_t port_id, const char* mac, uint32_t vf,  uint8_t on)
   struct ether_addr mac_addr;
   ether_aton_r(mac, &mac_addr);
 
+  uint64_t vt_start = vfd_timing_start();
   uint dev_type = get_nic_type(port_id);
 	if(on)
 	{
@@ -593,6 +703,10 @@ set_vf_rx_mac(portid_t port_id, const char* mac, uint32_t vf,  uint8_t on)
 				diag = vfd_mlx5_set_vf_mac_addr(port_id, vf, mac, on);
 				break;
 
+			case VFD_SIM:
+				diag = vfd_sim_set_vf_mac_addr(port_id, vf, &mac_addr, on);
+				break;
+
 			default:
 				bleat_printf( 0, "set_vf_rx_mac: unknown device type: %u, port: %u", port_id, dev_type);
 				break;	
@@ -608,6 +722,10 @@ set_vf_rx_mac(portid_t port_id, const char* mac, uint32_t vf,  uint8_t on)
 			case VFD_MLX5:
 				diag = vfd_mlx5_set_vf_mac_addr(port_id, vf, mac, on);
 				break;
+			case VFD_SIM:
+				diag = vfd_sim_set_vf_mac_addr(port_id, vf, &mac_addr, on);
+				break;
+
 			default:
 				diag = rte_eth_dev_mac_addr_remove( port_id, &mac_addr );
 				break;
@@ -619,6 +737,8 @@ set_vf_rx_mac(portid_t port_id, const char* mac, uint32_t vf,  uint8_t on)
 			bleat_printf( 3, "delete rx mac successful: pf/vf=%d/%d on/off=%d mac=%s", (int)port_id, (int)vf, on, mac );
 		}
 	}
+
+	vfd_timing_add( port_id, VT_RX_MAC, vt_start );
 }
 
 
@@ -637,6 +757,7 @@ void set_vf_default_mac( portid_t port_id, const char* mac, uint32_t vf ) {
 	struct ether_addr mac_addr;
 	ether_aton_r(mac, &mac_addr);
 
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -655,10 +776,15 @@ void set_vf_default_mac( portid_t port_id, const char* mac, uint32_t vf ) {
 			diag = vfd_mlx5_set_vf_def_mac_addr(port_id, vf, mac);
 			break;
 
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_default_mac_addr(port_id, vf, &mac_addr );
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_def_mac: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_DEFAULT_MAC, vt_start );
 
 	if (diag < 0) {
 		bleat_printf( 0, "set default rx mac failed: pf/vf=%d/%d mac=%s rc=%d", (int)port_id, (int)vf, mac, diag );
@@ -675,6 +801,7 @@ set_vf_rx_vlan(portid_t port_id, uint16_t vlan_id, uint64_t vf_mask, uint8_t on)
 {
 	int diag = 0;
 
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -693,10 +820,15 @@ set_vf_rx_vlan(portid_t port_id, uint16_t vlan_id, uint64_t vf_mask, uint8_t on)
 			diag = vfd_mlx5_set_vf_vlan_filter(port_id, vlan_id, vf_mask, on);
 			break;
 			
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_vlan_filter(port_id, vlan_id, vf_mask, on);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_rx_vlan: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_RX_VLAN, vt_start );
 	
 	if (diag < 0) {
 		bleat_printf( 0, "set rx vlan filter failed: port=%d vlan=%d on/off=%d rc=%d", (int)port_id, (int) vlan_id, on, diag );
@@ -712,6 +844,7 @@ set_vf_vlan_anti_spoofing(portid_t port_id, uint32_t vf, uint8_t on)
 {
 	int diag = 0;
 			
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -729,10 +862,15 @@ set_vf_vlan_anti_spoofing(portid_t port_id, uint32_t vf, uint8_t on)
 		case VFD_MLX5:
 			break;
 
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_vlan_anti_spoof(port_id, vf, on);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_vlan_anti_spoofing: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}	
+	vfd_timing_add( port_id, VT_VLAN_ANTISPOOF, vt_start );
 	
 	if (diag < 0) {
 		bleat_printf( 0, "set vlan antispoof failed: pf/vf=%d/%d on/off=%d rc=%d", (int)port_id, (int)vf, on, diag );
@@ -748,6 +886,7 @@ set_vf_mac_anti_spoofing(portid_t port_id, uint32_t vf, uint8_t on)
 {
 	int diag = 0;
 			
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -766,10 +905,15 @@ set_vf_mac_anti_spoofing(portid_t port_id, uint32_t vf, uint8_t on)
 			diag = vfd_mlx5_set_vf_mac_anti_spoof(port_id, vf, on);
 			break;
 			
+		case VFD_SIM:
+			diag = vfd_sim_set_vf_mac_anti_spoof(port_id, vf, on);
+			break;
+
 		default:
 			bleat_printf( 0, "set_vf_mac_anti_spoofing: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}	
+	vfd_timing_add( port_id, VT_MAC_ANTISPOOF, vt_start );
 	
 	if (diag < 0) {
 		bleat_printf( 0, "set mac antispoof failed: pf/vf=%d/%d on/off=%d rc=%d", (int)port_id, (int)vf, on, diag );
@@ -784,6 +928,7 @@ tx_set_loopback(portid_t port_id, u_int8_t on)
 {
 	int diag = 0;
 			
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -801,10 +946,15 @@ tx_set_loopback(portid_t port_id, u_int8_t on)
 		case VFD_MLX5:
 			break;
 
+		case VFD_SIM:
+			diag = vfd_sim_set_tx_loopback(port_id, on);
+			break;
+
 		default:
 			bleat_printf( 0, "tx_set_loopback: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}	
+	vfd_timing_add( port_id, VT_LOOPBACK, vt_start );
 
 	if (diag < 0) {
 		bleat_printf( 0, "set tx loopback failed: port=%d on/off=%d rc=%d", (int)port_id, on, diag );
@@ -821,6 +971,15 @@ tx_set_loopback(portid_t port_id, u_int8_t on)
 	other use).
 */
 int set_mirror( portid_t port_id, uint32_t vf, uint8_t id, uint8_t target, uint8_t direction ) {
+	return set_mirror_mask( port_id, (uint64_t) 1 << vf, id, target, direction );
+}
+
+/*
+	Set a mirror rule covering all of the pools (vfs) in pool_mask. The software mirror
+	(vfd_smirror.c) uses this to steer every soft mirrored vf on a port to the PF pool
+	with one rule per direction.
+*/
+int set_mirror_mask( portid_t port_id, uint64_t pool_mask, uint8_t id, uint8_t target, uint8_t direction ) {
 	struct rte_eth_mirror_conf mconf;
 	uint8_t on_off = SET_ON;
 	int state = 0;
@@ -832,7 +991,7 @@ int set_mirror( portid_t port_id, uint32_t vf, uint8_t id, uint8_t target, uint8
 
 	memset( &mconf, 0, sizeof( mconf ) );
 	mconf.dst_pool = target;					// assume 1:1 vf to pool mapping
-	mconf.pool_mask = 1 << vf;
+	mconf.pool_mask = pool_mask;
 
 	switch( direction ) {
 		case MIRROR_IN:
@@ -865,6 +1024,7 @@ int set_mirror( portid_t port_id, uint32_t vf, uint8_t id, uint8_t target, uint8
 }	
 
 int set_mirror_wrp( portid_t port_id, uint32_t vf, uint8_t id, uint8_t target, uint8_t direction ) {
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	int state = 0;
 	int on_off = (direction != MIRROR_OFF) ? 1 : 0; 
@@ -876,9 +1036,14 @@ int set_mirror_wrp( portid_t port_id, uint32_t vf, uint8_t id, uint8_t target, u
 			state = vfd_mlx5_set_mirror(port_id, vf, target, direction);
 			break;
 
+		case VFD_SIM:
+			state = vfd_sim_set_mirror(port_id, vf, target, direction);
+			break;
+
 		default:
 			state = set_mirror(port_id, vf, id, target, direction);
 	}
+	vfd_timing_add( port_id, VT_MIRROR, vt_start );
 
 	if( state < 0 ) {
 		bleat_printf( 0, "%s: set mirror for pf/vf=%d/%d mid=%d target=%d dir=%d on/off=%d failed: %d (%s)", 
@@ -909,6 +1074,9 @@ int get_split_ctlreg( portid_t port_id, uint16_t vf_id ) {
 		case VFD_BNXT:
 			break;
 			
+		case VFD_SIM:
+			break;
+
 		default:
 			bleat_printf( 0, "vfd_ixgbe_get_split_ctlreg: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
@@ -926,6 +1094,7 @@ int get_split_ctlreg( portid_t port_id, uint16_t vf_id ) {
 */
 void set_split_erop( portid_t port_id, uint16_t vf_id, int state ) {
 
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -940,10 +1109,15 @@ void set_split_erop( portid_t port_id, uint16_t vf_id, int state ) {
 			vfd_bnxt_set_split_erop(port_id, vf_id, state);
 			break;
 			
+		case VFD_SIM:
+			vfd_sim_set_split_erop(port_id, vf_id, state);
+			break;
+
 		default:
 			bleat_printf( 0, "set_split_erop: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_SPLIT_EROP, vt_start );
 }
 
 /*
@@ -965,6 +1139,10 @@ static void set_rx_drop(portid_t port_id, uint16_t vf_id, int state )
 			vfd_bnxt_set_rx_drop(port_id, vf_id, state);
 			break;
 			
+		case VFD_SIM:
+			vfd_sim_set_rx_drop(port_id, vf_id, state);
+			break;
+
 		default:
 			bleat_printf( 0, "set_rx_drop: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
@@ -992,6 +1170,10 @@ extern void set_pfrx_drop(portid_t port_id, int state )
 			//vfd_bnxt_set_pfrx_drop( port_id, state ); 				// not implemented TODO
 			break;
 			
+		case VFD_SIM:
+			vfd_sim_set_pfrx_drop( port_id, state );
+			break;
+
 		default:
 			bleat_printf( 0, "set_pfrx_drop: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
@@ -1017,6 +1199,7 @@ void set_queue_drop( portid_t port_id, int state ) {
 	bleat_printf( 2, "setting queue drop for port %d on all queues to: on/off=%d", port_id, !!state );
 	
 			
+	uint64_t vt_start = vfd_timing_start();
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
 		case VFD_NIANTIC:
@@ -1031,10 +1214,15 @@ void set_queue_drop( portid_t port_id, int state ) {
 			result = vfd_bnxt_set_all_queues_drop_en( port_id, !!state ); 				// not implemented TODO
 			break;
 			
+		case VFD_SIM:
+			result = vfd_sim_set_all_queues_drop_en( port_id, !!state );
+			break;
+
 		default:
 			bleat_printf( 0, "set_queue_drop: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
+	vfd_timing_add( port_id, VT_QUEUE_DROP, vt_start );
 	
 
 	if( result != 0 ) {
@@ -1112,6 +1300,10 @@ is_rx_queue_on(portid_t port_id, uint16_t vf_id, int* mcounter )
 			result = vfd_bnxt_is_rx_queue_on(port_id, vf_id, mcounter);
 			break;
 			
+		case VFD_SIM:
+			result = vfd_sim_is_rx_queue_on(port_id, vf_id, mcounter);
+			break;
+
 		default:
 			bleat_printf( 0, "is_rx_queue_on: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
@@ -1138,6 +1330,9 @@ disable_default_pool(portid_t port_id)
 		case VFD_BNXT:
 			break;
 			
+		case VFD_SIM:
+			break;
+
 		default:
 			bleat_printf( 0, "disable_default_pool: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
@@ -1304,8 +1499,13 @@ nic_stats_display(uint16_t port_id, char * buff, int bsize)
 {
 	struct rte_eth_stats stats;
 	struct rte_eth_link link;
-	rte_eth_link_get_nowait(port_id, &link);
-	rte_eth_stats_get(port_id, &stats);	
+	vfd_link_get(port_id, &link);
+	memset( &stats, 0, sizeof( stats ) );
+	if( vfd_sim_is_port( port_id ) ) {
+		vfd_sim_get_port_stats(port_id, &stats);
+	} else {
+		rte_eth_stats_get(port_id, &stats);	
+	}
 
 	uint dev_type = get_nic_type(port_id);
 	switch (dev_type) {
@@ -1324,6 +1524,10 @@ nic_stats_display(uint16_t port_id, char * buff, int bsize)
 		case VFD_MLX5:
 			spoffed[port_id] += vfd_mlx5_get_pf_spoof_stats(port_id); 
 			break;
+		case VFD_SIM:
+			spoffed[port_id] += vfd_sim_get_pf_spoof_stats(port_id);
+			break;
+
 		default:
 			bleat_printf( 0, "nic_stats_display: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
@@ -1352,6 +1556,74 @@ nic_stats_display(uint16_t port_id, char * buff, int bsize)
 	);
 }
 
+/*
+	Fetch the basic counters for a VF from whichever backend drives the port.
+	Stats is zeroed first as not all NICs fill in every field. The raw NIC
+	counters are folded into the monotonic software counters (vfd_ctrs.c) and
+	those are what is returned. Returns 0 on success.
+*/
+int get_vf_stats( portid_t port_id, uint16_t vf, struct rte_eth_stats* stats ) {
+	int result = 0;
+	uint dev_type;
+
+	memset( stats, 0, sizeof( *stats ) );
+	dev_type = get_nic_type( port_id );
+	switch( dev_type ) {
+		case VFD_NIANTIC:
+			result = vfd_ixgbe_get_vf_stats( port_id, vf, stats );
+			stats->oerrors = 0;
+			break;
+			
+		case VFD_FVL25:		
+			result = vfd_i40e_get_vf_stats( port_id, vf, stats );
+			break;
+
+		case VFD_BNXT:
+			result = vfd_bnxt_get_vf_stats( port_id, vf, stats );
+			break;
+			
+		case VFD_MLX5:
+			result = vfd_mlx5_get_vf_stats( port_id, vf, stats );
+			break;
+
+		case VFD_SIM:
+			result = vfd_sim_get_vf_stats( port_id, vf, stats );
+			break;
+
+		default:
+			bleat_printf( 0, "get_vf_stats: unknown device type: %u, port: %u", dev_type, port_id );
+			break;	
+	}
+
+	if( result == 0 ) {
+		vfd_ctrs_fold( port_id, vf, stats );
+	}
+
+	return result;
+}
+
+/*
+	Read the VF's settings back from the NIC into hw. Backends which cannot read
+	their settings leave valid at 0. Returns the VHW_ bits for the fields that
+	were read.
+*/
+int get_vf_hw_state( portid_t port_id, uint16_t vf, struct vf_hw_s* hw ) {
+	memset( hw, 0, sizeof( *hw ) );
+
+	switch( get_nic_type( port_id ) ) {
+		case VFD_NIANTIC:
+			return vfd_ixgbe_get_vf_hw_state( port_id, vf, hw );
+
+		case VFD_SIM:
+			return vfd_sim_get_vf_hw_state( port_id, vf, hw );
+
+		default:						// no readable vf state (i40e/bnxt/mlx5 settings are behind the admin queue or firmware)
+			break;
+	}
+
+	return 0;
+}
+
 /*
 *	prints VF statistics
 	Returns number of characters placd into buff, or -1 if error (vf not in use
@@ -1390,31 +1662,18 @@ vf_stats_display(uint16_t port_id, uint32_t pf_ari, int ivf, char * buff, int bs
 
 
 	struct rte_eth_stats stats;
-	memset( &stats, 0, sizeof( stats ) );			// not all NICs fill all data, so ensure we have 0s
-	uint dev_type = get_nic_type(port_id);
-	switch (dev_type) {
-		case VFD_NIANTIC:
-			result = vfd_ixgbe_get_vf_stats(port_id, vf, &stats);
-			stats.oerrors = 0;
-			break;
-			
-		case VFD_FVL25:		
-			result = vfd_i40e_get_vf_stats(port_id, vf, &stats);
-			break;
-
+	result = get_vf_stats( port_id, vf, &stats );
+	switch( get_nic_type( port_id ) ) {
 		case VFD_BNXT:
-			result = vfd_bnxt_get_vf_stats(port_id, vf, &stats);
 			if (rte_pmd_bnxt_get_vf_tx_drop_count(port_id, vf, &vf_spoffed))
 				vf_spoffed = UINT64_MAX;
 			break;
 			
 		case VFD_MLX5:
-			result = vfd_mlx5_get_vf_stats(port_id, vf, &stats);
 			vf_spoffed = vfd_mlx5_get_vf_spoof_stats(port_id, vf);
 			break;
 
 		default:
-			bleat_printf( 0, "vf_stats_display: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
 	}
 	
@@ -1438,74 +1697,6 @@ vf_stats_display(uint16_t port_id, uint32_t pf_ari, int ivf, char * buff, int bs
 }
 
 
-/*
-	prints extended PF statistics
-	rx_size_64_packets: 0
-	rx_size_65_to_127_packets: 0
-	rx_size_128_to_255_packets: 0
-	rx_size_256_to_511_packets: 0
-	rx_size_512_to_1023_packets: 0
-	rx_size_1024_to_max_packets: 0
-	tx_size_64_packets: 0
-	tx_size_65_to_127_packets: 0
-	tx_size_128_to_255_packets: 0
-	tx_size_256_to_511_packets: 0
-	tx_size_512_to_1023_packets: 0
-	tx_size_1024_to_max_packets: 0
-
-	eturns number of characters placed into buff.
-*/
-int
-port_xstats_display(uint16_t port_id, char * buff, int bsize)
-{
-	struct rte_eth_xstat *xstats;
-	int cnt_xstats, idx_xstat;
-	struct rte_eth_xstat_name *xstats_names;
-
-	cnt_xstats = rte_eth_xstats_get_names(port_id, NULL, 0);
-	if (cnt_xstats  < 0) {
-		bleat_printf( 0, "fail: unable to get count of xstats for port: %d", port_id);
-		return 0;
-	}
-
-	xstats_names = malloc(sizeof(struct rte_eth_xstat_name) * cnt_xstats);
-	if (xstats_names == NULL) {
-		bleat_printf( 0, "fail: unable to allocate memory for xstat names for port: %d", port_id);
-		return 0;
-	}
-	
-	if (cnt_xstats != rte_eth_xstats_get_names(port_id, xstats_names, cnt_xstats)) {
-		bleat_printf( 0, "fail: unable to get xstat names for port: %d", port_id);
-		free(xstats_names);
-		return 0;
-	}
-
-	xstats = malloc(sizeof(struct rte_eth_xstat) * cnt_xstats);
-	if (xstats == NULL) {
-		bleat_printf( 0, "fail: unable to allocate memory for xstat for port: %d", port_id);
-		free(xstats_names);
-		return 0;
-	}
-	
-	if (cnt_xstats != rte_eth_xstats_get(port_id, xstats, cnt_xstats)) {
-		bleat_printf( 0, "fail: unable to get xstat for port: %d", port_id);
-		free(xstats_names);
-		free(xstats);
-		return 0;
-	}
-
-  int lw = 0;
-	for (idx_xstat = 0; idx_xstat < cnt_xstats; idx_xstat++)
-		if (strncmp(xstats_names[idx_xstat].name, "rx_size_", 8) == 0 || strncmp(xstats_names[idx_xstat].name, "tx_size_", 8) == 0)
-			lw += snprintf(buff + lw, bsize - lw, "%s: %"PRIu64"\n", xstats_names[idx_xstat].name, xstats[idx_xstat].value);		
-
-	free(xstats_names);
-	free(xstats);
-	
-	return lw;
-}
-
-
 /*
   dumps all LAN ID's configured
   to be used for debugging
@@ -1532,6 +1723,9 @@ dump_all_vlans(portid_t port_id)
 		case VFD_MLX5:
 			break;
 
+		case VFD_SIM:
+			break;
+
 		default:
 			bleat_printf( 0, "set_queue_drop: unknown device type: %u, port: %u", port_id, dev_type);
 			break;	
@@ -1550,19 +1744,20 @@ int lsi_event_callback(uint16_t port_id, enum rte_eth_event_type type, void *par
 	RTE_SET_USED(data);
 
 	bleat_printf( 3, "Event type: %s", type == RTE_ETH_EVENT_INTR_LSC ? "LSC interrupt" : "unknown event");
-	rte_eth_link_get_nowait(port_id, &link);
+	vfd_link_get(port_id, &link);
 	if (link.link_status) {
 		bleat_printf( 3, "Port %d Link Up - speed %u Mbps - %s",
 				port_id, (unsigned)link.link_speed,
 			(link.link_duplex == ETH_LINK_FULL_DUPLEX) ?
 				("full-duplex") : ("half-duplex"));
 
-		if( type == RTE_ETH_EVENT_INTR_LSC ) {
-			restore_vf_setings( port_id, -1 );				// reset _all_ VFs on the port
-		}
 	} else
 		bleat_printf( 3, "Port %d Link Down", port_id);
 
+	if( type == RTE_ETH_EVENT_INTR_LSC ) {
+		vfd_link_change( port_id, &link );				// restore all VFs and rescale rates if the speed changed
+	}
+
 	// notify every VF about link status change
 	ping_vfs(port_id, -1);
 
@@ -1583,6 +1778,7 @@ int
 port_init(uint16_t port, __attribute__((__unused__)) struct rte_mempool *mbuf_pool, int hw_strip_crc, __attribute__((__unused__)) sriov_port_t *pf )
 {
 	struct rte_eth_conf port_conf = port_conf_default;
+	struct vf_hw_s hw;
 	const uint16_t rx_rings = 1;
 	const uint16_t tx_rings = 1;
 	int retval;
@@ -1597,6 +1793,7 @@ port_init(uint16_t port, __attribute__((__unused__)) struct rte_mempool *mbuf_po
 		return 1;
 	}
 
+	qos_reset_credits( port );											// the nic is being reset; cached credits no longer describe it
 	bleat_printf( 2, "port %d max_mtu=%d jumbo=%d", (int) port, (int) port_conf.rxmode.max_rx_pkt_len, (int) port_conf.rxmode.jumbo_frame );
 
 	if( !hw_strip_crc ) {
@@ -1604,6 +1801,15 @@ port_init(uint16_t port, __attribute__((__unused__)) struct rte_mempool *mbuf_po
 		port_conf.rxmode.hw_strip_crc = 0;
 	}
 
+	if( get_nic_type( port ) == VFD_SIM ) {					// virtual devices don't generate lsc interrupts; configure fails if we ask
+		bleat_printf( 2, "link state interrupts disabled for simulated port %d", port );
+		port_conf.intr_conf.lsc = 0;
+	}
+
+	if( get_nic_type( port ) == VFD_BNXT ) {				// pf queue 0 is drained by the drain thread; let it sleep on the rx interrupt
+		port_conf.intr_conf.rxq = 1;
+	}
+
 	// Configure the Ethernet device.
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
 	if (retval != 0) {
@@ -1633,6 +1839,9 @@ port_init(uint16_t port, __attribute__((__unused__)) struct rte_mempool *mbuf_po
 		case VFD_MLX5:
 			break;
 
+		case VFD_SIM:								// no mailbox behind a virtual device
+			break;
+
 		default:
 			bleat_printf( 0, "port_init: unknown device type: %u, port: %u", port, dev_type);
 			break;	
@@ -1701,10 +1910,15 @@ port_init(uint16_t port, __attribute__((__unused__)) struct rte_mempool *mbuf_po
 
 	// don't allow untagged packets to any VF
 	for(i = 0; i < get_num_vfs(port); i++) {
+		if( (pf->flags & PF_WARM) && (get_vf_hw_state( port, i, &hw ) & VHW_RXMODE) && ! hw.allow_untagged ) {
+			continue;							// warm restart: already off; don't touch a running vf
+		}
 		set_vf_allow_untagged(port, i, 0);   
 	}
 	
-	nic_stats_clear(port);
+	if( ! (pf->flags & PF_WARM) ) {				// counters carry on across a warm restart
+		nic_stats_clear(port);
+	}
 	
 	return 0;
 }
@@ -1774,6 +1988,9 @@ ping_vfs(portid_t port_id, int vf)
 			retval = vfd_bnxt_ping_vfs(port_id, vf);
 			break;
 			
+		case VFD_SIM:
+			break;
+
 		default:
 			bleat_printf( 0, "ping_vfs: unknown device type: %u, port: %u", port_id, dev_type);
 			break;		
@@ -1910,25 +2127,42 @@ void dump_dev_info( int num_ports  ) {
 	}
 }
 
-void discard_pf_traffic (portid_t port_id)
+/*
+	Pull everything waiting on PF rx queue 0 and free it. Only needed for NICs which
+	deliver traffic to the PF that we never consume (bnxt), and for ports where a
+	software mirror steers mirrored traffic to the PF pool. Returns the number of
+	packets pulled and adds their length to bytes if the pointer is given.
+	Mirrored packets are handed to the software mirror (vfd_smirror.c); the rest are
+	offered to the pf capture (vfd_pcap.c) before they are freed.
+	Called only from the drain thread (vfd_drain.c) which owns queue 0.
+*/
+int discard_pf_traffic( portid_t port_id, uint64_t* bytes )
 {
-	uint dev_type = get_nic_type(port_id);
-	switch (dev_type) {
-		case VFD_BNXT:
-		{
 #define MAX_PKT_BURST	32
-			struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
-			uint16_t nb_pkts;
-
-			while ( (nb_pkts = rte_eth_rx_burst(port_id, 0, pkts_burst, MAX_PKT_BURST)) > 0 ) {
-				uint16_t idx;
-				for (idx = 0; idx < nb_pkts; idx++)
-					rte_pktmbuf_free(pkts_burst[idx]);
-				bleat_printf( 4, "Discarded %hu frames on PF %d", nb_pkts, port_id);
+	struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
+	uint16_t nb_pkts;
+	uint16_t idx;
+	int	total = 0;
+
+	if( get_nic_type( port_id ) != VFD_BNXT && ! vfd_smirror_active( port_id ) ) {		// nothing lands on queue 0 for others unless a soft mirror steers it there
+		return 0;
+	}
+
+	while ( (nb_pkts = rte_eth_rx_burst(port_id, 0, pkts_burst, MAX_PKT_BURST)) > 0 ) {
+		total += nb_pkts;
+		if( bytes != NULL ) {
+			for (idx = 0; idx < nb_pkts; idx++) {
+				*bytes += rte_pktmbuf_pkt_len( pkts_burst[idx] );
 			}
 		}
-		break;
-		default:
-		return;
+
+		nb_pkts = vfd_smirror_burst( port_id, pkts_burst, nb_pkts );		// mirrored packets are consumed; the rest are left in the burst
+		for (idx = 0; idx < nb_pkts; idx++) {
+			vfd_pcap_offer( port_id, pkts_burst[idx] );		// copied if pf capture is on and it passes the filter/sample
+			rte_pktmbuf_free(pkts_burst[idx]);
+		}
+		bleat_printf( 4, "Discarded %hu frames on PF %d", nb_pkts, port_id);
 	}
+
+	return total;
 }
@@ -14,6 +14,12 @@
 					Fix comment in same initialisation.
 				16 May 2017 - Add flow control flag constant.
 				10 Oct 2017 - Change set_mirror proto.
+				18 Oct 2026 - Add simulated nic type.
+				18 Oct 2026 - Guard register access for ports without a pci device.
+				18 Oct 2026 - Add running qshare sums/histogram to the port.
+				18 Oct 2026 - Software mirror settings in mirror_s; add set_mirror_mask().
+				18 Oct 2026 - Add vf_hw_s and get_vf_hw_state() for reading vf settings back from the nic.
+				18 Oct 2026 - Add the tx rate cap to vf_hw_s.
 */
 
 #ifndef _SRIOV_H_
@@ -82,6 +88,7 @@
 #include "vfd_ixgbe.h"
 #include "vfd_i40e.h"
 #include "vfd_mlx5.h"
+#include "vfd_sim.h"
 
 
 // ---------------------------------------------------------------------------------------
@@ -112,6 +119,7 @@
 #define MAX_QUEUES	128			// max supported queues
 #define MAX_PORTS  16
 #define MAX_TCS		8			// max number of TCs possible
+#define QS_HIST_SIZE	101		// qshare values are percentages 0-100
 #define RESTORE_DELAY 2
 
 #define TC_4PERQ_MODE	0		// bool flag passed to qos funcitons indicating 4 or 8 mode
@@ -124,6 +132,7 @@
 #define VFD_FVL25		0x2
 #define VFD_BNXT		0x3
 #define VFD_MLX5		0x4
+#define VFD_SIM			0x5		// simulated nic (vfd_sim.c)
 
 #define VF_LINK_ON	1
 #define VF_LINK_OFF	-1
@@ -170,6 +179,17 @@ typedef uint16_t streamid_t;
 #define PF_OVERSUB	0x02		// allow qos oversubscription
 #define PF_FC_ON	0x04		// turn flow control on for port
 #define PF_PROMISC	0x08		// set promisc for the port when high
+#define PF_WARM		0x10		// reattached on a warm restart; nic settings are verified rather than reset
+
+								// vf_hw_s valid bits: settings the backend was able to read back
+#define VHW_VLANS	0x01		// vlan filter
+#define VHW_MACS	0x02		// mac filter (default and whitelist)
+#define VHW_SPOOF	0x04		// mac and vlan anti-spoof
+#define VHW_STRIP	0x08		// outer tag strip
+#define VHW_INSERT	0x10		// outer tag insert
+#define VHW_CTAG	0x20		// inner tag strip and insert
+#define VHW_RXMODE	0x40		// bcast, mcast, unknown unicast and untagged accept
+#define VHW_RATE	0x80		// tx rate cap
 
 /*
 	Provides a static port configuration struct with defaults.
@@ -231,6 +251,8 @@ struct vf_s
 	int     allow_untagged;
 	double  rate;
 	double  min_rate;
+	double	rate_ceiling;			// highest cap the rebalancer may raise rate to (== rate when not set)
+	double	min_rate_floor;			// lowest the rebalancer may drop min_rate to while the vf is idle
 	int     link;                 /* -1 = down, 0 = mirror PF, 1 = up  */
 	int     num_vlans;
 	int     num_macs;
@@ -256,6 +278,36 @@ struct mirror_s
 	uint8_t	target;		// vf where trafiic is being sent
 	int dir;			// traffic direction: in, out, both, off
 	uint8_t	id;			// the id we assigned to the mirror (size limited by dpdk lib calls)
+	int		soft;		// mirrored by the software engine (vfd_smirror.c); id is not used
+	int		pcap;		// soft: mirrored traffic goes to the pf capture files rather than the target vf
+	int		sample;		// soft: forward 1 in n mirrored packets
+	int		snaplen;	// soft: bytes of each packet forwarded (0 == all)
+	int		mbps;		// soft: cap on the forwarded rate (0 == none)
+};
+
+
+/*
+	VF settings as read back from the NIC by get_vf_hw_state(). Only the fields
+	covered by the VHW_ bits set in valid are meaningful.
+*/
+struct vf_hw_s
+{
+	int		valid;					// VHW_ constants
+	int		num_vlans;
+	int		vlans[MAX_VF_VLANS];
+	int		num_macs;
+	struct ether_addr macs[MAX_VF_MACS];
+	int		vlan_anti_spoof;
+	int		mac_anti_spoof;
+	int		strip;
+	int		insert_vlan;			// 0 == no insert
+	int		cstrip;
+	int		insert_cvlan;
+	int		allow_bcast;
+	int		allow_mcast;
+	int		allow_un_ucast;
+	int		allow_untagged;
+	int		rate;					// tx rate cap (Mbps) 0 == none
 };
 
 
@@ -273,11 +325,15 @@ typedef struct sriov_port_s
 	int     	num_mirrors;
 	int			nvfs_config;			// actual number of configured vfs; could be less than max
 	int			ntcs;					// number traffic clases (must be 4 or 8)
+	uint32_t	link_speed;				// link speed (Mbps) vf rates were last computed from (0 until the link is first up)
 	int     	num_vfs;					// number of VF spaces in the list used, NOT the total allocated on the port
 	struct  	mirror_s mirrors[MAX_VFS];	// mirror info for each VF
 	struct  	vf_s vfs[MAX_VFS];
 	tc_class_t*	tc_config[MAX_TCS];		// configuration information (max/min lsp/gsp) for the TC	(set from config)
 	int*		vftc_qshares;			// queue percentages arranged by vf/tc (computed with each add/del of a vf)
+	int			qs_sums[MAX_TCS];		// running sum of the configured qshares of active VFs for each TC
+	uint16_t	qs_hist[MAX_TCS][QS_HIST_SIZE];	// number of active VFs with each qshare value (per TC); gives min/max without a scan
+	uint8_t		qs_dirty;				// bit per TC which must be normalised on the next gen_port_qshares() call
 	uint8_t		tc2bwg[MAX_TCS];		// maps each TC to a bandwidth group (set from config info)
 	
 	// will keep PCI First VF offset and Stride here
@@ -343,6 +399,10 @@ port_pci_reg_read(portid_t port, uint32_t reg_off)
 	void *reg_addr;
 	uint32_t reg_v;
 
+	if( dev_info.pci_dev == NULL ) {		// virtual device; no registers to read
+		return 0;
+	}
+
 	reg_addr = (void *)
 		((char *)dev_info.pci_dev->mem_resource[0].addr + reg_off);
 	reg_v = *((volatile uint32_t *)reg_addr);
@@ -360,6 +420,10 @@ port_pci_reg_write(portid_t port, uint32_t reg_off, uint32_t reg_v)
  
 	void *reg_addr;
 
+	if( dev_info.pci_dev == NULL ) {		// virtual device; no registers to write
+		return;
+	}
+
 	reg_addr = (void *)
 		((char *)dev_info.pci_dev->mem_resource[0].addr + reg_off);
 	*((volatile uint32_t *)reg_addr) = rte_cpu_to_le_32(reg_v);
@@ -410,6 +474,7 @@ void init_port_config(void);
 int get_split_ctlreg( portid_t port_id, uint16_t vf_id );
 int set_mirror( portid_t port_id, uint32_t vf, uint8_t id, uint8_t target, uint8_t direction );
 int set_mirror_wrp( portid_t port_id, uint32_t vf, uint8_t id, uint8_t target, uint8_t direction );
+int set_mirror_mask( portid_t port_id, uint64_t pool_mask, uint8_t id, uint8_t target, uint8_t direction );
 void set_queue_drop( portid_t port_id, int state );
 void set_split_erop( portid_t port_id, uint16_t vf_id, int state );
 
@@ -432,7 +497,8 @@ int set_vf_link_status(portid_t port_id, uint16_t vf, int status);
 void nic_stats_clear(portid_t port_id);
 int nic_stats_display(uint16_t port_id, char * buff, int blen);
 int vf_stats_display(uint16_t port_id, uint32_t pf_ari, int vf, char * buff, int bsize);
-int port_xstats_display(uint16_t port_id, char * buff, int bsize);
+int get_vf_stats( portid_t port_id, uint16_t vf, struct rte_eth_stats* stats );
+int get_vf_hw_state( portid_t port_id, uint16_t vf, struct vf_hw_s* hw );
 int dump_all_vlans(portid_t port_id);
 void ping_vfs(portid_t port_id, int vf);
 
@@ -459,6 +525,7 @@ void disable_default_pool(portid_t port_id);
 int lsi_event_callback(uint16_t port_id, enum rte_eth_event_type type, void *param, void* data );
 //int lsi_event_callback(uint16_t port_id, enum rte_eth_event_type type, void *param, void *ret_param);
 void restore_vf_setings(uint16_t port_id, int vf);
+extern void vfd_link_change( portid_t port_id, struct rte_eth_link* link );
 
 // callback validation support
 int valid_mtu( int port, int mtu );
@@ -483,7 +550,8 @@ int get_nic_type(portid_t port_id);
 int get_mac_antispoof( portid_t port_id );
 int get_max_qpp( uint32_t port_id );
 int get_num_vfs( uint32_t port_id );
-void discard_pf_traffic( portid_t portid );
+int vfd_link_get( portid_t port_id, struct rte_eth_link* link );
+int discard_pf_traffic( portid_t portid, uint64_t* bytes );
 
 void log_port_state( struct sriov_port_s* port, const_str msg );
 
@@ -494,6 +562,7 @@ extern int can_add_mac( int port, int vfid, char* mac );
 extern int clear_macs( int port, int vfid, int assign_random );
 extern int push_mac( int port, int vfid, char* mac );
 extern int set_macs( int port, int vfid );
+extern int map_macs( int port, struct vf_s* vf );
 
 //-- testing --
 extern void set_fc_on( portid_t pf, int force );
@@ -509,14 +578,18 @@ extern int stricmp(const char *s1, const char *s2);
 
 // ---- new qos, merge up after initial testing ----
 void gen_port_qshares( sriov_port_t *port );
+void qs_add_vf( sriov_port_t* port, struct vf_s* vf );
+void qs_del_vf( sriov_port_t* port, struct vf_s* vf );
 int check_qs_oversub( struct sriov_port_s* port, uint8_t *qshares );
 int check_qs_spread( struct sriov_port_s* port, uint8_t* qshares );
 
 // --- qos hard coded nic funcitons that need to move to dpdk
 void qos_set_credits( portid_t pf, int mtu, int* rates, int tc8_mode );
+void qos_reset_credits( portid_t pf );
 extern void qos_enable_arb( portid_t pf );
-extern void qos_set_tdplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntcs, int mtu );
-extern void qos_set_txpplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntcs, int mtu );
+extern int qos_set_tdplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntcs, int mtu );
+extern int qos_set_txpplane( portid_t pf, uint8_t* pctgs, uint8_t *bwgs, int ntcs, int mtu );
+extern int qos_apply_tcs( sriov_port_t* port );
 extern void mlx5_set_vf_tcqos( sriov_port_t *port, uint32_t link_speed );
 
 
@@ -0,0 +1,359 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_bench.c
+	Abstract:	Control plane benchmark. Builds a running config of MAX_PORTS simulated
+				PFs, each with MAX_VFS VFs, and then drives add, delete, reset and show
+				operations through the same functions that the request interface uses
+				(vfd_update_nic(), gen_stats(), gen_port_qshares() and qos_set_credits()). The time for
+				each operation is captured and throughput and tail latency for each
+				operation type are written to stdout when finished.
+
+				Nothing here touches dpdk: the ports are attached to the simulator
+				(vfd_sim.c) and the eal is not initialised, so the benchmark can be
+				run on any box (vfd -b <iterations>). Ops are timed with clock_gettime();
+				the TSC rate used by vfd_timing.c is measured rather than taken from
+				the eal, and PF rx mode calls are not made for simulated ports.
+
+				The operations are chosen pseudo randomly using a fixed seed so that
+				runs are comparable.
+
+	Date:		18 October 2026
+*/
+
+#include <time.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_timing.h"
+#include "vfd_sim.h"
+
+#define BOP_ADD			0			// benchmark operation types
+#define BOP_DELETE		1
+#define BOP_RESET		2
+#define BOP_SHOW		3
+#define BOP_QSHARE		4
+#define BOP_NOPS		5
+
+#define BENCH_SEED		1021		// fixed seed so runs are comparable
+#define BENCH_SPEED		10000		// simulated link speed (Mbps)
+#define BENCH_MIRROR	16			// every nth VF is mirrored
+
+static const char* bop_names[BOP_NOPS] = { "add", "delete", "reset", "show", "qshare" };
+
+/*
+	Latencies (nsec) captured for one operation type.
+*/
+typedef struct bench_lat {
+	int			nalloc;
+	int			count;
+	uint64_t*	lat;
+	uint64_t	total;
+} bench_lat_t;
+
+// -----------------------------------------------------------------------------------------------------------
+
+static inline uint64_t bench_now( void ) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/*
+	Add a captured latency to the list for the operation; the list is extended as needed.
+*/
+static void bench_add( bench_lat_t* bl, uint64_t start ) {
+	uint64_t elapsed;
+
+	elapsed = bench_now() - start;
+
+	if( bl->count >= bl->nalloc ) {
+		bl->nalloc = bl->nalloc > 0 ? bl->nalloc * 2 : 4096;
+		if( (bl->lat = (uint64_t *) realloc( bl->lat, sizeof( *bl->lat ) * bl->nalloc )) == NULL ) {
+			fprintf( stderr, "abort: unable to allocate memory for latency capture\n" );
+			exit( 1 );
+		}
+	}
+
+	bl->lat[bl->count++] = elapsed;
+	bl->total += elapsed;
+}
+
+static int cmp_u64( const void* a, const void* b ) {
+	uint64_t va = *(const uint64_t *) a;
+	uint64_t vb = *(const uint64_t *) b;
+
+	return va < vb ? -1 : (va > vb);
+}
+
+/*
+	Return the pct (e.g. 99.9) percentile from a sorted list.
+*/
+static uint64_t bench_pctl( bench_lat_t* bl, double pct ) {
+	int i;
+
+	if( bl->count <= 0 ) {
+		return 0;
+	}
+
+	i = (int) ((pct / 100.0) * bl->count);
+	if( i >= bl->count ) {
+		i = bl->count - 1;
+	}
+
+	return bl->lat[i];
+}
+
+/*
+	Set up the VF in slot y on the port as if a config file had just been read by
+	vfd_add_vf().
+*/
+static void bench_fill_vf( sriov_conf_t* conf, struct sriov_port_s* port, int y ) {
+	struct vf_s* vf;
+	int i;
+
+	vf = &port->vfs[y];
+	memset( vf, 0, sizeof( *vf ) );
+
+	vf->num = y;
+	vf->last_updated = ADDED;
+	vf->link = VF_LINK_AUTO;
+	vf->strip_stag = 1;
+	vf->vlan_anti_spoof = 1;
+	vf->allow_bcast = 1;
+	vf->allow_mcast = 1;
+	vf->allow_untagged = 0;
+	vf->rate = 0.1;
+	vf->num_vlans = 1;
+	vf->vlans[0] = 10 + y;
+	vf->first_mac = 1;
+	vf->num_macs = 1;
+	snprintf( vf->macs[1], sizeof( vf->macs[1] ), "02:00:00:%02x:%02x:01", port->rte_port_number, y );
+	if( y < MAX_QUEUES / port->ntcs ) {				// only VFs which have queues get a share
+		for( i = 0; i < port->ntcs; i++ ) {
+			vf->qshares[i] = 5 + ((y + i) % 4) * 5;
+		}
+	}
+	qs_add_vf( port, vf );
+
+	if( y % BENCH_MIRROR == 1 ) {
+		port->mirrors[y].dir = MIRROR_IN;
+		port->mirrors[y].target = (y + 1) % port->num_vfs;
+		port->mirrors[y].id = idm_alloc( conf->mir_id_mgr );
+	} else {
+		port->mirrors[y].dir = MIRROR_OFF;
+		port->mirrors[y].target = MAX_VFS + 1;
+	}
+}
+
+/*
+	Build the configuration: MAX_PORTS simulated ports with MAX_VFS VF slots each, all
+	initially unused.
+*/
+static int bench_setup( sriov_conf_t* conf ) {
+	struct sriov_port_s* port;
+	int i;
+	int y;
+
+	conf->num_ports = MAX_PORTS;
+	for( i = 0; i < MAX_PORTS; i++ ) {
+		port = &conf->ports[i];
+
+		if( vfd_sim_attach( i, MAX_VFS, BENCH_SPEED ) != 0 ) {
+			return 0;
+		}
+
+		port->rte_port_number = i;
+		port2config_map[i] = i;
+		snprintf( port->name, sizeof( port->name ), "sim%d", i );
+		snprintf( port->pciid, sizeof( port->pciid ), "0000:%02x:00.0", 0xe0 + i );
+		port->mtu = 9000;
+		port->ntcs = 4;
+		port->nvfs_config = MAX_VFS;
+		port->num_vfs = MAX_VFS;
+		port->last_updated = ADDED;
+		for( y = 0; y < MAX_VFS; y++ ) {
+			port->vfs[y].num = -1;
+			port->vfs[y].last_updated = UNCHANGED;
+			port->mirrors[y].dir = MIRROR_OFF;
+			port->mirrors[y].target = MAX_VFS + 1;
+		}
+	}
+
+	return 1;
+}
+
+/*
+	Change the queue shares on the port by deleting and re-adding a VF which has
+	queues, then recompute the shares and push the credits (simulated). Only the
+	recompute and push are timed. Returns the number of credit register writes that
+	the push needed.
+*/
+static int bench_qshares( parms_t* parms, sriov_conf_t* conf, struct sriov_port_s* port, bench_lat_t* bl, int y ) {
+	uint64_t	start;
+	uint64_t	regw;
+
+	y %= MAX_QUEUES / port->ntcs;
+
+	port->vfs[y].last_updated = DELETED;
+	vfd_update_nic( parms, conf );
+	bench_fill_vf( conf, port, y );
+	vfd_update_nic( parms, conf );
+
+	regw = vfd_timing_get_regw( port->rte_port_number );
+	start = bench_now();
+	gen_port_qshares( port );
+	qos_set_credits( port->rte_port_number, port->mtu, port->vftc_qshares, TC_4PERQ_MODE );
+	bench_add( bl, start );
+
+	return (int) (vfd_timing_get_regw( port->rte_port_number ) - regw);
+}
+
+/*
+	Write the results to stdout.
+*/
+static void bench_report( bench_lat_t* lats, uint64_t elapsed, uint64_t regw ) {
+	int i;
+	bench_lat_t* bl;
+
+	printf( "\n%-8s %10s %12s %10s %10s %10s %10s %10s\n", "op", "count", "ops/sec", "mean(us)", "p50(us)", "p99(us)", "p99.9(us)", "max(us)" );
+	for( i = 0; i < BOP_NOPS; i++ ) {
+		bl = &lats[i];
+		if( bl->count <= 0 ) {
+			continue;
+		}
+
+		qsort( bl->lat, bl->count, sizeof( *bl->lat ), cmp_u64 );
+		printf( "%-8s %10d %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			bop_names[i], bl->count,
+			bl->total > 0 ? (double) bl->count / ((double) bl->total / 1000000000.0) : 0.0,
+			(double) bl->total / bl->count / 1000.0,
+			bench_pctl( bl, 50.0 ) / 1000.0,
+			bench_pctl( bl, 99.0 ) / 1000.0,
+			bench_pctl( bl, 99.9 ) / 1000.0,
+			bl->lat[bl->count-1] / 1000.0 );
+	}
+
+	if( lats[BOP_QSHARE].count > 0 ) {
+		printf( "\nqos credit register writes: %.1f per qshare op (a full rewrite is %d)\n", (double) regw / lats[BOP_QSHARE].count, MAX_QUEUES * 2 );
+	}
+	printf( "\nelapsed: %.3fs\n", elapsed / 1000000000.0 );
+}
+
+/*
+	Run the benchmark. All VFs on all ports are added, then iterations operations are
+	selected at random (reset 30%, show 30%, delete and re-add 30%, qshare 10%), and
+	finally all VFs are deleted. A qshare op replaces one VF's shares, then recomputes
+	and pushes the credits. Latency is the per-op simulated NIC latency (usec)
+	and may be 0.
+
+	Parms must have been allocated by the caller; it is set to look initialised and
+	for real. The global running config is replaced.
+
+	Returns the exit code for the process.
+*/
+extern int vfd_bench( parms_t* parms, int iterations, int latency ) {
+	bench_lat_t	lats[BOP_NOPS];
+	sriov_conf_t* conf;
+	struct sriov_port_s* port;
+	uint64_t	start;
+	uint64_t	bstart;
+	uint64_t	regw = 0;			// credit register writes made by qshare ops
+	char*		buf;
+	int			i;
+	int			y;
+	int			r;
+
+	if( (conf = (sriov_conf_t *) malloc( sizeof( *conf ) )) == NULL ) {
+		fprintf( stderr, "abort: unable to allocate memory for running config\n" );
+		return 1;
+	}
+	memset( conf, 0, sizeof( *conf ) );
+	rte_spinlock_init( &conf->update_lock );
+	conf->mir_id_mgr = mk_idm( 256 );
+	running_config = conf;
+
+	memset( lats, 0, sizeof( lats ) );
+	parms->forreal = 1;
+	parms->rflags |= RF_INITIALISED;
+	parms->rflags &= ~RF_ENABLE_QOS;				// qshares are driven separately (see bench_qshares()); only the first VFs have queues
+
+	mac_init();
+	vfd_timing_calibrate( );							// eal is not up to supply the tsc rate
+	vfd_sim_set_latency( SIM_ALL_OPS, latency );
+	if( ! bench_setup( conf ) ) {
+		fprintf( stderr, "abort: unable to set up simulated ports\n" );
+		return 1;
+	}
+
+	printf( "benchmark: %d ports, %d vfs/port, %d iterations, %dus simulated nic latency\n", MAX_PORTS, MAX_VFS, iterations, latency );
+	vfd_update_nic( parms, conf );								// port level setup; not timed
+	bstart = bench_now();
+
+	for( i = 0; i < MAX_PORTS; i++ ) {							// add all
+		port = &conf->ports[i];
+		for( y = 0; y < port->num_vfs; y++ ) {
+			start = bench_now();
+			bench_fill_vf( conf, port, y );
+			vfd_update_nic( parms, conf );
+			bench_add( &lats[BOP_ADD], start );
+		}
+	}
+
+	srand( BENCH_SEED );
+	for( i = 0; i < iterations; i++ ) {
+		port = &conf->ports[rand() % MAX_PORTS];
+		y = rand() % port->num_vfs;
+		r = rand() % 10;
+
+		if( r < 3 ) {
+			start = bench_now();
+			port->vfs[y].last_updated = RESET;
+			vfd_update_nic( parms, conf );
+			bench_add( &lats[BOP_RESET], start );
+		} else {
+			if( r < 6 ) {
+				start = bench_now();
+				buf = gen_stats( conf, 0, -1 );
+				bench_add( &lats[BOP_SHOW], start );
+				free( buf );
+			} else {
+				if( r < 9 ) {
+					start = bench_now();
+					port->vfs[y].last_updated = DELETED;
+					vfd_update_nic( parms, conf );
+					bench_add( &lats[BOP_DELETE], start );
+
+					start = bench_now();
+					bench_fill_vf( conf, port, y );
+					vfd_update_nic( parms, conf );
+					bench_add( &lats[BOP_ADD], start );
+				} else {
+					regw += bench_qshares( parms, conf, port, &lats[BOP_QSHARE], y );
+				}
+			}
+		}
+	}
+
+	for( i = 0; i < MAX_PORTS; i++ ) {							// delete all
+		port = &conf->ports[i];
+		for( y = 0; y < port->num_vfs; y++ ) {
+			start = bench_now();
+			port->vfs[y].last_updated = DELETED;
+			vfd_update_nic( parms, conf );
+			bench_add( &lats[BOP_DELETE], start );
+		}
+	}
+
+	bench_report( lats, bench_now() - bstart, regw );
+
+	for( i = 0; i < BOP_NOPS; i++ ) {
+		free( lats[i].lat );
+	}
+	for( i = 0; i < MAX_PORTS; i++ ) {
+		vfd_sim_detach( i );
+	}
+
+	return 0;
+}
@@ -0,0 +1,367 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_ctrs.c
+	Abstract:	Monotonic 64 bit VF counters. The NIC counters for a VF are reset
+				when the VF is reset or the PF is initialised (vfd restart), and on
+				some NICs they are narrower than 64 bits (ixgbe packet counters are
+				32 bits and byte counters 36) so they wrap. Rate calculations and
+				billing done from them jump when this happens.
+
+				Every read of the VF counters (get_vf_stats()) is passed through
+				vfd_ctrs_fold() which keeps, for each counter, the raw value last
+				seen and an accumulated value. The difference from the last raw
+				value is added to the accumulator; if the raw value went backwards
+				it is treated as a wrap when the counter is narrow and was in the
+				top half of its range, otherwise as a reset (the new raw value is
+				the delta). A reset event (VF reset callback) forces the next
+				decrease to be taken as a reset. The counter fields in the stats
+				struct are replaced with the accumulated values so that all users
+				(show, netlink, rebalancer, throttle) see the same monotonic values.
+
+				All VFs are sampled every VFC_SAMPLE_SECS so that a narrow counter
+				cannot wrap more than once between reads. The accumulated and last
+				raw values are written to a small state file every save interval
+				and at shutdown; at start the file is read back, matched to the
+				ports by pci id, so counters carry on across a restart. If the raw
+				values on restart are smaller than those saved the NIC counters
+				were reset and the new raw values are added as is.
+
+				When a VF is deleted its counters are dropped; the next VF added in
+				that slot starts from zero.
+
+	Date:		18 October 2026
+*/
+
+#include <time.h>
+#include <inttypes.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_ctrs.h"
+
+/*
+	Counter state for one vf.
+*/
+typedef struct vf_ctrs {
+	int			valid;					// last[] holds a raw sample
+	int			restored;				// acc/last were loaded from the state file, no sample yet
+	int			fresh;					// vf was (re)added; counting starts at zero rather than the current raw value
+	int			reset_pending;			// samples for which a decrease is taken as a reset (not a wrap)
+	uint32_t	nresets;				// number of resets absorbed
+	uint32_t	nwraps;					// number of wraps absorbed
+	uint64_t	acc[VFC_NCTRS];			// monotonic values
+	uint64_t	last[VFC_NCTRS];		// raw values at the last sample
+} vf_ctrs_t;
+
+static vf_ctrs_t		cstate[MAX_PORTS][MAX_VFS];
+static rte_spinlock_t	ctr_lock = RTE_SPINLOCK_INITIALIZER;		// folds come from the main and netlink threads
+static time_t			next_sample = 0;
+static time_t			next_save = 0;
+
+/*
+	Return the width (bits) of the raw counter for the nic type.
+*/
+static int ctr_width( int port, int ctr ) {
+	switch( get_nic_type( port ) ) {
+		case VFD_NIANTIC:
+			return ctr == VFC_IBYTES || ctr == VFC_OBYTES ? 36 : 32;
+
+		case VFD_FVL25:
+			return 48;
+
+		default:
+			break;
+	}
+
+	return 64;
+}
+
+/*
+	Pull the counters we keep from the stats struct, and put them back.
+*/
+static void stats2raw( struct rte_eth_stats* stats, uint64_t* raw ) {
+	raw[VFC_IPACKETS] = stats->ipackets;
+	raw[VFC_IBYTES] = stats->ibytes;
+	raw[VFC_IERRORS] = stats->ierrors;
+	raw[VFC_IMISSED] = stats->imissed;
+	raw[VFC_OPACKETS] = stats->opackets;
+	raw[VFC_OBYTES] = stats->obytes;
+	raw[VFC_OERRORS] = stats->oerrors;
+}
+
+static void raw2stats( uint64_t* raw, struct rte_eth_stats* stats ) {
+	stats->ipackets = raw[VFC_IPACKETS];
+	stats->ibytes = raw[VFC_IBYTES];
+	stats->ierrors = raw[VFC_IERRORS];
+	stats->imissed = raw[VFC_IMISSED];
+	stats->opackets = raw[VFC_OPACKETS];
+	stats->obytes = raw[VFC_OBYTES];
+	stats->oerrors = raw[VFC_OERRORS];
+}
+
+// -----------------------------------------------------------------------------------------------------------
+
+/*
+	Fold a raw sample for the vf into the monotonic counters and replace the
+	counter values in stats with them.
+*/
+extern void vfd_ctrs_fold( int port, int vf, struct rte_eth_stats* stats ) {
+	vf_ctrs_t*	cs;
+	uint64_t	raw[VFC_NCTRS];
+	uint64_t	delta;
+	int			width;
+	int			reset = 0;
+	int			wrap = 0;
+	int			c;
+
+	if( stats == NULL || port < 0 || port >= MAX_PORTS || vf < 0 || vf >= MAX_VFS ) {
+		return;
+	}
+
+	stats2raw( stats, raw );
+
+	rte_spinlock_lock( &ctr_lock );
+	cs = &cstate[port][vf];
+
+	if( ! cs->valid ) {
+		for( c = 0; c < VFC_NCTRS; c++ ) {
+			if( cs->restored ) {								// carry on from the saved values
+				cs->acc[c] += raw[c] >= cs->last[c] ? raw[c] - cs->last[c] : raw[c];
+			} else {
+				cs->acc[c] = cs->fresh ? 0 : raw[c];			// new vf counts from 0; one found at start reports what the nic has
+			}
+			cs->last[c] = raw[c];
+		}
+
+		cs->valid = 1;
+		cs->restored = 0;
+		cs->fresh = 0;
+	} else {
+		for( c = 0; c < VFC_NCTRS; c++ ) {
+			if( raw[c] >= cs->last[c] ) {
+				delta = raw[c] - cs->last[c];
+			} else {
+				width = ctr_width( port, c );
+				if( ! cs->reset_pending && width < 64 && cs->last[c] >= ((uint64_t) 1 << (width - 1)) ) {
+					delta = (((uint64_t) 1 << width) - cs->last[c]) + raw[c];
+					wrap = 1;
+				} else {
+					delta = raw[c];
+					reset = 1;
+				}
+			}
+
+			cs->acc[c] += delta;
+			cs->last[c] = raw[c];
+		}
+
+		if( reset ) {
+			cs->nresets++;
+			cs->reset_pending = 0;
+			bleat_printf( 2, "vf counters: pf=%d vf=%d counter reset absorbed", port, vf );
+		} else {
+			if( cs->reset_pending > 0 ) {
+				cs->reset_pending--;
+			}
+		}
+		if( wrap ) {
+			cs->nwraps++;
+			bleat_printf( 3, "vf counters: pf=%d vf=%d counter wrap absorbed", port, vf );
+		}
+	}
+
+	raw2stats( cs->acc, stats );
+	rte_spinlock_unlock( &ctr_lock );
+}
+
+/*
+	The vf was reset; the counters might drop to zero so a decrease seen in the
+	next couple of samples is a reset and not a wrap.
+*/
+extern void vfd_ctrs_reset_event( int port, int vf ) {
+	if( port < 0 || port >= MAX_PORTS || vf < 0 || vf >= MAX_VFS ) {
+		return;
+	}
+
+	rte_spinlock_lock( &ctr_lock );
+	cstate[port][vf].reset_pending = 2;
+	rte_spinlock_unlock( &ctr_lock );
+}
+
+/*
+	The vf was deleted; drop its counters so that the next vf added in the slot
+	starts from zero.
+*/
+extern void vfd_ctrs_clear( int port, int vf ) {
+	if( port < 0 || port >= MAX_PORTS || vf < 0 || vf >= MAX_VFS ) {
+		return;
+	}
+
+	rte_spinlock_lock( &ctr_lock );
+	memset( &cstate[port][vf], 0, sizeof( cstate[port][vf] ) );
+	cstate[port][vf].fresh = 1;
+	rte_spinlock_unlock( &ctr_lock );
+}
+
+/*
+	Called from the main loop on each spin. Samples every vf once each
+	VFC_SAMPLE_SECS, and writes the state file once each save interval.
+*/
+extern void vfd_ctrs_tick( parms_t* parms, sriov_conf_t* conf ) {
+	struct rte_eth_stats stats;
+	struct sriov_port_s* port;
+	time_t	now;
+	int		i;
+	int		y;
+
+	if( parms == NULL || conf == NULL || ! parms->forreal || (parms->rflags & RF_INITIALISED) == 0 ) {
+		return;
+	}
+
+	now = time( NULL );
+	if( now >= next_sample ) {
+		next_sample = now + VFC_SAMPLE_SECS;
+
+		rte_spinlock_lock( &conf->update_lock );
+		for( i = 0; i < conf->num_ports; i++ ) {
+			port = &conf->ports[i];
+			for( y = 0; y < port->num_vfs; y++ ) {
+				if( port->vfs[y].num >= 0 && port->vfs[y].last_updated != DELETED ) {
+					get_vf_stats( port->rte_port_number, port->vfs[y].num, &stats );		// fold is done by get_vf_stats
+				}
+			}
+		}
+		rte_spinlock_unlock( &conf->update_lock );
+	}
+
+	if( parms->ctr_save_itvl > 0 && now >= next_save ) {
+		if( next_save > 0 ) {							// skip the first; nothing has been sampled yet
+			vfd_ctrs_save( parms, conf );
+		}
+		next_save = now + parms->ctr_save_itvl;
+	}
+}
+
+/*
+	Read the state file and seed the counters for the vfs on ports we know
+	(matched by pci id). Must be called after the ports are initialised and
+	before the first sample. Returns the number of vfs restored.
+*/
+extern int vfd_ctrs_load( parms_t* parms, sriov_conf_t* conf ) {
+	FILE*	f;
+	char	buf[1024];
+	char	pciid[128];
+	vf_ctrs_t	cs;
+	int		vf;
+	int		i;
+	int		n = 0;
+	int		port;
+
+	if( parms == NULL || conf == NULL || parms->ctr_file == NULL || *parms->ctr_file == 0 ) {
+		return 0;
+	}
+
+	if( (f = fopen( parms->ctr_file, "r" )) == NULL ) {
+		bleat_printf( 1, "vf counters: no state file to restore from: %s: %s", parms->ctr_file, strerror( errno ) );
+		return 0;
+	}
+
+	if( fgets( buf, sizeof( buf ), f ) == NULL || strncmp( buf, VFC_FVERSION, strlen( VFC_FVERSION ) ) != 0 ) {
+		bleat_printf( 0, "WRN: vf counters: state file is not recognised, ignored: %s", parms->ctr_file );
+		fclose( f );
+		return 0;
+	}
+
+	while( fgets( buf, sizeof( buf ), f ) != NULL ) {
+		memset( &cs, 0, sizeof( cs ) );
+		if( sscanf( buf, "%127s %d %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+				" %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64, pciid, &vf,
+				&cs.acc[0], &cs.acc[1], &cs.acc[2], &cs.acc[3], &cs.acc[4], &cs.acc[5], &cs.acc[6],
+				&cs.last[0], &cs.last[1], &cs.last[2], &cs.last[3], &cs.last[4], &cs.last[5], &cs.last[6] ) != 2 + (VFC_NCTRS * 2) ) {
+			continue;
+		}
+
+		port = -1;
+		for( i = 0; i < conf->num_ports; i++ ) {
+			if( strcmp( conf->ports[i].pciid, pciid ) == 0 ) {
+				port = conf->ports[i].rte_port_number;
+				break;
+			}
+		}
+		if( port < 0 || port >= MAX_PORTS || vf < 0 || vf >= MAX_VFS ) {
+			bleat_printf( 2, "vf counters: saved counters for %s vf %d do not match a managed port", pciid, vf );
+			continue;
+		}
+
+		cs.restored = 1;
+		rte_spinlock_lock( &ctr_lock );
+		cstate[port][vf] = cs;
+		rte_spinlock_unlock( &ctr_lock );
+		n++;
+	}
+
+	fclose( f );
+	bleat_printf( 1, "vf counters: restored counters for %d vfs from %s", n, parms->ctr_file );
+	return n;
+}
+
+/*
+	Write the state for all vfs which have been sampled (or restored and not
+	yet sampled) to the state file. The file is written to a temp and renamed
+	so a crash while writing leaves the previous one. Returns 1 on success.
+*/
+extern int vfd_ctrs_save( parms_t* parms, sriov_conf_t* conf ) {
+	FILE*	f;
+	char	tname[1024];
+	vf_ctrs_t*	cs;
+	struct sriov_port_s* port;
+	int		i;
+	int		y;
+	int		pn;
+	int		vf;
+
+	if( parms == NULL || conf == NULL || parms->ctr_file == NULL || *parms->ctr_file == 0 ) {
+		return 0;
+	}
+
+	snprintf( tname, sizeof( tname ), "%s.new", parms->ctr_file );
+	if( (f = fopen( tname, "w" )) == NULL ) {
+		bleat_printf( 0, "WRN: vf counters: unable to open state file for writing: %s: %s", tname, strerror( errno ) );
+		return 0;
+	}
+
+	fprintf( f, "%s\n", VFC_FVERSION );
+	rte_spinlock_lock( &ctr_lock );
+	for( i = 0; i < conf->num_ports; i++ ) {
+		port = &conf->ports[i];
+		pn = port->rte_port_number;
+		if( pn < 0 || pn >= MAX_PORTS ) {
+			continue;
+		}
+
+		for( y = 0; y < port->num_vfs; y++ ) {
+			vf = port->vfs[y].num;
+			if( vf < 0 || vf >= MAX_VFS ) {
+				continue;
+			}
+
+			cs = &cstate[pn][vf];
+			if( cs->valid || cs->restored ) {
+				fprintf( f, "%s %d %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+					" %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", port->pciid, vf,
+					cs->acc[0], cs->acc[1], cs->acc[2], cs->acc[3], cs->acc[4], cs->acc[5], cs->acc[6],
+					cs->last[0], cs->last[1], cs->last[2], cs->last[3], cs->last[4], cs->last[5], cs->last[6] );
+			}
+		}
+	}
+	rte_spinlock_unlock( &ctr_lock );
+
+	if( fclose( f ) != 0 || rename( tname, parms->ctr_file ) != 0 ) {
+		bleat_printf( 0, "WRN: vf counters: unable to write state file: %s: %s", parms->ctr_file, strerror( errno ) );
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,36 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_ctrs.h
+	Abstract:	Monotonic 64 bit VF counters maintained in software over the
+				NIC counters which reset (VF reset, vfd restart) or wrap.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_CTRS_H
+#define _VFD_CTRS_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+#define VFC_NCTRS			7			// counters kept for each vf (index constants below)
+#define VFC_IPACKETS		0
+#define VFC_IBYTES			1
+#define VFC_IERRORS			2
+#define VFC_IMISSED			3
+#define VFC_OPACKETS		4
+#define VFC_OBYTES			5
+#define VFC_OERRORS			6
+
+#define VFC_SAMPLE_SECS		10			// all vfs sampled at least this often so that a narrow counter can't wrap twice between reads
+#define VFC_FVERSION		"vfd_vf_counters v1"	// first line of the state file
+
+// ------------- prototypes ----------------------------------------------
+extern void vfd_ctrs_fold( int port, int vf, struct rte_eth_stats* stats );
+extern void vfd_ctrs_reset_event( int port, int vf );
+extern void vfd_ctrs_clear( int port, int vf );
+extern void vfd_ctrs_tick( parms_t* parms, sriov_conf_t* conf );
+extern int vfd_ctrs_load( parms_t* parms, sriov_conf_t* conf );
+extern int vfd_ctrs_save( parms_t* parms, sriov_conf_t* conf );
+
+#endif
@@ -5,7 +5,11 @@
 	Date:		28 October 2016
 	Author:		E. Scott Daniels
 
-	Mods:
+	Mods:		18 Oct 2026 - Force a full credit write after dcb is configured.
+				18 Oct 2026 - Use qos_apply_tcs() so startup and runtime tc changes share a path.
+				18 Oct 2026 - Ask for rx queue interrupts on bnxt ports for the pf drain thread.
+				18 Oct 2026 - Drop the cached queue credits when the port is (re)initialised.
+				18 Oct 2026 - vfd_dcb_config() returns the error when the tc settings are not accepted.
 
 	useful doc:
 		http://dpdk.org/doc/api/vmdq_dcb_2main_8c-example.html
@@ -75,33 +79,31 @@ struct rte_eth_conf *vfd_dcb_init( uint8_t port ) {
 
 /*
 	Configure the given port for DCB. Port is the real device port number, not
-	the index in our configuration.
+	the index in our configuration. Returns 0 on success, non-zero if the nic
+	did not accept the tc settings.
 */
 extern int vfd_dcb_config( sriov_port_t *pf ) {
 	uint8_t port;									// rte port number that underlying funcitons need
 	struct rte_eth_dev *pf_dev;						// real device info managed by dpdk
-	int	i;
-	uint8_t tc_pctgs[MAX_TCS];						// collection of percentages to give to underlying funcitons
+	int		rc;
 
 	port = pf->rte_port_number;						// vetted by caller, so assume good
  	pf_dev = &rte_eth_devices[port];				// device info from dpdk
 
-	memset( tc_pctgs, 0, sizeof( tc_pctgs ) );
-	for( i = 0; i < pf->ntcs; i++ ) {				// we only allow tc config at start, so no need to keep past this call
-		tc_pctgs[i] = pf->tc_config[i]->min_bw;		// snag min bandwidth percentage for the tc
-	}
-
 	if (get_nic_type(port) != VFD_MLX5) { // No support in mlx5 yet
 		ixgbe_configure_dcb( pf_dev );											// set up dcb
-		qos_set_tdplane( port, tc_pctgs, pf->tc2bwg, pf->ntcs, pf->mtu );		// configure tc plane with our percentages
-		qos_set_txpplane( port, tc_pctgs, pf->tc2bwg, pf->ntcs, pf->mtu );		// configure packet plane with our percentages
+		if( (rc = qos_apply_tcs( pf )) != 0 ) {								// configure tc and packet planes with our percentages (same path as runtime changes)
+			bleat_printf( 0, "ERR: dcb config: port %d: tc settings were not applied: %d", (int) port, rc );
+			return rc;
+		}
 		qos_enable_arb( port );													// finally turn arbitors on
+		qos_reset_credits( port );												// nic reconfigured; next credit push must write every queue
 	} else {
 		vfd_mlx5_set_prio_trust(port);
 		return vfd_mlx5_set_qos_pf(port, pf->tc_config, pf->ntcs);
 	}
 
-	return 0;			// for now constant; but in future it will report an error if needed
+	return 0;
 }
 
 
@@ -134,8 +136,12 @@ extern int dcb_port_init( sriov_port_t *pf, __attribute__((__unused__)) struct r
 		return 1;
 	}
 
+	qos_reset_credits( port );											// the nic is being reset; cached credits no longer describe it
 	port_conf.rxmode.max_rx_pkt_len = pf->mtu;
 	port_conf.rxmode.jumbo_frame = pf->mtu > 1500;
+	if( get_nic_type( port ) == VFD_BNXT ) {				// pf queue 0 is drained by the drain thread; let it sleep on the rx interrupt
+		port_conf.intr_conf.rxq = 1;
+	}
 
 	// Configure the Ethernet device.
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
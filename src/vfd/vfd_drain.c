@@ -0,0 +1,257 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_drain.c
+	Abstract:	PF rx queue drain. Some NICs (bnxt) deliver traffic to PF queue 0
+				which nothing consumes; left alone the ring fills. Draining used to
+				be done from the main loop, which only runs every 50ms and then
+				spent its time freeing mbufs between requests. The drain now runs
+				on its own thread which owns queue 0 of each such port.
+
+				When the PMD supports rx queue interrupts the thread arms them and
+				sleeps in epoll until a packet arrives (or DRAIN_WAIT_MS passes so
+				that a stop is noticed). A port which cannot give us an interrupt
+				is polled every DRAIN_POLL_MS instead, as is a port while it has a
+				software mirror (vfd_smirror.c) steering traffic to its PF queue.
+
+				Packet/byte counts are kept per port and can be seen with
+				'show drain' (along with pf capture counts, see vfd_pcap.c).
+
+	Date:		18 October 2026
+*/
+
+#include <pthread.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_drain.h"
+#include "vfd_pcap.h"
+#include "vfd_smirror.h"
+
+/*
+	Drain state for one port.
+*/
+typedef struct drain_port {
+	int			active;			// port is drained by the thread
+	int			intr;			// rx interrupt is registered with the thread's epoll fd
+	uint64_t	pkts;			// discarded since start
+	uint64_t	bytes;
+	uint64_t	wakes;			// rx interrupt wakeups
+	uint64_t	max_burst;		// most packets pulled in one pass
+} drain_port_t;
+
+static drain_port_t	dstate[MAX_PORTS];
+static pthread_t	dtid;
+static int			running = 0;			// thread was started
+static volatile int	stopping = 0;
+
+/*
+	Set (or clear) the rx interrupt on queue 0 of every port which has one registered.
+*/
+static void arm_all( int on ) {
+	int	i;
+
+	for( i = 0; i < MAX_PORTS; i++ ) {
+		if( dstate[i].intr ) {
+			if( on ) {
+				rte_eth_dev_rx_intr_enable( i, 0 );
+			} else {
+				rte_eth_dev_rx_intr_disable( i, 0 );
+			}
+		}
+	}
+}
+
+/*
+	Drain every active port once; returns the number of packets pulled. The number of
+	ports drained which have no interrupt is left in npoll.
+*/
+static int drain_all( int* npoll ) {
+	drain_port_t* dp;
+	int	i;
+	int	n;
+	int	total = 0;
+
+	*npoll = 0;
+	for( i = 0; i < MAX_PORTS; i++ ) {
+		dp = &dstate[i];
+		if( dp->active || vfd_smirror_active( i ) ) {			// soft mirrors come and go; their ports are polled
+			if( ! dp->intr ) {
+				(*npoll)++;
+			}
+
+			if( (n = discard_pf_traffic( i, &dp->bytes )) > 0 ) {
+				dp->pkts += n;
+				if( (uint64_t) n > dp->max_burst ) {
+					dp->max_burst = n;
+				}
+				total += n;
+			}
+		}
+	}
+
+	return total;
+}
+
+/*
+	Thread driver. The interrupts must be registered from this thread as they are
+	added to the per-thread epoll fd.
+*/
+static void* drain_thread( __attribute__((__unused__)) void* arg ) {
+	struct rte_epoll_event	events[MAX_PORTS];
+	int	i;
+	int	nev;
+	int	npoll = 0;			// number of ports which must be polled
+	int	nintr = 0;
+
+	for( i = 0; i < MAX_PORTS; i++ ) {
+		if( dstate[i].active ) {
+			if( rte_eth_dev_rx_intr_ctl_q( i, 0, RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, (void *) (uintptr_t) i ) == 0 ) {
+				dstate[i].intr = 1;
+				nintr++;
+				bleat_printf( 1, "pf drain: port %d queue 0 drained on rx interrupt", i );
+			} else {
+				bleat_printf( 1, "pf drain: port %d has no rx queue interrupt; polling every %dms", i, DRAIN_POLL_MS );
+			}
+		}
+	}
+
+	while( ! stopping ) {
+		if( drain_all( &npoll ) > 0 ) {				// keep pulling while there is traffic
+			continue;
+		}
+
+		if( nintr == 0 ) {
+			usleep( (npoll > 0 ? DRAIN_POLL_MS : DRAIN_WAIT_MS) * 1000 );
+			continue;
+		}
+
+		arm_all( 1 );
+		if( drain_all( &npoll ) > 0 ) {				// something landed before the interrupt was armed; it won't fire for that
+			arm_all( 0 );
+			continue;
+		}
+
+		nev = rte_epoll_wait( RTE_EPOLL_PER_THREAD, events, MAX_PORTS, npoll > 0 ? DRAIN_POLL_MS : DRAIN_WAIT_MS );
+		arm_all( 0 );
+		for( i = 0; i < nev; i++ ) {
+			dstate[(uintptr_t) events[i].epdata.data % MAX_PORTS].wakes++;
+		}
+	}
+
+	for( i = 0; i < MAX_PORTS; i++ ) {
+		if( dstate[i].intr ) {
+			rte_eth_dev_rx_intr_ctl_q( i, 0, RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_DEL, NULL );
+			dstate[i].intr = 0;
+		}
+	}
+
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------
+
+/*
+	Start the drain thread. Ports which always need it are marked now; ports with a
+	software mirror are picked up as mirrors are added. Must be called after the ports
+	are started. Returns 0 on success.
+*/
+extern int vfd_drain_start( sriov_conf_t* conf ) {
+	int	i;
+	int	pn;
+	int	count = 0;
+	int	rc;
+
+	if( conf == NULL || running ) {
+		return 0;
+	}
+
+	memset( dstate, 0, sizeof( dstate ) );
+	for( i = 0; i < conf->num_ports; i++ ) {
+		pn = conf->ports[i].rte_port_number;
+		if( pn >= 0 && pn < MAX_PORTS && get_nic_type( pn ) == VFD_BNXT ) {		// must agree with discard_pf_traffic()
+			dstate[pn].active = 1;
+			count++;
+		}
+	}
+
+	if( conf->num_ports == 0 ) {
+		bleat_printf( 2, "pf drain: no ports; thread not started" );
+		return 0;
+	}
+
+	stopping = 0;
+	if( (rc = pthread_create( &dtid, NULL, drain_thread, NULL )) != 0 ) {
+		bleat_printf( 0, "ERR: pf drain: unable to create drain thread: %s", strerror( rc ) );
+		return -1;
+	}
+
+	if( rte_thread_setname( dtid, "vfd-drain" ) != 0 ) {
+		bleat_printf( 2, "error: failed to set thread name: %s", "vfd-drain" );
+	}
+
+	running = 1;
+	bleat_printf( 1, "pf drain thread created; %d port(s) always drained", count );
+	return 0;
+}
+
+/*
+	Stop the thread and wait for it; must be done before the ports are stopped.
+	Safe to call when the thread was never started.
+*/
+extern void vfd_drain_stop( void ) {
+	int	i;
+
+	if( ! running ) {
+		return;
+	}
+
+	stopping = 1;
+	pthread_join( dtid, NULL );
+	running = 0;
+
+	for( i = 0; i < MAX_PORTS; i++ ) {
+		if( dstate[i].pkts > 0 ) {
+			bleat_printf( 1, "pf drain: port %d pulled %llu packets %llu bytes", i,
+				(unsigned long long) dstate[i].pkts, (unsigned long long) dstate[i].bytes );
+		}
+	}
+}
+
+/*
+	Build the 'show drain' response; caller must free.
+*/
+extern char* vfd_drain_show( sriov_conf_t* conf ) {
+	drain_port_t* dp;
+	char*	buf;
+	int		bsize;
+	int		blen;
+	int		i;
+	int		pn;
+
+	bsize = BUF_1K + conf->num_ports * 128;
+	if( (buf = (char *) malloc( sizeof( char ) * bsize )) == NULL ) {
+		return NULL;
+	}
+
+	blen = snprintf( buf, bsize, "\npf drain: %s\n", running ? "running" : "not running" );
+	blen += snprintf( buf + blen, bsize - blen, "%4s %6s %16s %18s %12s %10s\n", "pf", "mode", "packets", "bytes", "wakeups", "max-burst" );
+	for( i = 0; i < conf->num_ports && blen < bsize; i++ ) {
+		pn = conf->ports[i].rte_port_number;
+		if( pn < 0 || pn >= MAX_PORTS ) {
+			continue;
+		}
+
+		dp = &dstate[pn];
+		blen += snprintf( buf + blen, bsize - blen, "%4d %6s %16llu %18llu %12llu %10llu\n", pn,
+			dp->intr ? "intr" : (dp->active || vfd_smirror_active( pn ) ? "poll" : "none"),
+			(unsigned long long) dp->pkts, (unsigned long long) dp->bytes,
+			(unsigned long long) dp->wakes, (unsigned long long) dp->max_burst );
+	}
+
+	if( blen >= bsize ) {
+		blen = bsize - 1;
+	}
+	return vfd_pcap_add( buf, &bsize, &blen );			// capture counters follow
+}
@@ -0,0 +1,23 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_drain.h
+	Abstract:	PF rx queue drain thread.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_DRAIN_H
+#define _VFD_DRAIN_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+#define DRAIN_WAIT_MS		100			// max epoll wait when every drained port has rx interrupts (bounds the stop latency)
+#define DRAIN_POLL_MS		1			// wait between passes when some port must be polled
+
+// ------------- prototypes ----------------------------------------------
+extern int vfd_drain_start( sriov_conf_t* conf );
+extern void vfd_drain_stop( void );
+extern char* vfd_drain_show( sriov_conf_t* conf );
+
+#endif
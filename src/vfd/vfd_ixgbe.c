@@ -690,3 +690,90 @@ vfd_ixgbe_dump_all_vlans(uint16_t port_id)
 	return count;
 }
 
+
+
+/*
+	Read the VF's settings back from the registers that the rte_pmd_ixgbe calls write:
+	vlan pool filter (VLVF/VLVFB), receive address pool select (RAH/RAL/MPSAR),
+	anti-spoof (PFVFSPOOF), rx mode (VMOLR), default vlan insert (VMVIR) and the tx
+	rate cap of the first queue (RTTBCNRC, selected with RTTDQSEL, holds link/rate as
+	a fixed point factor). The filters address only the first 64 pools. Returns the
+	VHW_ bits for the fields filled in; the rate is not read while the link is down.
+
+	Strip is not read: VME in the VF's RXDCTL is also set by the guest's ixgbevf
+	driver when it enables its queues, so it does not tell us what we set.
+*/
+int
+vfd_ixgbe_get_vf_hw_state(uint16_t port_id, uint16_t vf_id, struct vf_hw_s* hw)
+{
+	uint32_t	reg;
+	uint32_t	rah;
+	uint32_t	ral;
+	uint32_t	pool_bit;
+	uint32_t	factor;
+	struct ether_addr* mac;
+	struct rte_eth_link link;
+	int			ix;
+
+	memset( hw, 0, sizeof( *hw ) );
+	if( vf_id > 63 ) {
+		return 0;
+	}
+
+	pool_bit = 1U << (vf_id % 32);
+	for( ix = 0; ix < IXGBE_VLVF_ENTRIES && hw->num_vlans < MAX_VF_VLANS; ix++ ) {
+		reg = port_pci_reg_read( port_id, IXGBE_VLVF( ix ) );
+		if( (reg & IXGBE_VLVF_VIEN) && (reg & IXGBE_VLVF_VLANID_MASK) != 0 ) {			// vlan 0 belongs to the pf
+			if( port_pci_reg_read( port_id, IXGBE_VLVFB( (ix * 2) + (vf_id / 32) ) ) & pool_bit ) {
+				hw->vlans[hw->num_vlans++] = reg & IXGBE_VLVF_VLANID_MASK;
+			}
+		}
+	}
+
+	for( ix = 0; ix < IXGBE_82599_RAR_ENTRIES && hw->num_macs < MAX_VF_MACS; ix++ ) {
+		rah = port_pci_reg_read( port_id, IXGBE_RAH( ix ) );
+		if( ! (rah & IXGBE_RAH_AV) ) {
+			continue;
+		}
+
+		reg = port_pci_reg_read( port_id, vf_id < 32 ? IXGBE_MPSAR_LO( ix ) : IXGBE_MPSAR_HI( ix ) );
+		if( reg & pool_bit ) {
+			ral = port_pci_reg_read( port_id, IXGBE_RAL( ix ) );
+			mac = &hw->macs[hw->num_macs++];
+			mac->addr_bytes[0] = ral & 0xff;
+			mac->addr_bytes[1] = (ral >> 8) & 0xff;
+			mac->addr_bytes[2] = (ral >> 16) & 0xff;
+			mac->addr_bytes[3] = (ral >> 24) & 0xff;
+			mac->addr_bytes[4] = rah & 0xff;
+			mac->addr_bytes[5] = (rah >> 8) & 0xff;
+		}
+	}
+
+	reg = port_pci_reg_read( port_id, IXGBE_PFVFSPOOF( vf_id >> 3 ) );
+	hw->mac_anti_spoof = !!(reg & (1U << (vf_id % 8)));
+	hw->vlan_anti_spoof = !!(reg & (1U << ((vf_id % 8) + IXGBE_SPOOF_VLANAS_SHIFT)));
+
+	reg = port_pci_reg_read( port_id, IXGBE_VMOLR( vf_id ) );
+	hw->allow_untagged = !!(reg & IXGBE_VMOLR_AUPE);
+	hw->allow_un_ucast = !!(reg & IXGBE_VMOLR_ROPE);
+	hw->allow_mcast = !!(reg & IXGBE_VMOLR_MPE);
+	hw->allow_bcast = !!(reg & IXGBE_VMOLR_BAM);
+
+	reg = port_pci_reg_read( port_id, IXGBE_VMVIR( vf_id ) );
+	hw->insert_vlan = (reg & IXGBE_VMVIR_VLANA_DEFAULT) ? (int) (reg & IXGBE_VMVIR_VLAN_VID_MASK) : 0;
+
+	hw->valid = VHW_VLANS | VHW_MACS | VHW_SPOOF | VHW_INSERT | VHW_RXMODE;
+
+	rte_eth_link_get_nowait( port_id, &link );
+	if( link.link_speed > 0 ) {
+		port_pci_reg_write( port_id, IXGBE_RTTDQSEL, vf_id * get_max_qpp( port_id ) );
+		reg = port_pci_reg_read( port_id, IXGBE_RTTBCNRC );
+		factor = reg & (IXGBE_RTTBCNRC_RF_INT_MASK | IXGBE_RTTBCNRC_RF_DEC_MASK);
+		if( (reg & IXGBE_RTTBCNRC_RS_ENA) && factor > 0 ) {
+			hw->rate = (int) (((uint64_t) link.link_speed << IXGBE_RTTBCNRC_RF_INT_SHIFT) / factor);
+		}
+		hw->valid |= VHW_RATE;
+	}
+
+	return hw->valid;
+}
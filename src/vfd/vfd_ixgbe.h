@@ -7,6 +7,8 @@
 #include <drivers/net/ixgbe/base/ixgbe_mbx.h>
 
 
+struct vf_hw_s;				// defined in sriov.h which includes us first
+
 // ------------- prototypes ----------------------------------------------
 
 int vfd_ixgbe_ping_vfs(uint16_t port, int16_t vf);
@@ -42,6 +44,7 @@ void vfd_ixgbe_set_rx_drop(uint16_t port_id, uint16_t vf_id, int state);
 void vfd_ixgbe_set_split_erop(uint16_t port_id, uint16_t vf_id, int state);
 int vfd_ixgbe_get_split_ctlreg(uint16_t port_id, uint16_t vf_id);
 int vfd_ixgbe_dump_all_vlans(uint16_t port_id);
+int vfd_ixgbe_get_vf_hw_state(uint16_t port_id, uint16_t vf_id, struct vf_hw_s* hw);
 
 #endif
 
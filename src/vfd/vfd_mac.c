@@ -7,7 +7,7 @@
 	Author:		E. Scott Daniels
 	Date:		28 October 2017  (broken from main.c and added extensions.
 
-	Mods:
+	Mods:		18 Oct 2026 - Add map_macs() to register the MACs of a VF restored from a snapshot.
 */
 
 
@@ -338,6 +338,29 @@ extern int push_mac( int port, int vfid, char* mac ) {
 	return 1;
 }
 
+/*
+	Register the MACs already in the VF's list (restored from a state snapshot rather
+	than added one at a time with add_mac()) in the symtab so that duplicate checking
+	on the PF works. Returns the number mapped.
+*/
+extern int map_macs( int port, struct vf_s* vf ) {
+	int m;
+	int n = 0;
+
+	if( vf == NULL || vf->num_macs <= 0 ) {
+		return 0;
+	}
+
+	for( m = vf->first_mac; m <= vf->num_macs && m < MAX_VF_MACS; m++ ) {
+		if( vf->macs[m][0] ) {
+			sym_map( mac_stab, vf->macs[m], port, (void*) 1 );
+			n++;
+		}
+	}
+
+	return n;
+}
+
 /*
 	Run the list of MAC addresses whe have associated with the VF and push them out to the NIC.
 	We run the list in _reverse_ order because on some NICs the last one pushed is assumed to be
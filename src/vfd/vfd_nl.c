@@ -4,6 +4,10 @@
 	Date:		October 2017
 	Author:		Alex Zelezniak
 
+	Mods:		18 Oct 2026 - Push VF stats to the module on an interval rather than
+					answering a request each time the kernel reads netdev stats.
+				18 Oct 2026 - Queue device add/delete notifications and send them
+					coalesced in preallocated batch messages; acks are async.
 */
 
 #include "sriov.h"
@@ -13,15 +17,46 @@
 
 static __u32 seq;
 
+#define NL_DQ_SIZE	(MAX_PORTS * MAX_VFS)		// room for every pf/vf; a port/vf is never queued twice
+
+static struct vfd_nl_dev_rec dq[NL_DQ_SIZE];			// pending add/delete notifications
+static int dq_len = 0;
+static int16_t dq_idx[MAX_PORTS][MAX_VFS];				// index+1 into dq of the pending record for a port/vf, 0 if none
+static rte_spinlock_t dq_lock = RTE_SPINLOCK_INITIALIZER;	// queued from the main and netlink threads
+static char dq_buf[sizeof(struct cn_msg) + VFD_NL_MAX_PAYLOAD];	// preallocated batch message (under dq_lock)
+static __u32 cn_seq = 0;								// seq on messages we send
+static int dq_unacked = 0;								// batches sent and not yet acked
+
+static struct rte_pci_addr pf_addrs[MAX_PORTS];		// pf pci address, fetched once for each port
+static int pf_addr_ok[MAX_PORTS];
+
+/*
+	Fill in the pci address of the port. Virtual devices have no pci device so the
+	address the simulator assigned is used.
+*/
+static void
+port_pci_addr(int port, struct rte_eth_dev_info *dev_info, struct rte_pci_addr *addr)
+{
+	if (dev_info->pci_dev != NULL)
+		*addr = dev_info->pci_dev->addr;
+	else
+		vfd_sim_pci_addr(port, addr);
+}
+
 int 
 netlink_send(int s, struct cn_msg *msg)
 {
 	struct nlmsghdr *nlh;
 	unsigned int size;
 	int err;
-	char buf[128];
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + VFD_NL_MAX_PAYLOAD)];
 	struct cn_msg *m;
 
+	if (msg->len > VFD_NL_MAX_PAYLOAD) {
+		bleat_printf( 1, "WRN: netlink message too large: %u > %d", msg->len, VFD_NL_MAX_PAYLOAD );
+		return -1;
+	}
+
 	size = NLMSG_SPACE(sizeof(struct cn_msg) + msg->len);
 
 	nlh = (struct nlmsghdr *)buf;
@@ -39,7 +74,7 @@ netlink_send(int s, struct cn_msg *msg)
 #endif
 	memcpy(m, msg, sizeof(*m) + msg->len);
 
-	err = send(s, nlh, size, 0);
+	err = send(s, nlh, size, MSG_DONTWAIT);			// never hold up nic configuration on the module
 	if (err == -1)
 		bleat_printf( 2, "Failed to send: %s [%d].\n",
 			strerror(errno), errno);
@@ -48,7 +83,7 @@ netlink_send(int s, struct cn_msg *msg)
 }
 
 
-int nl_socket;
+int nl_socket = -1;
 
 
 void 
@@ -178,9 +213,8 @@ netlink_connect(void)
 		
 			switch(msg_rq->req) {
 				
-				case NL_VF_STATS_RQ:
-					bleat_printf( 5, "nl GET Stats, Port: %d, VF: %d\n", msg_rq->port, msg_rq->vf);					
-					device_message(msg_rq->port, msg_rq->vf, NL_VF_STATS_RQ, NL_PF_RESP_OK);
+				case NL_VF_STATS_RQ:			// older modules ask on each read; stats are now pushed on an interval
+					bleat_printf( 5, "nl GET Stats ignored (stats are pushed), Port: %d, VF: %d\n", msg_rq->port, msg_rq->vf);
 					break;
 					
 				case NL_VF_GET_DEV_RQ:
@@ -188,6 +222,22 @@ netlink_connect(void)
 					get_all_devices();
 					break;
 					
+				case NL_PF_DEV_ACK:
+					{
+						struct vfd_nl_stats_hdr *ack = (struct vfd_nl_stats_hdr *) data->data;
+
+						rte_spinlock_lock(&dq_lock);
+						if (dq_unacked > 0)
+							dq_unacked--;
+						rte_spinlock_unlock(&dq_lock);
+
+						if (ack->resp != NL_PF_RESP_OK)
+							bleat_printf( 1, "WRN: nl device batch %u: %u applied, %u failed", data->ack, ack->nrecs, ack->port);
+						else
+							bleat_printf( 3, "nl device batch %u acked: %u applied", data->ack, ack->nrecs);
+					}
+					break;
+
 				default:
 					bleat_printf( 2, "nl Unknown request, Port: %d, VF: %d, REQ: %d\n", msg_rq->port, msg_rq->vf, msg_rq->req);
 					device_message(msg_rq->port, msg_rq->vf, NL_PF_RES_DEV_RQ, NL_PF_RESP_ERR);
@@ -204,162 +254,283 @@ netlink_connect(void)
 
 
 
+/*
+	Send a single, record-less request to the module (update device list,
+	remove all devices, error reply). Adds and deletes are queued with
+	vfd_nl_queue_dev() and sent in batches by vfd_nl_flush().
+*/
 void
 device_message(int port, int vf, int req, int resp)
 {
-	int len;
-	char buf[1024];
-	char pciaddr[PCIADDR_LEN + 1];
+	char buf[sizeof(struct cn_msg) + sizeof(struct vfd_nl_message)];
 	struct vfd_nl_message *msg_rq;
 	struct cn_msg *data;
-	struct nlmsghdr *reply;
-	struct rte_eth_link link;
-	struct rte_eth_dev_info dev_info;
-	
-	uint8_t bytes[6];
-	int values[6];
-	int i;
-	struct vf_s* vfp;
-	struct ether_addr e_addr;
+	int len;
 
 	memset(buf, 0, sizeof(buf));
-	reply = (struct nlmsghdr *)buf;
-	
-	data = (struct cn_msg *)NLMSG_DATA(reply);
-	
-	data = (struct cn_msg *)buf;
-
+	data = (struct cn_msg *) buf;
 	data->id.idx = CN_VFD_IDX;
 	data->id.val = CN_VFD_VAL;
-	data->seq++;
+	data->seq = cn_seq++;
 	data->ack = 0;
-	
-	msg_rq = (struct vfd_nl_message *) data->data;
-	
-	msg_rq->info = malloc(sizeof(struct dev_info));
-	msg_rq->info->stats = malloc(sizeof(struct dev_stats));
-	
-	msg_rq->info->mac = malloc(6);
-	
-	msg_rq->pciaddr = malloc(PCIADDR_LEN);
-	
-	
-	if(req == NL_VF_STATS_RQ) {
-		struct rte_eth_stats rt_stats;
-		
-		if(vf == MAX_VFS - 1) {
-			rte_eth_stats_get(port, &rt_stats);		//PF			
-			rte_eth_link_get_nowait(port, &link);
-			
-			msg_rq->info->link_state = link.link_status;
-			msg_rq->info->link_speed = link.link_speed;
-			msg_rq->info->link_duplex = link.link_duplex;
-			
-		} else {
-			get_vf_stats(port, vf, &rt_stats);		//VF
-			
-			int mcounter = 0;
-			if(is_rx_queue_on(port, vf, &mcounter ))
-				msg_rq->info->link_state = 1;
-			else
-				msg_rq->info->link_state = 0;
-		}
-		
-		
-		msg_rq->info->stats->rx_packets	= rt_stats.ipackets;
-		msg_rq->info->stats->tx_packets	= rt_stats.opackets;
-		msg_rq->info->stats->rx_bytes		= rt_stats.ibytes;
-		msg_rq->info->stats->tx_bytes		= rt_stats.obytes;
-		msg_rq->info->stats->rx_errors	= rt_stats.ierrors;
-		msg_rq->info->stats->tx_errors	= rt_stats.oerrors;
-		msg_rq->info->stats->rx_dropped	= rt_stats.rx_nombuf;
-		//msg_rq->info->stats.tx_dropped	= rt_stats.
-		//msg_rq->info->stats.multicast	= rt_stats.
-		//msg_rq->info->stats.collisions	= rt_stats.
-		
-							
-				
-		if(vf < MAX_VFS - 1) {  
-			// VF
-			vfp = suss_vf( port, vf );
-				
-			len = sscanf( vfp->macs[0], "%x:%x:%x:%x:%x:%x",
-				&values[0], &values[1], &values[2], &values[3], &values[4], &values[5]);
-					
-			if (len == 6) {
-				// convert to uint8_t 
-				for( i = 0; i < 6; ++i )
-					bytes[i] = (uint8_t) values[i];	
-				
-				memcpy(msg_rq->info->mac,  bytes, 6);				
-			} else {
-				bleat_printf( 3, "nl: incorrect MAC: %s\n", vfp->macs[0]);
-				memset(msg_rq->info->mac,  0, 6);	
-			}
-		} else {
-			//PF
-			rte_eth_macaddr_get(port, &e_addr);
-			memcpy(msg_rq->info->mac, (char *) &e_addr, 6);
-		}
-
-	} else if (req == NL_PF_ADD_DEV_RQ) {
-		rte_eth_dev_info_get(port, &dev_info);
-			
-		if(vf == MAX_VFS - 1) {  
-			// PF
-			snprintf(pciaddr, sizeof( pciaddr ), "%04X:%02X:%02X.%01X", 
-					dev_info.pci_dev->addr.domain,
-					dev_info.pci_dev->addr.bus,
-					dev_info.pci_dev->addr.devid,
-					dev_info.pci_dev->addr.function);
-					
-			strncpy(msg_rq->pciaddr, pciaddr, PCIADDR_LEN);
-		} else {
-			
-			// VF
-			uint32_t pf_ari = dev_info.pci_dev->addr.bus << 8 | dev_info.pci_dev->addr.devid << 3 | dev_info.pci_dev->addr.function;
-			struct sriov_port_s *p = &running_config->ports[port];	
-			uint32_t new_ari = pf_ari + p->vf_offset + (vf * p->vf_stride);
-			
-			int domain = 0;
-			int bus = (new_ari >> 8) & 0xff;
-			int devid = (new_ari >> 3) & 0x1f;
-			int function = new_ari & 0x7;
-			
-			snprintf(pciaddr, sizeof( pciaddr ), "%04X:%02X:%02X.%01X", 
-					domain,
-					bus,
-					devid,
-					function);
-					
-			strncpy(msg_rq->pciaddr, pciaddr, PCIADDR_LEN);
-		}
-	
-		bleat_printf( 5, "nl: PCI ADDR: %s\n", pciaddr);
-	}
-	
+	data->len = sizeof(struct vfd_nl_message);
 
-	
+	msg_rq = (struct vfd_nl_message *) data->data;
 	msg_rq->port = port;
 	msg_rq->vf = vf;
-					
 	msg_rq->req = req;
 	msg_rq->resp = resp;
-	
-	memcpy (data->data, msg_rq, sizeof(struct vfd_nl_message));
-	data->len = sizeof(struct vfd_nl_message);
-	
+
 	len = netlink_send(nl_socket, data);
-	
-	bleat_printf( 5, "nl messages have been sent to %08x.%08x, link = %08x, data len = %d, msg len = %d\n", data->id.idx, data->id.val, msg_rq->info->link_state, data->len, len);
-		
-	free(msg_rq->info->stats);
-	free(msg_rq->info->mac);
-	free(msg_rq->pciaddr);
-	free(msg_rq->info);		
+	bleat_printf( 5, "nl message %d sent to %08x.%08x, data len = %d, msg len = %d\n", req, data->id.idx, data->id.val, data->len, len);
+}
+
+/*
+	Build the pci address string used as the alias for the PF (vf == MAX_VFS - 1)
+	or a VF of the port. The PF address is fetched once per port.
+*/
+static void
+dev_pciaddr(struct sriov_port_s *port, int vf, char *pciaddr, int len)
+{
+	struct rte_eth_dev_info dev_info;
+	struct rte_pci_addr *pf_addr;
+	uint32_t pf_ari;
+	uint32_t new_ari;
+	int pid;
+
+	pid = port->rte_port_number;
+	pf_addr = &pf_addrs[pid];
+	if (!pf_addr_ok[pid]) {
+		rte_eth_dev_info_get(pid, &dev_info);
+		port_pci_addr(pid, &dev_info, pf_addr);
+		pf_addr_ok[pid] = 1;
+	}
+
+	if (vf == MAX_VFS - 1) {
+		snprintf(pciaddr, len, "%04X:%02X:%02X.%01X", pf_addr->domain, pf_addr->bus, pf_addr->devid, pf_addr->function);
+		return;
+	}
+
+	pf_ari = pf_addr->bus << 8 | pf_addr->devid << 3 | pf_addr->function;
+	new_ari = pf_ari + port->vf_offset + (vf * port->vf_stride);
+	snprintf(pciaddr, len, "%04X:%02X:%02X.%01X", 0, (new_ari >> 8) & 0xff, (new_ari >> 3) & 0x1f, new_ari & 0x7);
+}
+
+/*
+	Queue an add or delete notification for the PF (vf == MAX_VFS - 1) or a VF.
+	If one is already pending for the port/vf it is replaced (the module only
+	needs the final state). Nothing is sent until vfd_nl_flush().
+*/
+void
+vfd_nl_queue_dev(struct sriov_port_s *port, int vf, int req)
+{
+	struct vfd_nl_dev_rec *rec;
+	int pid;
+	int i;
+
+	pid = port->rte_port_number;
+	if (pid < 0 || pid >= MAX_PORTS || vf < 0 || vf >= MAX_VFS) {
+		bleat_printf( 1, "WRN: nl: device notification not queued: port/vf out of range: %d/%d", pid, vf);
+		return;
+	}
+
+	rte_spinlock_lock(&dq_lock);
+	if ((i = dq_idx[pid][vf]) > 0) {
+		rec = &dq[i-1];
+	} else {
+		rec = &dq[dq_len++];					// cannot overflow; sized for every port/vf
+		dq_idx[pid][vf] = dq_len;
+	}
+
+	rec->req = req;
+	rec->port = pid;
+	rec->vf = vf;
+	dev_pciaddr(port, vf, rec->pciaddr, sizeof(rec->pciaddr));
+	rte_spinlock_unlock(&dq_lock);
+
+	bleat_printf( 5, "nl: queued device request %d port %d vf %d", req, pid, vf);
 }
 
+/*
+	Send the queued device notifications, VFD_NL_DEVS_PER_MSG to a message. The
+	send does not block; if the socket is full the unsent records stay queued
+	for the next call. Acks are handled by the netlink thread as they arrive.
+	Called each pass of the main loop.
+*/
+void
+vfd_nl_flush(void)
+{
+	struct cn_msg *data = (struct cn_msg *) dq_buf;
+	struct vfd_nl_stats_hdr *hdr = (struct vfd_nl_stats_hdr *) data->data;
+	int sent = 0;
+	int n;
+	int i;
 
+	if (nl_socket < 0 || dq_len == 0)			// unlocked peek; a record queued as we look goes on the next pass
+		return;
+
+	rte_spinlock_lock(&dq_lock);
+	while (sent < dq_len) {
+		n = dq_len - sent;
+		if (n > (int) VFD_NL_DEVS_PER_MSG)
+			n = VFD_NL_DEVS_PER_MSG;
+
+		data->id.idx = CN_VFD_IDX;
+		data->id.val = CN_VFD_VAL;
+		data->seq = cn_seq++;
+		data->ack = 0;
+		data->len = sizeof(*hdr) + (n * sizeof(struct vfd_nl_dev_rec));
+
+		hdr->req = NL_PF_DEV_BATCH;
+		hdr->resp = NL_PF_RESP_OK;
+		hdr->port = 0;
+		hdr->nrecs = n;
+		memcpy(hdr + 1, &dq[sent], n * sizeof(struct vfd_nl_dev_rec));
+
+		if (netlink_send(nl_socket, data) < 0)
+			break;
+
+		dq_unacked++;
+		sent += n;
+	}
+
+	for (i = 0; i < sent; i++)
+		dq_idx[dq[i].port][dq[i].vf] = 0;
+
+	if (sent > 0 && sent < dq_len) {			// keep what didn't go; reindex
+		memmove(&dq[0], &dq[sent], (dq_len - sent) * sizeof(dq[0]));
+		for (i = 0; i < dq_len - sent; i++)
+			dq_idx[dq[i].port][dq[i].vf] = i + 1;
+	}
+	dq_len -= sent;
+	n = dq_unacked;
+	rte_spinlock_unlock(&dq_lock);
+
+	if (sent > 0)
+		bleat_printf( 3, "nl: %d device notifications sent; %d batches unacked", sent, n);
+}
+
+
+/*
+	Fill one pushed stats record for the PF (vf == MAX_VFS - 1) or a VF. VF
+	counters come from get_vf_stats() so they are the monotonic values.
+*/
+static void
+fill_stats_rec(struct vfd_nl_vf_stats *rec, int port, int vf)
+{
+	struct rte_eth_stats rt_stats;
+	struct rte_eth_link link;
+	struct ether_addr e_addr;
+	struct vf_s* vfp;
+	int values[6];
+	int mcounter = 0;
+	int i;
+
+	memset(rec, 0, sizeof(*rec));
+	memset(&rt_stats, 0, sizeof(rt_stats));
+	rec->vf = vf;
+
+	if (vf == MAX_VFS - 1) {
+		rte_eth_stats_get(port, &rt_stats);
+		rte_eth_link_get_nowait(port, &link);
+		rec->link_state = link.link_status;
+
+		rte_eth_macaddr_get(port, &e_addr);
+		memcpy(rec->mac, (char *) &e_addr, 6);
+	} else {
+		get_vf_stats(port, vf, &rt_stats);
+		rec->link_state = is_rx_queue_on(port, vf, &mcounter) ? 1 : 0;
+
+		if ((vfp = suss_vf(port, vf)) != NULL &&
+			sscanf(vfp->macs[0], "%x:%x:%x:%x:%x:%x", &values[0], &values[1], &values[2], &values[3], &values[4], &values[5]) == 6) {
+			for (i = 0; i < 6; i++)
+				rec->mac[i] = (uint8_t) values[i];
+		}
+	}
+
+	rec->stats.rx_packets		= rt_stats.ipackets;
+	rec->stats.tx_packets		= rt_stats.opackets;
+	rec->stats.rx_bytes			= rt_stats.ibytes;
+	rec->stats.tx_bytes			= rt_stats.obytes;
+	rec->stats.rx_errors		= rt_stats.ierrors;
+	rec->stats.tx_errors		= rt_stats.oerrors;
+	rec->stats.rx_dropped		= rt_stats.rx_nombuf;
+	rec->stats.rx_missed_errors	= rt_stats.imissed;
+}
+
+/*
+	Send one stats message with n records already in place.
+*/
+static void
+send_stats_msg(struct cn_msg *data, int port, int n)
+{
+	static __u32 sseq = 0;
+	struct vfd_nl_stats_hdr *hdr = (struct vfd_nl_stats_hdr *) data->data;
+
+	data->id.idx = CN_VFD_IDX;
+	data->id.val = CN_VFD_VAL;
+	data->seq = sseq++;
+	data->ack = 0;
+	data->len = sizeof(*hdr) + (n * sizeof(struct vfd_nl_vf_stats));
+
+	hdr->req = NL_VF_STATS_PUSH;
+	hdr->resp = NL_PF_RESP_OK;
+	hdr->port = port;
+	hdr->nrecs = n;
+
+	netlink_send(nl_socket, data);
+}
+
+/*
+	Push the stats for the PF and each configured VF of every port to the kernel
+	module. The module serves the netdev stats from what was pushed, so a read
+	of /proc/net/dev or ip -s link costs nothing here. Records for a port are
+	packed VFD_NL_STATS_PER_MSG to a message. Driven from the main loop; does
+	nothing until the interval (nl_stats_itvl) has passed.
+*/
+void
+vfd_nl_stats_tick(parms_t *parms, sriov_conf_t *conf)
+{
+	static char buf[sizeof(struct cn_msg) + VFD_NL_MAX_PAYLOAD];		// only the main thread pushes
+	static time_t next_push = 0;
+	struct cn_msg *data = (struct cn_msg *) buf;
+	struct vfd_nl_vf_stats *recs;
+	struct sriov_port_s *port;
+	time_t now;
+	int i, y, n;
+
+	if (parms->nl_stats_itvl <= 0 || nl_socket < 0)
+		return;
+
+	now = time(NULL);
+	if (now < next_push)
+		return;
+	next_push = now + parms->nl_stats_itvl;
+
+	recs = (struct vfd_nl_vf_stats *) (data->data + sizeof(struct vfd_nl_stats_hdr));
+
+	rte_spinlock_lock(&conf->update_lock);
+	for (i = 0; i < conf->num_ports; i++) {
+		port = &conf->ports[i];
+
+		n = 0;
+		fill_stats_rec(&recs[n++], port->rte_port_number, MAX_VFS - 1);
+
+		for (y = 0; y < port->num_vfs; y++) {
+			if (port->vfs[y].num < 0)
+				continue;
+
+			if (n == VFD_NL_STATS_PER_MSG) {
+				send_stats_msg(data, port->rte_port_number, n);
+				n = 0;
+			}
+			fill_stats_rec(&recs[n++], port->rte_port_number, port->vfs[y].num);
+		}
+
+		send_stats_msg(data, port->rte_port_number, n);
+	}
+	rte_spinlock_unlock(&conf->update_lock);
+}
 
 
 void
@@ -370,12 +541,12 @@ get_all_devices(void)
 	
 	for (i = 0; i < sriov_config->num_ports; i++){
 
-		device_message(i, MAX_VFS - 1, NL_PF_ADD_DEV_RQ, NL_PF_RESP_OK);  // indicates PF
+		vfd_nl_queue_dev(&sriov_config->ports[i], MAX_VFS - 1, NL_PF_ADD_DEV_RQ);  // indicates PF
 		
 		for (y = 0; y < sriov_config->ports[i].num_vfs; y++){
 			if( sriov_config->ports[i].vfs[y].num >= 0 ) {
 	
-				device_message(sriov_config->ports[i].rte_port_number, sriov_config->ports[i].vfs[y].num, NL_PF_ADD_DEV_RQ, NL_PF_RESP_OK);
+				vfd_nl_queue_dev(&sriov_config->ports[i], sriov_config->ports[i].vfs[y].num, NL_PF_ADD_DEV_RQ);
 				
 			} else {
 				bleat_printf( 2, "get_all_devices: port %d index %d is not configured", i, y );
@@ -411,7 +582,7 @@ get_port_by_pci(const char * pciaddr)
 
 		rte_eth_dev_info_get( running_config->ports[i].rte_port_number, &dev_info );				// must use port number that we mapped during initialisation
 		
-		d_pci_addr = dev_info.pci_dev->addr;
+		port_pci_addr(running_config->ports[i].rte_port_number, &dev_info, &d_pci_addr);
 
 		if (!rte_eal_compare_pci_addr(&d_pci_addr, &s_pci_addr)) {
 			bleat_printf( 5, "port found: Port=%d, pciaddr=%s", running_config->ports[i].rte_port_number, pciaddr);
@@ -423,40 +594,6 @@ get_port_by_pci(const char * pciaddr)
 }
 
 
-/*
-*	returns VF stats based on provided 
-	PF PCIADDR and VF number
-*/
-int
-get_vf_stats(int port_id, int vf, struct rte_eth_stats *stats)
-{
-	int result = -1;
-	uint dev_type = get_nic_type(port_id);
-	
-	switch (dev_type) {
-		case VFD_NIANTIC:
-			result = vfd_ixgbe_get_vf_stats(port_id, vf, stats);
-			stats->oerrors = 0;
-			break;
-			
-		case VFD_FVL25:		
-			result = vfd_i40e_get_vf_stats(port_id, vf, stats);
-			break;
-
-		case VFD_BNXT:
-			result = vfd_bnxt_get_vf_stats(port_id, vf, stats);
-			break;
-			
-		case VFD_MLX5:
-			result = vfd_mlx5_get_vf_stats(port_id, vf, stats);
-			break;
-
-		default:
-			bleat_printf( 2, "get_vf_stats: unknown device type: %u, port: %u", port_id, dev_type);
-			break;	
-	}	
-	return result;
-}
 
 
 
@@ -51,7 +51,6 @@
 
 
 int get_port_by_pci(const char * pciaddr);
-int get_vf_stats(int pf, int vf, struct rte_eth_stats *stats);
 
 void netlink_init(void);
 void netlink_connect(void);
@@ -60,6 +59,9 @@ int send_message(struct cn_msg *msg);
 
 void get_all_devices(void);
 void device_message(int p, int v, int req, int resp);
+void vfd_nl_stats_tick(parms_t *parms, sriov_conf_t *conf);
+void vfd_nl_queue_dev(struct sriov_port_s *port, int vf, int req);
+void vfd_nl_flush(void);
 
 
 #endif /* _VFD_NL_H_ */
\ No newline at end of file
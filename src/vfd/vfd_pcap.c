@@ -0,0 +1,611 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_pcap.c
+	Abstract:	Optional capture of the traffic which lands on the PF queues that the
+				drain thread empties (usually misdirected VF traffic or LLDP). When
+				pf_capture_dir is set in the parm file, each packet the drain thread
+				pulls is offered here before it is freed. Packets passing the filter
+				(pf_capture_filter) are sampled 1 in pf_capture_sample and the first
+				pf_capture_snaplen bytes are copied into a single producer/single
+				consumer ring of fixed size slots in mmap'd memory. The drain thread
+				never waits: if the ring is full the packet is counted and skipped.
+
+				A writer thread (vfd-pcap) empties the ring into a pcap file per port
+				in the capture directory. A file is closed when it reaches
+				pf_capture_file_mb and a new one opened; only the newest
+				pf_capture_nfiles files for each port are kept.
+
+				The filter is a comma separated list of terms:
+					<ethertype>		hex (0x88cc) or decimal ethertype; the inner type if tagged
+					vlan			any tagged packet
+					vlan:<id>		packets tagged with the id
+					untagged		packets without a tag
+				A packet must match one of the ethertype terms (if any are given) and
+				one of the vlan terms (if any are given). An empty filter captures all.
+
+				A VLAN tag stripped by the NIC is put back into the captured bytes.
+
+				The software mirror (vfd_smirror.c) may also target the capture; its
+				packets go to a separate mirror_pf<n> file set for the port and are
+				marked with an 'm' in the show output.
+
+	Date:		18 October 2026
+*/
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_pcap.h"
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_LT_ETHER	1
+
+#define VLAN_ANY		-1			// filter values for vlan terms
+#define VLAN_NONE		-2
+
+/*
+	Slot in the ring; data follows the header and is snaplen + tag bytes long.
+*/
+typedef struct pcap_slot {
+	uint32_t	sec;
+	uint32_t	usec;
+	uint32_t	caplen;			// bytes in data
+	uint32_t	origlen;		// length on the wire (with any reinserted tag)
+	uint16_t	port;
+	uint16_t	pad;
+	unsigned char data[];
+} pcap_slot_t;
+
+/*
+	Pcap file and record headers.
+*/
+typedef struct pcap_fhdr {
+	uint32_t	magic;
+	uint16_t	major;
+	uint16_t	minor;
+	int32_t		thiszone;
+	uint32_t	sigfigs;
+	uint32_t	snaplen;
+	uint32_t	linktype;
+} pcap_fhdr_t;
+
+typedef struct pcap_rhdr {
+	uint32_t	sec;
+	uint32_t	usec;
+	uint32_t	caplen;
+	uint32_t	origlen;
+} pcap_rhdr_t;
+
+/*
+	Output state for one port; managed only by the writer.
+*/
+typedef struct pcap_out {
+	FILE*		f;
+	uint64_t	fbytes;					// bytes in the current file
+	int			nnames;					// names of files kept (oldest first)
+	char*		names[PCAP_MAX_FILES];
+} pcap_out_t;
+
+/*
+	Counters for one port. Producer side counts are changed only by the drain thread,
+	writer side only by the writer thread.
+*/
+typedef struct pcap_ctrs {
+	uint64_t	offered;
+	uint64_t	filtered;				// didn't pass the filter
+	uint64_t	sampled;				// passed the filter but skipped by sampling
+	uint64_t	ring_full;
+	uint32_t	nth;					// sample countdown
+	uint64_t	written;				// writer side
+	uint64_t	wbytes;
+	uint64_t	werrors;
+	uint64_t	files;
+} pcap_ctrs_t;
+
+static volatile int		enabled = 0;
+static volatile int		stopping = 0;
+static pthread_t		wtid;
+
+static unsigned char*	ring = NULL;				// mmap'd slots
+static size_t			ring_size = 0;
+static uint32_t			slot_size = 0;
+static volatile uint32_t	ring_head __rte_cache_aligned = 0;		// next slot the producer fills
+static volatile uint32_t	ring_tail __rte_cache_aligned = 0;		// next slot the consumer empties
+
+static char*	cap_dir = NULL;
+static int		snaplen = 256;
+static int		sample = 1;
+static uint64_t	max_fbytes = 0;
+static int		nfiles = 8;
+static int		netypes = 0;
+static uint16_t	etypes[PCAP_MAX_FILTER];
+static int		nvlans = 0;
+static int		vlans[PCAP_MAX_FILTER];
+
+static pcap_ctrs_t	ctrs[PCAP_STREAMS];
+static pcap_out_t	outs[PCAP_STREAMS];
+
+/*
+	Parse the filter string. Returns the number of bad terms (which are ignored).
+*/
+static int parse_filter( char* fstr ) {
+	char*	dstr;
+	char*	tok;
+	char*	strtok_p = NULL;
+	char*	ep;
+	long	v;
+	int		errs = 0;
+
+	netypes = nvlans = 0;
+	if( fstr == NULL || *fstr == 0 ) {
+		return 0;
+	}
+
+	dstr = strdup( fstr );
+	for( tok = strtok_r( dstr, ", ", &strtok_p ); tok != NULL; tok = strtok_r( NULL, ", ", &strtok_p ) ) {
+		if( strcmp( tok, "vlan" ) == 0 ) {
+			if( nvlans < PCAP_MAX_FILTER ) {
+				vlans[nvlans++] = VLAN_ANY;
+			}
+			continue;
+		}
+		if( strcmp( tok, "untagged" ) == 0 ) {
+			if( nvlans < PCAP_MAX_FILTER ) {
+				vlans[nvlans++] = VLAN_NONE;
+			}
+			continue;
+		}
+		if( strncmp( tok, "vlan:", 5 ) == 0 ) {
+			v = strtol( tok + 5, &ep, 0 );
+			if( *ep == 0 && v >= 0 && v < 4096 && nvlans < PCAP_MAX_FILTER ) {
+				vlans[nvlans++] = (int) v;
+			} else {
+				bleat_printf( 1, "WRN: pf capture: bad filter term ignored: %s", tok );
+				errs++;
+			}
+			continue;
+		}
+
+		v = strtol( tok, &ep, 0 );
+		if( *ep == 0 && v > 0 && v <= 0xffff && netypes < PCAP_MAX_FILTER ) {
+			etypes[netypes++] = (uint16_t) v;
+		} else {
+			bleat_printf( 1, "WRN: pf capture: bad filter term ignored: %s", tok );
+			errs++;
+		}
+	}
+
+	free( dstr );
+	return errs;
+}
+
+/*
+	Test the packet against the filter. Vlan is the tag (VLAN_NONE if untagged)
+	and etype the inner ethertype (host order).
+*/
+static int filter_match( int vlan, uint16_t etype ) {
+	int i;
+	int hit;
+
+	if( netypes > 0 ) {
+		for( hit = 0, i = 0; i < netypes && !hit; i++ ) {
+			hit = etypes[i] == etype;
+		}
+		if( !hit ) {
+			return 0;
+		}
+	}
+
+	if( nvlans > 0 ) {
+		for( hit = 0, i = 0; i < nvlans && !hit; i++ ) {
+			hit = vlans[i] == vlan || (vlans[i] == VLAN_ANY && vlan >= 0);
+		}
+		if( !hit ) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// ----------------------- writer side -----------------------------------------------------
+
+/*
+	Close the current file for the port (if any) and open the next. Old files beyond
+	the number to keep are removed.
+*/
+static FILE* rotate( int port ) {
+	pcap_out_t*	po;
+	pcap_fhdr_t	fh;
+	struct tm	tm;
+	time_t		now;
+	char		wbuf[1024];
+	int			i;
+
+	po = &outs[port];
+	if( po->f != NULL ) {
+		fclose( po->f );
+		po->f = NULL;
+	}
+
+	while( po->nnames >= nfiles ) {							// drop the oldest
+		if( unlink( po->names[0] ) != 0 && errno != ENOENT ) {
+			bleat_printf( 1, "WRN: pf capture: unable to remove %s: %s", po->names[0], strerror( errno ) );
+		}
+		free( po->names[0] );
+		for( i = 1; i < po->nnames; i++ ) {
+			po->names[i-1] = po->names[i];
+		}
+		po->nnames--;
+	}
+
+	now = time( NULL );
+	localtime_r( &now, &tm );
+	snprintf( wbuf, sizeof( wbuf ), "%s/%spf%d_%04d%02d%02d%02d%02d%02d_%llu.pcap", cap_dir,
+		port >= MAX_PORTS ? "mirror_" : "", port % MAX_PORTS,
+		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, (unsigned long long) ctrs[port].files );
+
+	if( (po->f = fopen( wbuf, "w" )) == NULL ) {
+		bleat_printf( 0, "ERR: pf capture: unable to open %s: %s", wbuf, strerror( errno ) );
+		return NULL;
+	}
+
+	memset( &fh, 0, sizeof( fh ) );
+	fh.magic = PCAP_MAGIC;
+	fh.major = 2;
+	fh.minor = 4;
+	fh.snaplen = snaplen + 4;
+	fh.linktype = PCAP_LT_ETHER;
+	fwrite( &fh, sizeof( fh ), 1, po->f );
+
+	po->fbytes = sizeof( fh );
+	po->names[po->nnames++] = strdup( wbuf );
+	ctrs[port].files++;
+	bleat_printf( 2, "pf capture: port %d writing to %s", port, wbuf );
+
+	return po->f;
+}
+
+/*
+	Write one slot to the port's file.
+*/
+static void write_slot( pcap_slot_t* slot ) {
+	pcap_out_t*	po;
+	pcap_rhdr_t	rh;
+	int			port;
+
+	port = slot->port;
+	po = &outs[port];
+	if( po->f == NULL || po->fbytes >= max_fbytes ) {
+		if( rotate( port ) == NULL ) {
+			ctrs[port].werrors++;
+			return;
+		}
+	}
+
+	rh.sec = slot->sec;
+	rh.usec = slot->usec;
+	rh.caplen = slot->caplen;
+	rh.origlen = slot->origlen;
+	if( fwrite( &rh, sizeof( rh ), 1, po->f ) != 1 || fwrite( slot->data, slot->caplen, 1, po->f ) != 1 ) {
+		ctrs[port].werrors++;
+		return;
+	}
+
+	po->fbytes += sizeof( rh ) + slot->caplen;
+	ctrs[port].written++;
+	ctrs[port].wbytes += slot->caplen;
+}
+
+/*
+	Writer thread: empty the ring, flushing the files whenever it runs dry so that
+	they are readable while capture continues.
+*/
+static void* writer( __attribute__((__unused__)) void* arg ) {
+	uint32_t	head;
+	uint32_t	tail;
+	int			i;
+	int			dirty = 0;
+
+	while( 1 ) {
+		head = ring_head;
+		rte_smp_rmb();								// slot contents are visible once head is
+		tail = ring_tail;
+
+		if( head == tail ) {
+			if( dirty ) {
+				for( i = 0; i < PCAP_STREAMS; i++ ) {
+					if( outs[i].f != NULL ) {
+						fflush( outs[i].f );
+					}
+				}
+				dirty = 0;
+			}
+			if( stopping ) {
+				break;
+			}
+			usleep( PCAP_IDLE_US );
+			continue;
+		}
+
+		for( ; tail != head; tail++ ) {
+			write_slot( (pcap_slot_t *) (ring + (size_t) (tail & (PCAP_RING_SLOTS-1)) * slot_size) );
+		}
+		rte_smp_mb();								// done with the slots before the producer may reuse them
+		ring_tail = tail;
+		dirty = 1;
+	}
+
+	for( i = 0; i < PCAP_STREAMS; i++ ) {
+		if( outs[i].f != NULL ) {
+			fclose( outs[i].f );
+			outs[i].f = NULL;
+		}
+	}
+
+	return NULL;
+}
+
+// ----------------------- producer side (drain thread) -----------------------------------
+
+/*
+	Copy up to snap bytes of the packet into the next slot for the stream. Returns 0
+	if queued, -1 if the ring is full. Only the drain thread may call (single producer).
+*/
+static int ring_put( int stream, struct rte_mbuf* m, uint32_t snap ) {
+	pcap_slot_t*	slot;
+	struct timeval	tv;
+	uint32_t		head;
+	uint32_t		plen;
+	uint32_t		clen;
+	uint16_t		tag;
+	const void*		p;
+
+	head = ring_head;
+	if( head - ring_tail >= PCAP_RING_SLOTS ) {
+		return -1;
+	}
+
+	if( snap > (uint32_t) snaplen ) {
+		snap = snaplen;									// slots are sized for the capture snap length
+	}
+
+	slot = (pcap_slot_t *) (ring + (size_t) (head & (PCAP_RING_SLOTS-1)) * slot_size);
+	plen = rte_pktmbuf_pkt_len( m );
+	clen = plen > snap ? snap : plen;
+	if( (m->ol_flags & PKT_RX_VLAN_STRIPPED) && clen >= 12 ) {		// put the tag back after the macs
+		tag = m->vlan_tci;
+		memcpy( slot->data, rte_pktmbuf_mtod( m, void* ), 12 );
+		slot->data[12] = ETHER_TYPE_VLAN >> 8;
+		slot->data[13] = ETHER_TYPE_VLAN & 0xff;
+		slot->data[14] = tag >> 8;
+		slot->data[15] = tag & 0xff;
+		if( (p = rte_pktmbuf_read( m, 12, clen - 12, slot->data + 16 )) != NULL && p != slot->data + 16 ) {
+			memcpy( slot->data + 16, p, clen - 12 );
+		}
+		clen += 4;
+		plen += 4;
+	} else {
+		if( (p = rte_pktmbuf_read( m, 0, clen, slot->data )) != NULL && p != slot->data ) {
+			memcpy( slot->data, p, clen );
+		}
+	}
+
+	gettimeofday( &tv, NULL );
+	slot->sec = tv.tv_sec;
+	slot->usec = tv.tv_usec;
+	slot->caplen = clen;
+	slot->origlen = plen;
+	slot->port = stream;
+
+	rte_smp_wmb();									// slot must be visible before the head moves
+	ring_head = head + 1;
+	return 0;
+}
+
+/*
+	Offer a packet drained from a PF queue. Called by the drain thread only, before the
+	mbuf is freed; the packet is copied if it is to be kept.
+*/
+extern void vfd_pcap_offer( portid_t port, struct rte_mbuf* m ) {
+	struct ether_hdr*	eh;
+	struct vlan_hdr*	vh;
+	pcap_ctrs_t*	pc;
+	uint16_t		etype;
+	int				vlan = VLAN_NONE;
+
+	if( ! enabled || port >= MAX_PORTS || m == NULL || rte_pktmbuf_data_len( m ) < sizeof( struct ether_hdr ) ) {
+		return;
+	}
+
+	pc = &ctrs[port];
+	pc->offered++;
+
+	eh = rte_pktmbuf_mtod( m, struct ether_hdr* );
+	etype = rte_be_to_cpu_16( eh->ether_type );
+	if( m->ol_flags & PKT_RX_VLAN_STRIPPED ) {
+		vlan = m->vlan_tci & 0xfff;
+	} else {
+		if( etype == ETHER_TYPE_VLAN && rte_pktmbuf_data_len( m ) >= sizeof( struct ether_hdr ) + sizeof( struct vlan_hdr ) ) {
+			vh = (struct vlan_hdr *) (eh + 1);
+			vlan = rte_be_to_cpu_16( vh->vlan_tci ) & 0xfff;
+			etype = rte_be_to_cpu_16( vh->eth_proto );
+		}
+	}
+
+	if( ! filter_match( vlan, etype ) ) {
+		pc->filtered++;
+		return;
+	}
+
+	if( sample > 1 ) {
+		if( pc->nth > 0 ) {
+			pc->nth--;
+			pc->sampled++;
+			return;
+		}
+		pc->nth = sample - 1;
+	}
+
+	if( ring_put( port, m, snaplen ) < 0 ) {
+		pc->ring_full++;
+	}
+}
+
+/*
+	Queue a packet from the software mirror (vfd_smirror.c) for the port's mirror file.
+	The mirror has already sampled/capped; no filter is applied here. Drain thread only.
+	Returns 0 if queued, -1 if capture is off or the ring is full (caller frees the mbuf
+	either way).
+*/
+extern int vfd_pcap_mirror( portid_t port, struct rte_mbuf* m, int snap ) {
+	pcap_ctrs_t*	pc;
+
+	if( ! enabled || port >= MAX_PORTS || m == NULL ) {
+		return -1;
+	}
+
+	pc = &ctrs[MAX_PORTS + port];
+	pc->offered++;
+	if( ring_put( MAX_PORTS + port, m, snap > 0 ? (uint32_t) snap : (uint32_t) snaplen ) < 0 ) {
+		pc->ring_full++;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+	Returns true if capture is running (mirrors may only target pcap when it is).
+*/
+extern int vfd_pcap_enabled( void ) {
+	return enabled;
+}
+
+// ------------------------------------------------------------------------------------------
+
+/*
+	Set up capture if a directory is given in the parms and start the writer. Must be
+	called before the drain thread starts. Capture problems are not fatal: we log and
+	run without it. Returns 0 if capture is running.
+*/
+extern int vfd_pcap_start( parms_t* parms ) {
+	int	rc;
+
+	if( parms == NULL || parms->pfcap_dir == NULL || *parms->pfcap_dir == 0 ) {
+		return -1;
+	}
+
+	if( mkdir( parms->pfcap_dir, 0755 ) != 0 && errno != EEXIST ) {
+		bleat_printf( 0, "ERR: pf capture: unable to create directory %s: %s", parms->pfcap_dir, strerror( errno ) );
+		return -1;
+	}
+
+	cap_dir = strdup( parms->pfcap_dir );
+	snaplen = parms->pfcap_snaplen < PCAP_MIN_SNAP ? PCAP_MIN_SNAP : (parms->pfcap_snaplen > PCAP_MAX_SNAP ? PCAP_MAX_SNAP : parms->pfcap_snaplen);
+	sample = parms->pfcap_sample < 1 ? 1 : parms->pfcap_sample;
+	max_fbytes = (uint64_t) (parms->pfcap_file_mb < 1 ? 1 : parms->pfcap_file_mb) * 1024 * 1024;
+	nfiles = parms->pfcap_nfiles < 1 ? 1 : (parms->pfcap_nfiles > PCAP_MAX_FILES ? PCAP_MAX_FILES : parms->pfcap_nfiles);
+	parse_filter( parms->pfcap_filter );
+
+	slot_size = (sizeof( pcap_slot_t ) + snaplen + 4 + 63) & ~63;				// room to reinsert a tag; cache line multiple
+	ring_size = (size_t) slot_size * PCAP_RING_SLOTS;
+	ring = mmap( NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if( ring == MAP_FAILED ) {
+		bleat_printf( 0, "ERR: pf capture: unable to map %llu byte ring: %s", (unsigned long long) ring_size, strerror( errno ) );
+		ring = NULL;
+		return -1;
+	}
+
+	memset( ctrs, 0, sizeof( ctrs ) );
+	memset( outs, 0, sizeof( outs ) );
+	ring_head = ring_tail = 0;
+	stopping = 0;
+	if( (rc = pthread_create( &wtid, NULL, writer, NULL )) != 0 ) {
+		bleat_printf( 0, "ERR: pf capture: unable to create writer thread: %s", strerror( rc ) );
+		munmap( ring, ring_size );
+		ring = NULL;
+		return -1;
+	}
+
+	if( rte_thread_setname( wtid, "vfd-pcap" ) != 0 ) {
+		bleat_printf( 2, "error: failed to set thread name: %s", "vfd-pcap" );
+	}
+
+	enabled = 1;
+	bleat_printf( 1, "pf capture: dir=%s snaplen=%d sample=1/%d file_mb=%d nfiles=%d etypes=%d vlans=%d",
+		cap_dir, snaplen, sample, (int) (max_fbytes / (1024 * 1024)), nfiles, netypes, nvlans );
+	return 0;
+}
+
+/*
+	Stop capture once the drain thread has stopped; the writer empties the ring and
+	closes the files before we return.
+*/
+extern void vfd_pcap_stop( void ) {
+	int	i;
+	int	j;
+
+	if( ! enabled ) {
+		return;
+	}
+
+	enabled = 0;
+	stopping = 1;
+	pthread_join( wtid, NULL );
+
+	for( i = 0; i < PCAP_STREAMS; i++ ) {
+		if( ctrs[i].offered > 0 ) {
+			bleat_printf( 1, "pf capture: %s %d offered=%llu written=%llu ring_full=%llu", i >= MAX_PORTS ? "mirror" : "port", i % MAX_PORTS,
+				(unsigned long long) ctrs[i].offered, (unsigned long long) ctrs[i].written, (unsigned long long) ctrs[i].ring_full );
+		}
+		for( j = 0; j < outs[i].nnames; j++ ) {
+			free( outs[i].names[j] );
+		}
+		outs[i].nnames = 0;
+	}
+
+	munmap( ring, ring_size );
+	ring = NULL;
+	free( cap_dir );
+	cap_dir = NULL;
+}
+
+/*
+	Add capture counters to a show buffer (see vfd_add_str()).
+*/
+extern char* vfd_pcap_add( char* buf, int* bsize, int* blen ) {
+	pcap_ctrs_t*	pc;
+	char	wbuf[256];
+	int		i;
+
+	if( ! enabled ) {
+		return vfd_add_str( buf, bsize, blen, "\npf capture: disabled\n" );
+	}
+
+	snprintf( wbuf, sizeof( wbuf ), "\npf capture: dir=%s  snaplen=%d  sample=1/%d  ring=%u/%d\n",
+		cap_dir, snaplen, sample, (unsigned) (ring_head - ring_tail), PCAP_RING_SLOTS );
+	buf = vfd_add_str( buf, bsize, blen, wbuf );
+	snprintf( wbuf, sizeof( wbuf ), "%4s %12s %12s %12s %10s %12s %14s %8s %6s\n",
+		"pf", "offered", "filtered", "sampled", "ring-full", "written", "bytes", "errors", "files" );
+	buf = vfd_add_str( buf, bsize, blen, wbuf );
+
+	for( i = 0; i < PCAP_STREAMS && buf != NULL; i++ ) {
+		pc = &ctrs[i];
+		if( pc->offered == 0 ) {
+			continue;
+		}
+
+		snprintf( wbuf, sizeof( wbuf ), "%3d%s %12llu %12llu %12llu %10llu %12llu %14llu %8llu %6llu\n", i % MAX_PORTS, i >= MAX_PORTS ? "m" : " ",
+			(unsigned long long) pc->offered, (unsigned long long) pc->filtered, (unsigned long long) pc->sampled,
+			(unsigned long long) pc->ring_full, (unsigned long long) pc->written, (unsigned long long) pc->wbytes,
+			(unsigned long long) pc->werrors, (unsigned long long) pc->files );
+		buf = vfd_add_str( buf, bsize, blen, wbuf );
+	}
+
+	return buf;
+}
@@ -0,0 +1,31 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_pcap.h
+	Abstract:	Capture of traffic drained from PF queues to rotating pcap files.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_PCAP_H
+#define _VFD_PCAP_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+#define PCAP_RING_SLOTS		4096		// packets buffered between the drain and writer threads (power of 2)
+#define PCAP_MAX_SNAP		2048		// bounds for the snap length parm
+#define PCAP_MIN_SNAP		64
+#define PCAP_MAX_FILES		64			// max files kept per port
+#define PCAP_MAX_FILTER		16			// max terms in the filter
+#define PCAP_IDLE_US		10000		// writer sleep when the ring is empty
+#define PCAP_STREAMS		(MAX_PORTS * 2)	// a drain and a mirror file set for each port
+
+// ------------- prototypes ----------------------------------------------
+extern int vfd_pcap_start( parms_t* parms );
+extern void vfd_pcap_stop( void );
+extern void vfd_pcap_offer( portid_t port, struct rte_mbuf* m );
+extern int vfd_pcap_mirror( portid_t port, struct rte_mbuf* m, int snap );
+extern int vfd_pcap_enabled( void );
+extern char* vfd_pcap_add( char* buf, int* bsize, int* blen );
+
+#endif
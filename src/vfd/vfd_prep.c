@@ -0,0 +1,568 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_prep.c
+	Abstract:	Preparation of the PF and VF devices before dpdk is initialised. This
+				was done by vfd_pre_start.py which ran lsmod, modprobe, lspci and
+				dpdk_nic_bind pipelines through a shell for each PF and VF and added
+				tens of seconds to node start. Here everything is read from, and
+				written to, sysfs directly:
+					- a driver is available when its module is listed in /sys/module
+					  (only missing ones are modprobed, all at once)
+					- the vendor and the iommu group come from the device directory
+					- vfs are the device's virtfn links and are created by writing
+					  sriov_numvfs (max_vfs when igb_uio owns the pf)
+					- a device is bound by unbinding its driver, setting driver_override
+					  and writing the id to drivers_probe
+
+				Each PF is prepared on its own thread. If the PF already has vfs_count
+				VFs it is just bound to pf_driver; if it has none it is bound to a
+				driver which can create them (igb_uio when pf_driver is vfio-pci),
+				the VFs are created and the PF is then bound to pf_driver. Any other
+				VF count is an error as changing it would pull VFs out from under
+				running guests. Other devices in the PF's iommu group which have a
+				driver are bound to pf_driver. The script never bound VFs (vf_driver
+				only chose the modules to load); here a VF with no driver at all is
+				bound to vf_driver, and a VF which has one (ixgbevf, iavf, vfio-pci
+				for a guest) is never moved.
+
+				Enabled with "prep_devices": true in the parm file; the pf_driver,
+				vf_driver and vfs_count come from the pciid objects. A PF without
+				a pf_driver is left alone.
+
+	Date:		18 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "vfd_prep.h"
+
+/*
+	Work and results for one PF's thread.
+*/
+typedef struct prep_pf {
+	pfdef_t*	def;
+	pthread_t	tid;
+	int			started;			// thread was created
+	int			rc;					// 0 == prepared
+	int			nvfs;				// vfs on the pf when done
+	int			nvf_bound;			// driverless vfs bound to vf_driver
+	int64_t		elapsed;			// ms
+} prep_pf_t;
+
+static int64_t prep_now( void ) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ((int64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*
+	Read a (short) sysfs attribute; trailing newline is removed. Returns the
+	length or -1 on error.
+*/
+static int read_attr( const char* path, char* buf, int len ) {
+	int	fd;
+	int	n;
+
+	if( (fd = open( path, O_RDONLY )) < 0 ) {
+		return -1;
+	}
+
+	n = read( fd, buf, len - 1 );
+	close( fd );
+	if( n < 0 ) {
+		return -1;
+	}
+
+	while( n > 0 && (buf[n-1] == '\n' || buf[n-1] == ' ') ) {
+		n--;
+	}
+	buf[n] = 0;
+	return n;
+}
+
+/*
+	Write a value to a sysfs attribute. Returns 0 on success, else errno.
+*/
+static int write_attr( const char* path, const char* val ) {
+	int	fd;
+	int	rc = 0;
+
+	if( (fd = open( path, O_WRONLY )) < 0 ) {
+		return errno;
+	}
+
+	if( write( fd, val, strlen( val ) ) < 0 ) {
+		rc = errno;
+	}
+	close( fd );
+	return rc;
+}
+
+/*
+	Return the basename of the target of a link in the device directory (e.g. the
+	driver, or the device a virtfn link points at). Buf is set to an empty string
+	if the link isn't there.
+*/
+static char* dev_link( const char* id, const char* link, char* buf, int len ) {
+	char	path[1024];
+	char	target[1024];
+	char*	tok;
+	int		n;
+
+	*buf = 0;
+	snprintf( path, sizeof( path ), "%s/devices/%s/%s", PREP_SYS_PCI, id, link );
+	if( (n = readlink( path, target, sizeof( target ) - 1 )) > 0 ) {
+		target[n] = 0;
+		tok = strrchr( target, '/' );
+		snprintf( buf, len, "%s", tok != NULL ? tok + 1 : target );
+	}
+
+	return buf;
+}
+
+/*
+	Fill vfids with the pci ids of the pf's vfs, in vf number order. Returns the
+	number of vfs.
+*/
+static int get_vfs( const char* id, char vfids[][PREP_ID_LEN], int max ) {
+	char	link[64];
+	int		i;
+
+	for( i = 0; i < max; i++ ) {
+		snprintf( link, sizeof( link ), "virtfn%d", i );
+		if( *dev_link( id, link, vfids[i], PREP_ID_LEN ) == 0 ) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+/*
+	Bind the device to the driver. Nothing is done if it is already bound there.
+	Returns 0 on success.
+*/
+static int bind_dev( const char* id, const char* drv ) {
+	char	path[1024];
+	char	cur[128];
+	int		rc;
+
+	if( strcmp( dev_link( id, "driver", cur, sizeof( cur ) ), drv ) == 0 ) {
+		return 0;
+	}
+
+	if( *cur ) {
+		snprintf( path, sizeof( path ), "%s/devices/%s/driver/unbind", PREP_SYS_PCI, id );
+		if( (rc = write_attr( path, id )) != 0 ) {
+			bleat_printf( 0, "ERR: prep: unable to unbind %s from %s: %s", id, cur, strerror( rc ) );
+			return -1;
+		}
+	}
+
+	snprintf( path, sizeof( path ), "%s/devices/%s/driver_override", PREP_SYS_PCI, id );
+	if( (rc = write_attr( path, drv )) != 0 ) {
+		bleat_printf( 0, "ERR: prep: unable to set driver_override to %s for %s: %s", drv, id, strerror( rc ) );
+		return -1;
+	}
+
+	snprintf( path, sizeof( path ), "%s/drivers_probe", PREP_SYS_PCI );
+	write_attr( path, id );														// result is in the driver link, not the write
+	if( strcmp( dev_link( id, "driver", cur, sizeof( cur ) ), drv ) != 0 ) {
+		snprintf( path, sizeof( path ), "%s/drivers/%s/bind", PREP_SYS_PCI, drv );		// older kernels: bind explicitly
+		rc = write_attr( path, id );
+		if( strcmp( dev_link( id, "driver", cur, sizeof( cur ) ), drv ) != 0 ) {
+			bleat_printf( 0, "ERR: prep: unable to bind %s to %s: %s", id, drv, rc ? strerror( rc ) : "probe failed" );
+			return -1;
+		}
+	}
+
+	bleat_printf( 1, "prep: %s bound to %s", id, drv );
+	return 0;
+}
+
+/*
+	Set the number of vfs on the pf and wait for them to show up. igb_uio has its
+	own max_vfs attribute; everything else uses the standard sriov_numvfs.
+*/
+static int set_numvfs( const char* id, const char* drv, int nvfs ) {
+	char	path[1024];
+	char	val[32];
+	char	vfids[PREP_MAX_VFS][PREP_ID_LEN];
+	int64_t	deadline;
+	int		rc;
+
+	snprintf( path, sizeof( path ), "%s/devices/%s/max_vfs", PREP_SYS_PCI, id );
+	if( strncmp( drv, "mlx", 3 ) == 0 || access( path, W_OK ) != 0 ) {
+		snprintf( path, sizeof( path ), "%s/devices/%s/sriov_numvfs", PREP_SYS_PCI, id );
+	}
+
+	snprintf( val, sizeof( val ), "%d", nvfs );
+	if( (rc = write_attr( path, val )) != 0 ) {
+		bleat_printf( 0, "ERR: prep: unable to write %d to %s: %s", nvfs, path, strerror( rc ) );
+		return -1;
+	}
+
+	deadline = prep_now() + PREP_VF_WAIT_MS;
+	while( get_vfs( id, vfids, PREP_MAX_VFS ) != nvfs ) {
+		if( prep_now() > deadline ) {
+			bleat_printf( 0, "ERR: prep: %s: %d vfs requested, %d appeared", id, nvfs, get_vfs( id, vfids, PREP_MAX_VFS ) );
+			return -1;
+		}
+		usleep( 10000 );
+	}
+
+	return 0;
+}
+
+/*
+	Prepare one pf (and its vfs). Run on a thread per pf.
+*/
+static void* prep_pf( void* vpp ) {
+	prep_pf_t*	pp;
+	pfdef_t*	def;
+	const char*	cdrv;					// driver used while vfs are created
+	char	vfids[PREP_MAX_VFS][PREP_ID_LEN];
+	char	cur[128];
+	int		nvfs;
+	int		i;
+
+	pp = (prep_pf_t *) vpp;
+	def = pp->def;
+	pp->elapsed = prep_now();
+	pp->rc = -1;
+
+	nvfs = get_vfs( def->id, vfids, PREP_MAX_VFS );
+	if( def->vfs_count < 0 || nvfs == def->vfs_count ) {
+		if( bind_dev( def->id, def->pf_driver ) != 0 ) {
+			goto done;
+		}
+	} else {
+		if( nvfs != 0 ) {
+			bleat_printf( 0, "ERR: prep: %s has %d vfs, config wants %d; vfs must be removed by hand to change the count", def->id, nvfs, def->vfs_count );
+			goto done;
+		}
+
+		cdrv = strcmp( def->pf_driver, "vfio-pci" ) == 0 ? "igb_uio" : def->pf_driver;		// vfio-pci can't create vfs
+		if( bind_dev( def->id, cdrv ) != 0 ||
+			set_numvfs( def->id, cdrv, def->vfs_count ) != 0 ||
+			bind_dev( def->id, def->pf_driver ) != 0 ) {
+			goto done;
+		}
+		bleat_printf( 1, "prep: %s: created %d vfs", def->id, def->vfs_count );
+		nvfs = get_vfs( def->id, vfids, PREP_MAX_VFS );
+	}
+
+	if( def->vf_driver != NULL ) {
+		for( i = 0; i < nvfs; i++ ) {
+			if( *dev_link( vfids[i], "driver", cur, sizeof( cur ) ) ) {		// host or guest has it; leave it be
+				continue;
+			}
+			if( bind_dev( vfids[i], def->vf_driver ) != 0 ) {
+				goto done;
+			}
+			pp->nvf_bound++;
+		}
+	}
+
+	pp->nvfs = nvfs;
+	pp->rc = 0;
+
+done:
+	pp->elapsed = prep_now() - pp->elapsed;
+	return NULL;
+}
+
+/*
+	Return true if the id is one of the configured pfs or one of their vfs.
+*/
+static int is_ours( parms_t* parms, const char* id ) {
+	char	vfids[PREP_MAX_VFS][PREP_ID_LEN];
+	int		i;
+	int		j;
+	int		nvfs;
+
+	for( i = 0; i < parms->npciids; i++ ) {
+		if( parms->pciids[i].id != NULL && strcmp( parms->pciids[i].id, id ) == 0 ) {
+			return 1;
+		}
+	}
+
+	for( i = 0; i < parms->npciids; i++ ) {
+		if( parms->pciids[i].pf_driver != NULL ) {
+			nvfs = get_vfs( parms->pciids[i].id, vfids, PREP_MAX_VFS );
+			for( j = 0; j < nvfs; j++ ) {
+				if( strcmp( vfids[j], id ) == 0 ) {
+					return 1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+	Devices which share the pf's iommu group must be given to the same driver
+	(vfio insists that the whole group is owned). Those with no driver are left.
+*/
+static int prep_group( parms_t* parms, pfdef_t* def ) {
+	char	path[1024];
+	char	cur[128];
+	struct dirent*	de;
+	DIR*	d;
+	int		rc = 0;
+
+	snprintf( path, sizeof( path ), "%s/devices/%s/iommu_group/devices", PREP_SYS_PCI, def->id );
+	if( (d = opendir( path )) == NULL ) {
+		return 0;									// no iommu, no group
+	}
+
+	while( (de = readdir( d )) != NULL ) {
+		if( *de->d_name == '.' || is_ours( parms, de->d_name ) ) {
+			continue;
+		}
+
+		if( *dev_link( de->d_name, "driver", cur, sizeof( cur ) ) && strcmp( cur, def->pf_driver ) != 0 ) {
+			bleat_printf( 1, "prep: %s shares an iommu group with %s", de->d_name, def->id );
+			if( bind_dev( de->d_name, def->pf_driver ) != 0 ) {
+				rc = -1;
+			}
+		}
+	}
+
+	closedir( d );
+	return rc;
+}
+
+/*
+	Ensure that the drivers named are available, modprobing those which are missing
+	(concurrently). Module names use underscores where the driver may use dashes.
+*/
+static int prep_modules( parms_t* parms ) {
+	char	mods[64][64];
+	char	path[256];
+	char	cmd[128];
+	const char*	names[3];
+	void*	cbx = NULL;
+	int		nmods = 0;
+	int		i;
+	int		j;
+	int		k;
+	int		rc = 0;
+
+	for( i = 0; i < parms->npciids; i++ ) {
+		if( parms->pciids[i].pf_driver == NULL || parms->pciids[i].vdev != NULL ) {
+			continue;
+		}
+
+		names[0] = parms->pciids[i].pf_driver;
+		names[1] = parms->pciids[i].vf_driver;
+		names[2] = strcmp( parms->pciids[i].pf_driver, "vfio-pci" ) == 0 ? "igb_uio" : NULL;		// used to create the vfs
+		for( j = 0; j < 3; j++ ) {
+			if( names[j] == NULL || nmods >= 64 ) {
+				continue;
+			}
+
+			snprintf( mods[nmods], sizeof( mods[nmods] ), "%s", names[j] );
+			for( k = 0; mods[nmods][k]; k++ ) {
+				if( mods[nmods][k] == '-' ) {
+					mods[nmods][k] = '_';
+				}
+			}
+			for( k = 0; k < nmods && strcmp( mods[k], mods[nmods] ) != 0; k++ );
+			if( k == nmods ) {
+				nmods++;
+			}
+		}
+	}
+
+	for( i = 0; i < nmods; i++ ) {
+		snprintf( path, sizeof( path ), "/sys/module/%s", mods[i] );
+		if( access( path, F_OK ) == 0 ) {
+			continue;
+		}
+
+		if( cbx == NULL && (cbx = cbx_mk( nmods, PREP_MOD_TIMEOUT )) == NULL ) {
+			return -1;
+		}
+		snprintf( cmd, sizeof( cmd ), "modprobe %s", mods[i] );
+		cbx_add( cbx, geteuid(), cmd, "prep" );
+	}
+
+	if( cbx != NULL ) {
+		cbx_wait( cbx, PREP_MOD_TIMEOUT + 10 );
+		cbx_free( cbx );
+	}
+
+	for( i = 0; i < nmods; i++ ) {
+		snprintf( path, sizeof( path ), "/sys/module/%s", mods[i] );
+		if( access( path, F_OK ) != 0 ) {
+			bleat_printf( 0, "ERR: prep: module %s is not loaded and could not be loaded", mods[i] );
+			rc = -1;
+		}
+	}
+
+	return rc;
+}
+
+/*
+	Config files use igb-uio and igb_uio (etc.) interchangeably; the name must match
+	the registered driver so the dash/underscore is flipped, in place, if the name
+	given isn't known but the other form is.
+*/
+static void fix_drv_name( char* drv ) {
+	char	path[256];
+	char*	ch;
+	char	from;
+	char	to;
+
+	if( drv == NULL ) {
+		return;
+	}
+
+	snprintf( path, sizeof( path ), "%s/drivers/%s", PREP_SYS_PCI, drv );
+	if( access( path, F_OK ) == 0 ) {
+		return;
+	}
+
+	from = strchr( drv, '-' ) != NULL ? '-' : '_';
+	to = from == '-' ? '_' : '-';
+	for( ch = drv; *ch; ch++ ) {
+		if( *ch == from ) {
+			*ch = to;
+		}
+	}
+
+	snprintf( path, sizeof( path ), "%s/drivers/%s", PREP_SYS_PCI, drv );
+	if( access( path, F_OK ) != 0 ) {
+		for( ch = drv; *ch; ch++ ) {			// neither is known; put it back so messages show what was given
+			if( *ch == to ) {
+				*ch = from;
+			}
+		}
+	}
+}
+
+/*
+	Ensure the pf is from a vendor we support.
+*/
+static int check_vendor( pfdef_t* def ) {
+	char	path[1024];
+	char	vendor[32];
+
+	snprintf( path, sizeof( path ), "%s/devices/%s/vendor", PREP_SYS_PCI, def->id );
+	if( read_attr( path, vendor, sizeof( vendor ) ) < 0 ) {
+		bleat_printf( 0, "ERR: prep: %s: no such pci device", def->id );
+		return -1;
+	}
+
+	if( strcmp( vendor, "0x8086" ) != 0 && strcmp( vendor, "0x14e4" ) != 0 && strcmp( vendor, "0x15b3" ) != 0 ) {		// intel, broadcom, mellanox
+		bleat_printf( 0, "ERR: prep: %s: vendor %s is not supported", def->id, vendor );
+		return -1;
+	}
+
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------
+
+/*
+	Prepare the devices listed in the parms. Must be called before dpdk is initialised.
+	Returns 0 on success, -1 if any pf could not be prepared.
+*/
+extern int vfd_prep_devices( parms_t* parms ) {
+	prep_pf_t*	pps;
+	prep_pf_t*	pp;
+	pfdef_t*	def;
+	int64_t	start;
+	int		i;
+	int		rc = 0;
+	int		count = 0;
+
+	if( parms == NULL || parms->npciids <= 0 ) {
+		return 0;
+	}
+
+	start = prep_now();
+	for( i = 0; i < parms->npciids; i++ ) {
+		def = &parms->pciids[i];
+		if( def->pf_driver != NULL && def->vdev == NULL ) {
+			if( check_vendor( def ) != 0 ) {
+				return -1;
+			}
+			count++;
+		}
+	}
+
+	if( count == 0 ) {
+		bleat_printf( 1, "prep: no pciids have a pf_driver; nothing to prepare" );
+		return 0;
+	}
+
+	if( prep_modules( parms ) != 0 ) {
+		return -1;
+	}
+
+	for( i = 0; i < parms->npciids; i++ ) {
+		fix_drv_name( parms->pciids[i].pf_driver );
+		fix_drv_name( parms->pciids[i].vf_driver );
+	}
+
+	if( (pps = (prep_pf_t *) malloc( sizeof( *pps ) * parms->npciids )) == NULL ) {
+		bleat_printf( 0, "ERR: prep: unable to allocate memory" );
+		return -1;
+	}
+	memset( pps, 0, sizeof( *pps ) * parms->npciids );
+
+	for( i = 0; i < parms->npciids; i++ ) {
+		pp = &pps[i];
+		pp->def = &parms->pciids[i];
+		if( pp->def->pf_driver == NULL || pp->def->vdev != NULL ) {
+			continue;
+		}
+
+		if( pthread_create( &pp->tid, NULL, prep_pf, pp ) == 0 ) {
+			pp->started = 1;
+		} else {
+			prep_pf( pp );								// can't thread it, do it here
+		}
+	}
+
+	for( i = 0; i < parms->npciids; i++ ) {
+		pp = &pps[i];
+		if( pp->started ) {
+			pthread_join( pp->tid, NULL );
+		}
+		if( pp->def->pf_driver == NULL || pp->def->vdev != NULL ) {
+			continue;
+		}
+
+		if( pp->rc == 0 ) {
+			bleat_printf( 1, "prep: %s ready on %s with %d vfs (%d bound to %s) in %lldms", pp->def->id, pp->def->pf_driver,
+				pp->nvfs, pp->nvf_bound, pp->def->vf_driver ? pp->def->vf_driver : "-", (long long) pp->elapsed );
+			if( prep_group( parms, pp->def ) != 0 ) {
+				rc = -1;
+			}
+		} else {
+			bleat_printf( 0, "ERR: prep: %s could not be prepared", pp->def->id );
+			rc = -1;
+		}
+	}
+
+	free( pps );
+	bleat_printf( 0, "prep: %d pf(s) prepared in %lldms%s", count, (long long) (prep_now() - start), rc ? " with errors" : "" );
+	return rc;
+}
@@ -0,0 +1,23 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_prep.h
+	Abstract:	Startup preparation of PF/VF devices (driver binding, vf creation).
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_PREP_H
+#define _VFD_PREP_H
+
+#include "vfdlib.h"
+
+#define PREP_SYS_PCI		"/sys/bus/pci"
+#define PREP_MOD_TIMEOUT	30			// seconds allowed for a modprobe
+#define PREP_VF_WAIT_MS		2000		// time allowed for vfs to appear after sriov_numvfs is written
+#define PREP_ID_LEN			32			// room for a pci id (dddd:bb:dd.f)
+#define PREP_MAX_VFS		256
+
+// ------------- prototypes ----------------------------------------------
+extern int vfd_prep_devices( parms_t* parms );
+
+#endif
@@ -0,0 +1,422 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_rebal.c
+	Abstract:	Work conserving bandwidth rebalancer. The rate (cap) and min_rate
+				(guarantee) of each VF are fractions of link speed which are set
+				from the VF config and programmed by update_nic. Left alone, an
+				idle VF holds on to its guarantee while a busy neighbour sits at
+				its cap. When enabled (rebalance_itvl in the parm file) this module
+				samples the tx byte counters of each VF every interval and:
+
+					- lends the unused part of an idle VF's guarantee (down to the
+					  VF's min_rate_floor) to the busy VFs on the same PF
+					- raises the cap of a busy VF towards its rate_ceiling
+
+				A VF is busy when its smoothed tx rate reaches RB_BUSY_ON of its
+				cap and stays busy until the rate falls below RB_BUSY_OFF. The
+				guarantee lent out is never more than what idle VFs gave up, so
+				the total guarantee on the PF never exceeds what was configured.
+				A new value is only pushed to the NIC when it differs from what
+				was last pushed by more than rebalance_hyst percent of link speed,
+				or when it returns the VF to its configured value; this and the
+				busy on/off gap keep the NIC from being hammered with small changes.
+
+				State is reset for a VF whenever update_nic programs its configured
+				rates (add, reset) so a pass always starts from what is really on
+				the NIC. VFs which are throttled (vfd_throttle.c) are skipped.
+				Passes are run from the main loop under the update lock.
+
+	Date:		18 October 2026
+
+	Mods:		18 Oct 2026 - Skip throttled VFs.
+				18 Oct 2026 - Lend only the guarantee idle VFs really gave up (a push filtered by
+							hysteresis or refused by the nic gives up nothing), and push all
+							decreases before any increase.
+*/
+
+#include <math.h>
+#include <time.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_timing.h"
+#include "vfd_rebal.h"
+#include "vfd_throttle.h"
+
+/*
+	Rebalancer state for one VF.
+*/
+typedef struct rb_vf {
+	int			active;			// baseline sample has been taken
+	int			busy;			// vf is pushing against its cap
+	uint64_t	obytes;			// tx bytes at last sample
+	double		util;			// smoothed tx rate as a fraction of link speed
+	double		min_rate;		// guarantee last programmed (fraction of link)
+	double		rate;			// cap last programmed (fraction of link; 0 == none)
+	uint32_t	nadj;			// number of times the vf was reprogrammed by us
+} rb_vf_t;
+
+static rb_vf_t	rstate[MAX_PORTS][MAX_VFS];
+static uint64_t	last_pass = 0;			// usec (monotonic) of the last pass
+static uint64_t	npasses = 0;
+
+/*
+	Monotonic clock in usec.
+*/
+static uint64_t rb_now( void ) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*
+	Returns true if the change from cur to want is worth pushing to the nic.
+*/
+static int rb_worth_it( double cur, double want, double cfg, double hyst ) {
+	if( cur == want ) {
+		return 0;
+	}
+
+	return want == cfg || fabs( want - cur ) >= hyst;
+}
+
+/*
+	Push a new guarantee (min set) or cap for the vf if the change is worth it. The
+	value is recorded as programmed only if the nic took it. Returns 1 if the nic
+	was changed.
+*/
+static int rb_push( int pn, struct vf_s* vf, rb_vf_t* rb, int min, double want, double hyst, uint32_t speed ) {
+	double*	cur;
+	int		rc;
+
+	cur = min ? &rb->min_rate : &rb->rate;
+	if( ! rb_worth_it( *cur, want, min ? vf->min_rate : vf->rate, hyst ) ) {
+		return 0;
+	}
+
+	bleat_printf( 2, "rebalance: pf=%d vf=%d %s %.3f -> %.3f (util=%.3f)", pn, vf->num, min ? "min_rate" : "rate", *cur, want, rb->util );
+	if( min ) {
+		rc = set_vf_min_rate( pn, vf->num, (uint16_t) ((double) speed * want), 0x01 );
+	} else {
+		rc = set_vf_rate_limit( pn, vf->num, (uint16_t) ((double) speed * want), 0x01 );
+	}
+	if( rc != 0 ) {
+		bleat_printf( 1, "WRN: rebalance: pf=%d vf=%d %s not changed: %d", pn, vf->num, min ? "min_rate" : "rate", rc );
+		return 0;
+	}
+
+	*cur = want;
+	rb->nadj++;
+	return 1;
+}
+
+/*
+	Run one rebalance pass over a port. Elapsed is the usec since the previous
+	sample was taken.
+
+	Changes are pushed in three steps so that the total guarantee on the nic never
+	exceeds what was configured, even for a moment: idle vfs give up guarantee
+	first; what they really gave up (pushes filtered by hysteresis or refused by
+	the nic give up nothing) is shared among the busy vfs, and any busy vf whose
+	share shrank gives back; only then are increases pushed, and each is limited
+	to what is still unclaimed. Idle vfs taking back their own guarantee go before
+	busy vfs.
+*/
+static void rebal_port( parms_t* parms, struct sriov_port_s* port, uint64_t elapsed ) {
+	struct rte_eth_link link;
+	struct rte_eth_stats stats;
+	struct vf_s*	vf;
+	rb_vf_t*	rb;
+	double	want_min[MAX_VFS];
+	double	want_rate[MAX_VFS];
+	double	pool = 0.0;			// guarantee given up by idle vfs, less what they are about to take back
+	double	budget = 0.0;		// configured guarantee of the vfs being balanced
+	double	held = 0.0;			// guarantee those vfs hold on the nic
+	double	share = 0.0;
+	double	grant;
+	double	was;
+	double	cap;
+	double	u;
+	double	hyst;
+	int		nbusy = 0;
+	int		pn;
+	int		pass;
+	int		i;
+
+	pn = port->rte_port_number;
+	if( pn < 0 || pn >= MAX_PORTS ) {
+		return;
+	}
+
+	vfd_link_get( pn, &link );
+	if( ! link.link_status || link.link_speed == 0 ) {
+		return;
+	}
+
+	hyst = (double) parms->rebal_hyst / 100.0;
+	for( i = 0; i < port->num_vfs; i++ ) {						// sample each vf and figure busy/idle
+		vf = &port->vfs[i];
+		want_min[i] = -1;										// < 0 means leave it alone
+		if( vf->num < 0 || vf->num >= MAX_VFS || vf->last_updated == DELETED ) {
+			continue;
+		}
+		if( vf->rate == 0 && vf->min_rate == 0 ) {				// nothing to balance
+			continue;
+		}
+		if( vfd_throttle_active( pn, vf->num ) ) {				// throttle owns the rate for now; baseline again once it's lifted
+			rstate[pn][vf->num].active = 0;
+			continue;
+		}
+
+		rb = &rstate[pn][vf->num];
+		if( get_vf_stats( pn, vf->num, &stats ) != 0 ) {
+			continue;
+		}
+
+		if( ! rb->active ) {									// first sample; nic holds the configured values
+			rb->active = 1;
+			rb->busy = 0;
+			rb->util = 0.0;
+			rb->obytes = stats.obytes;
+			rb->min_rate = vf->min_rate;
+			rb->rate = vf->rate;
+			continue;
+		}
+		if( stats.obytes < rb->obytes ) {						// counters were reset under us; new baseline, but the nic still has what we pushed
+			rb->obytes = stats.obytes;
+			continue;
+		}
+
+		u = ((double) (stats.obytes - rb->obytes) * 8.0) / ((double) elapsed * (double) link.link_speed);	// bytes/us * 8 == Mbit/s
+		rb->obytes = stats.obytes;
+		rb->util = (RB_ALPHA * u) + ((1.0 - RB_ALPHA) * rb->util);
+
+		cap = rb->rate > 0 ? rb->rate : 1.0;
+		if( rb->busy ) {
+			rb->busy = rb->util >= cap * RB_BUSY_OFF;
+		} else {
+			rb->busy = rb->util >= cap * RB_BUSY_ON;
+		}
+
+		want_min[i] = vf->min_rate;
+		want_rate[i] = vf->rate;
+		if( rb->busy ) {
+			nbusy++;
+		} else {
+			if( vf->min_rate > 0 ) {							// idle; keep some headroom and lend the rest
+				want_min[i] = rb->util * RB_HEADROOM;
+				if( want_min[i] < vf->min_rate_floor ) {
+					want_min[i] = vf->min_rate_floor;
+				}
+				if( want_min[i] > vf->min_rate ) {
+					want_min[i] = vf->min_rate;
+				}
+			}
+
+			if( rb->rate > vf->rate ) {							// cap was raised; bring it back down towards configured
+				want_rate[i] = rb->util * RB_HEADROOM;
+				if( want_rate[i] > rb->rate ) {
+					want_rate[i] = rb->rate;
+				}
+				if( want_rate[i] < vf->rate ) {
+					want_rate[i] = vf->rate;
+				}
+			}
+
+			if( want_rate[i] > 0 && want_min[i] > want_rate[i] ) {	// guarantee can never exceed the cap
+				want_min[i] = want_rate[i];
+			}
+
+			if( want_min[i] < rb->min_rate ) {					// step 1: idle vfs give up guarantee
+				rb_push( pn, vf, rb, 1, want_min[i], hyst, link.link_speed );
+			}
+			if( want_rate[i] < rb->rate ) {
+				rb_push( pn, vf, rb, 0, want_rate[i], hyst, link.link_speed );
+			}
+		}
+	}
+
+	for( i = 0; i < port->num_vfs; i++ ) {						// tally what was really given up
+		if( want_min[i] < 0 ) {
+			continue;
+		}
+		vf = &port->vfs[i];
+		rb = &rstate[pn][vf->num];
+
+		budget += vf->min_rate;
+		held += rb->min_rate;
+		if( ! rb->busy ) {
+			pool += vf->min_rate - (want_min[i] > rb->min_rate ? want_min[i] : rb->min_rate);
+		}
+	}
+
+	if( nbusy > 0 ) {
+		share = pool / nbusy;
+	}
+
+	for( i = 0; i < port->num_vfs; i++ ) {						// step 2: set the busy vf targets; give back where the share shrank
+		if( want_min[i] < 0 ) {
+			continue;
+		}
+		vf = &port->vfs[i];
+		rb = &rstate[pn][vf->num];
+		if( ! rb->busy ) {
+			continue;
+		}
+
+		if( vf->rate > 0 ) {
+			want_rate[i] = rb->rate + (share > RB_CAP_STEP ? share : RB_CAP_STEP);
+			if( want_rate[i] > vf->rate_ceiling ) {
+				want_rate[i] = vf->rate_ceiling;
+			}
+			if( want_rate[i] < vf->rate ) {
+				want_rate[i] = vf->rate;
+			}
+		}
+
+		want_min[i] = vf->min_rate + share;
+		if( want_min[i] < 0 ) {									// idle vfs hold more than configured (a give back failed)
+			want_min[i] = 0;
+		}
+		if( want_rate[i] > 0 && want_min[i] > want_rate[i] ) {
+			want_min[i] = want_rate[i];
+		}
+
+		if( want_min[i] < rb->min_rate ) {
+			was = rb->min_rate;
+			if( rb_push( pn, vf, rb, 1, want_min[i], hyst, link.link_speed ) ) {
+				held -= was - rb->min_rate;
+			}
+		}
+		if( want_rate[i] < rb->rate ) {
+			rb_push( pn, vf, rb, 0, want_rate[i], hyst, link.link_speed );
+		}
+	}
+
+	for( pass = 0; pass < 2; pass++ ) {							// step 3: increases; idle vfs first, then busy
+		for( i = 0; i < port->num_vfs; i++ ) {
+			if( want_min[i] < 0 ) {
+				continue;
+			}
+			vf = &port->vfs[i];
+			rb = &rstate[pn][vf->num];
+			if( rb->busy != pass ) {
+				continue;
+			}
+
+			if( want_rate[i] > rb->rate ) {						// caps are not part of the guarantee budget
+				rb_push( pn, vf, rb, 0, want_rate[i], hyst, link.link_speed );
+			}
+
+			if( want_min[i] > rb->min_rate ) {
+				grant = want_min[i];
+				if( grant - rb->min_rate > budget - held ) {		// only what is unclaimed
+					grant = rb->min_rate + (budget - held);
+				}
+				was = rb->min_rate;
+				if( grant > rb->min_rate && rb_push( pn, vf, rb, 1, grant, hyst, link.link_speed ) ) {
+					held += rb->min_rate - was;
+				}
+			}
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------
+
+/*
+	Called from the main loop on each spin. A pass is made over all ports
+	once every rebal_itvl seconds; nothing is done if the rebalancer is not
+	enabled or the nic is not yet initialised.
+*/
+extern void vfd_rebal_tick( parms_t* parms, sriov_conf_t* conf ) {
+	uint64_t	now;
+	uint64_t	elapsed;
+	int			i;
+
+	if( parms == NULL || conf == NULL || parms->rebal_itvl <= 0 || ! parms->forreal || (parms->rflags & RF_INITIALISED) == 0 ) {
+		return;
+	}
+
+	now = rb_now();
+	elapsed = now - last_pass;
+	if( elapsed < (uint64_t) parms->rebal_itvl * 1000000 ) {
+		return;
+	}
+	last_pass = now;
+	npasses++;
+
+	rte_spinlock_lock( &conf->update_lock );
+	for( i = 0; i < conf->num_ports; i++ ) {
+		rebal_port( parms, &conf->ports[i], elapsed );
+	}
+	rte_spinlock_unlock( &conf->update_lock );
+}
+
+/*
+	Forget what we know about a vf. Called when update_nic programs the configured
+	rates, or the vf is deleted; the next pass takes a fresh baseline.
+*/
+extern void vfd_rebal_reset( int port, int vf ) {
+	if( port < 0 || port >= MAX_PORTS || vf < 0 || vf >= MAX_VFS ) {
+		return;
+	}
+
+	memset( &rstate[port][vf], 0, sizeof( rstate[port][vf] ) );
+}
+
+/*
+	Generate a buffer with the current rebalancer state for each vf which has
+	a rate or min_rate configured. Rates are shown as a percentage of link
+	speed. Caller must free.
+*/
+extern char* vfd_rebal_show( parms_t* parms, sriov_conf_t* conf ) {
+	struct sriov_port_s* port;
+	struct vf_s*	vf;
+	rb_vf_t*	rb;
+	char*	buf;
+	int		bsize;
+	int		blen;
+	int		i;
+	int		y;
+	int		pn;
+
+	bsize = BUF_1K;
+	for( i = 0; i < conf->num_ports; i++ ) {
+		bsize += conf->ports[i].num_vfs * 160;
+	}
+	if( (buf = (char *) malloc( sizeof( char ) * bsize )) == NULL ) {
+		return NULL;
+	}
+
+	blen = snprintf( buf, bsize, "\nrebalancer: %s  interval=%ds  hysteresis=%d%%  passes=%lld\n",
+		parms->rebal_itvl > 0 ? "enabled" : "disabled", parms->rebal_itvl, parms->rebal_hyst, (long long) npasses );
+	blen += snprintf( buf + blen, bsize - blen, "%4s %4s %6s %8s %8s %8s %8s %8s %8s %8s\n",
+		"pf", "vf", "state", "tx%", "floor%", "min%", "eff_min%", "rate%", "ceil%", "eff_rate%" );
+
+	for( i = 0; i < conf->num_ports && blen < bsize; i++ ) {
+		port = &conf->ports[i];
+		pn = port->rte_port_number;
+		if( pn < 0 || pn >= MAX_PORTS ) {
+			continue;
+		}
+
+		for( y = 0; y < port->num_vfs && blen < bsize; y++ ) {
+			vf = &port->vfs[y];
+			if( vf->num < 0 || vf->num >= MAX_VFS || (vf->rate == 0 && vf->min_rate == 0) ) {
+				continue;
+			}
+
+			rb = &rstate[pn][vf->num];
+			blen += snprintf( buf + blen, bsize - blen, "%4d %4d %6s %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f  adj=%u\n",
+				pn, vf->num, ! rb->active ? "new" : rb->busy ? "busy" : "idle",
+				rb->util * 100.0, vf->min_rate_floor * 100.0, vf->min_rate * 100.0, (rb->active ? rb->min_rate : vf->min_rate) * 100.0,
+				vf->rate * 100.0, vf->rate_ceiling * 100.0, (rb->active ? rb->rate : vf->rate) * 100.0, rb->nadj );
+		}
+	}
+
+	return buf;
+}
@@ -0,0 +1,26 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_rebal.h
+	Abstract:	Work conserving VF bandwidth rebalancer.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_REBAL_H
+#define _VFD_REBAL_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+#define RB_ALPHA		0.5			// weight of the newest sample in the smoothed tx rate
+#define RB_HEADROOM		1.25		// an idle vf keeps this multiple of its tx rate as guarantee
+#define RB_BUSY_ON		0.90		// smoothed rate/cap at which a vf becomes busy
+#define RB_BUSY_OFF		0.70		// and at which it is no longer busy
+#define RB_CAP_STEP		0.05		// minimum cap increase (fraction of link) for a busy vf
+
+// ------------- prototypes ----------------------------------------------
+extern void vfd_rebal_tick( parms_t* parms, sriov_conf_t* conf );
+extern void vfd_rebal_reset( int port, int vf );
+extern char* vfd_rebal_show( parms_t* parms, sriov_conf_t* conf );
+
+#endif
@@ -0,0 +1,541 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_recon.c
+	Abstract:	Reconcile the VF settings on the NIC with the running configuration.
+				A VF reset, a MAC pushed through the mailbox, or a tool poking the
+				NIC behind our back can leave the hardware different from what
+				sriov_conf_t says. restore_vf_setings() rewrites everything for a
+				VF when we know it was reset; this catches what we are not told
+				about, and writes only what differs.
+
+				The VF settings are read back from the NIC (get_vf_hw_state())
+				and compared, item by item, with what vfd_update_nic() would have
+				set: vlan filter, mac filter (our macs must be present; a default
+				set by the guest is left alone), vlan and mac anti-spoof, outer and
+				inner tag strip/insert, bcast/mcast/unknown unicast/untagged accept
+				and the tx rate cap. Only the differing items are written: a
+				missing vlan is added and a stray one removed, a single anti-spoof
+				bit is flipped, and so on. Settings a backend cannot read are not
+				compared (ixgbe outer strip: the guest driver sets the same bit);
+				NICs with no readback (i40e, bnxt, mlx5) are skipped.
+
+				The rate cap is compared only while the rebalancer is off and the
+				VF is not throttled; otherwise the cap on the NIC is theirs, not
+				the configured one. It is not compared until the link speed is known.
+
+				VFs with a pending update (last_updated not UNCHANGED) are left to
+				vfd_update_nic(). A pass is run every reconcile_itvl seconds (0
+				disables), and on demand with the reconcile request. Counts by port
+				and item can be seen with 'show reconcile'.
+
+	Date:		18 October 2026
+*/
+
+#include <ctype.h>
+#include <time.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_throttle.h"
+#include "vfd_recon.h"
+
+/*
+	Counters for one port.
+*/
+typedef struct recon_port {
+	uint64_t	checked;				// vfs compared
+	uint64_t	unreadable;				// vfs the nic could not give settings for
+	uint64_t	drifted;				// vfs found to differ
+	uint64_t	unfixed;				// vfs which still differed after the fix
+	uint64_t	writes;					// nic calls made to fix them
+	uint64_t	items[RCN_NITEMS];		// items found different, by VHW_ bit
+} recon_port_t;
+
+static recon_port_t	rstats[MAX_PORTS];
+static uint64_t		npasses = 0;
+static time_t		next_pass = 0;
+
+static const char* item_names[RCN_NITEMS] = {
+	"vlans", "macs", "spoof", "strip", "insert", "ctag", "rxmode", "rate"
+};
+
+static int has_vlan( int* vlans, int nvlans, int vlan ) {
+	int i;
+
+	for( i = 0; i < nvlans; i++ ) {
+		if( vlans[i] == vlan ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int has_mac( struct vf_hw_s* hw, struct ether_addr* mac ) {
+	int i;
+
+	for( i = 0; i < hw->num_macs; i++ ) {
+		if( is_same_ether_addr( mac, &hw->macs[i] ) ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+	Return the rate cap (Mbps) the vf should have, or -1 if the cap on the nic is not
+	ours to check (rebalancer or throttle own it, or the link speed is not yet known).
+*/
+static int want_rate( parms_t* parms, struct sriov_port_s* port, struct vf_s* vf ) {
+	if( (parms != NULL && parms->rebal_itvl > 0) || port->link_speed == 0 || vfd_throttle_active( port->rte_port_number, vf->num ) ) {
+		return -1;
+	}
+
+	return vf->rate > 0 ? (int) ( (float) port->link_speed * vf->rate ) : 0;		// as vfd_update_nic() computes it
+}
+
+/*
+	Compare the vf with what was read from the nic. When apply is set each item which
+	differs is written. Returns the VHW_ bits of the items which differ; the number of
+	nic calls made is added to writes.
+*/
+static int diff_vf( parms_t* parms, struct sriov_port_s* port, struct vf_s* vf, struct vf_hw_s* hw, int apply, uint64_t* writes ) {
+	struct ether_addr mac;
+	uint64_t	vf_mask;
+	int		pn;
+	int		bits = 0;
+	int		expect;
+	int		tol;
+	int		i;
+	int		m;
+
+	pn = port->rte_port_number;
+	vf_mask = 1ULL << vf->num;
+	if( vf->num >= 64 ) {
+		hw->valid &= ~VHW_VLANS;								// filter does not address the upper pools
+	}
+
+	if( hw->valid & VHW_VLANS ) {
+		for( i = 0; i < vf->num_vlans; i++ ) {					// add those missing
+			if( ! has_vlan( hw->vlans, hw->num_vlans, vf->vlans[i] ) ) {
+				bits |= VHW_VLANS;
+				if( apply ) {
+					set_vf_rx_vlan( pn, vf->vlans[i], vf_mask, SET_ON );
+					(*writes)++;
+				}
+			}
+		}
+		for( i = 0; i < hw->num_vlans; i++ ) {					// drop those we did not add
+			if( ! has_vlan( vf->vlans, vf->num_vlans, hw->vlans[i] ) ) {
+				bits |= VHW_VLANS;
+				if( apply ) {
+					set_vf_rx_vlan( pn, hw->vlans[i], vf_mask, SET_OFF );
+					(*writes)++;
+				}
+			}
+		}
+	}
+
+	if( hw->valid & VHW_MACS ) {
+		for( m = vf->num_macs; m >= vf->first_mac; m-- ) {		// reverse order, as set_macs(), so the default is pushed last
+			if( vf->macs[m][0] == 0 ) {
+				continue;
+			}
+
+			ether_aton_r( vf->macs[m], &mac );
+			if( ! has_mac( hw, &mac ) ) {
+				bits |= VHW_MACS;
+				if( apply ) {
+					if( m > vf->first_mac ) {
+						set_vf_rx_mac( pn, vf->macs[m], vf->num, SET_ON );
+					} else {
+						set_vf_default_mac( pn, vf->macs[m], vf->num );
+					}
+					(*writes)++;
+				}
+			}
+		}
+	}
+
+	if( hw->valid & VHW_SPOOF ) {
+		if( hw->vlan_anti_spoof != !!vf->vlan_anti_spoof ) {
+			bits |= VHW_SPOOF;
+			if( apply ) {
+				set_vf_vlan_anti_spoofing( pn, vf->num, vf->vlan_anti_spoof );
+				(*writes)++;
+			}
+		}
+		if( hw->mac_anti_spoof != !!vf->mac_anti_spoof ) {
+			bits |= VHW_SPOOF;
+			if( apply ) {
+				set_vf_mac_anti_spoofing( pn, vf->num, vf->mac_anti_spoof );
+				(*writes)++;
+			}
+		}
+	}
+
+	if( (hw->valid & VHW_STRIP) && hw->strip != !!vf->strip_stag ) {
+		bits |= VHW_STRIP;
+		if( apply ) {
+			rx_vlan_strip_set_on_vf( pn, vf->num, vf->strip_stag );
+			(*writes)++;
+		}
+	}
+
+	if( hw->valid & VHW_INSERT ) {
+		expect = (vf->num_vlans == 1 && vf->strip_stag) ? vf->vlans[0] : 0;		// as vfd_set_ins_strip() sets it
+		if( hw->insert_vlan != expect ) {
+			bits |= VHW_INSERT;
+			if( apply ) {
+				tx_vlan_insert_set_on_vf( pn, vf->num, expect );
+				(*writes)++;
+			}
+		}
+	}
+
+	if( hw->valid & VHW_CTAG ) {
+		if( hw->cstrip != !!vf->strip_ctag ) {
+			bits |= VHW_CTAG;
+			if( apply ) {
+				rx_cvlan_strip_set_on_vf( pn, vf->num, vf->strip_ctag );
+				(*writes)++;
+			}
+		}
+
+		expect = (vf->num_vlans == 1 && ! vf->strip_stag && vf->strip_ctag) ? vf->vlans[0] : 0;
+		if( hw->insert_cvlan != expect ) {
+			bits |= VHW_CTAG;
+			if( apply ) {
+				tx_cvlan_insert_set_on_vf( pn, vf->num, expect );
+				(*writes)++;
+			}
+		}
+	}
+
+	if( hw->valid & VHW_RXMODE ) {
+		if( hw->allow_bcast != !!vf->allow_bcast ) {
+			bits |= VHW_RXMODE;
+			if( apply ) {
+				set_vf_allow_bcast( pn, vf->num, vf->allow_bcast );
+				(*writes)++;
+			}
+		}
+		if( hw->allow_mcast != !!vf->allow_mcast ) {
+			bits |= VHW_RXMODE;
+			if( apply ) {
+				set_vf_allow_mcast( pn, vf->num, vf->allow_mcast );
+				(*writes)++;
+			}
+		}
+		if( hw->allow_un_ucast != !!vf->allow_un_ucast ) {
+			bits |= VHW_RXMODE;
+			if( apply ) {
+				set_vf_allow_un_ucast( pn, vf->num, vf->allow_un_ucast );
+				(*writes)++;
+			}
+		}
+		if( hw->allow_untagged != 0 ) {							// update_nic never accepts untagged for a live vf
+			bits |= VHW_RXMODE;
+			if( apply ) {
+				set_vf_allow_untagged( pn, vf->num, SET_OFF );
+				(*writes)++;
+			}
+		}
+	}
+
+	if( (hw->valid & VHW_RATE) && (expect = want_rate( parms, port, vf )) >= 0 ) {
+		tol = expect / (100 / RCN_RATE_TOL);
+		if( tol < 1 ) {
+			tol = 1;
+		}
+		if( hw->rate < expect - tol || hw->rate > expect + tol ) {
+			bits |= VHW_RATE;
+			if( apply ) {
+				set_vf_rate_limit( pn, vf->num, (uint16_t) expect, 0x01 );
+				(*writes)++;
+			}
+		}
+	}
+
+	return bits;
+}
+
+/*
+	Run one vf; the caller holds the update lock. Returns -1 if the nic settings cannot
+	be read; else the VHW_ bits of the items which differed. When apply is set the items
+	are fixed and read back; left (if not nil) gets the bits which still differ.
+*/
+static int recon_vf( parms_t* parms, struct sriov_port_s* port, struct vf_s* vf, int apply, int* left, uint64_t* writes ) {
+	recon_port_t*	rs;
+	struct vf_hw_s	hw;
+	int		bits;
+	int		still = 0;
+	int		i;
+
+	rs = &rstats[port->rte_port_number % MAX_PORTS];
+	rs->checked++;
+	if( get_vf_hw_state( port->rte_port_number, vf->num, &hw ) == 0 ) {
+		rs->unreadable++;
+		return -1;
+	}
+
+	if( (bits = diff_vf( parms, port, vf, &hw, apply, writes )) != 0 ) {
+		rs->drifted++;
+		for( i = 0; i < RCN_NITEMS; i++ ) {
+			if( bits & (1 << i) ) {
+				rs->items[i]++;
+			}
+		}
+
+		if( apply ) {
+			if( get_vf_hw_state( port->rte_port_number, vf->num, &hw ) == 0 ||
+				(still = diff_vf( parms, port, vf, &hw, 0, writes )) != 0 ) {
+				rs->unfixed++;
+			}
+		}
+	}
+
+	if( left != NULL ) {
+		*left = still;
+	}
+	return bits;
+}
+
+// ------------------------------------------------------------------------------------------
+
+/*
+	Build a readable list of the items in bits (VHW_ constants) into buf; returns buf.
+*/
+extern const char* vfd_recon_items( int bits, char* buf, int blen ) {
+	int	len = 0;
+	int	i;
+
+	*buf = 0;
+	for( i = 0; i < RCN_NITEMS && len < blen; i++ ) {
+		if( bits & (1 << i) ) {
+			len += snprintf( buf + len, blen - len, "%s%s", len ? "," : "", item_names[i] );
+		}
+	}
+
+	return buf;
+}
+
+/*
+	Reconcile a single vf (see recon_vf()). Used by the warm start verification which
+	runs before the update lock is needed.
+*/
+extern int vfd_recon_vf( parms_t* parms, struct sriov_port_s* port, struct vf_s* vf, int apply, int* left ) {
+	if( port == NULL || vf == NULL || vf->num < 0 || port->rte_port_number < 0 ) {
+		return -1;
+	}
+
+	return recon_vf( parms, port, vf, apply, left, &rstats[port->rte_port_number % MAX_PORTS].writes );
+}
+
+/*
+	Run a pass on demand. Req is the request resource: empty or "all" for every pf,
+	else "<pf> [<vf>]". Returns a report of the vfs which were out of step; caller
+	must free. Returns nil if the request cannot be parsed, or names a pf or vf
+	which is not configured.
+*/
+extern char* vfd_recon_run( parms_t* parms, sriov_conf_t* conf, const_str req ) {
+	struct sriov_port_s* port;
+	struct vf_s*	vf;
+	char*	buf;
+	char*	end;
+	char	ibuf[128];
+	char	lbuf[128];
+	int		bsize;
+	int		blen;
+	int		pf = -1;
+	int		vfn = -1;
+	int		bits;
+	int		left;
+	int		nvfs = 0;
+	int		ndrift = 0;
+	int		pmatch = 0;					// configured pfs and vfs matching the request
+	int		vmatch = 0;
+	int		i;
+	int		y;
+
+	if( conf == NULL ) {
+		return NULL;
+	}
+
+	if( req != NULL && *req && strcmp( req, "all" ) != 0 ) {
+		pf = (int) strtol( req, &end, 10 );
+		if( end == req || pf < 0 ) {
+			bleat_printf( 1, "reconcile: bad pf in request: %s", req );
+			return NULL;
+		}
+		while( isspace( *end ) ) {
+			end++;
+		}
+		if( *end ) {
+			req = end;
+			vfn = (int) strtol( req, &end, 10 );
+			while( isspace( *end ) ) {
+				end++;
+			}
+			if( end == req || vfn < 0 || *end ) {
+				bleat_printf( 1, "reconcile: bad vf in request: %s", req );
+				return NULL;
+			}
+		}
+	}
+
+	bsize = BUF_1K;
+	for( i = 0; i < conf->num_ports; i++ ) {
+		bsize += conf->ports[i].num_vfs * 128;
+	}
+	if( (buf = (char *) malloc( sizeof( char ) * bsize )) == NULL ) {
+		return NULL;
+	}
+
+	blen = snprintf( buf, bsize, "\n%4s %4s  %-40s %s\n", "pf", "vf", "fixed", "still-differs" );
+	rte_spinlock_lock( &conf->update_lock );
+	for( i = 0; i < conf->num_ports; i++ ) {
+		port = &conf->ports[i];
+		if( port->rte_port_number < 0 || (pf >= 0 && port->rte_port_number != pf) ) {
+			continue;
+		}
+		pmatch++;
+
+		for( y = 0; y < port->num_vfs; y++ ) {
+			vf = &port->vfs[y];
+			if( vf->num < 0 || vf->last_updated == DELETED || (vfn >= 0 && vf->num != vfn) ) {
+				continue;
+			}
+			vmatch++;
+			if( vf->last_updated != UNCHANGED ) {					// update_nic has yet to program it
+				continue;
+			}
+
+			nvfs++;
+			bits = recon_vf( parms, port, vf, 1, &left, &rstats[port->rte_port_number % MAX_PORTS].writes );
+			if( bits != 0 && blen < bsize ) {
+				ndrift++;
+				blen += snprintf( buf + blen, bsize - blen, "%4d %4d  %-40s %s\n", port->rte_port_number, vf->num,
+					bits < 0 ? "(settings cannot be read)" : vfd_recon_items( bits, ibuf, sizeof( ibuf ) ),
+					bits < 0 ? "" : vfd_recon_items( left, lbuf, sizeof( lbuf ) ) );
+				if( bits > 0 ) {
+					bleat_printf( 1, "reconcile: pf=%d vf=%d differed from config: %s", port->rte_port_number, vf->num, ibuf );
+				}
+			}
+		}
+	}
+	rte_spinlock_unlock( &conf->update_lock );
+
+	if( (pf >= 0 && pmatch == 0) || (vfn >= 0 && vmatch == 0) ) {
+		bleat_printf( 1, "reconcile: no configured %s matches the request: pf=%d vf=%d", pmatch == 0 ? "pf" : "vf", pf, vfn );
+		free( buf );
+		return NULL;
+	}
+
+	if( blen < bsize ) {
+		blen += snprintf( buf + blen, bsize - blen, "reconcile: %d vfs checked, %d out of step or unreadable\n", nvfs, ndrift );
+	}
+	if( blen >= bsize ) {
+		buf[bsize - 1] = 0;
+	}
+
+	return buf;
+}
+
+/*
+	Called from the main loop; runs a pass every reconcile_itvl seconds.
+*/
+extern void vfd_recon_tick( parms_t* parms, sriov_conf_t* conf ) {
+	struct sriov_port_s* port;
+	struct vf_s*	vf;
+	char	ibuf[128];
+	time_t	now;
+	int		bits;
+	int		left;
+	int		i;
+	int		y;
+
+	if( parms == NULL || conf == NULL || parms->recon_itvl <= 0 || ! parms->forreal || (parms->rflags & RF_INITIALISED) == 0 ) {
+		return;
+	}
+
+	now = time( NULL );
+	if( now < next_pass ) {
+		return;
+	}
+	next_pass = now + parms->recon_itvl;
+	npasses++;
+
+	rte_spinlock_lock( &conf->update_lock );
+	for( i = 0; i < conf->num_ports; i++ ) {
+		port = &conf->ports[i];
+		if( port->rte_port_number < 0 ) {
+			continue;
+		}
+
+		for( y = 0; y < port->num_vfs; y++ ) {
+			vf = &port->vfs[y];
+			if( vf->num < 0 || vf->last_updated != UNCHANGED ) {
+				continue;
+			}
+
+			if( (bits = recon_vf( parms, port, vf, 1, &left, &rstats[port->rte_port_number % MAX_PORTS].writes )) > 0 ) {
+				bleat_printf( 1, "reconcile: pf=%d vf=%d differed from config: %s%s", port->rte_port_number, vf->num,
+					vfd_recon_items( bits, ibuf, sizeof( ibuf ) ), left ? " (still differs after fix)" : "" );
+			}
+		}
+	}
+	rte_spinlock_unlock( &conf->update_lock );
+}
+
+/*
+	Build the 'show reconcile' response; caller must free.
+*/
+extern char* vfd_recon_show( parms_t* parms, sriov_conf_t* conf ) {
+	recon_port_t*	rs;
+	char*	buf;
+	int		bsize;
+	int		blen;
+	int		i;
+	int		j;
+	int		pn;
+
+	bsize = BUF_1K + conf->num_ports * 256;
+	if( (buf = (char *) malloc( sizeof( char ) * bsize )) == NULL ) {
+		return NULL;
+	}
+
+	blen = snprintf( buf, bsize, "\nreconciler: %s  interval=%ds  passes=%lld\n",
+		parms->recon_itvl > 0 ? "enabled" : "disabled", parms->recon_itvl, (long long) npasses );
+	blen += snprintf( buf + blen, bsize - blen, "%4s %10s %10s %10s %10s %10s  ", "pf", "checked", "unreadable", "drifted", "unfixed", "writes" );
+	for( j = 0; j < RCN_NITEMS; j++ ) {
+		blen += snprintf( buf + blen, bsize - blen, "%7s ", item_names[j] );
+	}
+	blen += snprintf( buf + blen, bsize - blen, "\n" );
+
+	for( i = 0; i < conf->num_ports && blen < bsize; i++ ) {
+		pn = conf->ports[i].rte_port_number;
+		if( pn < 0 || pn >= MAX_PORTS ) {
+			continue;
+		}
+
+		rs = &rstats[pn];
+		blen += snprintf( buf + blen, bsize - blen, "%4d %10llu %10llu %10llu %10llu %10llu  ", pn,
+			(unsigned long long) rs->checked, (unsigned long long) rs->unreadable, (unsigned long long) rs->drifted,
+			(unsigned long long) rs->unfixed, (unsigned long long) rs->writes );
+		for( j = 0; j < RCN_NITEMS && blen < bsize; j++ ) {
+			blen += snprintf( buf + blen, bsize - blen, "%7llu ", (unsigned long long) rs->items[j] );
+		}
+		if( blen < bsize ) {
+			blen += snprintf( buf + blen, bsize - blen, "\n" );
+		}
+	}
+
+	if( blen >= bsize ) {
+		buf[bsize - 1] = 0;
+	}
+	return buf;
+}
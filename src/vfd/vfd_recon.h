@@ -0,0 +1,25 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_recon.h
+	Abstract:	Reconcile the VF settings on the NIC with the running configuration.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_RECON_H
+#define _VFD_RECON_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+#define RCN_NITEMS		8			// settings compared; one for each VHW_ bit
+#define RCN_RATE_TOL	1			// rate caps within this percentage (or 1 Mbps) are taken as equal
+
+// ------------- prototypes ----------------------------------------------
+extern int vfd_recon_vf( parms_t* parms, struct sriov_port_s* port, struct vf_s* vf, int apply, int* left );
+extern char* vfd_recon_run( parms_t* parms, sriov_conf_t* conf, const_str req );
+extern void vfd_recon_tick( parms_t* parms, sriov_conf_t* conf );
+extern char* vfd_recon_show( parms_t* parms, sriov_conf_t* conf );
+extern const char* vfd_recon_items( int bits, char* buf, int blen );
+
+#endif
@@ -21,12 +21,35 @@
 								Correct loop initialisation bug; $259
 				14 Feb 2018 : Add support to keep config file name field and compare at delete. (#262)
 				19 Feb 2018 : Add support for 'live' config directory (#263)
+				18 Oct 2026 : Add flight recorder dump request.
+				18 Oct 2026 : Add show timings request.
+				18 Oct 2026 : Add request tracing and echo the request id in responses.
+				18 Oct 2026 : Maintain running qshare sums; normalise only the TCs which changed.
+				18 Oct 2026 : Add tcbw request to change tc bandwidth settings on a running port.
+				18 Oct 2026 : Add show rebalance; vet rebalance bounds on vf add.
+				18 Oct 2026 : Add show throttled.
+				18 Oct 2026 : Extended stats from the cached xstats id maps; dump logs all ports.
+				18 Oct 2026 : Add show drain.
+				18 Oct 2026 : Software mirror options on the mirror request; show mirror reports their counters.
+				18 Oct 2026 : Mark the state snapshot for rewrite after add, delete and mirror requests.
+				18 Oct 2026 : Add the reconcile request and show reconcile.
+				18 Oct 2026 : Escape the request id echoed in the response.
+				18 Oct 2026 : Include the nic's error in the tcbw failure reason.
+				18 Oct 2026 : Unknown show t* resources get an error response.
 */
 
 
 #include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
 #include "sriov.h"
 #include "vfd_rif.h"
+#include "vfd_timing.h"
+#include "vfd_state.h"
+#include "vfd_rebal.h"
+#include "vfd_recon.h"
+#include "vfd_throttle.h"
+#include "vfd_xstats.h"
+#include "vfd_drain.h"
+#include "vfd_smirror.h"
 
 //--------------------------------------------------------------------------------------------------------------
 
@@ -142,30 +165,20 @@ static void delete_vf_config( const_str fname, const_str target_dir ) {
 	Port is the PF number mapped from the pciid in the parm file.
 	req_tcs is an array of the reqested tc percentages ordered traffic class 0-7.
 
+	The running sums kept by qs_add_vf()/qs_del_vf() are used so there is no need
+	to scan the VFs.
+
 	Return code of 0 indicates success; non-zero is failure.
 	
 */
 extern int check_qs_oversub( struct sriov_port_s* port, uint8_t* qshares ) {
-
-	int	totals[MAX_TCS];			// current pct totals
 	int	i;
-	int j;
 	int	rc = 0;						// return code; assume good
 
-	memset( totals, 0, sizeof( totals ) );
-
-	for( i = 0; i < port->num_vfs; i++ ) {			// sum the pctgs for each TC across all VFs
-		if( port->vfs[i].num >= 0 ) {				// active VF
-			for( j = 0; j < MAX_TCS; j++ ) {
-				totals[j] += port->vfs[i].qshares[j];	// add in this total
-			}
-		}
-	}
-
 	for( i = 0; i < MAX_TCS; i++ ) {
-		if( totals[i] + qshares[i] > 100 ) {
+		if( port->qs_sums[i] + qshares[i] > 100 ) {
 			rc = 1;
-			bleat_printf( 1, "requested traffic class percentage causes limit to be exceeded: tc=%d current=%d requested=%d", i, totals[i], qshares[i] );
+			bleat_printf( 1, "requested traffic class percentage causes limit to be exceeded: tc=%d current=%d requested=%d", i, port->qs_sums[i], qshares[i] );
 		}
 	}
 
@@ -177,7 +190,8 @@ extern int check_qs_oversub( struct sriov_port_s* port, uint8_t* qshares ) {
 	min and max.  This function will check the queue shares and return non-zero if
 	the difference between min and max is greater than 10x. Qshares is a pointer to
 	the values which are being added to the port and will be taken into consideration
-	with the current port settings.
+	with the current port settings. The current min/max for each TC come from the
+	per-TC histogram of active VF shares rather than from a scan of the VFs.
 
 	Return of 0 indicates that the qshares can safely be added; non-zero indicates one 
 	or more of the shares busts the limit.
@@ -191,17 +205,17 @@ extern int check_qs_spread( struct sriov_port_s* port, uint8_t* qshares ) {
 
 	for( i = 0; i < MAX_TCS; i++ ) {				// seed with the values we wish to insert
 		min[i] = max[i] = qshares[i];
-	}
 
-	for( i = 0; i < port->num_vfs; i++ ) {			// sum the pctgs for each TC across all VFs
-		if( port->vfs[i].num >= 0 ) {				// active VF
-			for( j = 0; j < MAX_TCS; j++ ) {
-				if( port->vfs[i].qshares[j] > 0  &&  min[j] > port->vfs[i].qshares[j] ) {		// zeros are ignored
-					min[j] = port->vfs[i].qshares[j];
-				}
-				if( max[j] < port->vfs[i].qshares[j] ) {
-					max[j] = port->vfs[i].qshares[j];
-				}
+		for( j = 1; j < QS_HIST_SIZE && j < min[i]; j++ ) {			// smallest non-zero share in use; zeros are ignored
+			if( port->qs_hist[i][j] > 0 ) {
+				min[i] = j;
+				break;
+			}
+		}
+		for( j = QS_HIST_SIZE - 1; j > max[i]; j-- ) {					// largest share in use
+			if( port->qs_hist[i][j] > 0 ) {
+				max[i] = j;
+				break;
 			}
 		}
 	}
@@ -217,6 +231,51 @@ extern int check_qs_spread( struct sriov_port_s* port, uint8_t* qshares ) {
 }
 
 // -------------- queue share related things ------------------------------------------------------------------------
+/*
+	Add the VF's configured qshares to the port's running sums and histogram. TCs
+	whose sum changes are marked so that only they are normalised by the next call
+	to gen_port_qshares(). Must be called once the VF is active (vf->num set) and
+	its qshares have been filled in.
+*/
+extern void qs_add_vf( sriov_port_t* port, struct vf_s* vf ) {
+	int i;
+	int v;
+
+	for( i = 0; i < MAX_TCS; i++ ) {
+		v = vf->qshares[i] < QS_HIST_SIZE ? vf->qshares[i] : QS_HIST_SIZE - 1;
+		port->qs_hist[i][v]++;
+		if( vf->qshares[i] > 0 ) {
+			port->qs_sums[i] += vf->qshares[i];
+			port->qs_dirty |= 1 << i;
+		}
+	}
+}
+
+/*
+	Remove the VF's qshares from the port's running sums and histogram. Must be
+	called before the VF is marked inactive (vf->num set to -1) so that its slots
+	in the normalised array can be cleared.
+*/
+extern void qs_del_vf( sriov_port_t* port, struct vf_s* vf ) {
+	int i;
+	int v;
+
+	for( i = 0; i < MAX_TCS; i++ ) {
+		v = vf->qshares[i] < QS_HIST_SIZE ? vf->qshares[i] : QS_HIST_SIZE - 1;
+		if( port->qs_hist[i][v] > 0 ) {
+			port->qs_hist[i][v]--;
+		}
+		if( vf->qshares[i] > 0 ) {
+			port->qs_sums[i] -= vf->qshares[i];
+			port->qs_dirty |= 1 << i;
+		}
+
+		if( port->vftc_qshares != NULL && vf->num >= 0 && i < port->ntcs && (vf->num * port->ntcs) + i < MAX_QUEUES ) {
+			port->vftc_qshares[(vf->num * port->ntcs)+i] = 0;
+		}
+	}
+}
+
 /*
 	Generate the array of queue share percentages adjusting for under/over subscription such that the percentages
 	across each TC total exactly 100%.  The output array is grouped by VF (illustrated below) and attached to the
@@ -233,68 +292,72 @@ extern int check_qs_spread( struct sriov_port_s* port, uint8_t* qshares ) {
 	are increased proportionally if the TC is undersubscribed, and reduced proportionally if the
 	TC is over subscribed.
 
-	This should be called after every VF add/delete to recompute the queue shares across all.
+	This should be called after every VF add/delete to recompute the queue shares. The array is
+	allocated on the first call and reused; the per-TC sums are maintained by qs_add_vf() and
+	qs_del_vf() and only the TCs they marked dirty are normalised again. Setting all bits in
+	port->qs_dirty forces a full recompute.
 */
 void gen_port_qshares( sriov_port_t *port ) {
-	int* 	norm_pctgs;				// normalised percentages (to be returned)
+	int* 	norm_pctgs;				// normalised percentages
 	int 	i;
 	int		j;
-	int		sums[MAX_TCS];					// TC percentage sums
+	int		sum;							// TC percentage sum after normalisation
 	int		ntcs;							// number of TCs
 	double	v;								// computed value
 	int		vfid;							// the vf number we are looking at (vf # might not correspond to index in table)
+	int		max_vf;							// VFs beyond this have no queue in the array
 	double	factor;							// normalisation factor
 
-	norm_pctgs = (int *) malloc( sizeof( *norm_pctgs ) * MAX_QUEUES );
-	if( norm_pctgs == NULL ) {
-		bleat_printf( 0, "error: unable to allocate %d bytes for max-pctg array", sizeof( *norm_pctgs ) * MAX_QUEUES  );
-		return;
+	if( (norm_pctgs = port->vftc_qshares) == NULL ) {
+		norm_pctgs = (int *) malloc( sizeof( *norm_pctgs ) * MAX_QUEUES );
+		if( norm_pctgs == NULL ) {
+			bleat_printf( 0, "error: unable to allocate %d bytes for max-pctg array", sizeof( *norm_pctgs ) * MAX_QUEUES  );
+			return;
+		}
+		memset( norm_pctgs, 0, sizeof( *norm_pctgs ) * MAX_QUEUES );
+		port->vftc_qshares = norm_pctgs;
+		port->qs_dirty = 0xff;							// first time; everything must be computed
 	}
-	memset( norm_pctgs, 0, sizeof( *norm_pctgs ) * MAX_QUEUES );
 
 	ntcs = port->ntcs;
-	for( i = 0; i < ntcs; i++ ) {			// for each tc, compute the overall sum based on configured
-		sums[i] = 0;
-
-		for( j = 0; j < port->num_vfs; j++ ) {
-			if( port->vfs[j].num >= 0 ) {					// only for active VFs
-				//bleat_printf( 1, ">>> add to sum tc=%d vf=%d sum=%d share=%d", i, port->vfs[j].num, sums[i], port->vfs[j].qshares[i] );
-				sums[i] += port->vfs[j].qshares[i];
-			}
+	max_vf = ntcs > 0 ? MAX_QUEUES / ntcs : 0;
+	for( i = 0; i < ntcs; i++ ) {
+		if( ! (port->qs_dirty & (1 << i)) ) {
+			continue;										// sum unchanged since last time; existing values are good
 		}
-	}
 
-	for( i = 0; i < ntcs; i++ ) {
-		if( sums[i] != 100 ) {									// over/under subscribed; must normalise
-			factor = 100.0 / (double) sums[i];
-			bleat_printf( 3, "normalise qshare: tc=%d factor=%.2f sum=%d", i, factor, sums[i] );
-			sums[i] = 0;
+		if( port->qs_sums[i] != 100 && port->qs_sums[i] > 0 ) {		// over/under subscribed; must normalise
+			factor = 100.0 / (double) port->qs_sums[i];
+			bleat_printf( 3, "normalise qshare: tc=%d factor=%.2f sum=%d", i, factor, port->qs_sums[i] );
+			sum = 0;
 
 			for( j = 0; j < port->num_vfs; j++ ) {
-				if( (vfid = port->vfs[j].num) >= 0 ) {			// only deal with active VFs
+				if( (vfid = port->vfs[j].num) >= 0 && vfid < max_vf ) {			// only deal with active VFs which have queues
 					v = port->vfs[j].qshares[i] * factor;		// adjust the configured value
 					norm_pctgs[(vfid * ntcs)+i] = (uint8_t) v;	// stash it, dropping fractional part
 
-					sums[i] += (int) v;
+					sum += (int) v;
 				}
 			}	
 
-			if( sums[i] < 100 ) {									// rounding will likely leave us short and DPDK demands an exact 100% total
-				for( j = 0; j < port->num_vfs && sums[i] < 100; j++ ) {
-					if( (vfid = port->vfs[j].num) >= 0 ) {
+			if( sum < 100 ) {									// rounding will likely leave us short and DPDK demands an exact 100% total
+				for( j = 0; j < port->num_vfs && sum < 100; j++ ) {
+					if( (vfid = port->vfs[j].num) >= 0 && vfid < max_vf ) {
 						norm_pctgs[(vfid * ntcs)+i]++;		// fudge up each until we top off at 100; not fair, but did we promise to be?
+						sum++;
 					}
 				}
 			}
 		} else {
-			bleat_printf( 3, "no qshare normalisation needed: tc=%d sum=%d", i,  sums[i] );
+			bleat_printf( 3, "no qshare normalisation needed: tc=%d sum=%d", i,  port->qs_sums[i] );
 			for( j = 0; j < port->num_vfs; j++ ) {
-				if( (vfid = port->vfs[j].num) >= 0 ){								// active VF
-					norm_pctgs[(vfid * ntcs)+i] =  port->vfs[j].qshares[i];			// sum is 100, stash unchanged
+				if( (vfid = port->vfs[j].num) >= 0 && vfid < max_vf ){				// active VF
+					norm_pctgs[(vfid * ntcs)+i] =  port->vfs[j].qshares[i];			// sum is 100 (or nothing to share), stash unchanged
 				}
 			}
 		}
 	}
+	port->qs_dirty = 0;
 
 	if( bleat_will_it( 2 ) ) {
 		for( i = 0; i < MAX_QUEUES; i += 16 ) {
@@ -304,12 +367,6 @@ void gen_port_qshares( sriov_port_t *port ) {
 					norm_pctgs[i+8], norm_pctgs[i+9], norm_pctgs[i+10], norm_pctgs[i+11], norm_pctgs[i+12], norm_pctgs[i+13], norm_pctgs[i+14], norm_pctgs[i+15] );
 		}
 	}
-
-	if( port->vftc_qshares != NULL ) {
-		free( port->vftc_qshares );
-	}
-
-	port->vftc_qshares = norm_pctgs;
 }
 
 //  --------------------- global config management ------------------------------------------------------------
@@ -393,14 +450,15 @@ extern void vfd_add_ports( parms_t* parms, sriov_conf_t* conf ) {
 */
 static char* gen_mirror_stats( struct sriov_conf_c* conf, int limit ) {
 	char* buf;
-	char wbuf[128];
+	char wbuf[384];
 	int blen = 0;
 	const_str	dir;
 	int p;
 	int v;
+	int wlen;
 	struct mirror_s* mirror;
 
-	if( (buf = (char*) malloc( sizeof( char ) * 4096 )) == NULL ) {
+	if( (buf = (char*) malloc( sizeof( char ) * MSTATS_BUFSZ )) == NULL ) {
 		return NULL;
 	}
 
@@ -411,7 +469,7 @@ static char* gen_mirror_stats( struct sriov_conf_c* conf, int limit ) {
 		}
 
 		blen += snprintf( wbuf, sizeof( wbuf ), "port %d has %d mirrors:\n", conf->ports[p].rte_port_number, conf->ports[p].num_mirrors );
-		if( blen >= 4080 ) {
+		if( blen >= MSTATS_BUFSZ - 16 ) {
 			strcat( buf, "<truncated>\n" );
 			return buf;				// out of room
 		}
@@ -419,7 +477,7 @@ static char* gen_mirror_stats( struct sriov_conf_c* conf, int limit ) {
 
 		for( v = 0; v < MAX_VFS; v++ ) {
 			if( (mirror = suss_mirror( conf->ports[p].rte_port_number, v )) != NULL ) {
-				if( mirror->target < MAX_VFS ) {		// mirror defined
+				if( mirror->target < MAX_VFS || (mirror->soft && mirror->pcap && mirror->dir != MIRROR_OFF) ) {		// mirror defined
 					switch( mirror->dir ) {
 						case MIRROR_IN: dir = "in"; break;
 						case MIRROR_OUT: dir = "out"; break;
@@ -427,8 +485,16 @@ static char* gen_mirror_stats( struct sriov_conf_c* conf, int limit ) {
 						default: dir = "off";
 					}
 
-					blen += snprintf( wbuf, sizeof( wbuf ), "  vf %d (%s) ==> vf %d\n", v, dir, mirror->target );
-					if( blen >= 4080 ) {
+					if( mirror->pcap ) {
+						wlen = snprintf( wbuf, sizeof( wbuf ), "  vf %d (%s) ==> pcap\n", v, dir );
+					} else {
+						wlen = snprintf( wbuf, sizeof( wbuf ), "  vf %d (%s) ==> vf %d\n", v, dir, mirror->target );
+					}
+					if( mirror->soft && wlen < (int) sizeof( wbuf ) ) {
+						wlen += vfd_smirror_stats( conf->ports[p].rte_port_number, v, wbuf + wlen, sizeof( wbuf ) - wlen );		// throughput and drops
+					}
+					blen += wlen;
+					if( blen >= MSTATS_BUFSZ - 16 ) {
 						strcat( buf, "<truncated>\n" );
 						return buf;				// out of room
 					}
@@ -448,6 +514,11 @@ static char* gen_mirror_stats( struct sriov_conf_c* conf, int limit ) {
 		<pf> <vf> <state>
 	where pf and vf are the respective numbers and state is one of:
 		in, out, all, off.
+	A target is given after in/out/all, followed by optional software mirror
+	settings:
+		<pf> <vf> <dir> <target> [sample=<n>] [snap=<bytes>] [mbps=<n>] [sw]
+	Any of these (or pcap as the target) makes the mirror a software mirror
+	(vfd_smirror.c) rather than a nic mirror rule to the target.
 */
 static int vfd_update_mirror( sriov_conf_t* conf, const_str req, char** reason ) {
 	struct vf_s*  vf;					// vf block for confirmation that pf/vf is managed
@@ -462,6 +533,12 @@ static int vfd_update_mirror( sriov_conf_t* conf, const_str req, char** reason )
 	int		state = 0;			// return state; 0 == fail
 	int		req_dir = MIRROR_OFF;
 	int		target;				// target vf for mirrored traffic
+	int		soft = 0;			// software mirror settings (vfd_smirror.c)
+	int		to_pcap = 0;
+	int		sample = 1;
+	int		snaplen = 0;
+	int		mbps = 0;
+	int		bad_opt = 0;
 
 	if( conf == NULL ) {
 		if( reason != NULL ) {
@@ -519,18 +596,64 @@ static int vfd_update_mirror( sriov_conf_t* conf, const_str req, char** reason )
 
 					if( req_dir != MIRROR_OFF ) {
 						if( tok != NULL ) {										// target supplied (if missing it goes unchagned)
-							target = atoi( tok );
-							if( target >= 0 && target < MAX_VFS ) {				// must be in range
-								mirror->target = target;
-								if( mirror->dir == MIRROR_OFF ) {					// if mirror was previously off
-									pf->num_mirrors++;
-									mirror->id = idm_alloc( conf->mir_id_mgr );		// alloc an unused id value
+							if( strcmp( tok, "pcap" ) == 0 ) {					// soft mirror into the pf capture files
+								to_pcap = soft = 1;
+								target = MAX_VFS;
+							} else {
+								target = atoi( tok );
+							}
+
+							while( (tok = strtok_r( NULL, " ", &tok_base )) != NULL ) {		// optional software mirror settings; any of them makes it soft
+								soft = 1;
+								if( strncmp( tok, "sample=", 7 ) == 0 ) {
+									sample = atoi( tok + 7 );
+								} else {
+									if( strncmp( tok, "snap=", 5 ) == 0 ) {
+										snaplen = atoi( tok + 5 );
+									} else {
+										if( strncmp( tok, "mbps=", 5 ) == 0 ) {
+											mbps = atoi( tok + 5 );
+										} else {
+											if( strcmp( tok, "sw" ) != 0 ) {
+												bad_opt = 1;
+											}
+										}
+									}
 								}
-	
-								mirror->dir = req_dir;								// safe to set the direction now
-								state = 1;
+							}
+
+							if( bad_opt || sample < 0 || snaplen < 0 || mbps < 0 ) {
+								msg = "unrecognised or negative mirror option (sample=n snap=n mbps=n sw)";
 							} else {
-								msg = "target VF number is out of range";
+								if( to_pcap || (target >= 0 && target < MAX_VFS) ) {		// must be in range
+									if( mirror->dir == MIRROR_OFF ) {					// if mirror was previously off
+										pf->num_mirrors++;
+										if( ! soft ) {
+											mirror->id = idm_alloc( conf->mir_id_mgr );		// alloc an unused id value
+										}
+									} else {
+										if( mirror->soft && ! soft ) {					// soft to hardware; needs its own rule
+											vfd_smirror_clear( conf, pf, vf->num );
+											mirror->id = idm_alloc( conf->mir_id_mgr );
+										} else {
+											if( ! mirror->soft && soft ) {				// hardware to soft; drop the vf's own rule
+												set_mirror( pf->rte_port_number, vf->num, mirror->id, mirror->target, MIRROR_OFF );
+												idm_return( conf->mir_id_mgr, mirror->id );
+											}
+										}
+									}
+		
+									mirror->target = target;
+									mirror->soft = soft;
+									mirror->pcap = to_pcap;
+									mirror->sample = sample;
+									mirror->snaplen = snaplen;
+									mirror->mbps = mbps;
+									mirror->dir = req_dir;								// safe to set the direction now
+									state = 1;
+								} else {
+									msg = "target VF number is out of range";
+								}
 							}
 						} else {
 							msg = "target VF number not supplied";
@@ -548,12 +671,29 @@ static int vfd_update_mirror( sriov_conf_t* conf, const_str req, char** reason )
 					}
 
 					if( state ) {									// all vetted successfully
-						bleat_printf( 1, "update mirror:  setting: pf/vf=%d/%d dir=%d target=%d",  pf->rte_port_number, vf->num, req_dir, mirror->target );
-						if( set_mirror( pf->rte_port_number, vf->num, mirror->id, mirror->target, mirror->dir ) < 0 ) {		// actually do it
-							msg = "unable to update nic with mirror request";
-							state = 0;
+						bleat_printf( 1, "update mirror:  setting: pf/vf=%d/%d dir=%d target=%d soft=%d",  pf->rte_port_number, vf->num, req_dir, mirror->target, mirror->soft );
+						if( mirror->soft ) {
+							if( mirror->dir == MIRROR_OFF ) {
+								vfd_smirror_clear( conf, pf, vf->num );
+								mirror->soft = mirror->pcap = 0;
+								msg = NULL;
+							} else {
+								if( vfd_smirror_set( conf, pf, vf, mirror, &msg ) < 0 ) {		// msg has the reason
+									mirror->dir = MIRROR_OFF;
+									mirror->soft = mirror->pcap = 0;
+									if( pf->num_mirrors > 0 ) {
+										pf->num_mirrors--;
+									}
+									state = 0;
+								}
+							}
 						} else {
-							msg = NULL;
+							if( set_mirror( pf->rte_port_number, vf->num, mirror->id, mirror->target, mirror->dir ) < 0 ) {		// actually do it
+								msg = "unable to update nic with mirror request";
+								state = 0;
+							} else {
+								msg = NULL;
+							}
 						}
 					}
 
@@ -577,6 +717,188 @@ static int vfd_update_mirror( sriov_conf_t* conf, const_str req, char** reason )
 }
 
 
+/*
+	Change the traffic class bandwidth settings for a PF without reinitialising the port.
+	The request (req) is a string of the form:
+		<pf> <tcspec> [<tcspec>...]
+	where each tcspec is a comma separated list of key=value pairs which must start
+	with tc=<n> and may include:
+		min=<pct>		minimum bandwidth (percentage of link)
+		max=<pct>		maximum bandwidth (percentage of link)
+		bwg=<n>			bandwidth group the tc belongs to
+		lsp=<0|1>		link strict priority
+		bsp=<0|1>		bandwidth group strict priority
+	e.g.  "0 tc=1,min=30 tc=2,min=50,bwg=1 tc=3,lsp=1"
+
+	The whole request is vetted against a copy of the current settings before anything
+	is touched: tc must be < the number of TCs on the port, percentages 1-100 with
+	min <= max, bwg < NUM_BWGS, and the min values of the TCs which are not link strict
+	must not total more than 100. The new values are then pushed with qos_apply_tcs();
+	if the nic does not accept them the previous values are restored and pushed again.
+
+	Returns 1 on success, 0 on failure with a message in reason (caller must free).
+*/
+static int vfd_update_tcbw( parms_t* parms, sriov_conf_t* conf, const_str req, char** reason ) {
+	struct sriov_port_s* pf;
+	tc_class_t	cur[MAX_TCS];			// current settings; restored if the nic balks
+	tc_class_t	new[MAX_TCS];			// proposed settings
+	uint8_t		cur_bwg[MAX_TCS];
+	uint8_t		new_bwg[MAX_TCS];
+	char	mbuf[BUF_1K];
+	char*	raw;						// raw request we can mangle
+	char*	tok;
+	char*	tok_base = NULL;			// strtok_r() base pointers
+	char*	kv;
+	char*	kv_base = NULL;
+	char*	val;
+	int		tc;
+	int		v;
+	int		i;
+	int		sum = 0;
+	int		rc = 0;						// qos_apply_tcs() result
+	int		state = 0;					// return state; 0 == fail
+
+	*mbuf = 0;
+	if( conf == NULL || req == NULL ) {
+		snprintf( mbuf, sizeof( mbuf ), "no configuration or request string" );
+	} else {
+		if( ! (parms->rflags & RF_ENABLE_QOS) ) {
+			snprintf( mbuf, sizeof( mbuf ), "qos is not enabled" );
+		}
+	}
+
+	if( *mbuf ) {
+		if( reason != NULL ) {
+			*reason = strdup( mbuf );
+		}
+		return 0;
+	}
+
+	raw = strdup( req );
+	pf = NULL;
+	if( (tok = strtok_r( raw, " ", &tok_base )) != NULL ) {
+		pf = suss_port( atoi( tok ) );
+	}
+	if( pf == NULL ) {
+		snprintf( mbuf, sizeof( mbuf ), "pf is not managed or was not given" );
+	}
+
+	if( ! *mbuf ) {
+		for( i = 0; i < pf->ntcs; i++ ) {
+			if( pf->tc_config[i] == NULL ) {
+				snprintf( mbuf, sizeof( mbuf ), "tc %d has no configuration on the pf", i );
+				break;
+			}
+			cur[i] = new[i] = *pf->tc_config[i];
+			cur_bwg[i] = new_bwg[i] = pf->tc2bwg[i];
+		}
+	}
+
+	while( ! *mbuf && (tok = strtok_r( NULL, " ", &tok_base )) != NULL ) {		// vet each tc spec, applying to the new set
+		tc = -1;
+		for( kv = strtok_r( tok, ",", &kv_base ); kv != NULL && ! *mbuf; kv = strtok_r( NULL, ",", &kv_base ) ) {
+			if( (val = strchr( kv, '=' )) == NULL ) {
+				snprintf( mbuf, sizeof( mbuf ), "missing value: %s", kv );
+				break;
+			}
+			*(val++) = 0;
+			v = atoi( val );
+
+			if( strcmp( kv, "tc" ) == 0 ) {
+				if( v < 0 || v >= pf->ntcs ) {
+					snprintf( mbuf, sizeof( mbuf ), "tc is out of range (0-%d): %d", pf->ntcs - 1, v );
+				}
+				tc = v;
+				continue;
+			}
+
+			if( tc < 0 ) {
+				snprintf( mbuf, sizeof( mbuf ), "tc=<n> must be first in each tc spec" );
+				break;
+			}
+
+			if( strcmp( kv, "min" ) == 0 || strcmp( kv, "max" ) == 0 ) {
+				if( v < 1 || v > 100 ) {
+					snprintf( mbuf, sizeof( mbuf ), "%s bandwidth is out of range (1-100) for tc %d: %d", kv, tc, v );
+				} else {
+					if( *(kv+1) == 'i' ) {
+						new[tc].min_bw = v;
+					} else {
+						new[tc].max_bw = v;
+					}
+				}
+			} else {
+				if( strcmp( kv, "bwg" ) == 0 ) {
+					if( v < 0 || v >= NUM_BWGS ) {
+						snprintf( mbuf, sizeof( mbuf ), "bandwidth group is out of range (0-%d) for tc %d: %d", NUM_BWGS - 1, tc, v );
+					} else {
+						new_bwg[tc] = v;
+					}
+				} else {
+					if( strcmp( kv, "lsp" ) == 0 ) {
+						new[tc].flags = v ? new[tc].flags | TCF_LNK_STRICTP : new[tc].flags & ~TCF_LNK_STRICTP;
+					} else {
+						if( strcmp( kv, "bsp" ) == 0 ) {
+							new[tc].flags = v ? new[tc].flags | TCF_BW_STRICTP : new[tc].flags & ~TCF_BW_STRICTP;
+						} else {
+							snprintf( mbuf, sizeof( mbuf ), "unrecognised tc setting: %s", kv );
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if( ! *mbuf ) {											// vet the complete set
+		for( i = 0; i < pf->ntcs; i++ ) {
+			if( new[i].min_bw > new[i].max_bw ) {
+				snprintf( mbuf, sizeof( mbuf ), "min bandwidth exceeds max for tc %d: %d > %d", i, new[i].min_bw, new[i].max_bw );
+				break;
+			}
+			if( ! (new[i].flags & TCF_LNK_STRICTP) ) {
+				sum += new[i].min_bw;
+			}
+		}
+		if( ! *mbuf && sum > 100 ) {
+			snprintf( mbuf, sizeof( mbuf ), "min bandwidth of the non-strict tcs totals more than 100%%: %d", sum );
+		}
+	}
+
+	if( ! *mbuf ) {
+		vfd_trace_lock( &conf->update_lock );				// keep update_nic from pushing credits while the arbiter is changed
+		for( i = 0; i < pf->ntcs; i++ ) {
+			*pf->tc_config[i] = new[i];
+			pf->tc2bwg[i] = new_bwg[i];
+		}
+
+		if( (rc = qos_apply_tcs( pf )) == 0 ) {
+			state = 1;
+			for( i = 0; i < pf->ntcs; i++ ) {
+				bleat_printf( 1, "tc bandwidth updated: pf=%d tc=%d min=%d max=%d bwg=%d flags=0x%02x",
+					pf->rte_port_number, i, new[i].min_bw, new[i].max_bw, new_bwg[i], new[i].flags );
+			}
+		} else {
+			for( i = 0; i < pf->ntcs; i++ ) {				// roll back and push the old values
+				*pf->tc_config[i] = cur[i];
+				pf->tc2bwg[i] = cur_bwg[i];
+			}
+			if( qos_apply_tcs( pf ) == 0 ) {
+				snprintf( mbuf, sizeof( mbuf ), "nic did not accept the settings (%d); previous settings restored", rc );
+			} else {
+				snprintf( mbuf, sizeof( mbuf ), "nic did not accept the settings (%d); CAUTION: restore of previous settings also failed", rc );
+			}
+		}
+		rte_spinlock_unlock( &conf->update_lock );
+	}
+
+	free( raw );
+	if( ! state && reason != NULL ) {
+		*reason = strdup( mbuf );
+	}
+
+	return state;
+}
+
 /*
 	Add one of the virtualisation manager generated configuration files to a global
 	config struct passed in.  A small amount of error checking (vf id dup, etc) is
@@ -718,6 +1040,16 @@ extern int vfd_add_vf( sriov_conf_t* conf, char* fname, char** reason ) {
 		return 0;
 	}
 
+	if( vfc->min_rate_floor > vfc->min_rate || (vfc->rate_ceiling > 0 && (vfc->rate_ceiling < vfc->rate || vfc->rate_ceiling > 1)) ) {
+		snprintf( mbuf, sizeof( mbuf ), "rebalance bounds are not sane: min_rate_floor must be <= min_rate and rate <= rate_ceiling <= 1" );
+		bleat_printf( 1, "vf not added: %s", mbuf );
+		if( reason ) {
+			*reason = strdup( mbuf );
+		}
+		free_config( vfc );
+		return 0;
+	}
+
 	if( vfc->nvlans > MAX_VF_VLANS ) {				// more than allowed for a single VF
 		snprintf( mbuf, sizeof( mbuf ), "number of vlans supplied (%d) exceeds the maximum (%d)", vfc->nvlans, MAX_VF_VLANS );
 		bleat_printf( 1, "vf not added: %s", mbuf );
@@ -874,7 +1206,7 @@ extern int vfd_add_vf( sriov_conf_t* conf, char* fname, char** reason ) {
 		port->num_vfs++;
 	}
 	
-	rte_spinlock_lock( &conf->update_lock );
+	vfd_trace_lock( &conf->update_lock );		// lock, charging any wait to the request being traced
 
 	vf = &port->vfs[vidx];						// copy from config data doing any translation needed
 	memset( vf, 0, sizeof( *vf ) );				// assume zeroing everything is good
@@ -890,6 +1222,7 @@ extern int vfd_add_vf( sriov_conf_t* conf, char* fname, char** reason ) {
 	vf->allow_mcast = vfc->allow_mcast;
 	vf->allow_un_ucast = vfc->allow_un_ucast;
 
+	port->mirrors[vidx].soft = port->mirrors[vidx].pcap = 0;		// mirrors from a config file are nic mirrors
 	port->mirrors[vidx].dir = vfc->mirror_dir;						// mirrors are added to the port list
 	if( vfc->mirror_dir != MIRROR_OFF ) {
 		port->mirrors[vidx].target = vfc->mirror_target;
@@ -905,6 +1238,8 @@ extern int vfd_add_vf( sriov_conf_t* conf, char* fname, char** reason ) {
 
 	vf->rate = vfc->rate;
 	vf->min_rate = vfc->min_rate;
+	vf->rate_ceiling = vfc->rate_ceiling > 0 ? vfc->rate_ceiling : vfc->rate;		// cap is not raised unless a ceiling was given
+	vf->min_rate_floor = vfc->min_rate_floor;
 	
 	if( vfc->start_cb != NULL ) {
 		vf->start_cb = strdup( vfc->start_cb );
@@ -941,6 +1276,7 @@ extern int vfd_add_vf( sriov_conf_t* conf, char* fname, char** reason ) {
 	for( i = 0; i < MAX_TCS; i++ ) {				// copy in the VF's share of each traffic class (percentage)
 		vf->qshares[i] = vfc->qshare[i];
 	}
+	qs_add_vf( port, vf );							// update the port's running sums
 
 	rte_spinlock_unlock( &conf->update_lock );		// updates finished, safe to release now
 
@@ -1192,6 +1528,35 @@ extern int vfd_write( int fd, const_str buf, int len ) {
 	return -1;
 }
 
+/*
+	Copy src to dest (size dlen) escaping it for use as a json string value. Quotes and
+	backslashes are escaped; control characters are written as \u00xx. Dest is
+	truncated rather than left with a partial escape.
+*/
+static void json_esc( const char* src, char* dest, int dlen ) {
+	int		need;
+
+	for( ; src != NULL && *src && dlen > 1; src++ ) {
+		need = (*src == '"' || *src == '\\') ? 2 : ((unsigned char) *src < 0x20 ? 6 : 1);
+		if( need >= dlen ) {
+			break;
+		}
+
+		if( need == 2 ) {
+			*dest++ = '\\';
+			*dest++ = *src;
+		} else if( need == 6 ) {
+			snprintf( dest, dlen, "\\u%04x", (unsigned char) *src );
+			dest += 6;
+		} else {
+			*dest++ = *src;
+		}
+		dlen -= need;
+	}
+
+	*dest = 0;
+}
+
 /*
 	Construct json to write onto the response pipe.  The response pipe is opened in non-block mode
 	so that it will fail immiediately if there isn't a reader or the pipe doesn't exist. We assume
@@ -1202,7 +1567,11 @@ extern int vfd_write( int fd, const_str buf, int len ) {
 extern void vfd_response( char* rpipe, int state, const_str msg ) {
 	int 	fd;
 	char	buf[BUF_1K];
+	char	erid[BUF_1K/2];		// request id escaped for json
+	const char*	rid;			// request id to echo back
 
+	vfd_trace_mark( VTP_WORK );
+	vfd_trace_state( state );
 	if( rpipe == NULL ) {
 		return;
 	}
@@ -1218,7 +1587,12 @@ extern void vfd_response( char* rpipe, int state, const_str msg ) {
 		bleat_printf( 2, "sending response: %s(%d) [%d] %d bytes", rpipe, fd, state, strlen( msg ) );
 	}
 
-	snprintf( buf, sizeof( buf ), "{ \"state\": \"%s\", \"msg\": \"", state ? "ERROR" : "OK" );
+	if( (rid = vfd_trace_id()) != NULL ) {
+		json_esc( rid, erid, sizeof( erid ) );					// id is the client's; it may hold anything
+		snprintf( buf, sizeof( buf ), "{ \"state\": \"%s\", \"req_id\": \"%s\", \"msg\": \"", state ? "ERROR" : "OK", erid );
+	} else {
+		snprintf( buf, sizeof( buf ), "{ \"state\": \"%s\", \"msg\": \"", state ? "ERROR" : "OK" );
+	}
 	if ( vfd_write( fd, buf, strlen( buf ) ) > 0 ) {
 		if ( msg != NULL ) {
 			vfd_write( fd, msg, strlen( msg ) );				// ignore state; we need to close the json regardless
@@ -1231,6 +1605,7 @@ extern void vfd_response( char* rpipe, int state, const_str msg ) {
 
 	bleat_pop_lvl();			// we assume it was pushed when the request received; we pop it once we respond
 	close( fd );
+	vfd_trace_mark( VTP_RESP );
 }
 
 /*
@@ -1258,12 +1633,16 @@ extern req_t* vfd_read_request( parms_t* parms ) {
 	char*	stuff;				// stuff teased out of the json blob
 	req_t*	req = NULL;
 	int		lvl;				// log level supplied
+	uint64_t	start;			// tsc before/after the fifo read for tracing
+	uint64_t	recvd;
 
+	start = vfd_timing_start();
 	rbuf = rfifo_read( parms->rfifo );
 	if( ! *rbuf ) {				// empty, nothing to do
 		free( rbuf );
 		return NULL;
 	}
+	recvd = vfd_timing_start();
 
 	if( (jblob = jw_new( rbuf )) == NULL ) {
 		bleat_printf( 0, "ERR: failed to create a json parsing object for: %s", rbuf );
@@ -1295,6 +1674,10 @@ extern req_t* vfd_read_request( parms_t* parms ) {
 			req->rtype = RT_ADD;
 			break;
 
+		case 'f':
+			req->rtype = RT_FLIGHT;
+			break;
+
 		case 'd':
 		case 'D':
 			if( strcmp( stuff, "dump" ) == 0 ) {
@@ -1308,10 +1691,18 @@ extern req_t* vfd_read_request( parms_t* parms ) {
 			req->rtype = RT_MIRROR;
 			break;
 
+		case 't':
+			req->rtype = RT_TCBW;
+			break;
+
 		case 'p':					// ping
 			req->rtype = RT_PING;
 			break;
 
+		case 'r':					// reconcile
+			req->rtype = RT_RECON;
+			break;
+
 		case 's':
 		case 'S':					// assume show
 			req->rtype = RT_SHOW;
@@ -1342,49 +1733,65 @@ extern req_t* vfd_read_request( parms_t* parms ) {
 	req->log_level = lvl = jw_missing( jblob, "params.loglevel" ) ? 0 : (int) jw_value( jblob, "params.loglevel" );
 	bleat_push_glvl( lvl );					// push the level if greater, else push current so pop won't fail
 
+	vfd_trace_begin( start, recvd );
+	vfd_trace_set( req->rtype, jw_string( jblob, "params.req_id" ) );		// id is generated if not supplied
+	vfd_trace_mark( VTP_PARSE );
+
 	free( rbuf );
 	jw_nuke( jblob );
 	return req;
 }
 
 /*
-	Fill a buffer with the extended stats for all ports. Caller must free the buffer.
-	If memory becomes an issue, this returns NULL to indicate error.
+	Dump the flight recorder messages captured in the last seconds seconds (all if
+	seconds is <= 0) to a time stamped file in the log directory. The name of the
+	file is placed into fname (if not nil). Returns the number of messages written
+	or -1 on error.
 */
-static char* gen_exstats( sriov_conf_t* conf ) {
-	char*	xbuf = NULL;							// extended stats from one port
-	char*	rbuf = NULL;							// response buffer with all output
-	int		rbsize = sizeof( char ) * 1024 * 10;	// amount allocated in rbuf
-	int		rbused = 0;								// amount used in the response buffer
-	int		xbsize = sizeof( char ) * 1024 * 5;
-	int		i;
-	int		len;
-
-	if( (rbuf = (char *) malloc( rbsize )) != NULL ) {
-		*rbuf = 0;
-		if( (xbuf = (char *) malloc( xbsize )) != NULL ) {
-			for( i = 0; i < conf->num_ports; i++ ) {
-				len = sprintf( xbuf, "\nport %d:\n", i );
-				len += port_xstats_display( conf->ports[i].rte_port_number, xbuf + len, xbsize - len );
-				if( len + rbused > rbsize ) {
-					while( rbused + len < rbsize ) {
-						rbsize += rbsize/2;
-					}
-					if( (rbuf = (char *) realloc( rbuf, rbsize )) == NULL ) {
-						bleat_printf( 0, "WARN: unable to get enough memory to display extended stats" );
-						return NULL;
-					}
-				}
+extern int vfd_fr_dump( parms_t* parms, int seconds, char* fname, int flen ) {
+	char	wbuf[BUF_1K];
 
-				strcat( rbuf, xbuf );
-				rbused += len;
-			}
+	if( parms == NULL || parms->log_dir == NULL ) {
+		return -1;
+	}
+
+	snprintf( wbuf, sizeof( wbuf ), "%s/vfd.flight.%ld", parms->log_dir, (long) time( NULL ) );
+	if( fname != NULL && flen > 0 ) {
+		snprintf( fname, flen, "%s", wbuf );
+	}
+
+	return bleat_fr_dump( wbuf, seconds );
+}
 
-			free( xbuf );
+/*
+	Add a string to a buffer growing the buffer if needed. Returns the buffer
+	which might be different than was passed in, or nil on allocation error
+	(the original buffer is freed). Bsize must be > 0 when buf is passed in
+	as nil; blen is the amount of the buffer already used.
+*/
+extern char* vfd_add_str( char* buf, int* bsize, int* blen, const char* str ) {
+	int slen;
+	char* nbuf;
+
+	if( str == NULL ) {
+		return buf;
+	}
+
+	slen = strlen( str );
+	if( buf == NULL || *blen + slen + 1 > *bsize ) {
+		while( *blen + slen + 1 > *bsize ) {
+			*bsize += *bsize/2;
+		}
+		if( (nbuf = (char *) realloc( buf, *bsize )) == NULL ) {
+			free( buf );
+			return NULL;
 		}
+		buf = nbuf;
 	}
 
-	return rbuf;
+	strcpy( buf + *blen, str );
+	*blen += slen;
+	return buf;
 }
 
 												
@@ -1400,6 +1807,7 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
 	int		rc = 0;
 	char*	reason;
 	int		req_handled = 0;
+	int		i;
 
 	if( forever ) {
 		bleat_printf( 1, "req_if: forever loop entered" );
@@ -1428,7 +1836,10 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
 					bleat_printf( 2, "adding vf from file: %s", mbuf );
 					if( vfd_add_vf( conf, mbuf, &reason ) ) {				// read the config file and add to in mem config if ok
 						relocate_vf_config( parms, mbuf, NULL );			// move the config to the live directory on success (nil suffix indicates live dir)
+						vfd_state_changed();
+						vfd_trace_mark( VTP_CONFIG );
 						if( vfd_update_nic( parms, conf ) == 0 ) {			// added to config was good, drive the nic update
+							vfd_trace_mark( VTP_NIC );
 							snprintf( mbuf, sizeof( mbuf ), "vf added successfully: %s", req->resource );
 							vfd_response( req->resp_fifo, RESP_OK, mbuf );
 							bleat_printf( 1, "vf added: %s", mbuf );
@@ -1441,6 +1852,7 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
 						}
 					} else {
 						relocate_vf_config( parms, mbuf, ".error" );		// move the config file to *.error for debugging, but keep in same directory
+						vfd_trace_mark( VTP_CONFIG );
 						snprintf( mbuf, sizeof( mbuf ), "unable to add vf: %s: %s", req->resource, reason );
 						vfd_response( req->resp_fifo, RESP_ERROR, mbuf );
 						free( reason );
@@ -1459,12 +1871,16 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
 
 					bleat_printf( 1, "deleting vf from file: %s", mbuf );
 					if( vfd_del_vf( parms, conf, req->resource, &reason ) ) {		// successfully updated internal struct
+						vfd_state_changed();
+						vfd_trace_mark( VTP_CONFIG );
 						if( vfd_update_nic( parms, conf ) == 0 ) {			// nic update was good too
+							vfd_trace_mark( VTP_NIC );
 							snprintf( mbuf, sizeof( mbuf ), "vf deleted successfully: %s", req->resource );
 							vfd_response( req->resp_fifo, RESP_OK, mbuf );
 							bleat_printf( 1, "vf deleted: %s", mbuf );
 						} // TODO need else -- see above
 					} else {
+						vfd_trace_mark( VTP_CONFIG );
 						snprintf( mbuf, sizeof( mbuf ), "unable to delete vf: %s: %s", req->resource, reason );
 						vfd_response( req->resp_fifo, RESP_ERROR, mbuf );
 						free( reason );
@@ -1479,19 +1895,33 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
   					dump_sriov_config( conf );					// pf/vf specific info
 					vfd_response( req->resp_fifo, RESP_OK, "dump captured in the log" );
 
-					char*	stats_buf;
-					if( (stats_buf = (char *) malloc( sizeof( char ) * 10 * 1024 )) != NULL ) {
-						if( port_xstats_display( 0, stats_buf, sizeof( char ) * 1024 * 10 ) > 0 ) {
-							bleat_printf( 0, "%s", stats_buf );
-						}
+					for( i = 0; i < conf->num_ports; i++ ) {
+						vfd_xstats_log( conf->ports[i].rte_port_number );
+					}
+					break;
 
-						free( stats_buf );
+				case RT_FLIGHT:									// dump the in memory messages which were below the log level
+					{
+						char	fr_fname[BUF_1K];
+						int		nmsgs;
+
+						fr_fname[0] = 0;								// not set if the dump fails early
+						nmsgs = vfd_fr_dump( parms, req->resource != NULL ? atoi( req->resource ) : 0, fr_fname, sizeof( fr_fname ) );
+						if( nmsgs >= 0 ) {
+							snprintf( mbuf, sizeof( mbuf ), "flight recorder: %d messages written to: %s", nmsgs, fr_fname );
+							vfd_response( req->resp_fifo, RESP_OK, mbuf );
+						} else {
+							snprintf( mbuf, sizeof( mbuf ), "flight recorder dump failed: %s: %s", fr_fname[0] ? fr_fname : "no file", strerror( errno ) );
+							vfd_response( req->resp_fifo, RESP_ERROR, mbuf );
+						}
+						bleat_printf( 1, "%s", mbuf );
 					}
 					break;
 
 				case RT_MIRROR:
 					if( parms->forreal ) {
 						if( vfd_update_mirror( conf, req->resource, &reason ) ) {
+							vfd_state_changed();
 							snprintf( mbuf, sizeof( mbuf ), "mirror update successful: %s", req->resource );
 							vfd_response( req->resp_fifo, RESP_OK, mbuf );
 						} else {
@@ -1505,6 +1935,35 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
 					}
 					break;
 
+				case RT_TCBW:
+					if( parms->forreal ) {
+						if( vfd_update_tcbw( parms, conf, req->resource, &reason ) ) {
+							snprintf( mbuf, sizeof( mbuf ), "tc bandwidth update successful: %s", req->resource );
+							vfd_response( req->resp_fifo, RESP_OK, mbuf );
+						} else {
+							snprintf( mbuf, sizeof( mbuf ), "tc bandwidth update failed: %s: %s", req->resource ? req->resource : "", reason ? reason : "" );
+							vfd_response( req->resp_fifo, RESP_ERROR, mbuf );
+							free( reason );
+						}
+						bleat_printf( 1, "%s", mbuf );
+					} else {
+						bleat_printf( 1, "tc bandwidth request received, but ignored (forreal is off): %s", req->resource == NULL ? "" : req->resource );
+					}
+					break;
+
+				case RT_RECON:
+					if( parms->forreal ) {
+						if( (buf = vfd_recon_run( parms, conf, req->resource )) != NULL ) {
+							vfd_response( req->resp_fifo, RESP_OK, buf );
+							free( buf );
+						} else {
+							vfd_response( req->resp_fifo, RESP_ERROR, "unable to reconcile: bad pf/vf or internal mishap" );
+						}
+					} else {
+						bleat_printf( 1, "reconcile request received, but ignored (forreal is off): %s", req->resource == NULL ? "" : req->resource );
+					}
+					break;
+
 				case RT_SHOW:
 					if( parms->forreal ) {
 						if( req->resource == NULL ) {
@@ -1522,9 +1981,20 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
 									}
 									break;
 
+								case 'd':			// show pf drain counts
+									if( strncmp( req->resource, "drain", 5 ) == 0 ) {
+										if( (buf = vfd_drain_show( conf )) != NULL ) {
+											vfd_response( req->resp_fifo, RESP_OK, buf );
+											free( buf );
+										} else {
+											vfd_response( req->resp_fifo, RESP_ERROR, "unable to generate pf drain counts" );
+										}
+									}
+									break;
+
 								case 'e':
 									if( strncmp( req->resource, "ex", 2 ) == 0 ) {							// show extended stats
-										buf = gen_exstats( conf );						// create a buffer with stats for all ports
+										buf = vfd_xstats_show( conf );					// create a buffer with stats for all ports
 										if( buf != NULL ) {
 											vfd_response( req->resp_fifo, RESP_OK, buf );
 											free( buf );
@@ -1555,6 +2025,60 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
 										}
 									}
 										break;
+
+								case 'r':			// show bandwidth rebalancer state, or reconcile counts
+									if( strncmp( req->resource, "rebal", 5 ) == 0 ) {
+										if( (buf = vfd_rebal_show( parms, conf )) != NULL ) {
+											vfd_response( req->resp_fifo, RESP_OK, buf );
+											free( buf );
+										} else {
+											vfd_response( req->resp_fifo, RESP_ERROR, "unable to generate rebalance state" );
+										}
+									} else if( strncmp( req->resource, "recon", 5 ) == 0 ) {			// show reconcile
+										if( (buf = vfd_recon_show( parms, conf )) != NULL ) {
+											vfd_response( req->resp_fifo, RESP_OK, buf );
+											free( buf );
+										} else {
+											vfd_response( req->resp_fifo, RESP_ERROR, "unable to generate reconcile state" );
+										}
+									}
+									break;
+
+								case 't':			// show timings, timings-reset shows then clears; traces shows request traces; throttled vfs
+									if( strncmp( req->resource, "throttle", 8 ) == 0 ) {
+										if( (buf = vfd_throttle_show( parms, conf )) != NULL ) {
+											vfd_response( req->resp_fifo, RESP_OK, buf );
+											free( buf );
+										} else {
+											vfd_response( req->resp_fifo, RESP_ERROR, "unable to generate throttle state" );
+										}
+									} else {
+										if( strcmp( req->resource, "traces" ) == 0 ) {
+											if( (buf = vfd_trace_show( )) != NULL ) {
+												vfd_response( req->resp_fifo, RESP_OK, buf );
+												free( buf );
+											} else {
+												vfd_response( req->resp_fifo, RESP_ERROR, "unable to generate request traces" );
+											}
+										} else {
+											if( strncmp( req->resource, "timings", 7 ) == 0 ) {
+												if( (buf = vfd_timing_show( )) != NULL ) {
+													vfd_response( req->resp_fifo, RESP_OK, buf );
+													free( buf );
+												} else {
+													vfd_response( req->resp_fifo, RESP_ERROR, "unable to generate timings" );
+												}
+
+												if( strcmp( req->resource, "timings-reset" ) == 0 ) {
+													vfd_timing_reset( );
+												}
+											} else {
+												bleat_printf( 2, "show: unknown target supplied: %s", req->resource );
+												vfd_response( req->resp_fifo, RESP_ERROR, "unknown show resource (not one of throttled, timings, timings-reset or traces)" );
+											}
+										}
+									}
+									break;
 								
 								default:
 									if( isdigit( *req->resource ) ) {						// dump just for the indicated pf
@@ -1568,7 +2092,7 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
 										if( req->resource ) {
 											bleat_printf( 2, "show: unknown target supplied: %s", req->resource );
 										}
-										vfd_response( req->resp_fifo, RESP_ERROR, "unable to generate stats: unnown target supplied (not one of all, pfs, extended or pf-number)" );
+										vfd_response( req->resp_fifo, RESP_ERROR, "unable to generate stats: unnown target supplied (not one of all, pfs, drain, extended, mirror, rebalance, throttled, timings, traces or pf-number)" );
 									}
 							}
 						}
@@ -1599,6 +2123,7 @@ extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever ) {
 			}
 
 			vfd_free_request( req );
+			vfd_trace_end( );
 		}
 		
 		if( forever )
@@ -26,9 +26,13 @@
 #define RT_VERBOSE 5
 #define RT_DUMP 6
 #define RT_MIRROR 7				// mirror on/off command
+#define RT_FLIGHT 8				// dump the bleat flight recorder
+#define RT_TCBW 9				// change tc bandwidth settings on a running port
+#define RT_RECON 10				// reconcile vf settings on the nic with the config
 
 #define BUF_1K	1024			// simple buffer size constants
 #define BUF_10K BUF_1K * 10
+#define MSTATS_BUFSZ	(BUF_1K * 16)	// show mirror response (soft mirrors add a stats line each)
 
 typedef struct request {
 	int		rtype;				// type: RT_ const
@@ -49,6 +53,8 @@ extern void vfd_response( char* rpipe, int state, const char* msg );
 extern void vfd_free_request( req_t* req );
 extern req_t* vfd_read_request( parms_t* parms );
 extern int vfd_req_if( parms_t *parms, sriov_conf_t* conf, int forever );
+extern int vfd_fr_dump( parms_t* parms, int seconds, char* fname, int flen );
+extern char* vfd_add_str( char* buf, int* bsize, int* blen, const char* str );
 
 
 #endif
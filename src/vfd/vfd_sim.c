@@ -0,0 +1,682 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_sim.c
+	Abstract:	A software NIC which implements the per-NIC operations that sriov.c
+				dispatches to, against an in-memory model of each port: VLAN filter
+				table, MAC whitelists, rate limits, mirrors, anti-spoof, strip/insert
+				and queue ready state. The intent is to be able to drive (and time)
+				the VFd control plane on a box without any SR-IOV hardware.
+
+				Each operation can be given a latency (usec) which is spent busy
+				waiting before the model is updated. This allows the cost of an
+				admin queue call or a register write to be approximated so that the
+				effect of a change to the number of NIC calls made by update_nic()
+				can be seen.
+
+				The model is keyed by the dpdk port number. A port is 'attached'
+				when vfd_sim_attach() is called and from then on get_nic_type()
+				reports it as VFD_SIM. Updates come from the same threads that
+				drive the real NIC functions (main, refresh queue, callbacks) and the
+				per port lock keeps the model consistent.
+
+	Date:		18 October 2026
+*/
+
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_timing.h"
+#include "vfd_sim.h"
+
+#define SIM_NVLANS	4096
+
+/*
+	Model of a single VF.
+*/
+typedef struct sim_vf {
+	int		link;						// VF_LINK_ constant
+	uint16_t rate;						// max rate (Mbps) 0 == off
+	uint16_t min_rate;
+	uint16_t insert_vlan;				// 0 == no insert
+	uint16_t insert_cvlan;
+	uint8_t	strip;
+	uint8_t	cstrip;
+	uint8_t	bcast;
+	uint8_t	mcast;
+	uint8_t	un_ucast;
+	uint8_t	untagged;
+	uint8_t	vlan_spoof;
+	uint8_t	mac_spoof;
+	uint8_t	split_erop;
+	uint8_t	rx_drop;
+	uint8_t	qready;						// queues enabled (reset will wait until set)
+	uint8_t	mirror_target;
+	uint8_t	mirror_dir;
+	int		nmacs;
+	struct ether_addr def_mac;
+	struct ether_addr macs[MAX_VF_MACS];
+	struct rte_eth_stats stats;
+} sim_vf_t;
+
+/*
+	Model of a single port.
+*/
+typedef struct sim_port {
+	rte_spinlock_t lock;
+	int		nvfs;						// number of VFs 'configured' on the port
+	int		link_status;
+	uint32_t link_speed;
+	uint8_t	loopback;
+	uint8_t	pfrx_drop;
+	uint8_t	all_drop;
+	uint32_t spoofed;
+	uint64_t vlans[SIM_NVLANS];			// pool (vf) mask for each vlan id
+	int		qshares[MAX_QUEUES];		// last set of queue shares pushed
+	sim_vf_t vfs[MAX_VFS];
+} sim_port_t;
+
+static sim_port_t* sims[MAX_PORTS];
+static int latency[VT_NOPS];			// usec to spend for each op
+
+// -----------------------------------------------------------------------------------------------------------
+
+/*
+	Spin for the latency assigned to the operation. We spin rather than sleep
+	so that the timing is close to what a blocking NIC call would cost.
+*/
+static void sim_delay( int op ) {
+	struct timespec now;
+	struct timespec end;
+	int usec;
+
+	if( op < 0 || op >= VT_NOPS || (usec = latency[op]) <= 0 ) {
+		return;
+	}
+
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	end.tv_nsec += (long) usec * 1000;
+	end.tv_sec += end.tv_nsec / 1000000000;
+	end.tv_nsec %= 1000000000;
+
+	do {
+		clock_gettime( CLOCK_MONOTONIC, &now );
+	} while( now.tv_sec < end.tv_sec || (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec) );
+}
+
+/*
+	Delay for the op and then return the locked port. Returns nil if the port
+	isn't attached.
+*/
+static sim_port_t* sim_lock( uint16_t port_id, int op ) {
+	sim_port_t* sp;
+
+	if( port_id >= MAX_PORTS || (sp = sims[port_id]) == NULL ) {
+		return NULL;
+	}
+
+	sim_delay( op );
+	rte_spinlock_lock( &sp->lock );
+	return sp;
+}
+
+/*
+	Lock the port and return the VF model, or nil if either is out of range.
+	The caller must unlock the port if a VF is returned.
+*/
+static sim_vf_t* sim_vf_lock( uint16_t port_id, uint32_t vf_id, int op, sim_port_t** spp ) {
+	sim_port_t* sp;
+
+	if( vf_id >= MAX_VFS || (sp = sim_lock( port_id, op )) == NULL ) {
+		return NULL;
+	}
+
+	if( (int) vf_id >= sp->nvfs ) {
+		rte_spinlock_unlock( &sp->lock );
+		return NULL;
+	}
+
+	*spp = sp;
+	return &sp->vfs[vf_id];
+}
+
+/*
+	Sets a single byte flag on the VF. Common code for the many on/off operations.
+*/
+static int sim_vf_flag( uint16_t port_id, uint16_t vf_id, int op, size_t offset, uint8_t on ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( (vf = sim_vf_lock( port_id, vf_id, op, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	*(((uint8_t *) vf) + offset) = !!on;
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+// ---------------- management -------------------------------------------------------------------------------
+
+/*
+	Attach a simulated port with nvfs VFs. Returns 0 on success; -1 on error.
+	If the port is already attached the model is reset.
+*/
+extern int vfd_sim_attach( uint16_t port_id, int nvfs, uint32_t link_speed ) {
+	sim_port_t* sp;
+	int i;
+
+	if( port_id >= MAX_PORTS || nvfs < 0 || nvfs > MAX_VFS ) {
+		bleat_printf( 0, "ERR: sim: unable to attach port %d: port or vf count (%d) out of range", port_id, nvfs );
+		return -1;
+	}
+
+	if( (sp = sims[port_id]) == NULL ) {
+		if( (sp = (sim_port_t *) malloc( sizeof( *sp ) )) == NULL ) {
+			bleat_printf( 0, "ERR: sim: unable to allocate memory for port %d", port_id );
+			return -1;
+		}
+	}
+
+	memset( sp, 0, sizeof( *sp ) );
+	rte_spinlock_init( &sp->lock );
+	sp->nvfs = nvfs;
+	sp->link_status = ETH_LINK_UP;
+	sp->link_speed = link_speed;
+	for( i = 0; i < MAX_VFS; i++ ) {
+		sp->vfs[i].link = VF_LINK_AUTO;
+		sp->vfs[i].qready = 1;
+		sp->vfs[i].mirror_target = MAX_VFS + 1;
+	}
+
+	sims[port_id] = sp;
+	bleat_printf( 1, "sim: port %d attached: vfs=%d speed=%u", port_id, nvfs, link_speed );
+	return 0;
+}
+
+extern void vfd_sim_detach( uint16_t port_id ) {
+	if( port_id < MAX_PORTS && sims[port_id] != NULL ) {
+		free( sims[port_id] );
+		sims[port_id] = NULL;
+	}
+}
+
+extern int vfd_sim_is_port( uint16_t port_id ) {
+	return port_id < MAX_PORTS && sims[port_id] != NULL;
+}
+
+extern int vfd_sim_get_num_vfs( uint16_t port_id ) {
+	if( ! vfd_sim_is_port( port_id ) ) {
+		return 0;
+	}
+
+	return sims[port_id]->nvfs;
+}
+
+/*
+	Fill in the link struct in the same manner as rte_eth_link_get_nowait().
+*/
+extern int vfd_sim_link_get( uint16_t port_id, struct rte_eth_link* link ) {
+	sim_port_t* sp;
+
+	if( link == NULL || ! vfd_sim_is_port( port_id ) ) {
+		return -EINVAL;
+	}
+
+	sp = sims[port_id];
+	memset( link, 0, sizeof( *link ) );
+	link->link_speed = sp->link_speed;
+	link->link_duplex = ETH_LINK_FULL_DUPLEX;
+	link->link_autoneg = ETH_LINK_AUTONEG;
+	link->link_status = sp->link_status;
+
+	return 0;
+}
+
+/*
+	Allow a test to bounce the link or change the speed. Speed of 0 leaves
+	the current value.
+*/
+extern void vfd_sim_set_link( uint16_t port_id, int status, uint32_t link_speed ) {
+	sim_port_t* sp;
+
+	if( (sp = sim_lock( port_id, -1 )) != NULL ) {
+		sp->link_status = !!status;
+		if( link_speed > 0 ) {
+			sp->link_speed = link_speed;
+		}
+		rte_spinlock_unlock( &sp->lock );
+	}
+}
+
+/*
+	Simulated ports have no pci device; generate a stable address from the
+	port number so that show output has something to display.
+*/
+extern int vfd_sim_pci_addr( uint16_t port_id, struct rte_pci_addr* addr ) {
+	if( addr == NULL || ! vfd_sim_is_port( port_id ) ) {
+		return -EINVAL;
+	}
+
+	memset( addr, 0, sizeof( *addr ) );
+	addr->bus = 0xe0 + port_id;
+	return 0;
+}
+
+/*
+	Set the latency (usec) for an operation (VT_ constant). If op is SIM_ALL_OPS
+	then all operations are set.
+*/
+extern void vfd_sim_set_latency( int op, int usec ) {
+	int i;
+
+	if( op == SIM_ALL_OPS ) {
+		for( i = 0; i < VT_NOPS; i++ ) {
+			latency[i] = usec;
+		}
+	} else {
+		if( op >= 0 && op < VT_NOPS ) {
+			latency[op] = usec;
+		}
+	}
+}
+
+/*
+	Set the queue ready state of the VF so that the reset queue can be exercised.
+*/
+extern void vfd_sim_set_qready( uint16_t port_id, uint16_t vf_id, int state ) {
+	sim_vf_flag( port_id, vf_id, -1, offsetof( sim_vf_t, qready ), state );
+}
+
+/*
+	Add traffic to a VF's counters.
+*/
+extern void vfd_sim_traffic( uint16_t port_id, uint16_t vf_id, uint64_t rx_pkts, uint64_t rx_bytes, uint64_t tx_pkts, uint64_t tx_bytes ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( (vf = sim_vf_lock( port_id, vf_id, -1, &sp )) != NULL ) {
+		vf->stats.ipackets += rx_pkts;
+		vf->stats.ibytes += rx_bytes;
+		vf->stats.opackets += tx_pkts;
+		vf->stats.obytes += tx_bytes;
+		rte_spinlock_unlock( &sp->lock );
+	}
+}
+
+// ---------------- nic operations ---------------------------------------------------------------------------
+
+extern int vfd_sim_set_vf_link_status( uint16_t port_id, uint16_t vf_id, int status ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( status < VF_LINK_OFF || status > VF_LINK_ON ) {
+		return -EINVAL;
+	}
+
+	if( (vf = sim_vf_lock( port_id, vf_id, VT_LINK_STATUS, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	vf->link = status;
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+extern int vfd_sim_set_vf_min_rate( uint16_t port_id, uint16_t vf_id, uint16_t rate ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( (vf = sim_vf_lock( port_id, vf_id, VT_MIN_RATE, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	vf->min_rate = rate;
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+extern int vfd_sim_set_vf_rate_limit( uint16_t port_id, uint16_t vf_id, uint16_t rate ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( (vf = sim_vf_lock( port_id, vf_id, VT_RATE_LIMIT, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	vf->rate = rate;
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+extern int vfd_sim_set_vf_vlan_insert( uint16_t port_id, uint16_t vf_id, uint16_t vlan_id ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( vlan_id >= SIM_NVLANS || (vf = sim_vf_lock( port_id, vf_id, VT_VLAN_INSERT, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	vf->insert_vlan = vlan_id;
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+extern int vfd_sim_set_vf_cvlan_insert( uint16_t port_id, uint16_t vf_id, uint16_t vlan_id ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( vlan_id >= SIM_NVLANS || (vf = sim_vf_lock( port_id, vf_id, VT_CVLAN_INSERT, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	vf->insert_cvlan = vlan_id;
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+extern int vfd_sim_set_vf_vlan_stripq( uint16_t port_id, uint16_t vf_id, uint8_t on ) {
+	return sim_vf_flag( port_id, vf_id, VT_VLAN_STRIP, offsetof( sim_vf_t, strip ), on );
+}
+
+extern int vfd_sim_set_vf_cvlan_stripq( uint16_t port_id, uint16_t vf_id, uint8_t on ) {
+	return sim_vf_flag( port_id, vf_id, VT_CVLAN_STRIP, offsetof( sim_vf_t, cstrip ), on );
+}
+
+extern int vfd_sim_set_vf_broadcast( uint16_t port_id, uint16_t vf_id, uint8_t on ) {
+	return sim_vf_flag( port_id, vf_id, VT_ALLOW_BCAST, offsetof( sim_vf_t, bcast ), on );
+}
+
+extern int vfd_sim_set_vf_multicast_promisc( uint16_t port_id, uint16_t vf_id, uint8_t on ) {
+	return sim_vf_flag( port_id, vf_id, VT_ALLOW_MCAST, offsetof( sim_vf_t, mcast ), on );
+}
+
+extern int vfd_sim_set_vf_unicast_promisc( uint16_t port_id, uint16_t vf_id, uint8_t on ) {
+	return sim_vf_flag( port_id, vf_id, VT_ALLOW_UN_UCAST, offsetof( sim_vf_t, un_ucast ), on );
+}
+
+extern int vfd_sim_allow_untagged( uint16_t port_id, uint16_t vf_id, uint8_t on ) {
+	return sim_vf_flag( port_id, vf_id, VT_ALLOW_UNTAGGED, offsetof( sim_vf_t, untagged ), on );
+}
+
+extern int vfd_sim_set_vf_vlan_anti_spoof( uint16_t port_id, uint16_t vf_id, uint8_t on ) {
+	return sim_vf_flag( port_id, vf_id, VT_VLAN_ANTISPOOF, offsetof( sim_vf_t, vlan_spoof ), on );
+}
+
+extern int vfd_sim_set_vf_mac_anti_spoof( uint16_t port_id, uint16_t vf_id, uint8_t on ) {
+	return sim_vf_flag( port_id, vf_id, VT_MAC_ANTISPOOF, offsetof( sim_vf_t, mac_spoof ), on );
+}
+
+extern void vfd_sim_set_split_erop( uint16_t port_id, uint16_t vf_id, int state ) {
+	sim_vf_flag( port_id, vf_id, VT_SPLIT_EROP, offsetof( sim_vf_t, split_erop ), state );
+}
+
+extern void vfd_sim_set_rx_drop( uint16_t port_id, uint16_t vf_id, int state ) {
+	sim_vf_flag( port_id, vf_id, -1, offsetof( sim_vf_t, rx_drop ), state );
+}
+
+/*
+	Add or remove a MAC from the VF's whitelist. The hardware limits are
+	mimicked: adding to a full list fails with ENOSPC. Adding a MAC which is
+	already in the list is not an error.
+*/
+extern int vfd_sim_set_vf_mac_addr( uint16_t port_id, uint16_t vf_id, struct ether_addr* mac_addr, uint8_t on ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+	int i;
+	int rc = 0;
+
+	if( mac_addr == NULL || (vf = sim_vf_lock( port_id, vf_id, VT_RX_MAC, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	for( i = 0; i < vf->nmacs; i++ ) {
+		if( is_same_ether_addr( &vf->macs[i], mac_addr ) ) {
+			break;
+		}
+	}
+
+	if( on ) {
+		if( i == vf->nmacs ) {
+			if( vf->nmacs < MAX_VF_MACS ) {
+				ether_addr_copy( mac_addr, &vf->macs[vf->nmacs++] );
+			} else {
+				rc = -ENOSPC;
+			}
+		}
+	} else {
+		if( i < vf->nmacs ) {
+			vf->nmacs--;
+			if( i < vf->nmacs ) {
+				ether_addr_copy( &vf->macs[vf->nmacs], &vf->macs[i] );		// order isn't important; fill the hole with the last
+			}
+		}
+	}
+
+	rte_spinlock_unlock( &sp->lock );
+	return rc;
+}
+
+extern int vfd_sim_set_vf_default_mac_addr( uint16_t port_id, uint16_t vf_id, struct ether_addr* mac_addr ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( mac_addr == NULL || (vf = sim_vf_lock( port_id, vf_id, VT_DEFAULT_MAC, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	ether_addr_copy( mac_addr, &vf->def_mac );
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+/*
+	Add/remove the vlan from the filter for each VF in the mask. Like the
+	hardware, the mask can only address the first 64 pools.
+*/
+extern int vfd_sim_set_vf_vlan_filter( uint16_t port_id, uint16_t vlan_id, uint64_t vf_mask, uint8_t on ) {
+	sim_port_t* sp;
+
+	if( vlan_id >= SIM_NVLANS || (sp = sim_lock( port_id, VT_RX_VLAN )) == NULL ) {
+		return -EINVAL;
+	}
+
+	if( on ) {
+		sp->vlans[vlan_id] |= vf_mask;
+	} else {
+		sp->vlans[vlan_id] &= ~vf_mask;
+	}
+
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+extern int vfd_sim_set_tx_loopback( uint16_t port_id, uint8_t on ) {
+	sim_port_t* sp;
+
+	if( (sp = sim_lock( port_id, VT_LOOPBACK )) == NULL ) {
+		return -EINVAL;
+	}
+
+	sp->loopback = !!on;
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+extern int vfd_sim_set_mirror( uint16_t port_id, uint32_t vf_id, uint8_t target, uint8_t direction ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( direction > MIRROR_ALL || (direction != MIRROR_OFF && target >= MAX_VFS) ) {
+		return -EINVAL;
+	}
+
+	if( (vf = sim_vf_lock( port_id, vf_id, VT_MIRROR, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	vf->mirror_dir = direction;
+	vf->mirror_target = direction == MIRROR_OFF ? MAX_VFS + 1 : target;
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+extern void vfd_sim_set_pfrx_drop( uint16_t port_id, int state ) {
+	sim_port_t* sp;
+
+	if( (sp = sim_lock( port_id, -1 )) != NULL ) {
+		sp->pfrx_drop = !!state;
+		rte_spinlock_unlock( &sp->lock );
+	}
+}
+
+extern int vfd_sim_set_all_queues_drop_en( uint16_t port_id, int state ) {
+	sim_port_t* sp;
+
+	if( (sp = sim_lock( port_id, VT_QUEUE_DROP )) == NULL ) {
+		return -EINVAL;
+	}
+
+	sp->all_drop = !!state;
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+extern int vfd_sim_is_rx_queue_on( uint16_t port_id, uint16_t vf_id, int* mcounter ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+	int state;
+
+	if( (vf = sim_vf_lock( port_id, vf_id, -1, &sp )) == NULL ) {
+		return 0;
+	}
+
+	state = vf->qready;
+	rte_spinlock_unlock( &sp->lock );
+
+	if( ! state && mcounter != NULL ) {
+		(*mcounter)++;
+	}
+	return state;
+}
+
+extern int vfd_sim_get_vf_stats( uint16_t port_id, uint16_t vf_id, struct rte_eth_stats* stats ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+
+	if( stats == NULL || (vf = sim_vf_lock( port_id, vf_id, -1, &sp )) == NULL ) {
+		return -EINVAL;
+	}
+
+	memcpy( stats, &vf->stats, sizeof( *stats ) );
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+/*
+	Port stats are the sum of the VF counters.
+*/
+extern int vfd_sim_get_port_stats( uint16_t port_id, struct rte_eth_stats* stats ) {
+	sim_port_t* sp;
+	int i;
+
+	if( stats == NULL || (sp = sim_lock( port_id, -1 )) == NULL ) {
+		return -EINVAL;
+	}
+
+	memset( stats, 0, sizeof( *stats ) );
+	for( i = 0; i < sp->nvfs; i++ ) {
+		stats->ipackets += sp->vfs[i].stats.ipackets;
+		stats->ibytes += sp->vfs[i].stats.ibytes;
+		stats->opackets += sp->vfs[i].stats.opackets;
+		stats->obytes += sp->vfs[i].stats.obytes;
+	}
+
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+/*
+	Like niantic, the spoof counter is reset on read.
+*/
+extern uint32_t vfd_sim_get_pf_spoof_stats( uint16_t port_id ) {
+	sim_port_t* sp;
+	uint32_t count;
+
+	if( (sp = sim_lock( port_id, -1 )) == NULL ) {
+		return 0;
+	}
+
+	count = sp->spoofed;
+	sp->spoofed = 0;
+	rte_spinlock_unlock( &sp->lock );
+	return count;
+}
+
+/*
+	Save the queue shares (organised as described in gen_port_qshares()).
+*/
+extern int vfd_sim_set_qshares( uint16_t port_id, int* rates ) {
+	sim_port_t* sp;
+
+	if( rates == NULL || (sp = sim_lock( port_id, VT_QOS_CREDITS )) == NULL ) {
+		return -EINVAL;
+	}
+
+	memcpy( sp->qshares, rates, sizeof( sp->qshares ) );
+	rte_spinlock_unlock( &sp->lock );
+	return 0;
+}
+
+/*
+	Fill in the vf_hw_s struct from the model. Everything the model keeps can
+	be read; returns the VHW_ bits set, or 0 if the port/vf is not attached.
+*/
+extern int vfd_sim_get_vf_hw_state( uint16_t port_id, uint16_t vf_id, struct vf_hw_s* hw ) {
+	sim_port_t* sp;
+	sim_vf_t* vf;
+	struct ether_addr zero;
+	int i;
+
+	memset( hw, 0, sizeof( *hw ) );
+	if( (vf = sim_vf_lock( port_id, vf_id, -1, &sp )) == NULL ) {
+		return 0;
+	}
+
+	if( vf_id < 64 ) {									// like the hardware, the filter addresses only the first 64 pools
+		for( i = 1; i < SIM_NVLANS && hw->num_vlans < MAX_VF_VLANS; i++ ) {
+			if( sp->vlans[i] & (1ULL << vf_id) ) {
+				hw->vlans[hw->num_vlans++] = i;
+			}
+		}
+	}
+
+	memset( &zero, 0, sizeof( zero ) );
+	if( ! is_same_ether_addr( &vf->def_mac, &zero ) ) {
+		ether_addr_copy( &vf->def_mac, &hw->macs[hw->num_macs++] );
+	}
+	for( i = 0; i < vf->nmacs && hw->num_macs < MAX_VF_MACS; i++ ) {
+		if( ! is_same_ether_addr( &vf->macs[i], &vf->def_mac ) ) {
+			ether_addr_copy( &vf->macs[i], &hw->macs[hw->num_macs++] );
+		}
+	}
+
+	hw->vlan_anti_spoof = vf->vlan_spoof;
+	hw->mac_anti_spoof = vf->mac_spoof;
+	hw->strip = vf->strip;
+	hw->insert_vlan = vf->insert_vlan;
+	hw->cstrip = vf->cstrip;
+	hw->insert_cvlan = vf->insert_cvlan;
+	hw->allow_bcast = vf->bcast;
+	hw->allow_mcast = vf->mcast;
+	hw->allow_un_ucast = vf->un_ucast;
+	hw->allow_untagged = vf->untagged;
+	hw->rate = vf->rate;
+	rte_spinlock_unlock( &sp->lock );
+
+	hw->valid = VHW_VLANS | VHW_MACS | VHW_SPOOF | VHW_STRIP | VHW_INSERT | VHW_CTAG | VHW_RXMODE | VHW_RATE;
+	return hw->valid;
+}
@@ -0,0 +1,65 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_sim.h
+	Abstract:	Simulated NIC backend. Ports attached to the simulator are reported
+				as VFD_SIM by get_nic_type() and all per-NIC operations are applied
+				to an in-memory model rather than to hardware.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_SIM_H
+#define _VFD_SIM_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+#define SIM_ALL_OPS		(-1)		// op value for vfd_sim_set_latency() which sets all ops
+
+struct vf_hw_s;						// defined in sriov.h which includes us before defining it
+
+// ------------- prototypes ----------------------------------------------
+int vfd_sim_attach( uint16_t port_id, int nvfs, uint32_t link_speed );
+void vfd_sim_detach( uint16_t port_id );
+int vfd_sim_is_port( uint16_t port_id );
+int vfd_sim_get_num_vfs( uint16_t port_id );
+int vfd_sim_link_get( uint16_t port_id, struct rte_eth_link* link );
+void vfd_sim_set_link( uint16_t port_id, int status, uint32_t link_speed );
+int vfd_sim_pci_addr( uint16_t port_id, struct rte_pci_addr* addr );
+void vfd_sim_set_latency( int op, int usec );
+void vfd_sim_set_qready( uint16_t port_id, uint16_t vf_id, int state );
+void vfd_sim_traffic( uint16_t port_id, uint16_t vf_id, uint64_t rx_pkts, uint64_t rx_bytes, uint64_t tx_pkts, uint64_t tx_bytes );
+
+int vfd_sim_set_vf_link_status( uint16_t port_id, uint16_t vf_id, int status );
+int vfd_sim_set_vf_min_rate( uint16_t port_id, uint16_t vf_id, uint16_t rate );
+int vfd_sim_set_vf_rate_limit( uint16_t port_id, uint16_t vf_id, uint16_t rate );
+int vfd_sim_set_vf_vlan_insert( uint16_t port_id, uint16_t vf_id, uint16_t vlan_id );
+int vfd_sim_set_vf_cvlan_insert( uint16_t port_id, uint16_t vf_id, uint16_t vlan_id );
+int vfd_sim_set_vf_vlan_stripq( uint16_t port_id, uint16_t vf_id, uint8_t on );
+int vfd_sim_set_vf_cvlan_stripq( uint16_t port_id, uint16_t vf_id, uint8_t on );
+int vfd_sim_set_vf_broadcast( uint16_t port_id, uint16_t vf_id, uint8_t on );
+int vfd_sim_set_vf_multicast_promisc( uint16_t port_id, uint16_t vf_id, uint8_t on );
+int vfd_sim_set_vf_unicast_promisc( uint16_t port_id, uint16_t vf_id, uint8_t on );
+int vfd_sim_allow_untagged( uint16_t port_id, uint16_t vf_id, uint8_t on );
+int vfd_sim_set_vf_mac_addr( uint16_t port_id, uint16_t vf_id, struct ether_addr* mac_addr, uint8_t on );
+int vfd_sim_set_vf_default_mac_addr( uint16_t port_id, uint16_t vf_id, struct ether_addr* mac_addr );
+int vfd_sim_set_vf_vlan_filter( uint16_t port_id, uint16_t vlan_id, uint64_t vf_mask, uint8_t on );
+int vfd_sim_set_vf_vlan_anti_spoof( uint16_t port_id, uint16_t vf_id, uint8_t on );
+int vfd_sim_set_vf_mac_anti_spoof( uint16_t port_id, uint16_t vf_id, uint8_t on );
+int vfd_sim_set_tx_loopback( uint16_t port_id, uint8_t on );
+int vfd_sim_set_mirror( uint16_t port_id, uint32_t vf_id, uint8_t target, uint8_t direction );
+void vfd_sim_set_split_erop( uint16_t port_id, uint16_t vf_id, int state );
+void vfd_sim_set_rx_drop( uint16_t port_id, uint16_t vf_id, int state );
+void vfd_sim_set_pfrx_drop( uint16_t port_id, int state );
+int vfd_sim_set_all_queues_drop_en( uint16_t port_id, int state );
+int vfd_sim_is_rx_queue_on( uint16_t port_id, uint16_t vf_id, int* mcounter );
+int vfd_sim_get_vf_stats( uint16_t port_id, uint16_t vf_id, struct rte_eth_stats* stats );
+int vfd_sim_get_port_stats( uint16_t port_id, struct rte_eth_stats* stats );
+uint32_t vfd_sim_get_pf_spoof_stats( uint16_t port_id );
+int vfd_sim_set_qshares( uint16_t port_id, int* rates );
+int vfd_sim_get_vf_hw_state( uint16_t port_id, uint16_t vf_id, struct vf_hw_s* hw );
+
+// ------------- benchmark (vfd_bench.c) --------------------------------
+int vfd_bench( parms_t* parms, int iterations, int latency );
+
+#endif
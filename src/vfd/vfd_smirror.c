@@ -0,0 +1,563 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_smirror.c
+	Abstract:	Software port mirroring. A hardware mirror (set_mirror()) sends every
+				packet of the mirrored VF to the target at full rate and needs a NIC
+				rule per mirror, and NICs have very few rules. A soft mirror instead
+				steers the mirrored traffic to the PF pool, where the drain thread
+				pulls it from PF queue 0 and hands it here. All soft mirrors on a
+				port share two NIC rules (one per direction) whose pool masks cover
+				the mirrored VFs.
+
+				Each packet is matched to its mirror by MAC (destination for in,
+				source for out), then 1 in 'sample' packets is kept, cut to
+				'snaplen' bytes, and held to the mirror's Mbit/s cap with a token
+				bucket. What is left is either:
+					- sent to the target VF from PF tx queue 0. The (truncated)
+					  frame is wrapped in an outer ethernet header addressed to the
+					  target VF's MAC, ethertype SM_ENCAP_ETYPE, so that the NIC
+					  switch delivers it to the target only and the original
+					  addresses are kept intact for the consumer; or
+					- queued for the port's mirror pcap files (vfd_pcap.c).
+
+				Soft mirrors are requested by giving any of sample=, snap=, mbps=
+				or sw on the mirror request, or pcap as the target. The per-port
+				lock is held by the drain thread while it works a burst and by the
+				request path while it changes a mirror.
+
+				Soft mirrored VFs must be below SM_MAX_POOLS, and the NIC must
+				support rte mirror rules (not mlx5 or the simulator).
+
+	Date:		18 October 2026
+*/
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_pcap.h"
+#include "vfd_smirror.h"
+
+/*
+	State for one soft mirrored VF.
+*/
+typedef struct sm_vf {
+	int			dir;					// MIRROR_ direction (in/out are bits of all)
+	int			target;					// target vf when not pcap
+	int			pcap;
+	uint32_t	sample;
+	uint32_t	snaplen;				// 0 == whole packet
+	double		rate;					// cap in bytes/sec (0 == none)
+	double		tokens;					// rate cap bucket
+	double		depth;
+	uint64_t	last_tsc;
+	uint32_t	nth;					// sample countdown
+	int			nmacs;
+	struct ether_addr	macs[MAX_VF_MACS];		// mirrored vf's macs (classification)
+	struct ether_addr	tmac;					// target vf's mac (outer destination)
+
+	uint64_t	seen;					// mirrored packets which matched this vf
+	uint64_t	seen_bytes;
+	uint64_t	sampled;				// skipped by sampling
+	uint64_t	capped;					// dropped by the rate cap
+	uint64_t	fwd;					// sent to the target/pcap
+	uint64_t	fwd_bytes;
+	uint64_t	drops;					// tx, headroom or pcap ring failures
+} sm_vf_t;
+
+/*
+	Soft mirror state for one port.
+*/
+typedef struct sm_port {
+	rte_spinlock_t	lock;
+	volatile int	nactive;			// number of soft mirrors (drain thread skips the port when 0)
+	int			act[SM_MAX_POOLS];		// vf ids of the active mirrors
+	sm_vf_t*	vfs[SM_MAX_POOLS];
+	int			id_in;					// nic rule id + 1 for each direction (0 == none)
+	int			id_out;
+	uint64_t	in_mask;				// pools covered by each rule
+	uint64_t	out_mask;
+	int			pool;					// pf pool the rules send traffic to
+	struct ether_addr	pf_mac;			// outer source
+	uint64_t	unmatched;				// packets on the pf queue matching no mirror
+} sm_port_t;
+
+static sm_port_t	smp[MAX_PORTS];
+
+/*
+	Return the pool index of the PF (the pool which mirror rules must target) or -1.
+*/
+static int pf_pool( int port ) {
+	struct rte_eth_dev* dev;
+
+	dev = &rte_eth_devices[port];
+	if( ! RTE_ETH_DEV_SRIOV( dev ).active ) {
+		return -1;
+	}
+
+	return RTE_ETH_DEV_SRIOV( dev ).def_vmdq_idx;
+}
+
+/*
+	Rebuild the active list and rule masks from the vf table. Caller holds the lock.
+*/
+static void rebuild( sm_port_t* sp ) {
+	int	i;
+	int	n = 0;
+
+	sp->in_mask = sp->out_mask = 0;
+	for( i = 0; i < SM_MAX_POOLS; i++ ) {
+		if( sp->vfs[i] != NULL ) {
+			sp->act[n++] = i;
+			if( sp->vfs[i]->dir & MIRROR_IN ) {
+				sp->in_mask |= (uint64_t) 1 << i;
+			}
+			if( sp->vfs[i]->dir & MIRROR_OUT ) {
+				sp->out_mask |= (uint64_t) 1 << i;
+			}
+		}
+	}
+
+	rte_smp_wmb();
+	sp->nactive = n;
+}
+
+/*
+	Set, change or drop the rule for one direction to match the mask. Returns <0 on error.
+*/
+static int apply_rule( sriov_conf_t* conf, int port, int pool, int* idp, uint64_t mask, int dir ) {
+	int	id;
+	int	state = 0;
+
+	if( mask != 0 ) {
+		if( *idp == 0 ) {
+			if( (id = idm_alloc( conf->mir_id_mgr )) < 0 ) {
+				bleat_printf( 0, "ERR: soft mirror: no mirror rule ids left: pf=%d", port );
+				return -1;
+			}
+			*idp = id + 1;
+		}
+		state = set_mirror_mask( port, mask, *idp - 1, pool, dir );
+	} else {
+		if( *idp != 0 ) {
+			state = set_mirror_mask( port, 0, *idp - 1, pool, MIRROR_OFF );
+			idm_return( conf->mir_id_mgr, *idp - 1 );
+			*idp = 0;
+		}
+	}
+
+	if( state < 0 ) {
+		bleat_printf( 0, "ERR: soft mirror: set rule failed: pf=%d mask=0x%llx dir=%d: %d (%s)", port, (unsigned long long) mask, dir, state, strerror( -state ) );
+	}
+	return state;
+}
+
+/*
+	Push both port rules to the nic.
+*/
+static int apply_rules( sriov_conf_t* conf, int port ) {
+	sm_port_t*	sp;
+	int	state;
+
+	sp = &smp[port];
+	state = apply_rule( conf, port, sp->pool, &sp->id_in, sp->in_mask, MIRROR_IN );
+	if( apply_rule( conf, port, sp->pool, &sp->id_out, sp->out_mask, MIRROR_OUT ) < 0 ) {
+		state = -1;
+	}
+
+	return state;
+}
+
+/*
+	Return the mirror the packet belongs to, or nil. Caller holds the lock.
+*/
+static sm_vf_t* classify( sm_port_t* sp, struct rte_mbuf* m ) {
+	struct ether_hdr*	eh;
+	sm_vf_t*	v;
+	int	i;
+	int	j;
+
+	if( rte_pktmbuf_data_len( m ) < sizeof( struct ether_hdr ) ) {
+		return NULL;
+	}
+
+	eh = rte_pktmbuf_mtod( m, struct ether_hdr* );
+	for( i = 0; i < sp->nactive; i++ ) {
+		v = sp->vfs[sp->act[i]];
+		for( j = 0; j < v->nmacs; j++ ) {
+			if( ((v->dir & MIRROR_IN) && is_same_ether_addr( &eh->d_addr, &v->macs[j] )) ||
+				((v->dir & MIRROR_OUT) && is_same_ether_addr( &eh->s_addr, &v->macs[j] )) ) {
+				return v;
+			}
+		}
+	}
+
+	if( sp->nactive == 1 && (sp->vfs[sp->act[0]]->dir & MIRROR_IN) && is_multicast_ether_addr( &eh->d_addr ) ) {
+		return sp->vfs[sp->act[0]];					// broadcast/multicast into the only mirrored vf
+	}
+
+	return NULL;
+}
+
+/*
+	Cut the packet to len bytes, freeing any segments no longer needed.
+*/
+static void truncate_mbuf( struct rte_mbuf* m, uint32_t len ) {
+	struct rte_mbuf*	s;
+	struct rte_mbuf*	prev = NULL;
+	uint32_t	left;
+	uint16_t	nsegs = 0;
+
+	left = len;
+	for( s = m; s != NULL && left > 0; s = s->next ) {
+		if( s->data_len > left ) {
+			s->data_len = left;
+		}
+		left -= s->data_len;
+		prev = s;
+		nsegs++;
+	}
+
+	if( s != NULL && prev != NULL ) {
+		prev->next = NULL;
+		rte_pktmbuf_free( s );
+	}
+
+	m->nb_segs = nsegs;
+	m->pkt_len = len;
+}
+
+/*
+	True if the packet fits under the mirror's rate cap (and takes the tokens).
+*/
+static int under_cap( sm_vf_t* v, uint32_t wire, uint64_t now, double hz ) {
+	if( v->rate <= 0 ) {
+		return 1;
+	}
+
+	v->tokens += (double) (now - v->last_tsc) * v->rate / hz;
+	v->last_tsc = now;
+	if( v->tokens > v->depth ) {
+		v->tokens = v->depth;
+	}
+
+	if( v->tokens < wire ) {
+		return 0;
+	}
+
+	v->tokens -= wire;
+	return 1;
+}
+
+// ------------------------------------------------------------------------------------------
+
+/*
+	Take the mirrored packets out of a burst pulled from the port's PF queue 0 and
+	forward them; the packets which are not mirrored are packed to the front of the
+	array and their count returned. Drain thread only.
+*/
+extern int vfd_smirror_burst( portid_t port, struct rte_mbuf** pkts, int npkts ) {
+	sm_port_t*	sp;
+	sm_vf_t*	v;
+	struct rte_mbuf*	m;
+	struct ether_hdr*	oh;
+	struct rte_mbuf*	tx[npkts];
+	sm_vf_t*	txv[npkts];
+	uint32_t	txlen[npkts];
+	uint64_t	now;
+	double		hz;
+	int	i;
+	int	keep = 0;
+	int	ntx = 0;
+	int	sent;
+
+	if( port >= MAX_PORTS || smp[port].nactive == 0 ) {
+		return npkts;
+	}
+
+	sp = &smp[port];
+	now = rte_rdtsc();
+	hz = (double) rte_get_tsc_hz();
+
+	rte_spinlock_lock( &sp->lock );
+	for( i = 0; i < npkts; i++ ) {
+		m = pkts[i];
+		if( (v = classify( sp, m )) == NULL ) {
+			sp->unmatched++;
+			pkts[keep++] = m;
+			continue;
+		}
+
+		v->seen++;
+		v->seen_bytes += rte_pktmbuf_pkt_len( m );
+		if( v->sample > 1 ) {
+			if( v->nth > 0 ) {
+				v->nth--;
+				v->sampled++;
+				rte_pktmbuf_free( m );
+				continue;
+			}
+			v->nth = v->sample - 1;
+		}
+
+		if( v->pcap ) {
+			if( ! under_cap( v, rte_pktmbuf_pkt_len( m ), now, hz ) ) {
+				v->capped++;
+			} else {
+				if( vfd_pcap_mirror( port, m, v->snaplen ) == 0 ) {
+					v->fwd++;
+					v->fwd_bytes += v->snaplen > 0 && rte_pktmbuf_pkt_len( m ) > v->snaplen ? v->snaplen : rte_pktmbuf_pkt_len( m );
+				} else {
+					v->drops++;
+				}
+			}
+			rte_pktmbuf_free( m );
+			continue;
+		}
+
+		if( v->snaplen > 0 && rte_pktmbuf_pkt_len( m ) > v->snaplen ) {
+			truncate_mbuf( m, v->snaplen );
+		}
+
+		if( m->ol_flags & PKT_RX_VLAN_STRIPPED ) {			// give the target the frame as it was on the wire
+			if( rte_vlan_insert( &m ) != 0 ) {
+				v->drops++;
+				rte_pktmbuf_free( m );
+				continue;
+			}
+		}
+
+		if( ! under_cap( v, rte_pktmbuf_pkt_len( m ) + sizeof( struct ether_hdr ), now, hz ) ) {
+			v->capped++;
+			rte_pktmbuf_free( m );
+			continue;
+		}
+
+		if( (oh = (struct ether_hdr *) rte_pktmbuf_prepend( m, sizeof( struct ether_hdr ) )) == NULL ) {
+			v->drops++;
+			rte_pktmbuf_free( m );
+			continue;
+		}
+		ether_addr_copy( &v->tmac, &oh->d_addr );
+		ether_addr_copy( &sp->pf_mac, &oh->s_addr );
+		oh->ether_type = rte_cpu_to_be_16( SM_ENCAP_ETYPE );
+		m->ol_flags = 0;
+
+		txlen[ntx] = rte_pktmbuf_pkt_len( m );
+		txv[ntx] = v;
+		tx[ntx++] = m;
+	}
+
+	if( ntx > 0 ) {
+		sent = rte_eth_tx_burst( port, 0, tx, ntx );
+		for( i = 0; i < ntx; i++ ) {
+			if( i < sent ) {
+				txv[i]->fwd++;
+				txv[i]->fwd_bytes += txlen[i];
+			} else {
+				txv[i]->drops++;
+				rte_pktmbuf_free( tx[i] );
+			}
+		}
+	}
+	rte_spinlock_unlock( &sp->lock );
+
+	return keep;
+}
+
+/*
+	Returns true if the port has any soft mirrors (its PF queue must be drained).
+*/
+extern int vfd_smirror_active( portid_t port ) {
+	return port < MAX_PORTS && smp[port].nactive > 0;
+}
+
+/*
+	Start or change the soft mirror for the vf from the settings in the mirror block.
+	Returns 0 on success; on failure reason points at a static message and the vf has
+	no soft mirror.
+*/
+extern int vfd_smirror_set( sriov_conf_t* conf, struct sriov_port_s* pf, struct vf_s* vf, struct mirror_s* mirror, const char** reason ) {
+	sm_port_t*	sp;
+	sm_vf_t*	nv;
+	sm_vf_t*	old;
+	struct vf_s*	tvf;
+	int	pn;
+	int	vfid;
+	int	nt;
+	int	pool;
+	int	i;
+
+	*reason = NULL;
+	pn = pf->rte_port_number;
+	vfid = vf->num;
+	if( pn < 0 || pn >= MAX_PORTS ) {
+		*reason = "port is out of range";
+		return -1;
+	}
+	if( vfid < 0 || vfid >= SM_MAX_POOLS ) {
+		*reason = "vf number is too large for software mirroring";
+		return -1;
+	}
+
+	nt = get_nic_type( pn );
+	if( nt == VFD_MLX5 || nt == VFD_SIM ) {
+		*reason = "software mirroring is not supported on this nic";
+		return -1;
+	}
+
+	if( (pool = pf_pool( pn )) < 0 ) {
+		*reason = "unable to determine the pf pool";
+		return -1;
+	}
+
+	if( (nv = (sm_vf_t *) malloc( sizeof( *nv ) )) == NULL ) {
+		*reason = "no memory";
+		return -1;
+	}
+	memset( nv, 0, sizeof( *nv ) );
+
+	if( mirror->pcap ) {
+		if( ! vfd_pcap_enabled() ) {
+			free( nv );
+			*reason = "pf capture is not enabled (pf_capture_dir)";
+			return -1;
+		}
+	} else {
+		if( (tvf = suss_vf( pn, mirror->target )) == NULL || tvf->macs[tvf->first_mac][0] == 0 ) {
+			free( nv );
+			*reason = "target vf is not configured or has no mac address";
+			return -1;
+		}
+		ether_aton_r( tvf->macs[tvf->first_mac], &nv->tmac );
+	}
+
+	for( i = vf->first_mac; i <= vf->num_macs && i < MAX_VF_MACS; i++ ) {
+		if( vf->macs[i][0] != 0 ) {
+			ether_aton_r( vf->macs[i], &nv->macs[nv->nmacs++] );
+		}
+	}
+
+	nv->dir = mirror->dir;
+	nv->target = mirror->target;
+	nv->pcap = mirror->pcap;
+	nv->sample = mirror->sample > 1 ? mirror->sample : 1;
+	nv->snaplen = mirror->snaplen <= 0 ? 0 : (mirror->snaplen < SM_MIN_SNAP ? SM_MIN_SNAP : mirror->snaplen);
+	nv->rate = (double) mirror->mbps * 125000.0;
+	nv->depth = nv->rate * SM_BURST_MS / 1000.0;
+	if( nv->rate > 0 && nv->depth < 65536 ) {
+		nv->depth = 65536;
+	}
+	nv->tokens = nv->depth;
+	nv->last_tsc = rte_rdtsc();
+
+	sp = &smp[pn];
+	rte_spinlock_lock( &sp->lock );
+	if( (old = sp->vfs[vfid]) != NULL ) {					// a change keeps the counters
+		nv->seen = old->seen;
+		nv->seen_bytes = old->seen_bytes;
+		nv->sampled = old->sampled;
+		nv->capped = old->capped;
+		nv->fwd = old->fwd;
+		nv->fwd_bytes = old->fwd_bytes;
+		nv->drops = old->drops;
+	}
+	sp->vfs[vfid] = nv;
+	sp->pool = pool;
+	rte_eth_macaddr_get( pn, &sp->pf_mac );
+	rebuild( sp );
+	rte_spinlock_unlock( &sp->lock );
+	free( old );
+
+	if( apply_rules( conf, pn ) < 0 ) {
+		vfd_smirror_clear( conf, pf, vfid );
+		*reason = "unable to set nic mirror rule for the software mirror";
+		return -1;
+	}
+
+	bleat_printf( 1, "soft mirror set: pf/vf=%d/%d dir=%d target=%s%d sample=1/%u snap=%u mbps=%d pool=%d macs=%d",
+		pn, vfid, nv->dir, nv->pcap ? "pcap " : "vf ", nv->pcap ? pn : nv->target, nv->sample, nv->snaplen, mirror->mbps, pool, nv->nmacs );
+	return 0;
+}
+
+/*
+	Stop the soft mirror for the vf (no-op if there is none).
+*/
+extern void vfd_smirror_clear( sriov_conf_t* conf, struct sriov_port_s* pf, int vfid ) {
+	sm_port_t*	sp;
+	sm_vf_t*	old;
+	int	pn;
+
+	pn = pf->rte_port_number;
+	if( pn < 0 || pn >= MAX_PORTS || vfid < 0 || vfid >= SM_MAX_POOLS ) {
+		return;
+	}
+
+	sp = &smp[pn];
+	rte_spinlock_lock( &sp->lock );
+	old = sp->vfs[vfid];
+	sp->vfs[vfid] = NULL;
+	rebuild( sp );
+	rte_spinlock_unlock( &sp->lock );
+
+	if( old != NULL ) {
+		bleat_printf( 1, "soft mirror cleared: pf/vf=%d/%d seen=%llu fwd=%llu", pn, vfid, (unsigned long long) old->seen, (unsigned long long) old->fwd );
+		free( old );
+		apply_rules( conf, pn );
+	}
+}
+
+/*
+	Drop every soft mirror and the nic rules behind them. Called at shutdown once the
+	drain thread has stopped.
+*/
+extern void vfd_smirror_shutdown( sriov_conf_t* conf ) {
+	sm_port_t*	sp;
+	int	i;
+	int	j;
+
+	for( i = 0; i < MAX_PORTS; i++ ) {
+		sp = &smp[i];
+		if( sp->id_in == 0 && sp->id_out == 0 && sp->nactive == 0 ) {
+			continue;
+		}
+
+		bleat_printf( 0, "terminating soft mirrors on shutdown: pf=%d", i );
+		rte_spinlock_lock( &sp->lock );
+		for( j = 0; j < SM_MAX_POOLS; j++ ) {
+			free( sp->vfs[j] );
+			sp->vfs[j] = NULL;
+		}
+		rebuild( sp );
+		rte_spinlock_unlock( &sp->lock );
+		apply_rules( conf, i );
+	}
+}
+
+/*
+	Format the counters for a soft mirror into buf. Returns the length added (0 if the
+	vf has no soft mirror).
+*/
+extern int vfd_smirror_stats( int port, int vfid, char* buf, int blen ) {
+	sm_vf_t*	v;
+	int	len;
+
+	if( port < 0 || port >= MAX_PORTS || vfid < 0 || vfid >= SM_MAX_POOLS ) {
+		return 0;
+	}
+
+	rte_spinlock_lock( &smp[port].lock );
+	if( (v = smp[port].vfs[vfid]) == NULL ) {
+		rte_spinlock_unlock( &smp[port].lock );
+		return 0;
+	}
+
+	len = snprintf( buf, blen, "    soft: sample=1/%u snap=%u mbps=%.0f seen=%llu fwd=%llu fwd_bytes=%llu sampled=%llu capped=%llu drops=%llu unmatched(pf)=%llu\n",
+		v->sample, v->snaplen, v->rate / 125000.0,
+		(unsigned long long) v->seen, (unsigned long long) v->fwd, (unsigned long long) v->fwd_bytes,
+		(unsigned long long) v->sampled, (unsigned long long) v->capped, (unsigned long long) v->drops,
+		(unsigned long long) smp[port].unmatched );
+	rte_spinlock_unlock( &smp[port].lock );
+
+	return len < blen ? len : blen - 1;
+}
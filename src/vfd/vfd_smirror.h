@@ -0,0 +1,28 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_smirror.h
+	Abstract:	Software port mirroring with sampling, truncation and rate caps.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_SMIRROR_H
+#define _VFD_SMIRROR_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+#define SM_ENCAP_ETYPE		0x88b5		// outer ethertype on frames forwarded to a target vf (ieee local experimental)
+#define SM_MAX_POOLS		64			// nic rules take a 64 bit pool mask; soft mirrored vfs must be below this
+#define SM_BURST_MS			10			// rate cap bucket depth (ms of traffic at the cap)
+#define SM_MIN_SNAP			64			// smallest snap length; keeps at least the l2/l3 headers
+
+// ------------- prototypes ----------------------------------------------
+extern int vfd_smirror_set( sriov_conf_t* conf, struct sriov_port_s* pf, struct vf_s* vf, struct mirror_s* mirror, const char** reason );
+extern void vfd_smirror_clear( sriov_conf_t* conf, struct sriov_port_s* pf, int vfid );
+extern void vfd_smirror_shutdown( sriov_conf_t* conf );
+extern int vfd_smirror_active( portid_t port );
+extern int vfd_smirror_burst( portid_t port, struct rte_mbuf** pkts, int npkts );
+extern int vfd_smirror_stats( int port, int vfid, char* buf, int blen );
+
+#endif
@@ -0,0 +1,620 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_state.c
+	Abstract:	Warm restart. A stop driven by SIGUSR2 leaves the PFs running with
+				the VFs as they were programmed (see close_ports() in main.c) and
+				writes a snapshot of the running configuration: each port's pci id
+				and, for every active VF, the vf_s and mirror_s structs as they are
+				in memory followed by the strings they reference.
+
+				A start which finds a warm snapshot marks the ports PF_WARM before
+				they are initialised (port_init() then skips the resets and counter
+				clears it can), restores the VFs from the snapshot rather than
+				reading the config_live files, and then reads each VF's settings
+				back from the NIC. Settings which differ are fixed item by item by
+				the reconciler (vfd_recon.c) and the VFs are left UNCHANGED so
+				vfd_update_nic() does not touch them. A VF is reset (reprogrammed
+				in full) if it has a mirror, if its NIC settings cannot be read, or
+				if they still differ after the fix. Rates are not verified here as
+				the link speed is not yet known; they are set again when the link
+				is reported.
+
+				The snapshot is used for a warm start only when it was written by a
+				warm stop since the last boot. Once restored it is rewritten as a
+				cold snapshot so that a crash does not lead to a second warm start
+				from stale data.
+
+				The snapshot is also kept for cold starts: it is written (flagged
+				cold) after each request which changes the running config (see
+				vfd_state_tick()), and a start which has no warm snapshot restores
+				from it rather than parsing every config_live file. The vfs are
+				restored as added so vfd_update_nic() programs them as it would
+				after reading the files; a default mac pushed by the guest is not
+				kept, as it would not be from the file. The mac symtab, mirror id
+				allocations and the port qshare sums are rebuilt from the records
+				as they are copied. The file is mapped rather than read.
+
+				A snapshot is used only if it was written by a build with the same
+				struct layout, for the same set of ports, the body checksum matches
+				and the config_live file list (names, sizes, mtimes) has the same
+				signature as when it was written, and every VF (and mirror target)
+				is within the number of VFs now configured on its port. Otherwise
+				it is stale and the config files are read as usual.
+
+	Date:		18 October 2026
+
+	Mods:		18 Oct 2026 - Reject records beyond the port's configured VF count.
+*/
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <inttypes.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_recon.h"
+#include "vfd_state.h"
+
+/*
+	A snapshot mapped from disk. Hdr points into buf.
+*/
+typedef struct vst_snap {
+	char*		buf;
+	size_t		len;
+	vst_hdr_t*	hdr;
+} vst_snap_t;
+
+static volatile int dirty = 0;				// running config changed since the snapshot was written
+
+#define WALK_CHECK	0		// walk() only checks the records
+#define WALK_FIT	1		// also check them against the vfs configured on each port (ports must be initialised)
+#define WALK_APPLY	2		// check, fit, and add the vfs to the config
+
+/*
+	Growable buffer the snapshot is built in before it is written.
+*/
+typedef struct vst_buf {
+	char*	data;
+	size_t	len;
+	size_t	size;
+} vst_buf_t;
+
+/*
+	Fnv-1a; enough to catch a torn or hand edited file.
+*/
+static uint64_t fnv1a64( const char* data, size_t len ) {
+	uint64_t	h = 0xcbf29ce484222325ULL;
+	size_t		i;
+
+	for( i = 0; i < len; i++ ) {
+		h ^= (uint8_t) data[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+/*
+	Fill buf with the kernel's boot id; empty if it cannot be read.
+*/
+static void get_boot_id( char* buf, int blen ) {
+	FILE*	f;
+	char*	cp;
+
+	memset( buf, 0, blen );
+	if( (f = fopen( VST_BOOTID_FILE, "r" )) == NULL ) {
+		return;
+	}
+
+	if( fgets( buf, blen, f ) != NULL ) {
+		if( (cp = strchr( buf, '\n' )) != NULL ) {
+			*cp = 0;
+		}
+	}
+	fclose( f );
+}
+
+/*
+	Build a signature of the config_live directory: the name, size and mtime of
+	each json file. The order of the list does not matter.
+*/
+static uint64_t cfg_signature( parms_t* parms ) {
+	char**	flist;
+	char	wbuf[2048];
+	char	key[2048 + 64];
+	struct stat	st;
+	uint64_t	sig;
+	int		llen = 0;
+	int		klen;
+	int		i;
+
+	if( parms->config_dir == NULL || snprintf( wbuf, sizeof( wbuf ), "%s_live", parms->config_dir ) >= (int) sizeof( wbuf ) ) {
+		return 0;
+	}
+
+	sig = 0;
+	if( (flist = list_files( wbuf, "json", 1, &llen )) != NULL ) {
+		for( i = 0; i < llen; i++ ) {
+			if( stat( flist[i], &st ) == 0 ) {
+				klen = snprintf( key, sizeof( key ), "%s %lld %lld.%09ld", flist[i], (long long) st.st_size,
+					(long long) st.st_mtim.tv_sec, (long) st.st_mtim.tv_nsec );
+				sig += fnv1a64( key, klen < (int) sizeof( key ) ? klen : (int) sizeof( key ) - 1 );
+			}
+		}
+		free_list( flist, llen );
+	}
+
+	return sig + llen;
+}
+
+/*
+	Append len bytes to the buffer. Returns 0 if it could not be grown.
+*/
+static int buf_add( vst_buf_t* b, const void* data, size_t len ) {
+	char*	nd;
+	size_t	nsize;
+
+	if( b->len + len > b->size ) {
+		nsize = b->size ? b->size : 4096;
+		while( b->len + len > nsize ) {
+			nsize *= 2;
+		}
+		if( (nd = (char *) realloc( b->data, nsize )) == NULL ) {
+			return 0;
+		}
+		b->data = nd;
+		b->size = nsize;
+	}
+
+	memcpy( b->data + b->len, data, len );
+	b->len += len;
+	return 1;
+}
+
+/*
+	Return the index of the port with the pci id, or -1.
+*/
+static int find_port( sriov_conf_t* conf, const char* pciid ) {
+	int i;
+
+	for( i = 0; i < conf->num_ports; i++ ) {
+		if( strcmp( conf->ports[i].pciid, pciid ) == 0 ) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*
+	Add one vf record from the snapshot to the port. The record and its strings were
+	vetted by walk(). Mirror ids are reserved in the allocator so a later add does not
+	get one which is in use; macs are mapped so duplicate checks on the pf work. On a
+	cold restore the vf is flagged as added, with the state vfd_add_vf() would give it.
+*/
+static void restore_vf( sriov_conf_t* conf, struct sriov_port_s* port, vst_vf_t* vv, char** strs, int warm ) {
+	struct vf_s*		vf;
+	struct mirror_s*	mir;
+	int	vidx;
+
+	vidx = port->num_vfs++;
+	vf = &port->vfs[vidx];
+	*vf = vv->vf;
+	vf->start_cb = vv->slen[0] ? strndup( strs[0], vv->slen[0] ) : NULL;
+	vf->stop_cb = vv->slen[1] ? strndup( strs[1], vv->slen[1] ) : NULL;
+	vf->config_name = vv->slen[2] ? strndup( strs[2], vv->slen[2] ) : strdup( "missing" );
+	if( warm ) {
+		vf->last_updated = UNCHANGED;						// verify decides what must be reset
+	} else {
+		vf->last_updated = ADDED;							// nic was reset; program it all
+		vf->first_mac = 1;									// a mac pushed by the guest came after the config
+		vf->default_mac_set = 0;
+		vf->rx_q_ready = 0;
+	}
+
+	mir = &port->mirrors[vidx];
+	*mir = vv->mirror;
+	if( mir->dir == MIRROR_OFF ) {
+		mir->target = MAX_VFS + 1;							// target is unsigned -- make high
+	} else {
+		if( ! mir->soft ) {
+			idm_use( conf->mir_id_mgr, mir->id );
+		}
+	}
+
+	map_macs( port->rte_port_number, vf );
+	qs_add_vf( port, vf );
+}
+
+/*
+	Run the snapshot body checking that it describes the ports we have and that each
+	record is sane. How is a WALK_ constant; with WALK_APPLY the vfs are added to the config as they are
+	passed. Returns NULL if all is well, else a reason.
+*/
+static const char* walk( vst_snap_t* snap, sriov_conf_t* conf, int how, int warm ) {
+	vst_port_t*	vp;
+	vst_vf_t*	vv;
+	char*		strs[VST_NSTRS];
+	char*		cp;
+	char*		end;
+	int			seen[MAX_PORTS];
+	uint32_t	p;
+	int			pidx;
+	int			i;
+	int			j;
+
+	if( snap->hdr->nports != (uint32_t) conf->num_ports ) {
+		return "port count differs from the configuration";
+	}
+
+	memset( seen, 0, sizeof( seen ) );
+	cp = snap->buf + sizeof( vst_hdr_t );
+	end = cp + snap->hdr->body_len;
+	for( p = 0; p < snap->hdr->nports; p++ ) {
+		if( cp + sizeof( vst_port_t ) > end ) {
+			return "truncated port record";
+		}
+		vp = (vst_port_t *) cp;
+		cp += sizeof( vst_port_t );
+
+		vp->pciid[sizeof( vp->pciid ) - 1] = 0;
+		if( (pidx = find_port( conf, vp->pciid )) < 0 || seen[pidx] ) {
+			return "port list differs from the configuration";
+		}
+		seen[pidx] = 1;
+		if( vp->num_vfs < 0 || vp->num_vfs > MAX_VFS ) {
+			return "bad vf count";
+		}
+
+		for( i = 0; i < vp->num_vfs; i++ ) {
+			if( cp + sizeof( vst_vf_t ) > end ) {
+				return "truncated vf record";
+			}
+			vv = (vst_vf_t *) cp;
+			cp += sizeof( vst_vf_t );
+
+			if( vv->vf.num < 0 || vv->vf.num >= MAX_VFS || vv->vf.num_vlans < 0 || vv->vf.num_vlans > MAX_VF_VLANS ||
+				vv->vf.num_macs < 0 || vv->vf.num_macs >= MAX_VF_MACS || vv->vf.first_mac < 0 || vv->vf.first_mac > 1 ) {
+				return "vf record out of range";
+			}
+			if( how != WALK_CHECK && (vv->vf.num >= conf->ports[pidx].nvfs_config ||
+				(vv->mirror.dir != MIRROR_OFF && ! vv->mirror.pcap && vv->mirror.target >= conf->ports[pidx].nvfs_config)) ) {
+				return "stale: vf or mirror target beyond the VFs configured on the port";		// pf was recreated with fewer vfs
+			}
+
+			for( j = 0; j < VST_NSTRS; j++ ) {
+				if( cp + vv->slen[j] > end ) {
+					return "truncated string";
+				}
+				strs[j] = cp;
+				cp += vv->slen[j];
+			}
+
+			if( how == WALK_APPLY ) {
+				restore_vf( conf, &conf->ports[pidx], vv, strs, warm );
+			}
+		}
+	}
+
+	if( cp != end ) {
+		return "unexpected data after the last record";
+	}
+
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------
+
+/*
+	Write the snapshot of the running config. Warm is set when the nic is being
+	left programmed for the next start. Returns 1 on success, 0 on failure.
+*/
+extern int vfd_state_save( parms_t* parms, sriov_conf_t* conf, int warm ) {
+	vst_buf_t	b;
+	vst_hdr_t	hdr;
+	vst_port_t	vp;
+	vst_vf_t	vv;
+	struct sriov_port_s* port;
+	struct vf_s* vf;
+	const char*	strs[VST_NSTRS];
+	char		tname[1024];
+	FILE*		f;
+	int			nvfs = 0;
+	int			i;
+	int			y;
+	int			j;
+	int			ok;
+
+	if( parms == NULL || conf == NULL || parms->state_file == NULL || *parms->state_file == 0 ) {
+		return 0;
+	}
+
+	memset( &b, 0, sizeof( b ) );
+	memset( &hdr, 0, sizeof( hdr ) );
+	ok = buf_add( &b, &hdr, sizeof( hdr ) );				// placeholder; filled in once the body is known
+
+	rte_spinlock_lock( &conf->update_lock );
+	for( i = 0; ok && i < conf->num_ports; i++ ) {
+		port = &conf->ports[i];
+		memset( &vp, 0, sizeof( vp ) );
+		strncpy( vp.pciid, port->pciid, sizeof( vp.pciid ) - 1 );
+		for( y = 0; y < port->num_vfs; y++ ) {
+			if( port->vfs[y].num >= 0 ) {
+				vp.num_vfs++;
+			}
+		}
+		ok = buf_add( &b, &vp, sizeof( vp ) );
+
+		for( y = 0; ok && y < port->num_vfs; y++ ) {
+			vf = &port->vfs[y];
+			if( vf->num < 0 ) {
+				continue;
+			}
+
+			memset( &vv, 0, sizeof( vv ) );
+			vv.vf = *vf;
+			vv.vf.start_cb = vv.vf.stop_cb = vv.vf.config_name = NULL;
+			vv.mirror = port->mirrors[y];
+			strs[0] = vf->start_cb;
+			strs[1] = vf->stop_cb;
+			strs[2] = vf->config_name;
+			for( j = 0; j < VST_NSTRS; j++ ) {
+				vv.slen[j] = strs[j] != NULL && strlen( strs[j] ) <= UINT16_MAX ? strlen( strs[j] ) : 0;
+			}
+
+			ok = buf_add( &b, &vv, sizeof( vv ) );
+			for( j = 0; ok && j < VST_NSTRS; j++ ) {
+				if( vv.slen[j] > 0 ) {
+					ok = buf_add( &b, strs[j], vv.slen[j] );
+				}
+			}
+			nvfs++;
+		}
+	}
+	rte_spinlock_unlock( &conf->update_lock );
+
+	if( ! ok ) {
+		bleat_printf( 0, "WRN: state: unable to allocate snapshot buffer" );
+		free( b.data );
+		return 0;
+	}
+
+	hdr.magic = VST_MAGIC;
+	hdr.version = VST_VERSION;
+	hdr.vf_size = sizeof( struct vf_s );
+	hdr.mirror_size = sizeof( struct mirror_s );
+	hdr.flags = warm ? VST_WARM : 0;
+	hdr.nports = conf->num_ports;
+	hdr.created = (int64_t) time( NULL );
+	get_boot_id( hdr.boot_id, sizeof( hdr.boot_id ) );
+	hdr.cfg_sig = cfg_signature( parms );
+	hdr.body_len = b.len - sizeof( hdr );
+	hdr.cksum = fnv1a64( b.data + sizeof( hdr ), hdr.body_len );
+	memcpy( b.data, &hdr, sizeof( hdr ) );
+
+	snprintf( tname, sizeof( tname ), "%s.new", parms->state_file );
+	if( (f = fopen( tname, "w" )) == NULL ) {
+		bleat_printf( 0, "WRN: state: unable to open snapshot for writing: %s: %s", tname, strerror( errno ) );
+		free( b.data );
+		return 0;
+	}
+
+	ok = fwrite( b.data, b.len, 1, f ) == 1 && fflush( f ) == 0 && fsync( fileno( f ) ) == 0;
+	if( fclose( f ) != 0 || ! ok || rename( tname, parms->state_file ) != 0 ) {
+		bleat_printf( 0, "WRN: state: unable to write snapshot: %s: %s", parms->state_file, strerror( errno ) );
+		unlink( tname );
+		free( b.data );
+		return 0;
+	}
+
+	bleat_printf( 2, "state: %s snapshot written: %s ports=%d vfs=%d bytes=%d", warm ? "warm" : "cold", parms->state_file, conf->num_ports, nvfs, (int) b.len );
+	free( b.data );
+	return 1;
+}
+
+/*
+	Map and vet the snapshot. Warm is set if the snapshot was written by a warm stop
+	since the last boot (the nic was left programmed); a warm snapshot from before a
+	reboot is used as a cold one. Returns a handle to pass to restore, or NULL if
+	there is no usable snapshot (the reason is logged).
+*/
+extern void* vfd_state_read( parms_t* parms, sriov_conf_t* conf, int* warm ) {
+	vst_snap_t*	snap;
+	struct stat	st;
+	char		boot_id[VST_BOOTID_LEN];
+	const char*	reason = NULL;
+	void*		addr;
+	int			fd;
+
+	*warm = 0;
+	if( parms == NULL || conf == NULL || parms->state_file == NULL || *parms->state_file == 0 ) {
+		return NULL;
+	}
+
+	if( (fd = open( parms->state_file, O_RDONLY )) < 0 ) {
+		bleat_printf( 1, "state: no snapshot: %s: %s", parms->state_file, strerror( errno ) );
+		return NULL;
+	}
+
+	if( fstat( fd, &st ) != 0 || st.st_size < (off_t) sizeof( vst_hdr_t ) ) {
+		bleat_printf( 0, "WRN: state: snapshot not used: %s: %s", parms->state_file, "too short" );
+		close( fd );
+		return NULL;
+	}
+
+	addr = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );		// private: walk() terminates strings in place
+	close( fd );
+	if( addr == MAP_FAILED ) {
+		bleat_printf( 0, "WRN: state: snapshot not used: %s: %s", parms->state_file, strerror( errno ) );
+		return NULL;
+	}
+
+	if( (snap = (vst_snap_t *) malloc( sizeof( *snap ) )) == NULL ) {
+		munmap( addr, st.st_size );
+		return NULL;
+	}
+	snap->buf = (char *) addr;
+	snap->len = st.st_size;
+	snap->hdr = (vst_hdr_t *) snap->buf;
+
+	if( snap->hdr->magic != VST_MAGIC || snap->hdr->version != VST_VERSION ) {
+		reason = "not a snapshot, or written by a different version";
+	} else if( snap->hdr->vf_size != sizeof( struct vf_s ) || snap->hdr->mirror_size != sizeof( struct mirror_s ) ) {
+		reason = "written by a build with a different layout";
+	} else if( snap->hdr->body_len != snap->len - sizeof( vst_hdr_t ) ) {
+		reason = "length mismatch";
+	} else if( snap->hdr->cksum != fnv1a64( snap->buf + sizeof( vst_hdr_t ), snap->hdr->body_len ) ) {
+		reason = "checksum mismatch";
+	} else if( snap->hdr->cfg_sig != cfg_signature( parms ) ) {
+		reason = "stale: config_live files changed since it was written";
+	} else {
+		reason = walk( snap, conf, WALK_CHECK, 0 );			// vf counts are not known until the ports are initialised
+	}
+
+	if( reason != NULL ) {
+		bleat_printf( 0, "WRN: state: snapshot not used: %s: %s", parms->state_file, reason );
+		vfd_state_free( snap );
+		return NULL;
+	}
+
+	if( snap->hdr->flags & VST_WARM ) {
+		get_boot_id( boot_id, sizeof( boot_id ) );
+		snap->hdr->boot_id[VST_BOOTID_LEN - 1] = 0;
+		if( *boot_id != 0 && strcmp( boot_id, snap->hdr->boot_id ) == 0 ) {
+			*warm = 1;
+		} else {
+			bleat_printf( 1, "state: warm snapshot was written before the last boot; used for a cold start" );
+		}
+	}
+
+	bleat_printf( 1, "state: %s snapshot accepted: %s written %" PRId64, *warm ? "warm" : "cold", parms->state_file, snap->hdr->created );
+	return snap;
+}
+
+/*
+	Add the vfs in the snapshot to the configuration. Must be called after the
+	ports are initialised (rte port numbers and vf counts known). Warm is the value
+	returned by vfd_state_read(). Returns the number of vfs restored, VST_STALE if
+	the snapshot no longer fits the ports (nothing was added; the caller should read
+	the config files), or -1 on error.
+*/
+extern int vfd_state_restore( void* vsnap, sriov_conf_t* conf, int warm ) {
+	vst_snap_t*	snap;
+	const char*	reason;
+	int	n = 0;
+	int	i;
+
+	if( (snap = (vst_snap_t *) vsnap) == NULL || conf == NULL ) {
+		return -1;
+	}
+
+	if( (reason = walk( snap, conf, WALK_FIT, warm )) != NULL ) {
+		bleat_printf( 0, "WRN: state: snapshot not used: %s", reason );
+		return VST_STALE;
+	}
+
+	rte_spinlock_lock( &conf->update_lock );
+	reason = walk( snap, conf, WALK_APPLY, warm );
+	rte_spinlock_unlock( &conf->update_lock );
+
+	if( reason != NULL ) {
+		bleat_printf( 0, "ERR: state: restore failed: %s", reason );
+		return -1;
+	}
+
+	for( i = 0; i < conf->num_ports; i++ ) {
+		n += conf->ports[i].num_vfs;
+	}
+	bleat_printf( 1, "state: %d vfs restored from snapshot", n );
+	return n;
+}
+
+/*
+	Compare the restored vfs on warm ports with the nic, fixing the items which
+	differ, and mark for reset those which cannot be checked or fixed. Returns the
+	number marked.
+*/
+extern int vfd_state_verify( parms_t* parms, sriov_conf_t* conf ) {
+	struct sriov_port_s* port;
+	struct vf_s*	vf;
+	const char*	reason;
+	char	ibuf[128];
+	int	bits;
+	int	left;
+	int	i;
+	int	y;
+	int	nvfs = 0;
+	int	nfixed = 0;
+	int	nreset = 0;
+
+	if( conf == NULL ) {
+		return 0;
+	}
+
+	for( i = 0; i < conf->num_ports; i++ ) {
+		port = &conf->ports[i];
+		if( ! (port->flags & PF_WARM) ) {
+			continue;
+		}
+
+		for( y = 0; y < port->num_vfs; y++ ) {
+			vf = &port->vfs[y];
+			if( vf->num < 0 ) {
+				continue;
+			}
+			nvfs++;
+
+			reason = NULL;
+			if( port->mirrors[y].dir != MIRROR_OFF ) {
+				reason = "mirror is re-established";						// close_ports() tore it down
+			} else if( (bits = vfd_recon_vf( parms, port, vf, 1, &left )) < 0 ) {
+				reason = "nic settings cannot be read";
+			} else if( left != 0 ) {
+				reason = "settings still differ after fix";
+			} else if( bits != 0 ) {
+				nfixed++;
+				bleat_printf( 1, "state: warm start: pf=%d vf=%d fixed: %s", port->rte_port_number, vf->num, vfd_recon_items( bits, ibuf, sizeof( ibuf ) ) );
+			}
+
+			if( reason != NULL ) {
+				vf->last_updated = RESET;
+				nreset++;
+				bleat_printf( 1, "state: warm start: pf=%d vf=%d will be reprogrammed: %s", port->rte_port_number, vf->num, reason );
+			}
+		}
+	}
+
+	bleat_printf( 0, "state: warm start: %d vfs: %d matched the nic, %d fixed in place, %d reset", nvfs, nvfs - nfixed - nreset, nfixed, nreset );
+	return nreset;
+}
+
+/*
+	Note that the running config changed; the snapshot is rewritten on the next tick.
+*/
+extern void vfd_state_changed( void ) {
+	dirty = 1;
+}
+
+/*
+	Called from the main loop after requests are processed; rewrites the (cold)
+	snapshot if the config changed. A failed write is tried again on the next change.
+*/
+extern void vfd_state_tick( parms_t* parms, sriov_conf_t* conf ) {
+	if( ! dirty || parms == NULL || ! parms->forreal ) {
+		return;
+	}
+
+	dirty = 0;
+	vfd_state_save( parms, conf, 0 );
+}
+
+extern void vfd_state_free( void* vsnap ) {
+	vst_snap_t*	snap;
+
+	if( (snap = (vst_snap_t *) vsnap) != NULL ) {
+		munmap( snap->buf, snap->len );
+		free( snap );
+	}
+}
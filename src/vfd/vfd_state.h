@@ -0,0 +1,64 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_state.h
+	Abstract:	Snapshot of the running configuration used to restart (warm or cold)
+				without parsing the config_live files.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_STATE_H
+#define _VFD_STATE_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+#define VST_MAGIC		0x56464453		// "VFDS"
+#define VST_VERSION		2
+#define VST_WARM		0x01			// header flag: written by a warm stop, the nic was left programmed
+#define VST_BOOTID_LEN	40
+#define VST_BOOTID_FILE	"/proc/sys/kernel/random/boot_id"
+#define VST_NSTRS		3				// strings kept with each vf: start_cb, stop_cb, config_name
+#define VST_STALE		(-2)			// vfd_state_restore(): snapshot does not fit the ports; nothing restored
+
+/*
+	File header. The body is a vst_port_t for each port, each followed by the
+	vst_vf_t records for its active vfs; each vf record is followed by its strings.
+	A snapshot written by a build whose structs differ in size, or when the config_live
+	files were different (cfg_sig), is not used.
+*/
+typedef struct vst_hdr {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	vf_size;					// sizeof( struct vf_s ) when written
+	uint32_t	mirror_size;				// sizeof( struct mirror_s ) when written
+	uint32_t	flags;						// VST_ constants
+	uint32_t	nports;
+	int64_t		created;
+	char		boot_id[VST_BOOTID_LEN];	// a warm snapshot from before a reboot describes a nic that was reset
+	uint64_t	cfg_sig;					// signature of the config_live file list when written
+	uint64_t	body_len;
+	uint64_t	cksum;						// fnv-1a of the body
+} vst_hdr_t;
+
+typedef struct vst_port {
+	char		pciid[64];
+	int32_t		num_vfs;					// vst_vf_t records which follow
+} vst_port_t;
+
+typedef struct vst_vf {
+	struct vf_s		vf;						// pointers are written as nil; the strings follow the record
+	struct mirror_s	mirror;
+	uint16_t		slen[VST_NSTRS];		// length of each string (0 == nil)
+} vst_vf_t;
+
+// ------------- prototypes ----------------------------------------------
+extern int vfd_state_save( parms_t* parms, sriov_conf_t* conf, int warm );
+extern void* vfd_state_read( parms_t* parms, sriov_conf_t* conf, int* warm );
+extern int vfd_state_restore( void* vsnap, sriov_conf_t* conf, int warm );
+extern int vfd_state_verify( parms_t* parms, sriov_conf_t* conf );
+extern void vfd_state_changed( void );
+extern void vfd_state_tick( parms_t* parms, sriov_conf_t* conf );
+extern void vfd_state_free( void* vsnap );
+
+#endif
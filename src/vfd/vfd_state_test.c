@@ -0,0 +1,236 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_state_test.c
+	Abstract:	Unit test for the state snapshot format (vfd_state.c). A snapshot is
+				written from a small config, then damaged in various ways and read
+				back; each damaged copy must be refused:
+					- truncated file, and truncated body with a matching length/checksum
+					- bad checksum
+					- bytes after the last record
+					- different version or struct layout
+					- config_live files changed since it was written
+					- a vf, or a mirror target, beyond the port's configured vf count
+
+				The source is included so the static checksum function can be used to
+				reseal a damaged body. The few vfd functions restore calls are stubbed.
+				Run from a scratch directory; vfd_state_test.snap and vfd_state_test.d_live
+				are created there and removed on success.
+
+	Date:		18 October 2026
+*/
+
+#include "vfd_state.c"
+
+#define SNAP_FILE	"vfd_state_test.snap"
+#define CFG_DIR		"vfd_state_test.d"			// cfg_signature() lists <dir>_live
+
+static sriov_conf_t	conf;
+static parms_t		parms;
+static int			errors = 0;
+
+// ---- stubs for what restore calls outside of vfd_state.c -------------------------
+extern int map_macs( __attribute__((__unused__)) int port, __attribute__((__unused__)) struct vf_s* vf ) {
+	return 0;
+}
+
+void qs_add_vf( __attribute__((__unused__)) sriov_port_t* port, __attribute__((__unused__)) struct vf_s* vf ) {
+	return;
+}
+
+extern int vfd_recon_vf( __attribute__((__unused__)) parms_t* parms, __attribute__((__unused__)) struct sriov_port_s* port, __attribute__((__unused__)) struct vf_s* vf, __attribute__((__unused__)) int apply, __attribute__((__unused__)) int* left ) {
+	return 0;
+}
+
+extern const char* vfd_recon_items( __attribute__((__unused__)) int bits, char* buf, __attribute__((__unused__)) int blen ) {
+	*buf = 0;
+	return buf;
+}
+
+// ----------------------------------------------------------------------------------
+
+static void check( int ok, const char* what ) {
+	fprintf( stderr, "[%s] %s\n", ok ? "OK" : "FAIL", what );
+	if( ! ok ) {
+		errors++;
+	}
+}
+
+/*
+	Reset the config to one port with nvfs vfs configured on the nic and no vfs added.
+*/
+static void mk_conf( int nvfs ) {
+	memset( &conf, 0, sizeof( conf ) );
+	conf.num_ports = 1;
+	conf.mir_id_mgr = mk_idm( 128 );
+	strcpy( conf.ports[0].pciid, "0000:01:00.0" );
+	conf.ports[0].rte_port_number = 0;
+	conf.ports[0].nvfs_config = nvfs;
+}
+
+static void add_vf( int num, int mir_target ) {
+	sriov_port_t*	port;
+	int		vidx;
+
+	port = &conf.ports[0];
+	vidx = port->num_vfs++;
+	port->vfs[vidx].num = num;
+	port->vfs[vidx].first_mac = 1;
+	port->vfs[vidx].config_name = strdup( "vf-config" );
+	if( mir_target >= 0 ) {
+		port->mirrors[vidx].dir = MIRROR_IN;
+		port->mirrors[vidx].target = mir_target;
+	} else {
+		port->mirrors[vidx].dir = MIRROR_OFF;
+		port->mirrors[vidx].target = MAX_VFS + 1;
+	}
+}
+
+/*
+	Load the snapshot file into a buffer; caller frees.
+*/
+static char* load( size_t* len ) {
+	struct stat	st;
+	char*	buf;
+	FILE*	f;
+
+	if( stat( SNAP_FILE, &st ) != 0 || (buf = (char *) malloc( st.st_size + 64 )) == NULL ) {
+		return NULL;
+	}
+	if( (f = fopen( SNAP_FILE, "r" )) == NULL ) {
+		free( buf );
+		return NULL;
+	}
+	*len = fread( buf, 1, st.st_size, f );
+	fclose( f );
+
+	return buf;
+}
+
+/*
+	Write buf as the snapshot. If reseal is set the body length and checksum are
+	recomputed so that only the damage in the body itself can be caught.
+*/
+static void store( char* buf, size_t len, int reseal ) {
+	vst_hdr_t*	hdr;
+	FILE*	f;
+
+	hdr = (vst_hdr_t *) buf;
+	if( reseal ) {
+		hdr->body_len = len - sizeof( *hdr );
+		hdr->cksum = fnv1a64( buf + sizeof( *hdr ), hdr->body_len );
+	}
+
+	if( (f = fopen( SNAP_FILE, "w" )) != NULL ) {
+		fwrite( buf, 1, len, f );
+		fclose( f );
+	}
+}
+
+/*
+	Read the snapshot and, if accepted, restore it into a fresh config with nvfs
+	vfs configured on the port. Returns the restore result, or -100 if read refused
+	the snapshot.
+*/
+static int read_restore( int nvfs ) {
+	void*	snap;
+	int		warm;
+	int		rc;
+
+	mk_conf( nvfs );
+	if( (snap = vfd_state_read( &parms, &conf, &warm )) == NULL ) {
+		return -100;
+	}
+	rc = vfd_state_restore( snap, &conf, warm );
+	vfd_state_free( snap );
+
+	return rc;
+}
+
+int main( __attribute__((__unused__)) int argc, __attribute__((__unused__)) char** argv ) {
+	char*	good;
+	char*	buf;
+	char	cfname[256];
+	size_t	glen;
+	FILE*	f;
+	int		rc;
+
+	bleat_set_lvl( 1 );
+	memset( &parms, 0, sizeof( parms ) );
+	parms.state_file = strdup( SNAP_FILE );
+	parms.config_dir = strdup( CFG_DIR );
+	mkdir( CFG_DIR "_live", 0755 );
+
+	mk_conf( 4 );
+	add_vf( 0, -1 );
+	add_vf( 3, 0 );
+	check( vfd_state_save( &parms, &conf, 0 ) == 1, "snapshot written" );
+	if( (good = load( &glen )) == NULL ) {
+		fprintf( stderr, "[FAIL] unable to load the snapshot; remaining tests skipped\n" );
+		exit( 1 );
+	}
+
+	rc = read_restore( 4 );
+	check( rc == 2, "intact snapshot is restored" );
+	check( conf.ports[0].num_vfs == 2 && conf.ports[0].vfs[1].num == 3 && conf.ports[0].mirrors[1].target == 0 &&
+		conf.ports[0].vfs[1].config_name != NULL && strcmp( conf.ports[0].vfs[1].config_name, "vf-config" ) == 0, "restored vfs match those saved" );
+
+	store( good, glen - 8, 0 );
+	check( read_restore( 4 ) == -100, "truncated file is refused" );
+
+	buf = (char *) malloc( glen + 16 );							// damaged copies are made here; good is never resealed
+	memcpy( buf, good, glen );
+	store( buf, sizeof( vst_hdr_t ) + sizeof( vst_port_t ) + (sizeof( vst_vf_t ) / 2), 1 );
+	check( read_restore( 4 ) == -100, "truncated body with a matching length and checksum is refused" );
+
+	memcpy( buf, good, glen );
+	buf[sizeof( vst_hdr_t ) + 2] ^= 0x5a;									// pci id of the port
+	store( buf, glen, 0 );
+	check( read_restore( 4 ) == -100, "bad checksum is refused" );
+
+	memcpy( buf, good, glen );
+	memset( buf + glen, 0, 16 );
+	store( buf, glen + 16, 1 );
+	check( read_restore( 4 ) == -100, "trailing bytes after the last record are refused" );
+
+	memcpy( buf, good, glen );
+	((vst_hdr_t *) buf)->version++;
+	store( buf, glen, 1 );
+	check( read_restore( 4 ) == -100, "different version is refused" );
+
+	memcpy( buf, good, glen );
+	((vst_hdr_t *) buf)->vf_size += 8;
+	store( buf, glen, 1 );
+	check( read_restore( 4 ) == -100, "different struct layout is refused" );
+
+	store( good, glen, 0 );
+	snprintf( cfname, sizeof( cfname ), "%s_live/vf.json", CFG_DIR );
+	if( (f = fopen( cfname, "w" )) != NULL ) {
+		fprintf( f, "{ }\n" );
+		fclose( f );
+	}
+	check( read_restore( 4 ) == -100, "snapshot is stale once a config_live file is added" );
+	unlink( cfname );
+	check( read_restore( 4 ) == 2, "snapshot is current again once the config_live file is gone" );
+
+	rc = read_restore( 3 );
+	check( rc == VST_STALE && conf.ports[0].num_vfs == 0, "vf past the port's vf count makes the snapshot stale; nothing restored" );
+
+	mk_conf( 4 );
+	add_vf( 0, 2 );
+	add_vf( 1, -1 );
+	vfd_state_save( &parms, &conf, 0 );
+	rc = read_restore( 2 );
+	check( rc == VST_STALE && conf.ports[0].num_vfs == 0, "mirror target equal to the port's vf count makes the snapshot stale" );
+	check( read_restore( 3 ) == 2, "mirror target within the port's vf count is restored" );
+
+	free( buf );
+	free( good );
+	if( errors == 0 ) {
+		unlink( SNAP_FILE );
+		rmdir( CFG_DIR "_live" );
+	}
+
+	fprintf( stderr, "%d failures\n", errors );
+	exit( errors != 0 );
+}
@@ -0,0 +1,365 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_throttle.c
+	Abstract:	Noisy neighbour detection. When enabled (throttle_itvl in the parm
+				file) the tx packet, byte and drop counters of each VF are sampled
+				every interval. A VF which is over any of the configured thresholds
+				(throttle_pps, throttle_mbps, throttle_drops) for throttle_window
+				consecutive samples is given a temporary rate limit of throttle_rate
+				percent of link speed. Once the VF has stayed under half of the
+				throttle rate and half of each threshold for throttle_calm samples
+				the configured rate limit (or none) is put back.
+
+				A throttle is never looser than the configured rate; if the VF is
+				already limited below the throttle rate it is left alone. While a
+				VF is throttled the rebalancer does not touch it, and when the
+				throttle is lifted the rebalancer starts again from the configured
+				values. If update_nic reprograms a throttled VF (a reset) the
+				throttle is reapplied so that a reset cannot be used to escape it.
+
+				Not every nic can limit a VF's rate (set_vf_rate_limit() is a no-op
+				on FVL25 and bnxt). Noisy VFs on those are reported as 'nolimit'
+				rather than throttled.
+
+				Passes run from the main loop under the update lock. Every action
+				is logged at level 0 and the state can be seen with 'show throttled'.
+
+	Date:		18 October 2026
+
+	Mods:		18 Oct 2026 - Don't mark VFs throttled on nics which cannot rate limit.
+*/
+
+#include <time.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_rebal.h"
+#include "vfd_throttle.h"
+
+/*
+	Throttle state for one VF.
+*/
+typedef struct thr_vf {
+	int			active;			// baseline sample has been taken
+	int			throttled;		// temporary rate limit is in place
+	int			nolimit;		// noisy, but the nic cannot rate limit
+	int			over;			// consecutive samples over a threshold
+	int			calm;			// consecutive calm samples while throttled
+	int			why;			// THR_ flags which tripped the last throttle
+	uint64_t	opackets;		// counters at the last sample
+	uint64_t	obytes;
+	uint64_t	drops;
+	uint64_t	pps;			// rates from the last sample
+	uint64_t	mbps;
+	uint64_t	dps;
+	double		rate;			// throttle rate applied (fraction of link)
+	time_t		since;			// time throttled
+	uint32_t	nthrottles;		// number of times throttled
+} thr_vf_t;
+
+static thr_vf_t	tstate[MAX_PORTS][MAX_VFS];
+static uint64_t	last_pass = 0;			// usec (monotonic) of the last pass
+static int		nthrottled = 0;			// number of vfs currently throttled
+
+static uint64_t thr_now( void ) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*
+	Returns true if the nic behind the port can actually apply a vf rate limit;
+	set_vf_rate_limit() quietly does nothing (and reports success) on the others.
+*/
+static int thr_can_limit( int pn ) {
+	switch( get_nic_type( pn ) ) {
+		case VFD_NIANTIC:
+		case VFD_MLX5:
+		case VFD_SIM:
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+
+/*
+	Returns the THR_ flags for each threshold exceeded. Thresholds are
+	scaled by frac so the same check gives the calm test.
+*/
+static int thr_over( parms_t* parms, thr_vf_t* ts, double frac ) {
+	int flags = 0;
+
+	if( parms->thr_pps > 0 && ts->pps > parms->thr_pps * frac ) {
+		flags |= THR_PPS;
+	}
+	if( parms->thr_mbps > 0 && ts->mbps > parms->thr_mbps * frac ) {
+		flags |= THR_BPS;
+	}
+	if( parms->thr_drops > 0 && ts->dps > parms->thr_drops * frac ) {
+		flags |= THR_DROPS;
+	}
+
+	return flags;
+}
+
+/*
+	Build a human readable list of the THR_ flags.
+*/
+static char* thr_why( int why, char* buf, int len ) {
+	snprintf( buf, len, "%s%s%s", why & THR_PPS ? "pps " : "", why & THR_BPS ? "mbps " : "", why & THR_DROPS ? "drops " : "" );
+	return buf;
+}
+
+/*
+	Sample and evaluate one port.
+*/
+static void throttle_port( parms_t* parms, struct sriov_port_s* port, uint64_t elapsed ) {
+	struct rte_eth_link link;
+	struct rte_eth_stats stats;
+	struct vf_s*	vf;
+	thr_vf_t*	ts;
+	uint64_t	drops;
+	double		secs;
+	double		thr_rate;
+	char		wbuf[64];
+	int			pn;
+	int			i;
+
+	pn = port->rte_port_number;
+	if( pn < 0 || pn >= MAX_PORTS ) {
+		return;
+	}
+
+	vfd_link_get( pn, &link );
+	if( ! link.link_status || link.link_speed == 0 ) {
+		return;
+	}
+
+	secs = (double) elapsed / 1000000.0;
+	thr_rate = (double) parms->thr_rate / 100.0;
+	for( i = 0; i < port->num_vfs; i++ ) {
+		vf = &port->vfs[i];
+		if( vf->num < 0 || vf->num >= MAX_VFS || vf->last_updated == DELETED ) {
+			continue;
+		}
+
+		ts = &tstate[pn][vf->num];
+		if( get_vf_stats( pn, vf->num, &stats ) != 0 ) {
+			continue;
+		}
+
+		drops = stats.imissed + stats.ierrors + stats.oerrors;
+		if( ! ts->active || stats.opackets < ts->opackets || stats.obytes < ts->obytes || drops < ts->drops ) {	// first sample or counters reset
+			ts->active = 1;
+			ts->over = ts->calm = 0;
+			ts->opackets = stats.opackets;
+			ts->obytes = stats.obytes;
+			ts->drops = drops;
+			continue;
+		}
+
+		ts->pps = (uint64_t) ((double) (stats.opackets - ts->opackets) / secs);
+		ts->mbps = (uint64_t) (((double) (stats.obytes - ts->obytes) * 8.0) / (double) elapsed);
+		ts->dps = (uint64_t) ((double) (drops - ts->drops) / secs);
+		ts->opackets = stats.opackets;
+		ts->obytes = stats.obytes;
+		ts->drops = drops;
+
+		if( ! ts->throttled ) {
+			if( (ts->why = thr_over( parms, ts, 1.0 )) == 0 ) {
+				ts->over = 0;
+				ts->nolimit = 0;
+				continue;
+			}
+
+			if( ++ts->over < parms->thr_window ) {
+				continue;
+			}
+
+			if( ! thr_can_limit( pn ) ) {
+				bleat_printf( ts->nolimit ? 2 : 0, "WRN: throttle: pf=%d vf=%d is noisy (%s) but the nic cannot rate limit it", pn, vf->num,
+					thr_why( ts->why, wbuf, sizeof( wbuf ) ) );
+				ts->nolimit = 1;
+				ts->over = 0;
+				continue;
+			}
+
+			if( vf->rate > 0 && vf->rate <= thr_rate ) {			// already held to less than we would throttle to
+				bleat_printf( 2, "throttle: pf=%d vf=%d is noisy (%s) but rate is already limited to %.0f%%", pn, vf->num,
+					thr_why( ts->why, wbuf, sizeof( wbuf ) ), vf->rate * 100.0 );
+				ts->over = 0;
+				continue;
+			}
+
+			if( set_vf_rate_limit( pn, vf->num, (uint16_t) ((double) link.link_speed * thr_rate), 0x01 ) == 0 ) {
+				ts->throttled = 1;
+				ts->rate = thr_rate;
+				ts->calm = 0;
+				ts->since = time( NULL );
+				ts->nthrottles++;
+				nthrottled++;
+				bleat_printf( 0, "throttle: pf=%d vf=%d throttled to %d%% of link: %s(pps=%lld mbps=%lld drops/s=%lld over %d samples)",
+					pn, vf->num, parms->thr_rate, thr_why( ts->why, wbuf, sizeof( wbuf ) ),
+					(long long) ts->pps, (long long) ts->mbps, (long long) ts->dps, ts->over );
+			} else {
+				bleat_printf( 0, "WRN: throttle: pf=%d vf=%d could not be throttled", pn, vf->num );
+				ts->over = 0;
+			}
+		} else {
+			if( ts->mbps < (uint64_t) ((double) link.link_speed * ts->rate * THR_CALM_FRAC) && thr_over( parms, ts, THR_CALM_FRAC ) == 0 ) {
+				ts->calm++;
+			} else {
+				ts->calm = 0;
+			}
+
+			if( ts->calm >= parms->thr_calm ) {
+				if( set_vf_rate_limit( pn, vf->num, (uint16_t) ((double) link.link_speed * vf->rate), 0x01 ) == 0 ) {	// rate of 0 removes the limit
+					bleat_printf( 0, "throttle: pf=%d vf=%d released after %ds; rate limit restored to %.0f%%",
+						pn, vf->num, (int) (time( NULL ) - ts->since), vf->rate * 100.0 );
+					ts->throttled = 0;
+					ts->over = ts->calm = 0;
+					nthrottled--;
+					vfd_rebal_reset( pn, vf->num );
+				}
+			}
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------
+
+/*
+	Called from the main loop on each spin; makes a pass once every thr_itvl
+	seconds when throttling is enabled and at least one threshold is set.
+*/
+extern void vfd_throttle_tick( parms_t* parms, sriov_conf_t* conf ) {
+	uint64_t	now;
+	uint64_t	elapsed;
+	int			i;
+
+	if( parms == NULL || conf == NULL || parms->thr_itvl <= 0 || ! parms->forreal || (parms->rflags & RF_INITIALISED) == 0 ) {
+		return;
+	}
+	if( parms->thr_pps == 0 && parms->thr_mbps == 0 && parms->thr_drops == 0 ) {
+		return;
+	}
+
+	now = thr_now();
+	elapsed = now - last_pass;
+	if( elapsed < (uint64_t) parms->thr_itvl * 1000000 ) {
+		return;
+	}
+	last_pass = now;
+
+	rte_spinlock_lock( &conf->update_lock );
+	for( i = 0; i < conf->num_ports; i++ ) {
+		throttle_port( parms, &conf->ports[i], elapsed );
+	}
+	rte_spinlock_unlock( &conf->update_lock );
+}
+
+/*
+	Returns true if the vf is currently throttled.
+*/
+extern int vfd_throttle_active( int port, int vf ) {
+	if( port < 0 || port >= MAX_PORTS || vf < 0 || vf >= MAX_VFS ) {
+		return 0;
+	}
+
+	return tstate[port][vf].throttled;
+}
+
+/*
+	Called by update_nic after it has programmed the configured rates for a vf.
+	If the vf is throttled the throttle rate is put back. Caller holds the
+	update lock.
+*/
+extern void vfd_throttle_reapply( int port, int vf, uint32_t link_speed ) {
+	thr_vf_t*	ts;
+
+	if( ! vfd_throttle_active( port, vf ) || link_speed == 0 ) {
+		return;
+	}
+
+	ts = &tstate[port][vf];
+	bleat_printf( 1, "throttle: pf=%d vf=%d reconfigured while throttled; throttle reapplied", port, vf );
+	set_vf_rate_limit( port, vf, (uint16_t) ((double) link_speed * ts->rate), 0x01 );
+}
+
+/*
+	Drop all state for a vf (deleted). The next pass takes a fresh baseline.
+*/
+extern void vfd_throttle_reset( int port, int vf ) {
+	if( port < 0 || port >= MAX_PORTS || vf < 0 || vf >= MAX_VFS ) {
+		return;
+	}
+
+	if( tstate[port][vf].throttled ) {
+		nthrottled--;
+	}
+	memset( &tstate[port][vf], 0, sizeof( tstate[port][vf] ) );
+}
+
+/*
+	Generate a buffer listing the vfs which are throttled, or close to it.
+	Caller must free.
+*/
+extern char* vfd_throttle_show( parms_t* parms, sriov_conf_t* conf ) {
+	struct sriov_port_s* port;
+	struct vf_s*	vf;
+	thr_vf_t*	ts;
+	char*	buf;
+	char	wbuf[64];
+	int		bsize;
+	int		blen;
+	int		i;
+	int		y;
+	int		pn;
+	time_t	now;
+
+	bsize = BUF_1K;
+	for( i = 0; i < conf->num_ports; i++ ) {
+		bsize += conf->ports[i].num_vfs * 160;
+	}
+	if( (buf = (char *) malloc( sizeof( char ) * bsize )) == NULL ) {
+		return NULL;
+	}
+
+	now = time( NULL );
+	blen = snprintf( buf, bsize, "\nthrottle: %s  interval=%ds  window=%d  calm=%d  rate=%d%%  pps>%lld  mbps>%lld  drops/s>%lld  throttled=%d\n",
+		parms->thr_itvl > 0 ? "enabled" : "disabled", parms->thr_itvl, parms->thr_window, parms->thr_calm, parms->thr_rate,
+		(long long) parms->thr_pps, (long long) parms->thr_mbps, (long long) parms->thr_drops, nthrottled );
+	blen += snprintf( buf + blen, bsize - blen, "%4s %4s %10s %12s %10s %10s %8s %6s  %s\n",
+		"pf", "vf", "state", "pps", "mbps", "drops/s", "secs", "count", "reason" );
+
+	for( i = 0; i < conf->num_ports && blen < bsize; i++ ) {
+		port = &conf->ports[i];
+		pn = port->rte_port_number;
+		if( pn < 0 || pn >= MAX_PORTS ) {
+			continue;
+		}
+
+		for( y = 0; y < port->num_vfs && blen < bsize; y++ ) {
+			vf = &port->vfs[y];
+			if( vf->num < 0 || vf->num >= MAX_VFS ) {
+				continue;
+			}
+
+			ts = &tstate[pn][vf->num];
+			if( ! ts->throttled && ! ts->nolimit && ts->over == 0 && ts->nthrottles == 0 ) {		// only list the interesting ones
+				continue;
+			}
+
+			blen += snprintf( buf + blen, bsize - blen, "%4d %4d %10s %12lld %10lld %10lld %8d %6u  %s\n",
+				pn, vf->num, ts->throttled ? "throttled" : ts->nolimit ? "nolimit" : ts->over > 0 ? "noisy" : "released",
+				(long long) ts->pps, (long long) ts->mbps, (long long) ts->dps,
+				ts->throttled ? (int) (now - ts->since) : 0, ts->nthrottles, thr_why( ts->why, wbuf, sizeof( wbuf ) ) );
+		}
+	}
+
+	return buf;
+}
@@ -0,0 +1,28 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_throttle.h
+	Abstract:	Noisy neighbour detection and temporary per-VF throttling.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_THROTTLE_H
+#define _VFD_THROTTLE_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+#define THR_CALM_FRAC	0.5			// a throttled vf is calm when under this fraction of the throttle rate and thresholds
+
+#define THR_PPS			0x01		// threshold(s) which tripped the throttle
+#define THR_BPS			0x02
+#define THR_DROPS		0x04
+
+// ------------- prototypes ----------------------------------------------
+extern void vfd_throttle_tick( parms_t* parms, sriov_conf_t* conf );
+extern int vfd_throttle_active( int port, int vf );
+extern void vfd_throttle_reapply( int port, int vf, uint32_t link_speed );
+extern void vfd_throttle_reset( int port, int vf );
+extern char* vfd_throttle_show( parms_t* parms, sriov_conf_t* conf );
+
+#endif
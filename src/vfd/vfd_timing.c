@@ -0,0 +1,469 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_timing.c
+	Abstract:	Lightweight latency instrumentation for the operations in the sriov.c
+				dispatch layer (and the qos credit writes). Each operation is timed
+				with the TSC and the count, total, max and a log2 bucketed histogram
+				are kept for each port. The intent is to be able to see which NIC
+				operations (admin queue calls, register writes, HWRM messages, shell
+				outs) dominate the time it takes to add a VF.
+
+				Requests received from iplex are traced through each phase of their
+				processing (receipt, parse, config, nic update, response) along with
+				the time spent waiting on the update lock. The last VT_NTRACES traces
+				are kept, and a histogram of each phase is kept for each request type
+				so that percentiles can be reported. Requests are processed only by
+				the main thread, so the trace itself needs no locking.
+
+				Counters are updated with atomic adds as the dispatch functions are
+				driven from the main thread, the refresh queue thread and the dpdk
+				callback thread. Reads for show and reset are not synchronised; a
+				show which races an update might be off by one, which is fine.
+
+	Date:		18 October 2026
+
+	Mods:		18 Oct 2026 - Add request tracing.
+				18 Oct 2026 - Use the shared vfd_add_str() to build show output.
+				18 Oct 2026 - No blank lines in the trace output; clients take one as the end of the response.
+				18 Oct 2026 - Allow the TSC rate to be measured when the eal is not initialised.
+*/
+
+#include <time.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_timing.h"
+
+/*
+	Stats for one operation on one port. Times are kept in TSC cycles and
+	converted when displayed; the histogram is in usec so the bucket is
+	computed at capture.
+*/
+typedef struct vt_op {
+	uint64_t	count;					// number of calls
+	uint64_t	total;					// total cycles
+	uint64_t	max;					// longest single call (cycles)
+	uint64_t	hist[VT_NBUCKETS];		// log2 usec buckets
+} vt_op_t;
+
+static vt_op_t	timings[MAX_PORTS][VT_NOPS];
+static uint64_t	tsc_hz = 0;				// cycles per second; fetched on first use as eal must be initialised
+
+typedef struct req_trace {
+	char		id[VT_IDLEN];			// request id supplied by the requestor, or generated
+	int			rtype;					// RT_ constant
+	int			state;					// state of the last response sent (RESP_ const)
+	time_t		when;					// time the request was received
+	uint64_t	start;					// tsc when the fifo read started
+	uint64_t	last;					// tsc of the most recent mark
+	uint64_t	phase[VTP_NPHASES];		// cycles spent in each phase
+} req_trace_t;
+
+static req_trace_t	traces[VT_NTRACES];	// ring of completed traces
+static uint64_t		ntraces = 0;		// total completed; next insert is ntraces % VT_NTRACES
+static uint64_t		req_seq = 0;		// used to generate request ids when one isn't supplied
+static req_trace_t	cur_trace;			// request in progress
+static __thread req_trace_t* active = NULL;	// set only for the thread processing the request
+
+static uint64_t		act_count[VT_MAX_RTYPES];
+static uint64_t		act_hist[VT_MAX_RTYPES][VTP_NPHASES][VT_NBUCKETS];
+
+static uint64_t		regw[MAX_PORTS];	// qos credit register writes for each port
+
+static const char* rt_names[VT_MAX_RTYPES] = {
+	"nop", "add", "delete", "show", "ping", "verbose", "dump", "mirror", "flight", "tcbw", "reconcile"
+};
+
+static const char* phase_names[VTP_NPHASES] = {
+	"recv", "parse", "config", "nic", "work", "resp", "lock", "total"
+};
+
+static const char* op_names[VT_NOPS] = {
+	"link_status", "min_rate", "rate_limit", "vlan_insert", "cvlan_insert", "vlan_strip",
+	"cvlan_strip", "allow_bcast", "allow_mcast", "allow_un_ucast", "allow_untagged", "rx_mac",
+	"default_mac", "rx_vlan", "vlan_antispoof", "mac_antispoof", "loopback", "mirror",
+	"split_erop", "queue_drop", "qos_credits", "tcqos"
+};
+
+// -----------------------------------------------------------------------------------------------------------
+
+/*
+	Convert cycles to microseconds.
+*/
+static inline uint64_t cyc2us( uint64_t cycles ) {
+	if( tsc_hz == 0 ) {
+		if( (tsc_hz = rte_get_tsc_hz()) == 0 ) {
+			return 0;
+		}
+	}
+
+	return (cycles * 1000000) / tsc_hz;
+}
+
+/*
+	Return the bucket for a latency in usec.
+*/
+static inline int us2bucket( uint64_t us ) {
+	int b = 0;
+
+	while( us > 0 && b < VT_NBUCKETS - 1 ) {
+		us >>= 1;
+		b++;
+	}
+
+	return b;
+}
+
+/*
+	Return the upper bound (usec) of the bucket which contains the pct (0-100)
+	percentile. Coarse, but that is the nature of a log2 histogram.
+*/
+static uint64_t hist_pctl( uint64_t* hist, uint64_t count, int pct ) {
+	uint64_t	target;
+	uint64_t	cum = 0;
+	int	b;
+
+	if( count == 0 ) {
+		return 0;
+	}
+
+	target = ((count * pct) + 99) / 100;
+	for( b = 0; b < VT_NBUCKETS; b++ ) {
+		cum += hist[b];
+		if( cum >= target ) {
+			return (uint64_t) 1 << b;
+		}
+	}
+
+	return (uint64_t) 1 << (VT_NBUCKETS - 1);
+}
+
+// -----------------------------------------------------------------------------------------------------------
+
+/*
+	Set the TSC rate by measuring it against the monotonic clock rather than asking
+	the eal. Used when the eal is not initialised (the benchmark); otherwise the rate
+	is fetched on first use. Takes about 10ms.
+*/
+extern void vfd_timing_calibrate( void ) {
+	struct timespec	ts;
+	struct timespec	te;
+	uint64_t	c0;
+	uint64_t	ns;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	c0 = rte_rdtsc();
+	do {
+		clock_gettime( CLOCK_MONOTONIC, &te );
+		ns = ((uint64_t) (te.tv_sec - ts.tv_sec) * 1000000000) + te.tv_nsec - ts.tv_nsec;
+	} while( ns < 10000000 );
+
+	tsc_hz = ((rte_rdtsc() - c0) * 1000000000) / ns;
+}
+
+/*
+	Record one operation for port which started at the given TSC value (from
+	vfd_timing_start()).
+*/
+extern void vfd_timing_add( int port, int op, uint64_t start ) {
+	vt_op_t*	vo;
+	uint64_t	elapsed;
+	uint64_t	cmax;
+
+	elapsed = rte_rdtsc() - start;
+	if( port < 0 || port >= MAX_PORTS || op < 0 || op >= VT_NOPS ) {
+		return;
+	}
+
+	vo = &timings[port][op];
+	__sync_fetch_and_add( &vo->count, 1 );
+	__sync_fetch_and_add( &vo->total, elapsed );
+	__sync_fetch_and_add( &vo->hist[us2bucket( cyc2us( elapsed ) )], 1 );
+
+	while( (cmax = vo->max) < elapsed ) {
+		if( __sync_bool_compare_and_swap( &vo->max, cmax, elapsed ) ) {
+			break;
+		}
+	}
+}
+
+/*
+	Count n register writes made to program qos credits on the port.
+*/
+extern void vfd_timing_regw( int port, int n ) {
+	if( port < 0 || port >= MAX_PORTS ) {
+		return;
+	}
+
+	__sync_fetch_and_add( &regw[port], n );
+}
+
+/*
+	Return the number of credit register writes counted for the port.
+*/
+extern uint64_t vfd_timing_get_regw( int port ) {
+	if( port < 0 || port >= MAX_PORTS ) {
+		return 0;
+	}
+
+	return regw[port];
+}
+
+/*
+	Clear all timing information.
+*/
+extern void vfd_timing_reset( void ) {
+	memset( timings, 0, sizeof( timings ) );
+	memset( regw, 0, sizeof( regw ) );
+	bleat_printf( 1, "operation timings reset" );
+}
+
+/*
+	Generate a human readable summary of the timings for all ports which have
+	had at least one timed operation. Times are in microseconds; p50/p99 are
+	the upper bounds of the histogram buckets they fall into. The nonzero
+	buckets follow as upper-bound:count pairs. Caller must free the buffer;
+	nil is returned on allocation error.
+*/
+extern char* vfd_timing_show( void ) {
+	char*	buf;
+	char	wbuf[1024];
+	int		bsize = 4096;
+	int		blen = 0;
+	int		wlen;
+	int		p;
+	int		o;
+	int		b;
+	int		hdr;
+	vt_op_t*	vo;
+
+	if( (buf = (char *) malloc( sizeof( char ) * bsize )) == NULL ) {
+		return NULL;
+	}
+	*buf = 0;
+
+	buf = vfd_add_str( buf, &bsize, &blen, "\n" );
+	for( p = 0; buf != NULL && p < MAX_PORTS; p++ ) {
+		hdr = 0;
+		for( o = 0; buf != NULL && o < VT_NOPS; o++ ) {
+			vo = &timings[p][o];
+			if( vo->count == 0 ) {
+				continue;
+			}
+
+			if( ! hdr ) {
+				snprintf( wbuf, sizeof( wbuf ), "port %d:\n  %-16s %10s %12s %10s %10s %8s %8s  histogram(us<=:n)\n",
+					p, "operation", "count", "total_us", "avg_us", "max_us", "p50", "p99" );
+				buf = vfd_add_str( buf, &bsize, &blen, wbuf );
+				hdr = 1;
+			}
+
+			wlen = snprintf( wbuf, sizeof( wbuf ), "  %-16s %10lld %12lld %10lld %10lld %8lld %8lld ",
+				op_names[o], (long long) vo->count, (long long) cyc2us( vo->total ), (long long) cyc2us( vo->total / vo->count ),
+				(long long) cyc2us( vo->max ), (long long) hist_pctl( vo->hist, vo->count, 50 ), (long long) hist_pctl( vo->hist, vo->count, 99 ) );
+
+			for( b = 0; b < VT_NBUCKETS && wlen < (int) sizeof( wbuf ) - 32; b++ ) {
+				if( vo->hist[b] > 0 ) {
+					wlen += snprintf( wbuf + wlen, sizeof( wbuf ) - wlen, " %lld:%lld", (long long) 1 << b, (long long) vo->hist[b] );
+				}
+			}
+			snprintf( wbuf + wlen, sizeof( wbuf ) - wlen, "\n" );
+
+			if( buf != NULL ) {
+				buf = vfd_add_str( buf, &bsize, &blen, wbuf );
+			}
+		}
+
+		if( buf != NULL && hdr && regw[p] > 0 ) {
+			snprintf( wbuf, sizeof( wbuf ), "  qos credit register writes: %lld\n", (long long) regw[p] );
+			buf = vfd_add_str( buf, &bsize, &blen, wbuf );
+		}
+	}
+
+	if( buf != NULL && blen < 2 ) {
+		buf = vfd_add_str( buf, &bsize, &blen, "no operations have been timed\n" );
+	}
+
+	return buf;
+}
+
+// ---------------- request tracing --------------------------------------------------------------------------
+
+/*
+	Start tracing a request. Start is the tsc captured before the fifo read, and
+	recvd is the tsc captured once the read returned data.
+*/
+extern void vfd_trace_begin( uint64_t start, uint64_t recvd ) {
+	memset( &cur_trace, 0, sizeof( cur_trace ) );
+	cur_trace.when = time( NULL );
+	cur_trace.start = start;
+	cur_trace.last = recvd;
+	cur_trace.phase[VTP_RECV] = recvd - start;
+	cur_trace.rtype = RT_NOP;
+
+	active = &cur_trace;
+}
+
+/*
+	Set the request type and id. If id is nil, or empty, one is generated.
+*/
+extern void vfd_trace_set( int rtype, const char* id ) {
+	if( active == NULL ) {
+		return;
+	}
+
+	active->rtype = rtype;
+	if( id != NULL && *id ) {
+		snprintf( active->id, sizeof( active->id ), "%s", id );
+	} else {
+		snprintf( active->id, sizeof( active->id ), "vfd-%lld", (long long) ++req_seq );
+	}
+}
+
+/*
+	Charge the time since the last mark to the given phase.
+*/
+extern void vfd_trace_mark( int phase ) {
+	uint64_t now;
+
+	if( active == NULL || phase < 0 || phase >= VTP_LOCK ) {
+		return;
+	}
+
+	now = rte_rdtsc();
+	active->phase[phase] += now - active->last;
+	active->last = now;
+}
+
+/*
+	Save the state of the response sent.
+*/
+extern void vfd_trace_state( int state ) {
+	if( active != NULL ) {
+		active->state = state;
+	}
+}
+
+/*
+	Return the id of the request being processed, or nil if there isn't one.
+*/
+extern const char* vfd_trace_id( void ) {
+	if( active == NULL || ! *active->id ) {
+		return NULL;
+	}
+
+	return active->id;
+}
+
+/*
+	Finish the trace for the current request; add it to the ring and the
+	aggregate histograms.
+*/
+extern void vfd_trace_end( void ) {
+	int	i;
+	int	rt;
+
+	if( active == NULL ) {
+		return;
+	}
+
+	vfd_trace_mark( VTP_WORK );									// anything since the response counts as work
+	active->phase[VTP_TOTAL] = active->last - active->start;
+
+	rt = active->rtype;
+	if( rt >= 0 && rt < VT_MAX_RTYPES ) {
+		act_count[rt]++;
+		for( i = 0; i < VTP_NPHASES; i++ ) {
+			act_hist[rt][i][us2bucket( cyc2us( active->phase[i] ) )]++;
+		}
+	}
+
+	memcpy( &traces[ntraces % VT_NTRACES], active, sizeof( *active ) );
+	ntraces++;
+
+	bleat_printf( 2, "request trace: id=%s type=%d total=%lldus parse=%lldus config=%lldus nic=%lldus lock=%lldus resp=%lldus",
+		active->id, rt, (long long) cyc2us( active->phase[VTP_TOTAL] ), (long long) cyc2us( active->phase[VTP_PARSE] ),
+		(long long) cyc2us( active->phase[VTP_CONFIG] ), (long long) cyc2us( active->phase[VTP_NIC] ),
+		(long long) cyc2us( active->phase[VTP_LOCK] ), (long long) cyc2us( active->phase[VTP_RESP] ) );
+
+	active = NULL;
+}
+
+/*
+	Lock the update lock, charging the time waiting for it to the request being
+	processed if the caller is the request processing thread.
+*/
+extern void vfd_trace_lock( rte_spinlock_t* lock ) {
+	uint64_t start;
+
+	if( active == NULL ) {
+		rte_spinlock_lock( lock );
+		return;
+	}
+
+	start = rte_rdtsc();
+	rte_spinlock_lock( lock );
+	active->phase[VTP_LOCK] += rte_rdtsc() - start;
+}
+
+/*
+	Generate a human readable summary of the request traces: p50/p90/p99 for
+	each phase by request type, followed by the most recent traces (newest
+	first). Times are in microseconds. Caller must free; nil returned on
+	allocation error.
+*/
+extern char* vfd_trace_show( void ) {
+	char*	buf;
+	char	wbuf[1024];
+	int		bsize = 4096;
+	int		blen = 0;
+	int		wlen;
+	int		rt;
+	int		i;
+	uint64_t	n;
+	req_trace_t* t;
+
+	if( (buf = (char *) malloc( sizeof( char ) * bsize )) == NULL ) {
+		return NULL;
+	}
+	*buf = 0;
+
+	buf = vfd_add_str( buf, &bsize, &blen, "\nrequest phase latency (us) p50/p90/p99:\n" );
+	for( rt = 0; buf != NULL && rt < VT_MAX_RTYPES; rt++ ) {
+		if( act_count[rt] == 0 ) {
+			continue;
+		}
+
+		wlen = snprintf( wbuf, sizeof( wbuf ), "  %-8s %6lld ", rt_names[rt] ? rt_names[rt] : "unknown", (long long) act_count[rt] );
+		for( i = 0; i < VTP_NPHASES && wlen < (int) sizeof( wbuf ) - 48; i++ ) {
+			wlen += snprintf( wbuf + wlen, sizeof( wbuf ) - wlen, " %s=%lld/%lld/%lld", phase_names[i],
+				(long long) hist_pctl( act_hist[rt][i], act_count[rt], 50 ),
+				(long long) hist_pctl( act_hist[rt][i], act_count[rt], 90 ),
+				(long long) hist_pctl( act_hist[rt][i], act_count[rt], 99 ) );
+		}
+		snprintf( wbuf + wlen, sizeof( wbuf ) - wlen, "\n" );
+		buf = vfd_add_str( buf, &bsize, &blen, wbuf );
+	}
+
+	if( buf != NULL ) {
+		snprintf( wbuf, sizeof( wbuf ), "last %d requests (newest first):\n  %-24s %-8s %5s %10s %8s %8s %8s %8s %8s %8s %8s %10s\n",
+			ntraces < VT_NTRACES ? (int) ntraces : VT_NTRACES, "id", "type", "state", "received", "recv", "parse", "config", "nic", "work", "resp", "lock", "total" );
+		buf = vfd_add_str( buf, &bsize, &blen, wbuf );
+	}
+
+	for( n = 0; buf != NULL && n < ntraces && n < VT_NTRACES; n++ ) {
+		t = &traces[(ntraces - n - 1) % VT_NTRACES];
+		snprintf( wbuf, sizeof( wbuf ), "  %-24s %-8s %5s %10lld %8lld %8lld %8lld %8lld %8lld %8lld %8lld %10lld\n",
+			t->id, (t->rtype >= 0 && t->rtype < VT_MAX_RTYPES && rt_names[t->rtype]) ? rt_names[t->rtype] : "unknown",
+			t->state == RESP_OK ? "ok" : "err", (long long) t->when,
+			(long long) cyc2us( t->phase[VTP_RECV] ), (long long) cyc2us( t->phase[VTP_PARSE] ),
+			(long long) cyc2us( t->phase[VTP_CONFIG] ), (long long) cyc2us( t->phase[VTP_NIC] ),
+			(long long) cyc2us( t->phase[VTP_WORK] ), (long long) cyc2us( t->phase[VTP_RESP] ),
+			(long long) cyc2us( t->phase[VTP_LOCK] ), (long long) cyc2us( t->phase[VTP_TOTAL] ) );
+		buf = vfd_add_str( buf, &bsize, &blen, wbuf );
+	}
+
+	return buf;
+}
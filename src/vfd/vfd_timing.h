@@ -0,0 +1,80 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_timing.h
+	Abstract:	Per operation latency instrumentation for the NIC dispatch layer, and
+				per request (iplex) phase tracing.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_TIMING_H
+#define _VFD_TIMING_H
+
+#include <rte_cycles.h>
+
+#define VT_LINK_STATUS		0			// operations which are timed (index into the stats)
+#define VT_MIN_RATE			1
+#define VT_RATE_LIMIT		2
+#define VT_VLAN_INSERT		3
+#define VT_CVLAN_INSERT		4
+#define VT_VLAN_STRIP		5
+#define VT_CVLAN_STRIP		6
+#define VT_ALLOW_BCAST		7
+#define VT_ALLOW_MCAST		8
+#define VT_ALLOW_UN_UCAST	9
+#define VT_ALLOW_UNTAGGED	10
+#define VT_RX_MAC			11
+#define VT_DEFAULT_MAC		12
+#define VT_RX_VLAN			13
+#define VT_VLAN_ANTISPOOF	14
+#define VT_MAC_ANTISPOOF	15
+#define VT_LOOPBACK			16
+#define VT_MIRROR			17
+#define VT_SPLIT_EROP		18
+#define VT_QUEUE_DROP		19
+#define VT_QOS_CREDITS		20
+#define VT_TCQOS			21
+#define VT_NOPS				22			// number of operations; must be last
+
+#define VT_NBUCKETS			24			// log2 usec buckets: 0 is < 1us, n is [2^(n-1), 2^n) us; last catches all beyond
+
+#define VTP_RECV			0			// request trace phases
+#define VTP_PARSE			1			// json parse (vfd_read_request)
+#define VTP_CONFIG			2			// vf config read/validate (add/del)
+#define VTP_NIC				3			// nic update (vfd_update_nic)
+#define VTP_WORK			4			// anything else before the response (show generation, dump, etc.)
+#define VTP_RESP			5			// response write
+#define VTP_LOCK			6			// time waiting on the update lock (included in config/nic)
+#define VTP_TOTAL			7			// receipt through response
+#define VTP_NPHASES			8
+
+#define VT_NTRACES			128			// number of request traces kept
+#define VT_MAX_RTYPES		16			// request types (RT_ consts) that are aggregated
+#define VT_IDLEN			64			// max request id length (including end of string)
+
+/*
+	Start a timing; the value returned is passed to vfd_timing_add() when the
+	operation has finished.
+*/
+static inline uint64_t vfd_timing_start( void ) {
+	return rte_rdtsc();
+}
+
+// ------------------ prototypes ---------------------------------------------
+extern void vfd_timing_calibrate( void );
+extern void vfd_timing_add( int port, int op, uint64_t start );
+extern void vfd_timing_reset( void );
+extern void vfd_timing_regw( int port, int n );
+extern uint64_t vfd_timing_get_regw( int port );
+extern char* vfd_timing_show( void );
+
+extern void vfd_trace_begin( uint64_t start, uint64_t recvd );
+extern void vfd_trace_set( int rtype, const char* id );
+extern void vfd_trace_mark( int phase );
+extern void vfd_trace_state( int state );
+extern const char* vfd_trace_id( void );
+extern void vfd_trace_end( void );
+extern void vfd_trace_lock( rte_spinlock_t* lock );
+extern char* vfd_trace_show( void );
+
+#endif
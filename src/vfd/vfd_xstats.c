@@ -0,0 +1,267 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_xstats.c
+	Abstract:	Extended (xstats) PF statistics. The xstats names for a port are
+				fixed once the port is started, so they are fetched once (at port
+				initialisation) and the ids of the stats which match the configured
+				filter (xstats_filter, a comma separated list of name prefixes) are
+				kept. A show or dump then fetches only those values by id rather
+				than fetching all names and all values and throwing most away.
+
+				If a fetch by id fails (driver reset the list) the map is rebuilt
+				once and the fetch retried.
+
+				All access is from the main thread (port init, request handling)
+				so the cache is not locked.
+
+	Date:		18 October 2026
+*/
+
+#include <inttypes.h>
+
+#include <vfdlib.h>		// if vfdlib.h needs an include it must be included there, can't be include prior
+#include "sriov.h"
+#include "vfd_rif.h"
+#include "vfd_xstats.h"
+
+/*
+	The cached map for one port. Names and values are parallel to ids.
+*/
+typedef struct xcache {
+	int		valid;						// map has been built
+	int		n;							// number of selected stats
+	uint64_t*	ids;					// the xstats ids of the selected stats
+	struct rte_eth_xstat_name* names;	// and their names
+	uint64_t*	values;					// values from the last fetch
+} xcache_t;
+
+static xcache_t xcache[RTE_MAX_ETHPORTS];
+static char* xfilter = NULL;			// our copy of the filter; used if we must rebuild a map
+
+// -----------------------------------------------------------------------------------------------------------
+
+/*
+	Returns true if name matches one of the prefixes in the filter. A filter of
+	"*" or an empty filter matches all names.
+*/
+static int selected( const char* filter, const char* name ) {
+	const char*	tok;
+	const char*	end;
+	int		tlen;
+
+	if( filter == NULL || *filter == 0 || strcmp( filter, "*" ) == 0 ) {
+		return 1;
+	}
+
+	for( tok = filter; tok != NULL && *tok; tok = *end ? end + 1 : NULL ) {
+		while( *tok == ' ' ) {
+			tok++;
+		}
+		if( (end = strchr( tok, ',' )) == NULL ) {
+			end = tok + strlen( tok );
+		}
+		tlen = end - tok;
+		while( tlen > 0 && tok[tlen-1] == ' ' ) {
+			tlen--;
+		}
+
+		if( tlen > 0 && strncmp( name, tok, tlen ) == 0 ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+	Drop the map for a port.
+*/
+static void clear_map( xcache_t* xc ) {
+	free( xc->ids );
+	free( xc->names );
+	free( xc->values );
+	memset( xc, 0, sizeof( *xc ) );
+}
+
+/*
+	Fetch the selected values for the port into the cache, building the map
+	if it is not valid or if the fetch by id fails (once). Returns 0 on
+	success, -1 on error.
+*/
+static int fetch( portid_t port ) {
+	xcache_t*	xc;
+	int			tries;
+
+	if( port >= RTE_MAX_ETHPORTS ) {
+		return -1;
+	}
+
+	xc = &xcache[port];
+	for( tries = 0; tries < 2; tries++ ) {
+		if( ! xc->valid && vfd_xstats_init( NULL, port ) < 0 ) {
+			return -1;
+		}
+
+		if( xc->n == 0 ) {
+			return 0;
+		}
+
+		if( rte_eth_xstats_get_by_id( port, xc->ids, xc->values, xc->n ) == xc->n ) {
+			return 0;
+		}
+
+		bleat_printf( 1, "xstats: fetch by id failed for port %d; rebuilding the id map", port );
+		xc->valid = 0;
+	}
+
+	bleat_printf( 0, "WRN: xstats: unable to fetch extended stats for port: %d", port );
+	return -1;
+}
+
+// -----------------------------------------------------------------------------------------------------------
+
+/*
+	Build (rebuild) the name/id map for the port. Parms may be nil when
+	rebuilding; the filter from the last call with parms is used. Returns
+	the number of selected stats, or -1 on error.
+*/
+extern int vfd_xstats_init( parms_t* parms, portid_t port ) {
+	xcache_t*	xc;
+	struct rte_eth_xstat_name*	all;
+	int		nall;
+	int		i;
+	int		j;
+
+	if( port >= RTE_MAX_ETHPORTS ) {
+		return -1;
+	}
+
+	if( parms != NULL && parms->xstats_filter != NULL ) {
+		if( xfilter == NULL || strcmp( xfilter, parms->xstats_filter ) != 0 ) {
+			free( xfilter );
+			xfilter = strdup( parms->xstats_filter );
+		}
+	}
+
+	xc = &xcache[port];
+	clear_map( xc );
+
+	if( (nall = rte_eth_xstats_get_names( port, NULL, 0 )) < 0 ) {
+		bleat_printf( 0, "WRN: xstats: unable to get count of xstats for port: %d", port );
+		return -1;
+	}
+
+	if( nall == 0 ) {
+		xc->valid = 1;
+		return 0;
+	}
+
+	if( (all = (struct rte_eth_xstat_name *) malloc( sizeof( *all ) * nall )) == NULL ) {
+		bleat_printf( 0, "WRN: xstats: unable to allocate memory for xstat names for port: %d", port );
+		return -1;
+	}
+
+	if( rte_eth_xstats_get_names( port, all, nall ) != nall ) {
+		bleat_printf( 0, "WRN: xstats: unable to get xstat names for port: %d", port );
+		free( all );
+		return -1;
+	}
+
+	xc->ids = (uint64_t *) malloc( sizeof( *xc->ids ) * nall );				// size for all; we don't know how many match
+	xc->values = (uint64_t *) malloc( sizeof( *xc->values ) * nall );
+	xc->names = (struct rte_eth_xstat_name *) malloc( sizeof( *xc->names ) * nall );
+	if( xc->ids == NULL || xc->values == NULL || xc->names == NULL ) {
+		bleat_printf( 0, "WRN: xstats: unable to allocate memory for xstat map for port: %d", port );
+		clear_map( xc );
+		free( all );
+		return -1;
+	}
+
+	for( i = 0, j = 0; i < nall; i++ ) {
+		if( selected( xfilter, all[i].name ) ) {
+			xc->ids[j] = i;														// id is the index in the names list
+			memcpy( &xc->names[j], &all[i], sizeof( all[i] ) );
+			j++;
+		}
+	}
+
+	free( all );
+	xc->n = j;
+	xc->valid = 1;
+
+	bleat_printf( 2, "xstats: port %d: %d of %d extended stats selected by filter: %s", port, j, nall, xfilter == NULL ? "*" : xfilter );
+	return j;
+}
+
+/*
+	Add the selected extended stats for the port to the buffer, one per line.
+	Returns the buffer (which may have been reallocated) or nil on allocation
+	error (the original buffer is freed). If the stats cannot be fetched,
+	nothing is added.
+*/
+extern char* vfd_xstats_add( char* buf, int* bsize, int* blen, portid_t port ) {
+	xcache_t*	xc;
+	char	wbuf[RTE_ETH_XSTATS_NAME_SIZE + 64];
+	int		i;
+
+	if( fetch( port ) < 0 ) {
+		return buf;
+	}
+
+	xc = &xcache[port];
+	for( i = 0; i < xc->n && buf != NULL; i++ ) {
+		snprintf( wbuf, sizeof( wbuf ), "%s: %"PRIu64"\n", xc->names[i].name, xc->values[i] );
+		buf = vfd_add_str( buf, bsize, blen, wbuf );
+	}
+
+	return buf;
+}
+
+/*
+	Fill a buffer with the extended stats for all ports. Caller must free the
+	buffer. Returns nil on allocation error.
+*/
+extern char* vfd_xstats_show( sriov_conf_t* conf ) {
+	char*	buf;
+	char	wbuf[128];
+	int		bsize = 4096;
+	int		blen = 0;
+	int		i;
+
+	if( (buf = (char *) malloc( sizeof( char ) * bsize )) == NULL ) {
+		return NULL;
+	}
+	*buf = 0;
+
+	for( i = 0; i < conf->num_ports && buf != NULL; i++ ) {
+		snprintf( wbuf, sizeof( wbuf ), "\nport %d:\n", conf->ports[i].rte_port_number );
+		buf = vfd_add_str( buf, &bsize, &blen, wbuf );
+		buf = vfd_xstats_add( buf, &bsize, &blen, conf->ports[i].rte_port_number );
+	}
+
+	if( buf == NULL ) {
+		bleat_printf( 0, "WRN: unable to get enough memory to display extended stats" );
+	}
+
+	return buf;
+}
+
+/*
+	Write the selected extended stats for the port to the log, one message
+	per stat (the log message buffer is too small for the whole list).
+*/
+extern void vfd_xstats_log( portid_t port ) {
+	xcache_t*	xc;
+	int		i;
+
+	if( fetch( port ) < 0 ) {
+		return;
+	}
+
+	xc = &xcache[port];
+	bleat_printf( 0, "xstats port %d: %d selected stats", port, xc->n );
+	for( i = 0; i < xc->n; i++ ) {
+		bleat_printf( 0, "xstats port %d: %s: %"PRIu64, port, xc->names[i].name, xc->values[i] );
+	}
+}
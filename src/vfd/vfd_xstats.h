@@ -0,0 +1,21 @@
+// vi: sw=4 ts=4 noet:
+
+/*
+	Mnemonic:	vfd_xstats.h
+	Abstract:	Cached per-port extended stats name/id maps.
+	Date:		18 October 2026
+*/
+
+#ifndef _VFD_XSTATS_H
+#define _VFD_XSTATS_H
+
+#include "vfdlib.h"
+#include "sriov.h"
+
+// ------------- prototypes ----------------------------------------------
+extern int vfd_xstats_init( parms_t* parms, portid_t port );
+extern char* vfd_xstats_add( char* buf, int* bsize, int* blen, portid_t port );
+extern char* vfd_xstats_show( sriov_conf_t* conf );
+extern void vfd_xstats_log( portid_t port );
+
+#endif